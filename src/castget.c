@@ -23,33 +23,72 @@
 
 #include "channel.h"
 #include "configuration.h"
+#include "filters.h"
+#include "metrics.h"
+#include "postprocess.h"
+#include "queue.h"
+#include "report.h"
+#include "schedule.h"
+#include "scheduler.h"
+#include "trace.h"
+#include "transfer.h"
+#include "urlget.h"
 
-#define _GNU_SOURCE
-#include <errno.h>
 #include <getopt.h>
 #include <glib/gprintf.h>
 #include <glib/gstdio.h>
 #include <libxml/parser.h>
+#include <signal.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
-#ifdef HAVE_TAGLIB
-#include <taglib/tag_c.h>
-#endif /* HAVE_TAGLIB */
 
 enum op { OP_UPDATE, OP_CATCHUP, OP_LIST };
 
+/* Number of threads that tag downloaded enclosures, add them to playlists
+   and run hooks. */
+#define POSTPROCESS_WORKERS 2
+
+/* Seconds between updates of a channel in daemon mode unless the channel
+   configuration sets an interval. Otherwise a channel is due on every run
+   unless the feed asks for a longer wait. */
+#define DEFAULT_INTERVAL (60 * 60)
+
+/* A channel that has been set up for processing. */
+struct _configured_channel {
+  struct channel_configuration *cfg;
+  channel *c;
+  enclosure_filter *filter;
+  feed_limits limits;
+  download_options options;
+  retention_policy retention;
+  gint64 next_update; /* when the channel is next due, set by updates */
+  int failed;         /* the feed could not be retrieved at the last update */
+};
+
+static int _channel_open(const gchar *channel_directory, GKeyFile *kf,
+                         const char *identifier,
+                         struct channel_configuration *defaults,
+                         struct _configured_channel **cc);
+static gboolean _channel_due(const gchar *identifier);
+static void _channel_process(struct _configured_channel *cc, enum op op);
+static void _channel_close(struct _configured_channel *cc);
+static GPtrArray *_open_channels(const gchar *channel_directory, GKeyFile *kf,
+                                 char **identifiers,
+                                 struct channel_configuration *defaults,
+                                 gboolean due_only);
+static void _update_channels(GPtrArray *channels);
 static int _process_channel(const gchar *channel_directory, GKeyFile *kf,
                             const char *identifier, enum op op,
-                            struct channel_configuration *defaults,
-                            enclosure_filter *filter);
+                            struct channel_configuration *defaults);
+static int _run_daemon(const gchar *channel_directory, GKeyFile *kf,
+                       char **identifiers,
+                       struct channel_configuration *defaults);
+static int _channel_filter_new(const struct channel_configuration *cfg,
+                               enclosure_filter **filter);
 static void version(void);
 static GKeyFile *_configuration_file_open(const gchar *rcfile);
 static void _configuration_file_close(GKeyFile *kf);
-#ifdef HAVE_TAGLIB
-static void _set_tags(const gchar *filename,
-                      const struct channel_configuration *cfg);
-#endif /* HAVE_TAGLIB */
-static int playlist_add(const gchar *playlist_file, const gchar *media_file);
 
 static gboolean verbose = FALSE;
 static gboolean quiet = FALSE;
@@ -61,8 +100,25 @@ static gboolean show_version = FALSE;
 static gboolean new_only = FALSE;
 static gboolean list = FALSE;
 static gboolean catchup = FALSE;
+static gboolean daemon_mode = FALSE;
+static gboolean ignore_schedule = FALSE;
 static gchar *rcfile = NULL;
-static gchar *filter_regex = NULL;
+static gchar *report_filename = NULL;
+static gchar *metrics_filename = NULL;
+static gchar *trace_filename = NULL;
+static gchar *progress_events_filename = NULL;
+static gchar **filter_regexes = NULL;
+static gchar **exclude_regexes = NULL;
+static postprocessor *postprocess = NULL;
+static schedule *update_schedule = NULL;
+static metrics *run_metrics = NULL;
+static download_queue *downloads = NULL;
+static transfer_engine *transfers = NULL;
+static progress_display *progress = NULL;
+static FILE *progress_events = NULL;
+static gint64 download_budget = 0;
+static gint64 download_time = 0;
+static volatile sig_atomic_t stop_requested = 0;
 
 int main(int argc, char **argv)
 {
@@ -70,10 +126,12 @@ int main(int argc, char **argv)
   int i;
   int ret = 0;
   gchar **groups;
-  gchar *channeldir;
+  gchar *channeldir, *schedule_filename;
+  GPtrArray *channels;
+  download_order order = DOWNLOAD_ORDER_FEED;
   GKeyFile *kf;
   struct channel_configuration *defaults;
-  enclosure_filter *filter = NULL;
+  enclosure_filter *filter;
   GError *error = NULL;
   GOptionContext *context;
 
@@ -84,11 +142,19 @@ int main(int argc, char **argv)
       "list available enclosures that have not yet been downloaded and exit" },
     { "version", 'V', 0, G_OPTION_ARG_NONE, &show_version,
       "print version and exit" },
+    { "daemon", 'D', 0, G_OPTION_ARG_NONE, &daemon_mode,
+      "keep running and update each channel at its interval" },
 
     { "resume", 'r', 0, G_OPTION_ARG_NONE, &resume,
       "resume aborted downloads" },
     { "rcfile", 'C', 0, G_OPTION_ARG_FILENAME, &rcfile,
       "override the default configuration file name" },
+    { "report", 'R', 0, G_OPTION_ARG_FILENAME, &report_filename,
+      "write a report on each update run in JSON to a file" },
+    { "metrics", 'M', 0, G_OPTION_ARG_FILENAME, &metrics_filename,
+      "write metrics in the Prometheus text format to a file" },
+    { "trace", 'T', 0, G_OPTION_ARG_FILENAME, &trace_filename,
+      "write a trace of the run in Chrome trace event format to a file" },
 
     { "debug", 'd', 0, G_OPTION_ARG_NONE, &debug,
       "print connection debug information" },
@@ -96,14 +162,22 @@ int main(int argc, char **argv)
       "print detailed progress information" },
     { "progress-bar", 'p', 0, G_OPTION_ARG_NONE, &show_progress_bar,
       "print progress bar" },
+    { "progress-events", 'P', 0, G_OPTION_ARG_FILENAME,
+      &progress_events_filename,
+      "write progress events in JSON lines to a file, or - for standard "
+      "output" },
 
     { "new-only", 'n', 0, G_OPTION_ARG_NONE, &new_only,
       "only process new channels" },
+    { "all", 'a', 0, G_OPTION_ARG_NONE, &ignore_schedule,
+      "update channels even if they are not due" },
     { "quiet", 'q', 0, G_OPTION_ARG_NONE, &quiet, "only print error messages" },
     { "first-only", '1', 0, G_OPTION_ARG_NONE, &first_only,
       "only process the most recent item from each channel" },
-    { "filter", 'f', 0, G_OPTION_ARG_STRING, &filter_regex,
+    { "filter", 'f', 0, G_OPTION_ARG_STRING_ARRAY, &filter_regexes,
       "only process items whose enclosure names match a regular expression" },
+    { "exclude", 'x', 0, G_OPTION_ARG_STRING_ARRAY, &exclude_regexes,
+      "skip items whose enclosure names match a regular expression" },
 
     { NULL }
   };
@@ -117,7 +191,8 @@ int main(int argc, char **argv)
   }
 
   /* Do some additional sanity checking of options. */
-  if ((verbose && quiet) || (show_progress_bar && quiet)) {
+  if ((verbose && quiet) || (show_progress_bar && quiet) ||
+      (show_progress_bar && progress_events_filename)) {
     g_print("option parsing failed: options are incompatible.\n");
     exit(1);
   }
@@ -130,6 +205,13 @@ int main(int argc, char **argv)
     exit(1);
   }
 
+  if (daemon_mode && (catchup || list || show_version || new_only)) {
+    g_print(
+        "option parsing failed: --daemon cannot be combined with --catchup, "
+        "--list, --version or --new-only.\n");
+    exit(1);
+  }
+
   /* Decide on the action to take */
   if (show_version) {
     version();
@@ -142,9 +224,15 @@ int main(int argc, char **argv)
   if (list)
     op = OP_LIST;
 
-  if (filter_regex) {
-    filter = enclosure_filter_new(filter_regex, FALSE);
-    g_free(filter_regex);
+  if (filter_regexes || exclude_regexes) {
+    /* Check the regular expressions before processing any channels. */
+    filter = enclosure_filter_new((const gchar *const *)filter_regexes,
+                                  (const gchar *const *)exclude_regexes, FALSE);
+
+    if (!filter)
+      exit(1);
+
+    enclosure_filter_free(filter);
   }
 
   if (verbose && new_only)
@@ -152,6 +240,29 @@ int main(int argc, char **argv)
 
   LIBXML_TEST_VERSION;
 
+  if (urlget_init())
+    exit(1);
+
+  if (trace_filename)
+    trace_open(trace_filename);
+
+  /* Progress is shown for transfers as they run. */
+  if (show_progress_bar)
+    progress = progress_display_new(stdout, PROGRESS_BARS);
+  else if (progress_events_filename) {
+    if (strcmp(progress_events_filename, "-"))
+      progress_events = fopen(progress_events_filename, "w");
+    else
+      progress_events = stdout;
+
+    if (!progress_events) {
+      perror("Error opening progress event file");
+      exit(1);
+    }
+
+    progress = progress_display_new(progress_events, PROGRESS_EVENTS);
+  }
+
   /* Build the channel directory path and ensure that it exists. */
   channeldir = g_build_filename(g_get_home_dir(), ".castget", NULL);
 
@@ -177,23 +288,102 @@ int main(int argc, char **argv)
         return -1;
 
       defaults = channel_configuration_new(kf, "*", NULL);
+
+      if (!defaults)
+        return -1;
     } else
       defaults = NULL;
 
+    /* Downloaded enclosures are post-processed while the next ones are
+       downloaded. */
+    if (op == OP_UPDATE) {
+      postprocess = postprocessor_new(POSTPROCESS_WORKERS, verbose);
+
+      if (!postprocess)
+        return 1;
+
+      schedule_filename = g_build_filename(channeldir, "schedule", NULL);
+      update_schedule = schedule_load(schedule_filename);
+      g_free(schedule_filename);
+
+      /* Metrics cover every configured channel, including those that are
+         not due. */
+      if (metrics_filename) {
+        run_metrics = metrics_new();
+        groups = g_key_file_get_groups(kf, NULL);
+
+        for (i = 0; groups[i]; i++)
+          if (strcmp(groups[i], "*"))
+            metrics_set_last_success(
+                run_metrics, groups[i],
+                schedule_get_last_success(update_schedule, groups[i]));
+
+        g_strfreev(groups);
+      }
+
+      /* Enclosures from all channels are downloaded in one queue. */
+      if (defaults) {
+        if (defaults->download_order &&
+            download_order_parse(defaults->download_order, &order) < 0) {
+          fprintf(stderr, "Invalid download order %s.\n",
+                  defaults->download_order);
+          return 1;
+        }
+
+        download_budget = defaults->download_budget;
+        download_time = defaults->download_time;
+      }
+
+      downloads = download_queue_new(order);
+
+      /* Feeds are retrieved concurrently. */
+      transfers = transfer_engine_new();
+
+      if (!transfers)
+        return 1;
+    }
+
     /* Perform actions. */
-    if (optind < argc) {
+    if (daemon_mode)
+      ret = _run_daemon(channeldir, kf, optind < argc ? argv + optind : NULL,
+                        defaults);
+    else if (op == OP_UPDATE) {
+      /* Channels named on the command line are updated even if they are
+         not due. */
+      channels =
+          _open_channels(channeldir, kf, optind < argc ? argv + optind : NULL,
+                         defaults, optind >= argc);
+      _update_channels(channels);
+      g_ptr_array_free(channels, TRUE);
+    } else if (optind < argc) {
       while (optind < argc)
-        _process_channel(channeldir, kf, argv[optind++], op, defaults, filter);
+        _process_channel(channeldir, kf, argv[optind++], op, defaults);
     } else {
       groups = g_key_file_get_groups(kf, NULL);
 
       for (i = 0; groups[i]; i++)
         if (strcmp(groups[i], "*"))
-          _process_channel(channeldir, kf, groups[i], op, defaults, filter);
+          _process_channel(channeldir, kf, groups[i], op, defaults);
 
       g_strfreev(groups);
     }
 
+    /* Wait for post-processing to finish. */
+    if (postprocess)
+      postprocessor_free(postprocess);
+
+    if (update_schedule)
+      schedule_free(update_schedule);
+
+    if (run_metrics)
+      metrics_free(run_metrics);
+
+    if (downloads)
+      download_queue_free(downloads);
+
+    if (transfers)
+      transfer_engine_free(transfers);
+
     /* Clean up defaults. */
     if (defaults)
       channel_configuration_free(defaults);
@@ -203,14 +393,29 @@ int main(int argc, char **argv)
   /* Clean-up. */
   g_free(channeldir);
 
-  if (filter)
-    enclosure_filter_free(filter);
+  g_strfreev(filter_regexes);
+  g_strfreev(exclude_regexes);
 
   g_free(rcfile);
+  g_free(report_filename);
+  g_free(metrics_filename);
+
+  if (progress)
+    progress_display_free(progress);
+
+  if (progress_events && progress_events != stdout)
+    fclose(progress_events);
+
+  g_free(progress_events_filename);
+
+  /* Post-processing threads have finished, so the trace is complete. */
+  trace_close();
+  g_free(trace_filename);
 
   if (kf)
     _configuration_file_close(kf);
 
+  urlget_cleanup();
   xmlCleanupParser();
 
   return ret;
@@ -228,6 +433,17 @@ static void version(void)
   g_printf("Copyright (C) 2005-2021 Marius L. Jøhndal\n");
 }
 
+/* Formats a time in seconds since the epoch as local time. */
+static gchar *_format_time(gint64 t)
+{
+  GDateTime *dt = g_date_time_new_from_unix_local(t);
+  gchar *s = g_date_time_format(dt, "%Y-%m-%d %H:%M:%S");
+
+  g_date_time_unref(dt);
+
+  return s;
+}
+
 static void _print_item_update(const enclosure *enclosure,
                                const gchar *filename)
 {
@@ -268,18 +484,16 @@ static void update_callback(void *user_data, channel_action action,
     g_assert(enclosure);
     g_assert(filename);
 
-#ifdef HAVE_TAGLIB
-    _set_tags(filename, c);
-#endif /* HAVE_TAGLIB */
+    /* Tag the enclosure, update the playlist and run the hook. */
+    postprocessor_submit(postprocess, filename, enclosure, c);
+    break;
 
-    /* Update playlist. */
-    if (c->playlist) {
-      playlist_add(c->playlist, filename);
+  case CCA_ENCLOSURE_DELETED:
+    g_assert(filename);
+
+    if (verbose)
+      g_printf(" * Deleted old enclosure %s.\n", filename);
 
-      if (verbose)
-        printf(" * Added downloaded enclosure %s to playlist %s.\n", filename,
-               c->playlist);
-    }
     break;
   }
 }
@@ -309,6 +523,7 @@ static void catchup_callback(void *user_data, channel_action action,
     break;
 
   case CCA_ENCLOSURE_DOWNLOAD_END:
+  case CCA_ENCLOSURE_DELETED:
     break;
   }
 }
@@ -337,19 +552,26 @@ static void list_callback(void *user_data, channel_action action,
     break;
 
   case CCA_ENCLOSURE_DOWNLOAD_END:
+  case CCA_ENCLOSURE_DELETED:
     break;
   }
 }
 
-static int _process_channel(const gchar *channel_directory, GKeyFile *kf,
-                            const char *identifier, enum op op,
-                            struct channel_configuration *defaults,
-                            enclosure_filter *filter)
+/* Reads and checks the configuration of a channel, loads its history and
+   sets up its filter. Sets 'cc' to NULL if the channel is skipped. Returns
+   -1 on error. */
+static int _channel_open(const gchar *channel_directory, GKeyFile *kf,
+                         const char *identifier,
+                         struct channel_configuration *defaults,
+                         struct _configured_channel **cc)
 {
   channel *c;
   gchar *channel_filename, *channel_file;
   struct channel_configuration *channel_configuration;
-  enclosure_filter *per_channel_filter = NULL;
+  enclosure_filter *filter;
+  gint64 t;
+
+  *cc = NULL;
 
   /* Check channel identifier and read channel configuration. */
   if (!g_key_file_has_group(kf, identifier)) {
@@ -364,6 +586,9 @@ static int _process_channel(const gchar *channel_directory, GKeyFile *kf,
 
   channel_configuration = channel_configuration_new(kf, identifier, defaults);
 
+  if (!channel_configuration)
+    return -1;
+
   /* Check that mandatory keys were set. */
   if (!channel_configuration->url) {
     fprintf(stderr, "No feed URL set for channel %s.\n", identifier);
@@ -379,6 +604,16 @@ static int _process_channel(const gchar *channel_directory, GKeyFile *kf,
     return -1;
   }
 
+  if (channel_configuration->playlist_format &&
+      strcmp(channel_configuration->playlist_format, "m3u") &&
+      strcmp(channel_configuration->playlist_format, "extm3u")) {
+    fprintf(stderr, "Invalid playlist format %s for channel %s.\n",
+            channel_configuration->playlist_format, identifier);
+
+    channel_configuration_free(channel_configuration);
+    return -1;
+  }
+
   /* Construct channel file name. */
   channel_filename = g_strjoin(".", identifier, "xml", NULL);
   channel_file = g_build_filename(channel_directory, channel_filename, NULL);
@@ -388,13 +623,16 @@ static int _process_channel(const gchar *channel_directory, GKeyFile *kf,
     /* If we are only fetching new channels, skip the channel if there is
        already a channel file present. */
 
+    g_free(channel_file);
     channel_configuration_free(channel_configuration);
     return 0;
   }
 
+  t = trace_begin();
   c = channel_new(channel_configuration->url, channel_file,
                   channel_configuration->spool_directory,
                   channel_configuration->filename_pattern, resume);
+  trace_end(t, "channel", "channel_new", identifier);
   g_free(channel_file);
 
   if (!c) {
@@ -404,147 +642,481 @@ static int _process_channel(const gchar *channel_directory, GKeyFile *kf,
     return -1;
   }
 
-  /* Set up per-channel filter unless overridden on the command
-     line. */
-  if (!filter && channel_configuration->regex_filter) {
-    per_channel_filter =
-        enclosure_filter_new(channel_configuration->regex_filter, FALSE);
+  if (_channel_filter_new(channel_configuration, &filter) < 0) {
+    fprintf(stderr, "Invalid filter for channel %s.\n", identifier);
 
-    filter = per_channel_filter;
+    channel_free(c);
+    channel_configuration_free(channel_configuration);
+    return -1;
   }
 
+  *cc = g_malloc(sizeof(struct _configured_channel));
+  (*cc)->cfg = channel_configuration;
+  (*cc)->c = c;
+  (*cc)->filter = filter;
+  (*cc)->next_update = 0;
+  (*cc)->failed = 0;
+
+  (*cc)->limits.max_feed_size = channel_configuration->max_feed_size;
+  (*cc)->limits.max_items = channel_configuration->max_items;
+  (*cc)->limits.max_parse_time = channel_configuration->max_parse_time;
+  (*cc)->limits.timeouts.connect = channel_configuration->feed_connect_timeout;
+  (*cc)->limits.timeouts.first_byte =
+      channel_configuration->feed_first_byte_timeout;
+  (*cc)->limits.timeouts.low_speed_limit =
+      channel_configuration->feed_low_speed_limit;
+  (*cc)->limits.timeouts.low_speed_time =
+      channel_configuration->feed_low_speed_time;
+  (*cc)->limits.timeouts.total = channel_configuration->feed_timeout;
+  (*cc)->limits.timeouts.deadline = 0;
+
+  (*cc)->options.receive_buffer_size =
+      channel_configuration->receive_buffer_size;
+  (*cc)->options.write_buffer_size = channel_configuration->write_buffer_size;
+  (*cc)->options.writeback_size = channel_configuration->writeback_size;
+  (*cc)->options.spool_quota = channel_configuration->spool_quota;
+  (*cc)->options.timeouts.connect =
+      channel_configuration->enclosure_connect_timeout;
+  (*cc)->options.timeouts.first_byte =
+      channel_configuration->enclosure_first_byte_timeout;
+  (*cc)->options.timeouts.low_speed_limit =
+      channel_configuration->enclosure_low_speed_limit;
+  (*cc)->options.timeouts.low_speed_time =
+      channel_configuration->enclosure_low_speed_time;
+  (*cc)->options.timeouts.total = channel_configuration->enclosure_timeout;
+  (*cc)->options.timeouts.deadline = 0;
+
+  (*cc)->retention.keep_episodes = channel_configuration->keep_episodes;
+  (*cc)->retention.keep_age = channel_configuration->keep_age;
+  (*cc)->retention.keep_size = channel_configuration->keep_size;
+
+  return 0;
+}
+
+/* Returns TRUE if a channel is due to be updated. Looking this up does not
+   involve the channel file or the network. */
+static gboolean _channel_due(const gchar *identifier)
+{
+  gint64 next_update;
+  gchar *s;
+
+  if (!update_schedule || ignore_schedule)
+    return TRUE;
+
+  next_update = schedule_get_next_update(update_schedule, identifier);
+
+  if (next_update <= g_get_real_time() / G_USEC_PER_SEC)
+    return TRUE;
+
+  if (verbose) {
+    s = _format_time(next_update);
+    g_printf("Skipping channel %s until %s.\n", identifier, s);
+    g_free(s);
+  }
+
+  return FALSE;
+}
+
+/* Works out when a channel that has just been updated is next due and
+   records it in the schedule together with the time the feed was last
+   retrieved. Hints from the feed are ignored if it could not be fetched.
+   The schedule is saved once the whole batch has been rescheduled. */
+static void _channel_reschedule(struct _configured_channel *cc, int failed)
+{
+  feed_hints hints;
+  gint64 interval, now;
+
+  interval = cc->cfg->interval;
+
+  if (!interval && daemon_mode)
+    interval = DEFAULT_INTERVAL;
+
+  hints = cc->c->hints;
+
+  /* Keep the previous estimate if the feed has too few dated items. */
+  if (!hints.cadence && update_schedule)
+    hints.cadence =
+        schedule_get_cadence(update_schedule, cc->cfg->identifier);
+
+  now = g_get_real_time() / G_USEC_PER_SEC;
+  cc->next_update =
+      schedule_next_update(now, interval, failed ? NULL : &hints);
+
+  if (update_schedule) {
+    schedule_set(update_schedule, cc->cfg->identifier, cc->next_update,
+                 hints.cadence);
+
+    if (!failed)
+      schedule_set_last_success(update_schedule, cc->cfg->identifier, now);
+  }
+}
+
+/* Updates channels together. The feeds of all the channels are retrieved
+   first, all at the same time, and the enclosures are then downloaded in
+   the order of the download queue until the budget for the run is used up.
+   Enclosures left out are downloaded by later updates. */
+static void _update_channels(GPtrArray *channels)
+{
+  struct _configured_channel *cc;
+  guint i, left;
+  report *r = NULL;
+  gint64 started, started_monotonic, t;
+
+  started = g_get_real_time();
+  started_monotonic = g_get_monotonic_time();
+  t = trace_begin();
+
+  if (report_filename)
+    r = report_new();
+
+  for (i = 0; i < channels->len; i++) {
+    cc = g_ptr_array_index(channels, i);
+    channel_queue_downloads(cc->c, cc->cfg, update_callback, first_only,
+                            resume, cc->filter, &cc->limits, &cc->options,
+                            debug, progress, downloads, transfers);
+  }
+
+  transfer_engine_run(transfers);
+  trace_end(t, "run", "get_feeds", NULL);
+
+  /* The feeds have been freed once their enclosures were queued. Filters
+     are not needed again either unless castget keeps running. */
+  for (i = 0; i < channels->len; i++) {
+    cc = g_ptr_array_index(channels, i);
+    cc->failed = cc->c->feed_info == NULL;
+
+    if (!daemon_mode && cc->filter) {
+      enclosure_filter_free(cc->filter);
+      cc->filter = NULL;
+    }
+  }
+
+  t = trace_begin();
+  left = download_queue_run(downloads, download_budget, download_time);
+  trace_end(t, "run", "download_queue", NULL);
+
+  if (left && !quiet)
+    g_printf("Download budget used up. %u enclosure(s) left for a later "
+             "update.\n",
+             left);
+
+  for (i = 0; i < channels->len; i++) {
+    cc = g_ptr_array_index(channels, i);
+    channel_end_update(cc->c);
+    channel_apply_retention(cc->c, cc->cfg, update_callback, &cc->retention,
+                            debug);
+    _channel_reschedule(cc, cc->failed);
+
+    if (r)
+      report_add_channel(r, cc->cfg->identifier, cc->c, cc->failed);
+
+    if (run_metrics) {
+      metrics_add_channel(run_metrics, cc->cfg->identifier, cc->c);
+
+      if (!cc->failed)
+        metrics_set_last_success(
+            run_metrics, cc->cfg->identifier,
+            schedule_get_last_success(update_schedule, cc->cfg->identifier));
+    }
+  }
+
+  if (run_metrics) {
+    metrics_add_run(run_metrics, started,
+                    g_get_monotonic_time() - started_monotonic, left);
+    metrics_save_totals(run_metrics, update_schedule);
+  }
+
+  if (update_schedule)
+    schedule_save(update_schedule);
+
+  if (r) {
+    report_set_left(r, left);
+
+    if (report_write(r, report_filename, debug))
+      fprintf(stderr, "Error writing report to %s.\n", report_filename);
+
+    report_free(r);
+  }
+
+  if (run_metrics &&
+      metrics_write(run_metrics, update_schedule, metrics_filename, debug))
+    fprintf(stderr, "Error writing metrics to %s.\n", metrics_filename);
+}
+
+static void _channel_process(struct _configured_channel *cc, enum op op)
+{
+  GPtrArray *channels;
+
   switch (op) {
   case OP_UPDATE:
-    channel_update(c, channel_configuration, update_callback, 0, 0, first_only,
-                   resume, filter, debug, show_progress_bar);
+    channels = g_ptr_array_new();
+    g_ptr_array_add(channels, cc);
+    _update_channels(channels);
+    g_ptr_array_free(channels, TRUE);
     break;
 
   case OP_CATCHUP:
-    channel_update(c, channel_configuration, catchup_callback, 1, 0, first_only,
-                   0, filter, debug, show_progress_bar);
+    channel_update(cc->c, cc->cfg, catchup_callback, 1, 0, first_only, 0,
+                   cc->filter, &cc->limits, &cc->options, debug,
+                   progress);
     break;
 
   case OP_LIST:
-    channel_update(c, channel_configuration, list_callback, 1, 1, first_only, 0,
-                   filter, debug, show_progress_bar);
+    channel_update(cc->c, cc->cfg, list_callback, 1, 1, first_only, 0,
+                   cc->filter, &cc->limits, &cc->options, debug,
+                   progress);
     break;
   }
+}
 
-  /* Clean-up. */
-  if (per_channel_filter)
-    enclosure_filter_free(per_channel_filter);
+static void _channel_close(struct _configured_channel *cc)
+{
+  if (cc->filter)
+    enclosure_filter_free(cc->filter);
 
-  channel_free(c);
-  channel_configuration_free(channel_configuration);
+  channel_free(cc->c);
+  channel_configuration_free(cc->cfg);
+  g_free(cc);
+}
 
-  return 0;
+/* Sets up the channels given by 'identifiers', or all channels in the
+   configuration file if it is NULL. Channels that are not due are left out
+   if 'due_only' is set. The channels are closed when the array is
+   freed. */
+static GPtrArray *_open_channels(const gchar *channel_directory, GKeyFile *kf,
+                                 char **identifiers,
+                                 struct channel_configuration *defaults,
+                                 gboolean due_only)
+{
+  GPtrArray *channels;
+  gchar **groups = NULL;
+  struct _configured_channel *cc;
+  int i;
+
+  if (!identifiers)
+    identifiers = groups = g_key_file_get_groups(kf, NULL);
+
+  channels = g_ptr_array_new_with_free_func((GDestroyNotify)_channel_close);
+
+  for (i = 0; identifiers[i]; i++)
+    if (strcmp(identifiers[i], "*") &&
+        (!due_only || _channel_due(identifiers[i])) &&
+        _channel_open(channel_directory, kf, identifiers[i], defaults, &cc) ==
+            0 &&
+        cc)
+      g_ptr_array_add(channels, cc);
+
+  g_strfreev(groups);
+
+  return channels;
 }
 
-static GKeyFile *_configuration_file_open(const gchar *rcfile)
+static int _process_channel(const gchar *channel_directory, GKeyFile *kf,
+                            const char *identifier, enum op op,
+                            struct channel_configuration *defaults)
 {
-  GKeyFile *kf;
-  GError *error = NULL;
+  struct _configured_channel *cc;
 
-  kf = g_key_file_new();
+  if (_channel_open(channel_directory, kf, identifier, defaults, &cc) < 0)
+    return -1;
 
-  if (!g_key_file_load_from_file(kf, rcfile, G_KEY_FILE_NONE, &error)) {
-    fprintf(stderr, "Error reading configuration file %s: %s.\n", rcfile,
-            error->message);
-    g_error_free(error);
-    g_key_file_free(kf);
-    kf = NULL;
+  if (cc) {
+    _channel_process(cc, op);
+    _channel_close(cc);
   }
 
-  return kf;
+  return 0;
 }
 
-static void _configuration_file_close(GKeyFile *kf)
+/* Asks the daemon to stop once the current update is done. A second
+   signal terminates castget at once. */
+static void _request_stop(int signum)
 {
-  g_key_file_free(kf);
+  if (stop_requested) {
+    signal(signum, SIG_DFL);
+    raise(signum);
+  }
+
+  stop_requested = 1;
 }
 
-#ifdef HAVE_TAGLIB
-static void _set_tags(const gchar *filename,
-                      const struct channel_configuration *cfg)
+/* Sleeps until the monotonic clock reaches 'until'. Returns -1 if castget
+   was asked to stop in the meantime. */
+static int _sleep_until(gint64 until)
 {
-  if (cfg->artist_tag || cfg->title_tag || cfg->album_tag || cfg->genre_tag ||
-      cfg->year_tag || cfg->comment_tag) {
-    TagLib_File *file;
-    TagLib_Tag *tag;
+  gint64 now;
+  struct timespec t;
 
-    file = taglib_file_new(filename);
+  while (!stop_requested && (now = g_get_monotonic_time()) < until) {
+    t.tv_sec = (until - now) / G_USEC_PER_SEC;
+    t.tv_nsec = ((until - now) % G_USEC_PER_SEC) * 1000;
 
-    if (file == NULL) {
-      fprintf(stderr, "Error setting tags for file %s.\n", filename);
-      return;
-    }
+    /* Interrupted by signals. */
+    nanosleep(&t, NULL);
+  }
+
+  return stop_requested ? -1 : 0;
+}
 
-    tag = taglib_file_tag(file);
+/* Keeps the channels open and updates each of them at its interval until
+   castget receives SIGINT or SIGTERM. The channels are taken from the
+   configuration file unless 'identifiers' is given. */
+static int _run_daemon(const gchar *channel_directory, GKeyFile *kf,
+                       char **identifiers,
+                       struct channel_configuration *defaults)
+{
+  struct sigaction action;
+  scheduler *s;
+  GPtrArray *channels, *batch;
+  struct _configured_channel *cc;
+  gint64 due, next, now, wall_now;
+  gchar *when;
+  guint i;
+
+  channels =
+      _open_channels(channel_directory, kf, identifiers, defaults, FALSE);
+
+  if (channels->len == 0) {
+    fprintf(stderr, "No channels to update.\n");
+
+    g_ptr_array_free(channels, TRUE);
+    return 1;
+  }
 
-    if (cfg->artist_tag) {
-      taglib_tag_set_artist(tag, cfg->artist_tag);
+  s = scheduler_new();
+  batch = g_ptr_array_new();
+  now = g_get_monotonic_time();
+  wall_now = g_get_real_time() / G_USEC_PER_SEC;
+
+  /* Channels that are due are updated right away, in the order they are
+     given. The schedule is kept in wall-clock time but the daemon sleeps on
+     the monotonic clock. */
+  for (i = 0; i < channels->len; i++) {
+    cc = g_ptr_array_index(channels, i);
+    next = ignore_schedule ? 0
+                           : schedule_get_next_update(update_schedule,
+                                                      cc->cfg->identifier);
+
+    scheduler_add(s, now + MAX(next - wall_now, 0) * G_USEC_PER_SEC, cc);
+  }
 
-      if (verbose)
-        printf(" * Set artist tag to %s.\n", cfg->artist_tag);
+  action.sa_handler = _request_stop;
+  sigemptyset(&action.sa_mask);
+  action.sa_flags = 0;
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+
+  while ((cc = scheduler_pop(s, &due))) {
+    /* Finish post-processing before going idle so that playlists are up to
+       date while castget sleeps. The trace of the updates is written out
+       at the same time rather than kept until castget stops. */
+    if (due > g_get_monotonic_time()) {
+      postprocessor_sync(postprocess);
+      trace_flush();
     }
 
-    if (cfg->title_tag) {
-      taglib_tag_set_title(tag, cfg->title_tag);
+    if (_sleep_until(due) < 0)
+      break;
 
-      if (verbose)
-        printf(" * Set title tag to %s.\n", cfg->title_tag);
-    }
+    /* Channels that are due by now share the download queue. */
+    g_ptr_array_add(batch, cc);
 
-    if (cfg->album_tag) {
-      taglib_tag_set_album(tag, cfg->album_tag);
+    while (scheduler_peek(s, &due) && due <= g_get_monotonic_time())
+      g_ptr_array_add(batch, scheduler_pop(s, NULL));
 
-      if (verbose)
-        printf(" * Set album tag to %s.\n", cfg->album_tag);
-    }
+    _update_channels(batch);
 
-    if (cfg->genre_tag) {
-      taglib_tag_set_genre(tag, cfg->genre_tag);
+    now = g_get_monotonic_time();
+    wall_now = g_get_real_time() / G_USEC_PER_SEC;
 
-      if (verbose)
-        printf(" * Set genre tag to %s.\n", cfg->genre_tag);
-    }
+    for (i = 0; i < batch->len; i++) {
+      cc = g_ptr_array_index(batch, i);
+      next = now + MAX(cc->next_update - wall_now, 0) * G_USEC_PER_SEC;
 
-    if (cfg->year_tag) {
-      taglib_tag_set_year(tag, g_ascii_strtoull(cfg->year_tag, NULL, 10));
+      if (verbose) {
+        when = _format_time(cc->next_update);
+        g_printf("Next update of channel %s at %s.\n", cc->cfg->identifier,
+                 when);
+        g_free(when);
+      }
 
-      if (verbose)
-        printf(" * Set year tag to %s.\n", cfg->year_tag);
+      scheduler_add(s, next, cc);
     }
 
-    if (cfg->comment_tag) {
-      taglib_tag_set_comment(tag, cfg->comment_tag);
+    g_ptr_array_set_size(batch, 0);
+  }
 
-      if (verbose)
-        printf(" * Set comment tag to %s.\n", cfg->comment_tag);
-    }
+  if (verbose)
+    g_printf("Stopping.\n");
 
-    if (!taglib_file_save(file))
-      fprintf(stderr, "Error setting tags for file %s.\n", filename);
+  g_ptr_array_free(batch, TRUE);
+  scheduler_free(s);
+  g_ptr_array_free(channels, TRUE);
 
-    taglib_tag_free_strings();
-    taglib_file_free(file);
-  }
+  return 0;
 }
-#endif /* HAVE_TAGLIB */
 
-static int playlist_add(const gchar *playlist_file, const gchar *media_file)
+/* Sets up the filter for a channel. Regular expression filters given on the
+   command line override those in the configuration. Sets 'filter' to NULL if
+   the channel is not filtered at all. Returns -1 if the filter is
+   invalid. */
+static int _channel_filter_new(const struct channel_configuration *cfg,
+                               enclosure_filter **filter)
 {
-  FILE *f;
+  const gchar *include[] = { cfg->regex_filter, NULL };
+  const gchar *exclude[] = { cfg->regex_exclude, NULL };
+
+  *filter = NULL;
 
-  f = fopen(playlist_file, "a");
+  if (!(filter_regexes || exclude_regexes || cfg->regex_filter ||
+        cfg->regex_exclude || cfg->type_filter || cfg->title_filter ||
+        cfg->min_size || cfg->max_size || cfg->newer_than || cfg->max_age))
+    return 0;
 
-  if (!f) {
-    fprintf(stderr, "Error opening playlist file %s: %s.\n", playlist_file,
-            strerror(errno));
+  if (filter_regexes || exclude_regexes)
+    *filter = enclosure_filter_new((const gchar *const *)filter_regexes,
+                                   (const gchar *const *)exclude_regexes,
+                                   FALSE);
+  else
+    *filter = enclosure_filter_new(include, exclude, FALSE);
+
+  if (!*filter)
+    return -1;
+
+  if ((cfg->type_filter &&
+       !enclosure_filter_set_type_pattern(*filter, cfg->type_filter)) ||
+      (cfg->title_filter &&
+       !enclosure_filter_set_title_pattern(*filter, cfg->title_filter))) {
+    enclosure_filter_free(*filter);
+    *filter = NULL;
     return -1;
   }
 
-  fprintf(f, "%s\n", media_file);
-  fclose(f);
+  enclosure_filter_set_size_range(*filter, cfg->min_size, cfg->max_size);
+  enclosure_filter_set_date_range(*filter, cfg->newer_than, cfg->max_age);
+
   return 0;
 }
+
+static GKeyFile *_configuration_file_open(const gchar *rcfile)
+{
+  GKeyFile *kf;
+  GError *error = NULL;
+
+  kf = g_key_file_new();
+
+  if (!g_key_file_load_from_file(kf, rcfile, G_KEY_FILE_NONE, &error)) {
+    fprintf(stderr, "Error reading configuration file %s: %s.\n", rcfile,
+            error->message);
+    g_error_free(error);
+    g_key_file_free(kf);
+    kf = NULL;
+  }
+
+  return kf;
+}
+
+static void _configuration_file_close(GKeyFile *kf)
+{
+  g_key_file_free(kf);
+}
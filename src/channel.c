@@ -23,37 +23,87 @@
 
 #include "channel.h"
 #include "filenames.h"
+#include "filters.h"
 #include "libxmlutil.h"
+#include "patterns.h"
 #include "progress.h"
+#include "queue.h"
 #include "rss.h"
+#include "spool.h"
+#include "trace.h"
 #include "urlget.h"
 #include "utils.h"
+#include "writer.h"
 
+#include <errno.h>
+#include <fcntl.h>
 #include <glib/gprintf.h>
+#include <glib/gstdio.h>
 #include <string.h>
-#include <sys/stat.h>
 #include <sys/types.h>
+#include <unistd.h>
 
-static int _enclosure_pattern_match(enclosure_filter *filter,
-                                    const enclosure *enclosure);
+/* Creates a download record that takes over the strings passed to it. */
+static download_record *_download_record_new(gchar *download_time,
+                                             gchar *sha256, gchar *filename,
+                                             gint64 size, gint64 timestamp)
+{
+  download_record *r = g_malloc(sizeof(struct _download_record));
+
+  r->download_time = download_time;
+  r->sha256 = sha256;
+  r->filename = filename;
+  r->size = size;
+  r->timestamp = timestamp;
+
+  return r;
+}
+
+static void _download_record_free(gpointer data)
+{
+  download_record *r = (download_record *)data;
+
+  g_free(r->download_time);
+  g_free(r->sha256);
+  g_free(r->filename);
+  g_free(r);
+}
+
+/* Copies an attribute into memory owned by glib. */
+static gchar *_dup_attr(const xmlNode *node, const char *name)
+{
+  xmlChar *s = xmlGetProp((xmlNode *)node, (const xmlChar *)name);
+  gchar *t = g_strdup((const gchar *)s);
+
+  xmlFree(s);
+
+  return t;
+}
 
 static void _enclosure_iterator(const void *user_data, int i,
                                 const xmlNode *node)
 {
-  const char *downloadtime;
+  gchar *url;
+  gchar *downloadtime;
 
   channel *c = (channel *)user_data;
 
-  downloadtime = libxmlutil_attr_as_string(node, "downloadtime");
+  url = _dup_attr(node, "url");
 
-  if (downloadtime)
-    downloadtime = g_strdup(downloadtime);
-  else
+  if (!url)
+    return;
+
+  downloadtime = _dup_attr(node, "downloadtime");
+
+  if (!downloadtime)
     downloadtime = get_rfc822_time();
 
-  g_hash_table_insert(c->downloaded_enclosures,
-                      (gpointer)libxmlutil_attr_as_string(node, "url"),
-                      (gpointer)downloadtime);
+  g_hash_table_insert(
+      c->downloaded_enclosures, url,
+      _download_record_new(downloadtime, _dup_attr(node, "sha256"),
+                           _dup_attr(node, "filename"),
+                           MAX(libxmlutil_attr_as_long(node, "size"), 0),
+                           MAX(libxmlutil_attr_as_long(node, "timestamp"), 0)));
 }
 
 channel *channel_new(const char *url, const char *channel_file,
@@ -70,10 +120,19 @@ channel *channel_new(const char *url, const char *channel_file,
   c->channel_filename = g_strdup(channel_file);
   c->spool_directory = g_strdup(spool_directory);
   c->filename_pattern = g_strdup(filename_pattern);
+  c->filename_program =
+      filename_pattern ? pattern_program_new(filename_pattern) : NULL;
+  c->filename_buffer = g_string_new(NULL);
+  c->spool = NULL;
+  c->feed_info = NULL;
   //  c->resume = resume;
   c->rss_last_fetched = NULL;
-  c->downloaded_enclosures =
-      g_hash_table_new_full(g_str_hash, g_str_equal, NULL, g_free);
+  c->last_index = 0;
+  c->update_started = 0;
+  memset(&c->hints, 0, sizeof(feed_hints));
+  memset(&c->stats, 0, sizeof(channel_stats));
+  c->downloaded_enclosures = g_hash_table_new_full(
+      g_str_hash, g_str_equal, g_free, _download_record_free);
 
   if (g_file_test(c->channel_filename, G_FILE_TEST_EXISTS)) {
     doc = xmlReadFile(c->channel_filename, NULL, 0);
@@ -104,6 +163,13 @@ channel *channel_new(const char *url, const char *channel_file,
     libxmlutil_iterate_by_tag_name(root_element, "enclosure", c,
                                    _enclosure_iterator);
 
+    /* Channel files written before enclosures were numbered continue from
+       the number of enclosures downloaded so far. */
+    c->last_index = libxmlutil_attr_as_long(root_element, "lastindex");
+
+    if (c->last_index < 0)
+      c->last_index = g_hash_table_size(c->downloaded_enclosures);
+
     xmlFreeDoc(doc);
   }
 
@@ -115,13 +181,29 @@ static void _cast_channel_save_downloaded_enclosure(gpointer key,
                                                     gpointer user_data)
 {
   FILE *f = (FILE *)user_data;
+  download_record *r = (download_record *)value;
   gchar *escaped_key = g_markup_escape_text(key, -1);
+  gchar *escaped_filename;
 
-  if (value)
-    g_fprintf(f, "  <enclosure url=\"%s\" downloadtime=\"%s\"/>\n", escaped_key,
-              (gchar *)value);
-  else
-    g_fprintf(f, "  <enclosure url=\"%s\"/>\n", escaped_key);
+  g_fprintf(f, "  <enclosure url=\"%s\"", escaped_key);
+
+  if (r->download_time)
+    g_fprintf(f, " downloadtime=\"%s\"", r->download_time);
+
+  if (r->sha256)
+    g_fprintf(f, " sha256=\"%s\"", r->sha256);
+
+  if (r->filename) {
+    escaped_filename = g_markup_escape_text(r->filename, -1);
+    g_fprintf(f, " filename=\"%s\" size=\"%" G_GINT64_FORMAT "\"",
+              escaped_filename, r->size);
+    g_free(escaped_filename);
+  }
+
+  if (r->timestamp)
+    g_fprintf(f, " timestamp=\"%" G_GINT64_FORMAT "\"", r->timestamp);
+
+  g_fprintf(f, "/>\n");
 
   g_free(escaped_key);
 }
@@ -132,11 +214,12 @@ static int _cast_channel_save_channel(FILE *f, gpointer user_data, int debug)
 
   g_fprintf(f, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
 
+  g_fprintf(f, "<channel version=\"1.0\"");
+
   if (c->rss_last_fetched)
-    g_fprintf(f, "<channel version=\"1.0\" rsslastfetched=\"%s\">\n",
-              c->rss_last_fetched);
-  else
-    g_fprintf(f, "<channel version=\"1.0\">\n");
+    g_fprintf(f, " rsslastfetched=\"%s\"", c->rss_last_fetched);
+
+  g_fprintf(f, " lastindex=\"%" G_GINT64_FORMAT "\">\n", c->last_index);
 
   g_hash_table_foreach(c->downloaded_enclosures,
                        _cast_channel_save_downloaded_enclosure, f);
@@ -148,8 +231,14 @@ static int _cast_channel_save_channel(FILE *f, gpointer user_data, int debug)
 
 static void _cast_channel_save(channel *c, int debug)
 {
+  gint64 started = g_get_monotonic_time();
+  gint64 t = trace_begin();
+
   write_by_temporary_file(c->channel_filename, _cast_channel_save_channel, c,
                           NULL, debug);
+
+  c->stats.save_time += g_get_monotonic_time() - started;
+  trace_end(t, "channel", "channel_save", c->channel_filename);
 }
 
 void channel_free(channel *c)
@@ -159,30 +248,360 @@ void channel_free(channel *c)
   g_free(c->channel_filename);
   g_free(c->url);
   g_free(c->filename_pattern);
+  if (c->filename_program)
+    pattern_program_free(c->filename_program);
+  g_string_free(c->filename_buffer, TRUE);
+  channel_end_update(c);
   free(c);
 }
 
+/* Number of times a download that stops early is resumed before giving
+   up. */
+#define MAX_RESUME_ATTEMPTS 3
+
+/* Outcome of an attempt to download an enclosure. */
+enum {
+  DOWNLOAD_OK,
+  DOWNLOAD_FAILED,
+  DOWNLOAD_DEFERRED, /* the enclosure does not fit in the spool for now */
+  DOWNLOAD_REJECTED  /* the enclosure does not match the hash in the feed */
+};
+
+/* State of an enclosure download in progress. */
+struct _enclosure_download {
+  int fd;
+  writer *w;
+  GChecksum *sha256;
+  GChecksum *verify; /* checksum to compare with the feed, may be 'sha256' */
+  gint64 offset;           /* amount of data already downloaded */
+  gint64 expected_length;  /* length given in the feed, or 0 if unknown */
+  gint64 announced_length; /* length given by the server, or 0 if unknown */
+  gint64 capacity;         /* room left in the spool, or -1 if unlimited */
+  gint64 needed;           /* room needed if the download was declined */
+  int preallocated;
+};
+
+/* Determines how much more data the spool directory can take. This is the
+   smaller of the free space on its file system and what remains of the
+   spool quota. Sets 'quota_limited' if the quota is the limiting factor.
+   Returns -1 if there is no known limit. */
+static gint64 _spool_capacity(channel *c, const download_options *options,
+                              int *quota_limited)
+{
+  gint64 capacity, remaining;
+
+  capacity = spool_index_free_space(c->spool);
+  *quota_limited = 0;
+
+  if (options->spool_quota) {
+    remaining = MAX(options->spool_quota - spool_index_total_size(c->spool), 0);
+
+    if (capacity < 0 || remaining < capacity) {
+      capacity = remaining;
+      *quota_limited = 1;
+    }
+  }
+
+  return capacity;
+}
+
+static void _report_no_room(channel *c, const download_options *options,
+                            const char *url, gint64 needed, gint64 capacity,
+                            int quota_limited)
+{
+  gchar *needed_s, *capacity_s, *quota_s;
+
+  needed_s = g_format_size(needed);
+  capacity_s = g_format_size(capacity);
+
+  if (quota_limited) {
+    quota_s = g_format_size(options->spool_quota);
+    g_fprintf(stderr,
+              "Skipping enclosure %s: %s needed but only %s left of the "
+              "spool quota of %s for %s.\n",
+              url, needed_s, capacity_s, quota_s, c->spool_directory);
+    g_free(quota_s);
+  } else
+    g_fprintf(stderr,
+              "Skipping enclosure %s: %s needed but only %s free in %s.\n",
+              url, needed_s, capacity_s, c->spool_directory);
+
+  g_free(capacity_s);
+  g_free(needed_s);
+}
+
+/* Reserves disk space for the rest of an enclosure once its length is known
+   so that the file is not fragmented. The length announced by the server is
+   preferred over that given in the feed. Space is reserved beyond the end of
+   the file so that the file size still reflects the data actually written,
+   which is what a resumed download relies on. Preallocation is only an
+   optimisation, so any failure is ignored. The download is declined if the
+   announced length shows that it cannot fit in the spool. */
+static int _enclosure_urlget_start_cb(gint64 content_length, void *user_data)
+{
+  struct _enclosure_download *d = (struct _enclosure_download *)user_data;
+  gint64 length;
+
+  if (d->capacity >= 0 && content_length > d->capacity) {
+    d->needed = content_length;
+    return 1;
+  }
+
+  if (content_length > 0)
+    d->announced_length = d->offset + content_length;
+
+  length =
+      content_length > 0 ? d->offset + content_length : d->expected_length;
+
+#if defined(HAVE_FALLOCATE) && defined(FALLOC_FL_KEEP_SIZE)
+  if (length > d->offset &&
+      fallocate(d->fd, FALLOC_FL_KEEP_SIZE, d->offset,
+                length - d->offset) == 0)
+    d->preallocated = 1;
+#endif /* HAVE_FALLOCATE && FALLOC_FL_KEEP_SIZE */
+
+  return 0;
+}
+
 static size_t _enclosure_urlget_cb(void *buffer, size_t size, size_t nmemb,
                                    void *user_data)
 {
-  FILE *f = (FILE *)user_data;
+  struct _enclosure_download *d = (struct _enclosure_download *)user_data;
+
+  g_checksum_update(d->sha256, buffer, size * nmemb);
+
+  if (d->verify && d->verify != d->sha256)
+    g_checksum_update(d->verify, buffer, size * nmemb);
+
+  if (!writer_write(d->w, buffer, size * nmemb))
+    return 0;
 
-  return fwrite(buffer, size, nmemb, f);
+  return nmemb;
+}
+
+/* Maps the name of a hash algorithm in an mrss feed to a checksum type.
+   Returns -1 if the algorithm is not supported. */
+static int _checksum_type(const char *algorithm)
+{
+  if (!g_ascii_strcasecmp(algorithm, "md5"))
+    return G_CHECKSUM_MD5;
+  else if (!g_ascii_strcasecmp(algorithm, "sha-1") ||
+           !g_ascii_strcasecmp(algorithm, "sha1"))
+    return G_CHECKSUM_SHA1;
+  else if (!g_ascii_strcasecmp(algorithm, "sha-256") ||
+           !g_ascii_strcasecmp(algorithm, "sha256"))
+    return G_CHECKSUM_SHA256;
+  else
+    return -1;
+}
+
+/* Feeds the first 'length' bytes of a partial download to the checksums so
+   that a resumed download can be checksummed as a whole. Returns FALSE if
+   the data cannot be read. */
+static gboolean _checksum_partial_file(struct _enclosure_download *d,
+                                       const gchar *filename, gint64 length)
+{
+  const gsize buffer_size = 1 << 20;
+  gchar *buffer;
+  ssize_t n;
+  int fd;
+
+  fd = g_open(filename, O_RDONLY, 0);
+
+  if (fd < 0)
+    return FALSE;
+
+  buffer = g_malloc(buffer_size);
+
+  while (length > 0) {
+    n = read(fd, buffer, MIN(buffer_size, length));
+
+    if (n < 0 && errno == EINTR)
+      continue;
+
+    if (n <= 0)
+      break;
+
+    g_checksum_update(d->sha256, (const guchar *)buffer, n);
+
+    if (d->verify && d->verify != d->sha256)
+      g_checksum_update(d->verify, (const guchar *)buffer, n);
+
+    length -= n;
+  }
+
+  g_free(buffer);
+  close(fd);
+
+  return length == 0;
+}
+
+/* Empties the partial file so that a download starts over. Returns FALSE if
+   the file cannot be truncated. */
+static gboolean _restart_download(struct _enclosure_download *d,
+                                  const download_options *options)
+{
+  writer *w;
+
+  writer_flush(d->w);
+
+  if (ftruncate(d->fd, 0) != 0)
+    return FALSE;
+
+  w = writer_new(d->fd, 0, options->write_buffer_size,
+                 options->writeback_size);
+
+  if (!w)
+    return FALSE;
+
+  writer_free(d->w);
+  d->w = w;
+
+  g_checksum_reset(d->sha256);
+  if (d->verify && d->verify != d->sha256)
+    g_checksum_reset(d->verify);
+
+  d->offset = 0;
+
+  return TRUE;
+}
+
+/* Transfers an enclosure to the partial file. A transfer that ends before
+   the whole enclosure has arrived, whether with an error or not, is resumed
+   from where it stopped as long as it makes progress. The server's idea of
+   the length of the enclosure is preferred over that of the feed. Returns
+   non-zero if the enclosure could not be transferred in full. */
+static int _transfer_enclosure(channel *c, const enclosure *e,
+                               struct _enclosure_download *d,
+                               const download_options *options,
+                               int quota_limited, int debug,
+                               progress_display *progress)
+{
+  int attempt, result;
+  gint64 received, expected;
+  gchar *received_s, *expected_s;
+
+  for (attempt = 0;; attempt++) {
+    d->announced_length = 0;
+
+    result = urlget_buffer(e->url, d, _enclosure_urlget_cb,
+                           _enclosure_urlget_start_cb, d->offset, 0,
+                           options->receive_buffer_size, &options->timeouts,
+                           &c->stats.enclosures, debug, progress);
+
+    /* The server refused to resume. The partial file holds all of the
+       enclosure if it is as long as the server says, or, if the server does
+       not say, as the feed says. Otherwise it cannot be part of this
+       enclosure, so the download starts over, as it does when the server
+       does not support resuming at all. */
+    if (result == URLGET_RANGE_AT_END ||
+        (result == URLGET_RANGE_NOT_SATISFIABLE &&
+         d->offset == d->expected_length))
+      return 0;
+
+    if (result == URLGET_RANGE_NOT_SATISFIABLE ||
+        result == URLGET_RANGE_MISMATCH || result == URLGET_RANGE_IGNORED) {
+      if (attempt == MAX_RESUME_ATTEMPTS || !_restart_download(d, options)) {
+        g_fprintf(stderr, "Error downloading enclosure from %s.\n", e->url);
+        return 1;
+      }
+
+      g_fprintf(stderr, "Cannot resume download of %s. Starting over.\n",
+                e->url);
+      continue;
+    }
+
+    if (d->needed) {
+      _report_no_room(c, options, e->url, d->needed, d->capacity,
+                      quota_limited);
+      return 1;
+    }
+
+    received = writer_offset(d->w);
+    expected = d->announced_length ? d->announced_length : d->expected_length;
+
+    if (result == 0 && received >= expected)
+      return 0;
+
+    /* Errors writing the file are not worth retrying, and neither is a
+       transfer that did not get anywhere. */
+    if (attempt == MAX_RESUME_ATTEMPTS || writer_error(d->w) ||
+        received <= d->offset) {
+      if (result == 0) {
+        received_s = g_format_size(received);
+        expected_s = g_format_size(expected);
+        g_fprintf(stderr,
+                  "Error downloading enclosure from %s: received %s of %s.\n",
+                  e->url, received_s, expected_s);
+        g_free(expected_s);
+        g_free(received_s);
+      } else
+        g_fprintf(stderr, "Error downloading enclosure from %s.\n", e->url);
+
+      return 1;
+    }
+
+    received_s = g_format_size(received);
+
+    /* A download is not resumed once the time for downloads is up, or
+       nearly so. */
+    if (options->timeouts.deadline &&
+        g_get_monotonic_time() + G_USEC_PER_SEC >=
+            options->timeouts.deadline) {
+      g_fprintf(stderr,
+                "Download of %s stopped after %s: time for downloads used "
+                "up.\n",
+                e->url, received_s);
+      g_free(received_s);
+      return 1;
+    }
+
+    g_fprintf(stderr, "Download of %s stopped after %s. Resuming.\n", e->url,
+              received_s);
+    g_free(received_s);
+
+    d->offset = received;
+  }
+}
+
+static gboolean _is_remote(const char *url)
+{
+  return !strncmp("http://", url, strlen("http://")) ||
+         !strncmp("https://", url, strlen("https://"));
+}
+
+/* Starts collecting measurements for an update. */
+static void _update_begin(channel *c)
+{
+  c->update_started = g_get_real_time() / G_USEC_PER_SEC;
+
+  memset(&c->stats, 0, sizeof(channel_stats));
+}
+
+static void _feed_received(channel *c, rss_file *f)
+{
+  if (f)
+    c->stats.parse_time = f->parse_time;
+  else
+    c->stats.failures++;
 }
 
 static rss_file *_get_rss(channel *c, void *user_data, channel_callback cb,
-                          int debug)
+                          const feed_limits *limits, int debug)
 {
   rss_file *f;
+  gint64 t = trace_begin();
 
   if (cb)
     cb(user_data, CCA_RSS_DOWNLOAD_START, NULL, NULL, NULL);
 
-  if (!strncmp("http://", c->url, strlen("http://")) ||
-      !strncmp("https://", c->url, strlen("https://")))
-    f = rss_open_url(c->url, debug);
+  if (_is_remote(c->url))
+    f = rss_open_url(c->url, limits, &c->stats.feed, debug);
   else
-    f = rss_open_file(c->url);
+    f = rss_open_file(c->url, limits);
+
+  trace_end(t, "feed", "get_rss", c->url);
+  _feed_received(c, f);
 
   if (cb)
     cb(user_data, CCA_RSS_DOWNLOAD_END, &(f->channel_info), NULL, NULL);
@@ -190,92 +609,333 @@ static rss_file *_get_rss(channel *c, void *user_data, channel_callback cb,
   return f;
 }
 
+/* Names of the files an enclosure is downloaded to. */
+struct _enclosure_names {
+  gchar *filename;              /* name of the complete enclosure */
+  gchar *partial_filename;      /* name of the file while downloading */
+  gchar *full_filename;         /* pathnames of the same */
+  gchar *partial_full_filename;
+};
+
+static void _enclosure_names_clear(struct _enclosure_names *names)
+{
+  g_free(names->partial_full_filename);
+  g_free(names->full_filename);
+  g_free(names->partial_filename);
+  g_free(names->filename);
+  memset(names, 0, sizeof(struct _enclosure_names));
+}
+
+/* Names an enclosure after the first free filename based on the expanded
+   filename pattern. If 'partial' is set, the partial file must not exist
+   either. Returns FALSE if there is no free filename. */
+static gboolean _enclosure_names_choose(channel *c,
+                                        struct _enclosure_names *names,
+                                        gboolean partial)
+{
+  gchar *filename =
+      spool_index_free_filename(c->spool, c->filename_buffer->str, partial);
+
+  if (!filename) {
+    g_fprintf(stderr, "Enclosure file %s already exists.\n",
+              c->filename_buffer->str);
+    return FALSE;
+  }
+
+  _enclosure_names_clear(names);
+  names->filename = filename;
+  names->partial_filename = g_strconcat(filename, PARTIAL_SUFFIX, NULL);
+  names->full_filename =
+      g_build_filename(c->spool_directory, filename, NULL);
+  names->partial_full_filename =
+      g_build_filename(c->spool_directory, names->partial_filename, NULL);
+
+  return TRUE;
+}
+
+/* Opens the partial file of a download. A partial file is only appended
+   to, or when 'offset' is 0 truncated, if the download is resumed.
+   Otherwise a new one is created, and if another channel or process has
+   created one with the same name since the name was chosen, the next free
+   filename is used instead. Returns -1 on error. */
+static int _open_partial_file(channel *c, struct _enclosure_names *names,
+                              int resume, gint64 offset)
+{
+  int fd;
+
+  if (resume)
+    return g_open(names->partial_full_filename,
+                  O_WRONLY | O_CREAT | (offset ? O_APPEND : O_TRUNC), 0666);
+
+  while ((fd = g_open(names->partial_full_filename,
+                      O_WRONLY | O_CREAT | O_EXCL, 0666)) < 0 &&
+         errno == EEXIST) {
+    spool_index_add(c->spool, names->partial_filename, -1);
+
+    if (!_enclosure_names_choose(c, names, TRUE))
+      return -1;
+  }
+
+  return fd;
+}
+
+/* Moves a complete download from its partial file into place. An existing
+   file is never replaced: the name is taken with link(), which fails if
+   the file exists, and the next free filename is used instead if another
+   channel or process has taken the name since it was chosen. File systems
+   without hard links fall back to checking for the file before renaming
+   it. Returns FALSE on error. */
+static gboolean _move_into_place(channel *c, struct _enclosure_names *names)
+{
+  gchar *partial_full_filename;
+  gboolean moved;
+
+  for (;;) {
+    if (link(names->partial_full_filename, names->full_filename) == 0) {
+      if (g_unlink(names->partial_full_filename) != 0)
+        g_fprintf(stderr, "Error removing %s.\n",
+                  names->partial_full_filename);
+
+      return TRUE;
+    }
+
+    if (errno != EEXIST &&
+        !g_file_test(names->full_filename, G_FILE_TEST_EXISTS))
+      return g_rename(names->partial_full_filename, names->full_filename) ==
+             0;
+
+    spool_index_add(c->spool, names->filename, -1);
+
+    /* The partial file keeps its name. */
+    partial_full_filename = g_strdup(names->partial_full_filename);
+    moved = _enclosure_names_choose(c, names, FALSE);
+    g_free(names->partial_full_filename);
+    names->partial_full_filename = partial_full_filename;
+
+    if (!moved)
+      return FALSE;
+  }
+}
+
+/* Downloads an enclosure. On success, a record of the download is returned
+   in 'record'. The
+   download is deferred without touching the network if the length given
+   in the feed shows that the enclosure does not fit in the spool, and
+   abandoned as soon as the server announces a length that does not
+   fit. */
 static int _do_download(channel *c, channel_info *channel_info, rss_item *item,
                         void *user_data, channel_callback cb, int resume,
-                        int debug, int show_progress_bar)
+                        const download_options *options, int debug,
+                        progress_display *progress, download_record **record)
 {
   int download_failed;
-  long resume_from = 0;
-  gchar *enclosure_full_filename;
-  FILE *enclosure_file;
-  struct stat fileinfo;
-  progress_bar *pb;
-
-  /* Check that the spool directory exists. */
-  if (!g_file_test(c->spool_directory, G_FILE_TEST_IS_DIR)) {
-    g_fprintf(stderr, "Spool directory %s not found.\n", c->spool_directory);
-    return 1;
+  struct _enclosure_names names;
+  struct _enclosure_download d;
+  gint64 size;
+  int checksum_type;
+  int discarded = 0;
+  int rejected = 0;
+  int quota_limited;
+  rss_item numbered;
+
+  /* Read the spool directory the first time it is needed during an update,
+     unless another channel with the same spool directory already has. This
+     also checks that it exists. */
+  if (!c->spool) {
+    c->spool = spool_index_open(c->spool_directory);
+
+    if (!c->spool) {
+      g_fprintf(stderr, "Spool directory %s not found.\n", c->spool_directory);
+      return DOWNLOAD_FAILED;
+    }
   }
 
-  /* Build enclosure filename. */
-  enclosure_full_filename = build_enclosure_filename(
-      c->spool_directory, c->filename_pattern, channel_info, item);
-
-  if (g_file_test(enclosure_full_filename, G_FILE_TEST_EXISTS)) {
-    /* A file with the same filename already exists. If the user has asked us
-       to resume downloads, we should append to the file. Otherwise we should
-       refuse to continue. If the feed uses the same filename for each
-       enclosure, running in append mode will corrupt existing files. There is
-       probably no practical way to avoid this, and the issue is documented in
-       castget(1) and castgetrc(5). */
-    if (resume) {
-      /* Set resume offset to the size of the file as it is now (and use
-         non-append mode if the size is zero or stat() fails). */
-      if (0 == stat(enclosure_full_filename, &fileinfo))
-        resume_from = fileinfo.st_size;
-      else
-        resume_from = 0;
-    } else {
-      /* File exists but user does not allow us to append so we have to
-         abort. */
-      g_fprintf(stderr, "Enclosure file %s already exists.\n",
-                enclosure_full_filename);
-      g_free(enclosure_full_filename);
-      return 1;
-    }
-  } else
-    /* By letting the offset be 0 we will write in non-append mode. */
-    resume_from = 0;
+  /* Build enclosure filename. Enclosures without an episode number in the
+     feed are numbered in the order they are downloaded, so that the number
+     stays the same however many items the feed lists. */
+  numbered = *item;
+
+  if (numbered.index <= 0)
+    numbered.index = c->last_index + 1;
+
+  build_enclosure_basename(c->filename_program, c->filename_buffer,
+                           channel_info, &numbered);
+
+  if (c->filename_buffer->len == 0) {
+    /* The pattern expanded to nothing usable. */
+    g_fprintf(stderr, "Unable to determine a filename for enclosure %s.\n",
+              item->enclosure->url);
+    return DOWNLOAD_FAILED;
+  }
 
-  enclosure_file = fopen(enclosure_full_filename, resume_from ? "ab" : "wb");
+  /* Never touch a file that already exists. If a file with the same filename
+     is found, we pick the first free filename with a numbered suffix
+     instead. The enclosure is downloaded to a partial file that is renamed
+     once the download is complete. If the user has asked us to resume
+     downloads, we should append to a partial file left behind by an
+     earlier attempt. Otherwise the filename must not have a partial file
+     either. If the feed uses the same filename for each enclosure,
+     resuming may corrupt the partial file. There is probably no practical
+     way to avoid this, and the issue is documented in castget(1) and
+     castgetrc(5). */
+  memset(&names, 0, sizeof(struct _enclosure_names));
+
+  if (!_enclosure_names_choose(c, &names, !resume))
+    return DOWNLOAD_FAILED;
+
+  /* Check that the rest of the enclosure fits before anything is
+     downloaded. The space is checked afresh for each enclosure as other
+     programs may be using the same file system. */
+  d.offset = 0;
+  if (resume && spool_index_contains(c->spool, names.partial_filename))
+    d.offset = MAX(spool_index_size(c->spool, names.partial_filename), 0);
+
+  d.expected_length = MAX(item->enclosure->length, 0);
+  d.capacity = _spool_capacity(c, options, &quota_limited);
+  d.needed = 0;
+
+  if (d.capacity >= 0 && d.expected_length - d.offset > d.capacity) {
+    _report_no_room(c, options, item->enclosure->url,
+                    d.expected_length - d.offset, d.capacity, quota_limited);
+    _enclosure_names_clear(&names);
+    return DOWNLOAD_DEFERRED;
+  }
+
+  /* The enclosure is checksummed as it is written. If the feed gives a
+     hash that we support, it is checked too. */
+  d.sha256 = g_checksum_new(G_CHECKSUM_SHA256);
+  d.verify = NULL;
+
+  if (item->enclosure->hash) {
+    checksum_type = _checksum_type(item->enclosure->hash_algorithm);
+
+    if (checksum_type == G_CHECKSUM_SHA256)
+      d.verify = d.sha256;
+    else if (checksum_type >= 0)
+      d.verify = g_checksum_new(checksum_type);
+  }
 
-  if (!enclosure_file) {
+  /* A resumed download needs the data that has already been downloaded
+     checksummed first. If that fails, start over. */
+  if (d.offset &&
+      !_checksum_partial_file(&d, names.partial_full_filename, d.offset)) {
+    g_checksum_reset(d.sha256);
+    if (d.verify)
+      g_checksum_reset(d.verify);
+    d.offset = 0;
+  }
+
+  d.fd = _open_partial_file(c, &names, resume, d.offset);
+  d.w = NULL;
+  d.preallocated = 0;
+
+  if (d.fd >= 0) {
+    d.w = writer_new(d.fd, d.offset, options->write_buffer_size,
+                     options->writeback_size);
+
+    if (!d.w)
+      close(d.fd);
+  }
+
+  if (!d.w) {
     g_fprintf(stderr, "Error opening enclosure file %s.\n",
-              enclosure_full_filename);
-    g_free(enclosure_full_filename);
-    return 1;
+              names.partial_full_filename);
+    if (d.verify && d.verify != d.sha256)
+      g_checksum_free(d.verify);
+    g_checksum_free(d.sha256);
+    _enclosure_names_clear(&names);
+    return DOWNLOAD_FAILED;
   }
 
   if (cb)
     cb(user_data, CCA_ENCLOSURE_DOWNLOAD_START, channel_info, item->enclosure,
-       enclosure_full_filename);
+       names.full_filename);
 
-  if (show_progress_bar)
-    pb = progress_bar_new(resume_from);
-  else
-    pb = NULL;
+  download_failed = _transfer_enclosure(c, item->enclosure, &d, options,
+                                        quota_limited, debug, progress);
+
+  size = writer_offset(d.w);
+
+  if (!writer_free(d.w)) {
+    g_fprintf(stderr, "Error writing enclosure file %s.\n",
+              names.partial_full_filename);
+    download_failed = 1;
+  }
+
+#if defined(HAVE_FALLOCATE) && defined(FALLOC_FL_KEEP_SIZE)
+  /* Release any space reserved beyond what was actually received. */
+  if (d.preallocated && !download_failed && ftruncate(d.fd, size) != 0)
+    g_fprintf(stderr, "Error releasing unused space in %s.\n",
+              names.partial_full_filename);
+#endif /* HAVE_FALLOCATE && FALLOC_FL_KEEP_SIZE */
 
-  if (urlget_buffer(item->enclosure->url, enclosure_file, _enclosure_urlget_cb,
-                    resume_from, debug, pb)) {
-    g_fprintf(stderr, "Error downloading enclosure from %s.\n",
+  close(d.fd);
+
+  if (!download_failed && d.verify &&
+      g_ascii_strcasecmp(g_checksum_get_string(d.verify),
+                         item->enclosure->hash) != 0) {
+    g_fprintf(stderr, "Checksum mismatch for enclosure %s.\n",
               item->enclosure->url);
 
+    /* There is no point in resuming a corrupt download later. */
+    g_unlink(names.partial_full_filename);
     download_failed = 1;
-  } else
-    download_failed = 0;
+    discarded = 1;
+    rejected = 1;
+  }
 
-  if (pb)
-    progress_bar_free(pb);
+  if (!download_failed && !_move_into_place(c, &names)) {
+    g_fprintf(stderr, "Error renaming %s to %s.\n", names.partial_full_filename,
+              names.full_filename);
+    download_failed = 1;
+  }
 
-  fclose(enclosure_file);
+  /* A declined download leaves nothing worth resuming behind unless an
+     earlier attempt did. */
+  if (d.needed && size == 0) {
+    g_unlink(names.partial_full_filename);
+    discarded = 1;
+  }
 
-  if (cb)
+  /* Keep the spool index in step with the file system. */
+  if (discarded)
+    spool_index_remove(c->spool, names.partial_filename);
+  else if (download_failed)
+    spool_index_add(c->spool, names.partial_filename, size);
+  else {
+    spool_index_remove(c->spool, names.partial_filename);
+    spool_index_add(c->spool, names.filename, size);
+  }
+
+  if (!download_failed && item->index <= 0)
+    c->last_index++;
+
+  /* A rejected enclosure is recorded without a file, along with the
+     checksum of what was received. */
+  if (!download_failed || rejected)
+    *record = _download_record_new(
+        get_rfc822_time(), g_strdup(g_checksum_get_string(d.sha256)),
+        rejected ? NULL : g_strdup(names.filename), rejected ? 0 : size,
+        g_get_real_time() / G_USEC_PER_SEC);
+
+  if (d.verify && d.verify != d.sha256)
+    g_checksum_free(d.verify);
+  g_checksum_free(d.sha256);
+
+  if (cb && !download_failed)
     cb(user_data, CCA_ENCLOSURE_DOWNLOAD_END, channel_info, item->enclosure,
-       enclosure_full_filename);
+       names.full_filename);
 
-  g_free(enclosure_full_filename);
+  _enclosure_names_clear(&names);
 
-  return download_failed;
+  if (d.needed)
+    return DOWNLOAD_DEFERRED;
+  else if (rejected)
+    return DOWNLOAD_REJECTED;
+  else if (download_failed)
+    return DOWNLOAD_FAILED;
+  else
+    return DOWNLOAD_OK;
 }
 
 static int _do_catchup(channel *c, channel_info *channel_info, rss_item *item,
@@ -292,126 +952,481 @@ static int _do_catchup(channel *c, channel_info *channel_info, rss_item *item,
   return 0;
 }
 
+/* Downloads the enclosure of an item, or only reports it if 'no_download'
+   is set, and records it in the download history unless 'no_mark_read' is
+   set. An enclosure that does not match the hash in the feed is recorded
+   too, so that it is not downloaded again on every update. Sets 'size' to
+   the size of the downloaded file. */
+static int _process_item(channel *c, channel_info *channel_info,
+                         rss_item *item, void *user_data, channel_callback cb,
+                         int no_download, int no_mark_read, int resume,
+                         const download_options *options, int debug,
+                         progress_display *progress, gint64 *size)
+{
+  int download_failed;
+  download_record *record = NULL;
+  gint64 t;
+
+  *size = 0;
+
+  if (no_download)
+    download_failed = _do_catchup(c, channel_info, item, user_data, cb);
+  else {
+    t = trace_begin();
+    download_failed =
+        _do_download(c, channel_info, item, user_data, cb, resume, options,
+                     debug, progress, &record);
+    trace_end(t, "enclosure", "download", item->enclosure->url);
+  }
+
+  if (download_failed == DOWNLOAD_FAILED ||
+      download_failed == DOWNLOAD_REJECTED)
+    c->stats.failures++;
+
+  if (download_failed && download_failed != DOWNLOAD_REJECTED)
+    return download_failed;
+
+  if (!no_download && !download_failed)
+    c->stats.downloads++;
+
+  if (record)
+    *size = record->size;
+
+  if (!no_mark_read) {
+    /* Mark enclosure as downloaded and immediately save channel file to
+       ensure that it reflects the change. */
+    if (!record)
+      record = _download_record_new(get_rfc822_time(), NULL, NULL, 0,
+                                    g_get_real_time() / G_USEC_PER_SEC);
+
+    g_hash_table_insert(c->downloaded_enclosures,
+                        g_strdup(item->enclosure->url), record);
+    record = NULL;
+
+    _cast_channel_save(c, debug);
+  }
+
+  if (record)
+    _download_record_free(record);
+
+  return download_failed;
+}
+
+/* Returns TRUE if the enclosure of an item is still to be processed. */
+static gboolean _item_wanted(channel *c, rss_item *item,
+                             enclosure_filter *filter)
+{
+  c->stats.items_seen++;
+
+  if (!item->enclosure ||
+      g_hash_table_lookup_extended(c->downloaded_enclosures,
+                                   item->enclosure->url, NULL, NULL))
+    return FALSE;
+
+  c->stats.items_new++;
+
+  if (filter && !enclosure_filter_match(filter, item)) {
+    c->stats.items_filtered++;
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+/* Remembers when the feed was fetched and what it says about when to fetch
+   it again. */
+static void _feed_fetched(channel *c, rss_file *f, int no_mark_read,
+                          int debug)
+{
+  if (!no_mark_read) {
+    /* Update the RSS last fetched time and save the channel file again. */
+
+    if (c->rss_last_fetched)
+      g_free(c->rss_last_fetched);
+
+    c->rss_last_fetched = g_strdup(f->fetched_time);
+
+    _cast_channel_save(c, debug);
+  }
+
+  c->hints = f->hints;
+}
+
 int channel_update(channel *c, void *user_data, channel_callback cb,
                    int no_download, int no_mark_read, int first_only,
-                   int resume, enclosure_filter *filter, int debug,
-                   int show_progress_bar)
+                   int resume, enclosure_filter *filter,
+                   const feed_limits *limits, const download_options *options,
+                   int debug, progress_display *progress)
 {
   int i, download_failed;
+  gint64 size;
   rss_file *f;
 
+  _update_begin(c);
+
   /* Retrieve the RSS file. */
-  f = _get_rss(c, user_data, cb, debug);
+  f = _get_rss(c, user_data, cb, limits, debug);
 
   if (!f)
     return 1;
 
   /* Check enclosures in RSS file. */
   for (i = 0; i < f->num_items; i++)
-    if (f->items[i]->enclosure) {
-      if (!g_hash_table_lookup_extended(c->downloaded_enclosures,
-                                        f->items[i]->enclosure->url, NULL,
-                                        NULL)) {
-        rss_item *item;
-
-        item = f->items[i];
-
-        if (!filter || _enclosure_pattern_match(filter, item->enclosure)) {
-          if (no_download)
-            download_failed =
-                _do_catchup(c, &(f->channel_info), item, user_data, cb);
-          else
-            download_failed =
-                _do_download(c, &(f->channel_info), item, user_data, cb, resume,
-                             debug, show_progress_bar);
-
-          if (download_failed)
-            break;
-
-          if (!no_mark_read) {
-            /* Mark enclosure as downloaded and immediately save channel
-               file to ensure that it reflects the change. */
-            g_hash_table_insert(c->downloaded_enclosures,
-                                f->items[i]->enclosure->url,
-                                (gpointer)get_rfc822_time());
-
-            _cast_channel_save(c, debug);
-          }
-
-          /* If we have been instructed to deal only with the first
-             available enclosure, it is time to break out of the loop. */
-          if (first_only)
-            break;
-        }
-      }
+    if (_item_wanted(c, f->items[i], filter)) {
+      download_failed = _process_item(
+          c, &(f->channel_info), f->items[i], user_data, cb, no_download,
+          no_mark_read, resume, options, debug, progress, &size);
+
+      /* An enclosure that does not fit is left for a later update, but
+         smaller enclosures further down may still fit. One that does not
+         match its hash says nothing about the others. */
+      if (download_failed == DOWNLOAD_DEFERRED ||
+          download_failed == DOWNLOAD_REJECTED)
+        continue;
+      else if (download_failed)
+        break;
+
+      /* If we have been instructed to deal only with the first available
+         enclosure, it is time to break out of the loop. */
+      if (first_only)
+        break;
     }
 
-  if (!no_mark_read) {
-    /* Update the RSS last fetched time and save the channel file again. */
+  _feed_fetched(c, f, no_mark_read, debug);
 
-    if (c->rss_last_fetched)
-      g_free(c->rss_last_fetched);
+  channel_end_update(c);
+  rss_close(f);
 
-    c->rss_last_fetched = g_strdup(f->fetched_time);
+  return 0;
+}
 
-    _cast_channel_save(c, debug);
+/* A download that has been added to a download queue. It holds its own
+   copy of what is needed from the item, so that the feed can be freed as
+   soon as its downloads are queued. The strings of the copy are stored
+   after the structure in the same block, which the queue frees with
+   g_free(). */
+struct _queued_download {
+  channel *c;
+  void *user_data;
+  channel_callback cb;
+  const download_options *options;
+  int resume;
+  int debug;
+  progress_display *progress;
+  rss_item item;
+  enclosure enclosure;
+  rfc822_time pub_time;
+};
+
+static gsize _string_size(const char *s)
+{
+  return s ? strlen(s) + 1 : 0;
+}
+
+/* Copies a string to '*p' and moves '*p' past it. */
+static char *_pack_string(gchar **p, const char *s)
+{
+  char *copy = *p;
+
+  if (!s)
+    return NULL;
+
+  memcpy(copy, s, strlen(s) + 1);
+  *p += strlen(s) + 1;
+
+  return copy;
+}
+
+/* Copies the fields of an item that filename patterns, the download and
+   post-processing use. */
+static struct _queued_download *_queued_download_new(const rss_item *item)
+{
+  const enclosure *e = item->enclosure;
+  struct _queued_download *q;
+  gchar *p;
+
+  q = g_malloc(sizeof(struct _queued_download) + _string_size(item->title) +
+               _string_size(item->pub_date) + _string_size(item->guid) +
+               _string_size(e->url) + _string_size(e->type) +
+               _string_size(e->hash) + _string_size(e->hash_algorithm) +
+               _string_size(e->title));
+  p = (gchar *)(q + 1);
+
+  q->item.title = _pack_string(&p, item->title);
+  q->item.link = NULL;
+  q->item.description = NULL;
+  q->item.pub_date = _pack_string(&p, item->pub_date);
+  q->item.guid = _pack_string(&p, item->guid);
+  q->item.pub_time = NULL;
+  q->item.index = item->index;
+  q->item.enclosure = &q->enclosure;
+
+  if (item->pub_time) {
+    q->pub_time = *item->pub_time;
+    q->item.pub_time = &q->pub_time;
   }
 
-  rss_close(f);
+  q->enclosure.url = _pack_string(&p, e->url);
+  q->enclosure.length = e->length;
+  q->enclosure.type = _pack_string(&p, e->type);
+  q->enclosure.hash = _pack_string(&p, e->hash);
+  q->enclosure.hash_algorithm = _pack_string(&p, e->hash_algorithm);
+  q->enclosure.title = _pack_string(&p, e->title);
+  q->enclosure.duration = e->duration;
+
+  return q;
+}
+
+static int _run_queued_download(gpointer data, gint64 deadline,
+                                gint64 *size)
+{
+  struct _queued_download *q = (struct _queued_download *)data;
+  download_options options = *q->options;
+
+  options.timeouts.deadline = deadline;
+
+  /* Spool space may have run out since the download was queued, in which
+     case it is left for a later update. */
+  if (_process_item(q->c, q->c->feed_info, &q->item, q->user_data, q->cb, 0,
+                    0, q->resume, &options, q->debug, q->progress,
+                    size) == DOWNLOAD_FAILED)
+    return -1;
 
   return 0;
 }
 
-/* Match the (file) name of an enclosure against a regexp. Letters
-   in the pattern match both upper and lower case letters if
-   'caseless' is TRUE. Returns TRUE if the pattern matches, FALSE
-   otherwise. */
-static gboolean _enclosure_pattern_match(enclosure_filter *filter,
-                                         const enclosure *enclosure)
+/* A request to queue the downloads of a channel once its feed has been
+   retrieved. */
+struct _feed_request {
+  channel *c;
+  void *user_data;
+  channel_callback cb;
+  int first_only;
+  int resume;
+  enclosure_filter *filter;
+  const download_options *options;
+  int debug;
+  progress_display *progress;
+  download_queue *queue;
+  gint64 trace_begin; /* when retrieval of the feed started */
+};
+
+static void _queue_feed_downloads(struct _feed_request *r, rss_file *f)
 {
-  GError *error = NULL;
-  GRegexCompileFlags compile_options = 0;
-  GRegexMatchFlags match_options = 0;
-  GRegex *regex;
-  gboolean match;
+  int i;
+  rss_item *item;
+  struct _queued_download *q;
+
+  /* Only the title of the channel is needed once the feed is freed. */
+  r->c->feed_info = g_malloc0(sizeof(channel_info));
+  r->c->feed_info->title = g_strdup(f->channel_info.title);
+
+  for (i = 0; i < f->num_items; i++) {
+    item = f->items[i];
+
+    if (!_item_wanted(r->c, item, r->filter))
+      continue;
+
+    q = _queued_download_new(item);
+    q->c = r->c;
+    q->user_data = r->user_data;
+    q->cb = r->cb;
+    q->options = r->options;
+    q->resume = r->resume;
+    q->debug = r->debug;
+    q->progress = r->progress;
+
+    download_queue_add(r->queue, r->c, item->enclosure->length,
+                       item->pub_time ? rfc822_time_to_unix(item->pub_time)
+                                      : 0,
+                       _run_queued_download, q);
+
+    if (r->first_only)
+      break;
+  }
 
-  g_assert(filter);
-  g_assert(filter->pattern);
-  g_assert(enclosure);
+  _feed_fetched(r->c, f, 0, r->debug);
+  rss_close(f);
+}
 
-  if (filter->caseless)
-    compile_options |= G_REGEX_CASELESS;
+static void _feed_received_cb(rss_file *f, void *user_data)
+{
+  struct _feed_request *r = (struct _feed_request *)user_data;
 
-  regex = g_regex_new(filter->pattern, compile_options, match_options, &error);
+  trace_async_end(r->c, r->trace_begin, "feed", "get_rss", r->c->url);
+  _feed_received(r->c, f);
 
-  if (error) {
-    fprintf(stderr, "Error compiling regular expression %s: %s\n",
-            filter->pattern, error->message);
-    g_error_free(error);
-    return FALSE;
+  if (r->cb)
+    r->cb(r->user_data, CCA_RSS_DOWNLOAD_END, f ? &(f->channel_info) : NULL,
+          NULL, NULL);
+
+  if (f)
+    _queue_feed_downloads(r, f);
+
+  g_free(r);
+}
+
+/* Retrieves the feed of a channel like channel_update(), but adds the
+   enclosures to download to 'queue' instead of downloading them right away.
+   'options' must remain valid until the queue has been run. The feed itself
+   is freed once its enclosures are queued, but c->feed_info is kept until
+   channel_end_update() is called. Returns 1 if the feed could not be
+   retrieved.
+
+   If 'engine' is given, a feed on a server is retrieved in the background
+   together with the other transfers of the engine, and its enclosures are
+   only queued once transfer_engine_run() has been called. c->feed_info is
+   left unset if the feed could not be retrieved. 'filter' and 'limits' must
+   then remain valid until the engine has been run. */
+int channel_queue_downloads(channel *c, void *user_data, channel_callback cb,
+                            int first_only, int resume,
+                            enclosure_filter *filter,
+                            const feed_limits *limits,
+                            const download_options *options, int debug,
+                            progress_display *progress,
+                            download_queue *queue,
+                            transfer_engine *engine)
+{
+  rss_file *f;
+  struct _feed_request *r;
+
+  _update_begin(c);
+
+  r = g_malloc(sizeof(struct _feed_request));
+  r->c = c;
+  r->user_data = user_data;
+  r->cb = cb;
+  r->first_only = first_only;
+  r->resume = resume;
+  r->filter = filter;
+  r->options = options;
+  r->debug = debug;
+  r->progress = progress;
+  r->queue = queue;
+  r->trace_begin = trace_begin();
+
+  if (engine && _is_remote(c->url)) {
+    if (cb)
+      cb(user_data, CCA_RSS_DOWNLOAD_START, NULL, NULL, NULL);
+
+    if (rss_open_url_async(engine, c->url, limits, &c->stats.feed, debug,
+                           progress, _feed_received_cb, r)) {
+      _feed_received_cb(NULL, r);
+      return 1;
+    }
+
+    return 0;
   }
 
-  match = g_regex_match(regex, enclosure->url, match_options, NULL);
+  f = _get_rss(c, user_data, cb, limits, debug);
+
+  if (f)
+    _queue_feed_downloads(r, f);
 
-  g_regex_unref(regex);
+  g_free(r);
 
-  return match;
+  return f ? 0 : 1;
 }
 
-enclosure_filter *enclosure_filter_new(const gchar *pattern, gboolean caseless)
+/* Releases what was kept for downloading enclosures during an update. */
+void channel_end_update(channel *c)
 {
-  enclosure_filter *e = g_malloc(sizeof(struct _enclosure_filter));
+  /* The spool directory is read again on the next update as other
+     programs may have changed it in the meantime. */
+  if (c->spool) {
+    spool_index_close(c->spool);
+    c->spool = NULL;
+  }
 
-  g_assert(pattern);
+  if (c->feed_info) {
+    g_free(c->feed_info->title);
+    g_free(c->feed_info);
+    c->feed_info = NULL;
+  }
+}
+
+/* Orders download records from the most recent to the oldest. */
+static gint _compare_records_by_age(gconstpointer a, gconstpointer b)
+{
+  const download_record *r = *(const download_record **)a;
+  const download_record *s = *(const download_record **)b;
 
-  e->pattern = g_strdup(pattern);
-  e->caseless = caseless;
+  if (r->timestamp != s->timestamp)
+    return r->timestamp > s->timestamp ? -1 : 1;
 
-  return e;
+  return strcmp(r->filename, s->filename);
 }
 
-void enclosure_filter_free(enclosure_filter *e)
+/* Deletes the oldest enclosures downloaded from a channel once there are
+   more of them than the policy allows. The enclosures to delete are picked
+   from the download history, so the spool directory is not scanned. The
+   enclosures are kept in the history, without a filename, so that they are
+   not downloaded again. Enclosures downloaded by the most recent update
+   are never deleted. Returns the number of enclosures deleted. */
+int channel_apply_retention(channel *c, void *user_data, channel_callback cb,
+                            const retention_policy *policy, int debug)
 {
-  g_free(e->pattern);
-  g_free(e);
+  GHashTableIter iter;
+  gpointer value;
+  GPtrArray *records;
+  download_record *r;
+  gint64 now, kept_episodes = 0, kept_size = 0;
+  gchar *filename;
+  int i, expired, deleted = 0;
+
+  if (!policy->keep_episodes && !policy->keep_age && !policy->keep_size)
+    return 0;
+
+  now = g_get_real_time() / G_USEC_PER_SEC;
+
+  /* Only enclosures whose files are still around are of interest. */
+  records = g_ptr_array_new();
+
+  g_hash_table_iter_init(&iter, c->downloaded_enclosures);
+
+  while (g_hash_table_iter_next(&iter, NULL, &value))
+    if (((download_record *)value)->filename)
+      g_ptr_array_add(records, value);
+
+  g_ptr_array_sort(records, _compare_records_by_age);
+
+  for (i = 0; i < records->len; i++) {
+    r = g_ptr_array_index(records, i);
+
+    expired =
+        (policy->keep_episodes && kept_episodes >= policy->keep_episodes) ||
+        (policy->keep_age && r->timestamp < now - policy->keep_age) ||
+        (policy->keep_size && kept_size + r->size > policy->keep_size);
+
+    if (expired &&
+        (!c->update_started || r->timestamp < c->update_started)) {
+      filename = g_build_filename(c->spool_directory, r->filename, NULL);
+
+      if (g_unlink(filename) == 0 || errno == ENOENT) {
+        if (cb)
+          cb(user_data, CCA_ENCLOSURE_DELETED, NULL, NULL, filename);
+
+        g_free(r->filename);
+        r->filename = NULL;
+        r->size = 0;
+        deleted++;
+      } else
+        g_fprintf(stderr, "Error deleting enclosure file %s: %s.\n", filename,
+                  strerror(errno));
+
+      g_free(filename);
+    }
+
+    if (r->filename) {
+      kept_episodes++;
+      kept_size += r->size;
+    }
+  }
+
+  g_ptr_array_free(records, TRUE);
+
+  if (deleted)
+    _cast_channel_save(c, debug);
+
+  return deleted;
 }
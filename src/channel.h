@@ -20,24 +20,71 @@
 #ifndef CHANNEL_H
 #define CHANNEL_H
 
+#include "urlget.h"
+
 #include <glib.h>
 
 typedef enum {
   CCA_RSS_DOWNLOAD_START,
   CCA_RSS_DOWNLOAD_END,
   CCA_ENCLOSURE_DOWNLOAD_START,
-  CCA_ENCLOSURE_DOWNLOAD_END
+  CCA_ENCLOSURE_DOWNLOAD_END,
+  CCA_ENCLOSURE_DELETED
 } channel_action;
 
+/* Hints on when a feed is worth fetching again. A value of zero means that
+   the feed gives no hint. */
+typedef struct _feed_hints {
+  gint64 ttl;         /* seconds the feed may be cached */
+  guint32 skip_hours; /* bit n is set if the feed is not updated at n UTC */
+  guint8 skip_days;   /* bit n is set if not updated on day n, 0 = Sunday */
+  gint64 cadence;     /* estimated seconds between new items */
+} feed_hints;
+
+/* Measurements taken during the last update of a channel. Times are in
+   microseconds. */
+typedef struct _channel_stats {
+  urlget_stats feed;
+  urlget_stats enclosures;
+  gint64 parse_time;
+  gint64 items_seen;     /* items examined */
+  gint64 items_new;      /* items with an enclosure not yet downloaded */
+  gint64 items_filtered; /* new items left out by filters */
+  gint64 downloads;      /* enclosures downloaded */
+  gint64 failures;       /* feed or enclosures that could not be retrieved */
+  gint64 save_time;      /* saving the channel file */
+} channel_stats;
+
 typedef struct _channel {
   gchar *url;
   gchar *channel_filename;
   gchar *spool_directory;
   gchar *filename_pattern;
-  GHashTable *downloaded_enclosures;
+  struct _pattern_program *filename_program;
+  GString *filename_buffer;
+  struct _spool_index *spool; /* index of the spool directory while
+                                 updating, shared by channels that use the
+                                 same directory */
+  struct _channel_info *feed_info; /* channel of the feed while downloads
+                                      from it are pending */
+  GHashTable *downloaded_enclosures; /* URL -> download_record */
   gchar *rss_last_fetched;
+  gint64 last_index; /* number given to the last enclosure downloaded
+                        without an episode number */
+  gint64 update_started; /* time the last update started, or 0 */
+  feed_hints hints;      /* hints from the feed at the last update */
+  channel_stats stats;   /* measurements of the last update */
 } channel;
 
+/* What is remembered about an enclosure that has been downloaded. */
+typedef struct _download_record {
+  gchar *download_time;
+  gchar *sha256;    /* hex digest of the enclosure, or NULL if unknown */
+  gchar *filename;  /* file in the spool directory, or NULL if deleted */
+  gint64 size;      /* size of the file */
+  gint64 timestamp; /* time of download, or 0 if unknown */
+} download_record;
+
 typedef struct _channel_info {
   char *title;
   char *link;
@@ -49,12 +96,41 @@ typedef struct _enclosure {
   char *url;
   long length;
   char *type;
+  char *hash;           /* hex digest from the feed, or NULL */
+  char *hash_algorithm; /* algorithm of 'hash' as named by the feed */
+  char *title;          /* title of the media or of the item, or NULL */
+  long duration;        /* seconds, or -1 if unknown */
 } enclosure;
 
-typedef struct _enclosure_filter {
-  gchar *pattern;
-  gboolean caseless;
-} enclosure_filter;
+typedef struct _enclosure_filter enclosure_filter;
+typedef struct _download_queue download_queue;
+
+/* Resource limits applied when retrieving and parsing a feed. A value of
+   zero means that no limit applies. */
+typedef struct _feed_limits {
+  gint64 max_feed_size;  /* bytes */
+  gint64 max_items;
+  gint64 max_parse_time; /* seconds */
+  urlget_timeouts timeouts;
+} feed_limits;
+
+/* Options for downloading enclosures. A value of zero selects the
+   default. */
+typedef struct _download_options {
+  gint64 receive_buffer_size; /* size of libcurl's receive buffer */
+  gint64 write_buffer_size;   /* size of the buffer writes are collected in */
+  gint64 writeback_size;      /* bytes written before writeback is forced */
+  gint64 spool_quota;         /* bytes the spool directory may use */
+  urlget_timeouts timeouts;
+} download_options;
+
+/* How many of the enclosures downloaded from a channel to keep in the spool
+   directory. A value of zero means that no limit applies. */
+typedef struct _retention_policy {
+  gint64 keep_episodes;
+  gint64 keep_age;  /* seconds */
+  gint64 keep_size; /* bytes */
+} retention_policy;
 
 typedef void (*channel_callback)(void *user_data, channel_action action,
                                  channel_info *channel_info,
@@ -66,10 +142,19 @@ channel *channel_new(const char *url, const char *channel_file,
 void channel_free(channel *c);
 int channel_update(channel *c, void *user_data, channel_callback cb,
                    int no_download, int no_mark_read, int first_only,
-                   int resume, enclosure_filter *filter, int debug,
-                   int progress_bar);
-
-enclosure_filter *enclosure_filter_new(const gchar *pattern, gboolean caseless);
-void enclosure_filter_free(enclosure_filter *e);
+                   int resume, enclosure_filter *filter,
+                   const feed_limits *limits, const download_options *options,
+                   int debug, progress_display *progress);
+int channel_queue_downloads(channel *c, void *user_data, channel_callback cb,
+                            int first_only, int resume,
+                            enclosure_filter *filter,
+                            const feed_limits *limits,
+                            const download_options *options, int debug,
+                            progress_display *progress,
+                            download_queue *queue,
+                            transfer_engine *engine);
+void channel_end_update(channel *c);
+int channel_apply_retention(channel *c, void *user_data, channel_callback cb,
+                            const retention_policy *policy, int debug);
 
 #endif /* CHANNEL_H */
@@ -24,6 +24,7 @@
 
 #include "configuration.h"
 
+#include <errno.h>
 #include <glib/gstdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -40,6 +41,132 @@ static gchar *_read_channel_configuration_key(GKeyFile *kf,
   return NULL;
 }
 
+/* Parses a non-negative number with an optional unit suffix. 'units' lists
+   the accepted suffix characters and 'multipliers' the corresponding factors.
+   Returns -1 if the value is invalid. */
+static gint64 _parse_number_with_unit(const gchar *s, const gchar *units,
+                                      const gint64 *multipliers)
+{
+  gchar *end;
+  const gchar *unit;
+  guint64 n;
+
+  if (!g_ascii_isdigit(*s))
+    return -1;
+
+  errno = 0;
+  n = g_ascii_strtoull(s, &end, 10);
+
+  if (errno)
+    return -1;
+
+  if (*end) {
+    unit = strchr(units, *end);
+
+    if (!unit || end[1])
+      return -1;
+
+    /* Values that do not fit are rejected rather than wrapped around. */
+    if (n > G_MAXINT64 / multipliers[unit - units])
+      return -1;
+
+    n *= multipliers[unit - units];
+  }
+
+  if (n > G_MAXINT64)
+    return -1;
+
+  return (gint64)n;
+}
+
+/* Parses a size in bytes with an optional k, M, G or T suffix. */
+static gint64 _parse_size(const gchar *s)
+{
+  static const gint64 multipliers[] = {
+    G_GINT64_CONSTANT(1) << 10, G_GINT64_CONSTANT(1) << 10,
+    G_GINT64_CONSTANT(1) << 20, G_GINT64_CONSTANT(1) << 20,
+    G_GINT64_CONSTANT(1) << 30, G_GINT64_CONSTANT(1) << 30,
+    G_GINT64_CONSTANT(1) << 40, G_GINT64_CONSTANT(1) << 40
+  };
+
+  return _parse_number_with_unit(s, "kKmMgGtT", multipliers);
+}
+
+/* Parses a plain count. */
+static gint64 _parse_count(const gchar *s)
+{
+  return _parse_number_with_unit(s, "", NULL);
+}
+
+/* Parses a duration in seconds with an optional s, m, h or d suffix. */
+static gint64 _parse_duration(const gchar *s)
+{
+  static const gint64 multipliers[] = { 1, 60, 60 * 60, 24 * 60 * 60 };
+
+  return _parse_number_with_unit(s, "smhd", multipliers);
+}
+
+/* Parses a date on the form YYYY-MM-DD and returns its Julian day
+   number. */
+static gint64 _parse_date(const gchar *s)
+{
+  int day, month, year;
+  char trailing;
+  GDate *date;
+  gint64 julian_day;
+
+  if (sscanf(s, "%4d-%2d-%2d%c", &year, &month, &day, &trailing) != 3)
+    return -1;
+
+  if (!g_date_valid_dmy(day, month, year))
+    return -1;
+
+  date = g_date_new_dmy(day, month, year);
+  julian_day = g_date_get_julian(date);
+  g_date_free(date);
+
+  return julian_day;
+}
+
+/* Reads a key with a number that is parsed by 'parse'. Returns 0 if the
+   key is not set. An invalid value is reported and sets 'invalid'. */
+static gint64 _read_channel_configuration_number_key(
+    GKeyFile *kf, const gchar *identifier, const gchar *key,
+    gint64 (*parse)(const gchar *s), int *invalid)
+{
+  gchar *s;
+  gint64 n;
+
+  s = _read_channel_configuration_key(kf, identifier, key);
+
+  if (!s)
+    return 0;
+
+  n = parse(s);
+
+  if (n < 0) {
+    fprintf(stderr,
+            "Invalid value %s for key %s in configuration of channel %s.\n",
+            s, key, identifier);
+    *invalid = 1;
+    n = 0;
+  }
+
+  g_free(s);
+
+  return n;
+}
+
+/* Limits in the global configuration are upper bounds. A channel may set a
+   tighter limit but not relax it. Zero means that no limit is set. */
+static gint64 _merge_limit(gint64 limit, gint64 global_limit)
+{
+  if (global_limit && (!limit || limit > global_limit))
+    return global_limit;
+
+  return limit;
+}
+
 void channel_configuration_free(struct channel_configuration *c)
 {
   g_free(c->identifier);
@@ -56,6 +183,15 @@ void channel_configuration_free(struct channel_configuration *c)
   if (c->playlist)
     g_free(c->playlist);
 
+  if (c->playlist_format)
+    g_free(c->playlist_format);
+
+  if (c->hook)
+    g_free(c->hook);
+
+  if (c->download_order)
+    g_free(c->download_order);
+
   if (c->artist_tag)
     g_free(c->artist_tag);
 
@@ -77,6 +213,15 @@ void channel_configuration_free(struct channel_configuration *c)
   if (c->regex_filter)
     g_free(c->regex_filter);
 
+  if (c->regex_exclude)
+    g_free(c->regex_exclude);
+
+  if (c->type_filter)
+    g_free(c->type_filter);
+
+  if (c->title_filter)
+    g_free(c->title_filter);
+
   g_free(c);
 }
 
@@ -85,6 +230,7 @@ struct channel_configuration *channel_configuration_new(
     struct channel_configuration *defaults)
 {
   struct channel_configuration *c;
+  int invalid = 0;
 
   g_assert(g_key_file_has_group(kf, identifier));
 
@@ -100,6 +246,11 @@ struct channel_configuration *channel_configuration_new(
   c->filename_pattern =
       _read_channel_configuration_key(kf, identifier, "filename");
   c->playlist = _read_channel_configuration_key(kf, identifier, "playlist");
+  c->playlist_format =
+      _read_channel_configuration_key(kf, identifier, "playlist_format");
+  c->hook = _read_channel_configuration_key(kf, identifier, "hook");
+  c->download_order =
+      _read_channel_configuration_key(kf, identifier, "download_order");
   c->artist_tag = _read_channel_configuration_key(kf, identifier, "artist_tag");
   c->title_tag = _read_channel_configuration_key(kf, identifier, "title_tag");
   c->album_tag = _read_channel_configuration_key(kf, identifier, "album_tag");
@@ -108,6 +259,73 @@ struct channel_configuration *channel_configuration_new(
   c->comment_tag =
       _read_channel_configuration_key(kf, identifier, "comment_tag");
   c->regex_filter = _read_channel_configuration_key(kf, identifier, "filter");
+  c->regex_exclude = _read_channel_configuration_key(kf, identifier, "exclude");
+  c->type_filter =
+      _read_channel_configuration_key(kf, identifier, "type_filter");
+  c->title_filter =
+      _read_channel_configuration_key(kf, identifier, "title_filter");
+  c->min_size = _read_channel_configuration_number_key(
+      kf, identifier, "min_size", _parse_size, &invalid);
+  c->max_size = _read_channel_configuration_number_key(
+      kf, identifier, "max_size", _parse_size, &invalid);
+  c->newer_than = _read_channel_configuration_number_key(
+      kf, identifier, "newer_than", _parse_date, &invalid);
+  c->max_age = _read_channel_configuration_number_key(
+      kf, identifier, "max_age", _parse_duration, &invalid);
+  c->max_feed_size = _read_channel_configuration_number_key(
+      kf, identifier, "max_feed_size", _parse_size, &invalid);
+  c->max_items = _read_channel_configuration_number_key(
+      kf, identifier, "max_items", _parse_count, &invalid);
+  c->max_parse_time = _read_channel_configuration_number_key(
+      kf, identifier, "max_parse_time", _parse_duration, &invalid);
+  c->receive_buffer_size = _read_channel_configuration_number_key(
+      kf, identifier, "receive_buffer", _parse_size, &invalid);
+  c->write_buffer_size = _read_channel_configuration_number_key(
+      kf, identifier, "write_buffer", _parse_size, &invalid);
+  c->writeback_size = _read_channel_configuration_number_key(
+      kf, identifier, "writeback", _parse_size, &invalid);
+  c->spool_quota = _read_channel_configuration_number_key(
+      kf, identifier, "spool_quota", _parse_size, &invalid);
+  c->feed_connect_timeout = _read_channel_configuration_number_key(
+      kf, identifier, "feed_connect_timeout", _parse_duration, &invalid);
+  c->feed_first_byte_timeout = _read_channel_configuration_number_key(
+      kf, identifier, "feed_first_byte_timeout", _parse_duration, &invalid);
+  c->feed_low_speed_limit = _read_channel_configuration_number_key(
+      kf, identifier, "feed_low_speed_limit", _parse_size, &invalid);
+  c->feed_low_speed_time = _read_channel_configuration_number_key(
+      kf, identifier, "feed_low_speed_time", _parse_duration, &invalid);
+  c->feed_timeout = _read_channel_configuration_number_key(
+      kf, identifier, "feed_timeout", _parse_duration, &invalid);
+  c->enclosure_connect_timeout = _read_channel_configuration_number_key(
+      kf, identifier, "enclosure_connect_timeout", _parse_duration, &invalid);
+  c->enclosure_first_byte_timeout = _read_channel_configuration_number_key(
+      kf, identifier, "enclosure_first_byte_timeout", _parse_duration,
+      &invalid);
+  c->enclosure_low_speed_limit = _read_channel_configuration_number_key(
+      kf, identifier, "enclosure_low_speed_limit", _parse_size, &invalid);
+  c->enclosure_low_speed_time = _read_channel_configuration_number_key(
+      kf, identifier, "enclosure_low_speed_time", _parse_duration, &invalid);
+  c->enclosure_timeout = _read_channel_configuration_number_key(
+      kf, identifier, "enclosure_timeout", _parse_duration, &invalid);
+  c->keep_episodes = _read_channel_configuration_number_key(
+      kf, identifier, "keep_episodes", _parse_count, &invalid);
+  c->keep_age = _read_channel_configuration_number_key(
+      kf, identifier, "keep_age", _parse_duration, &invalid);
+  c->keep_size = _read_channel_configuration_number_key(
+      kf, identifier, "keep_size", _parse_size, &invalid);
+  c->interval = _read_channel_configuration_number_key(
+      kf, identifier, "interval", _parse_duration, &invalid);
+  c->download_budget = _read_channel_configuration_number_key(
+      kf, identifier, "download_budget", _parse_size, &invalid);
+  c->download_time = _read_channel_configuration_number_key(
+      kf, identifier, "download_time", _parse_duration, &invalid);
+
+  /* A value that cannot be parsed must not be taken to mean that there is
+     no limit. */
+  if (invalid) {
+    channel_configuration_free(c);
+    return NULL;
+  }
 
   /* Populate with defaults if necessary. */
   if (defaults) {
@@ -123,6 +341,12 @@ struct channel_configuration *channel_configuration_new(
     if (!c->playlist && defaults->playlist)
       c->playlist = g_strdup(defaults->playlist);
 
+    if (!c->playlist_format && defaults->playlist_format)
+      c->playlist_format = g_strdup(defaults->playlist_format);
+
+    if (!c->hook && defaults->hook)
+      c->hook = g_strdup(defaults->hook);
+
     if (!c->artist_tag && defaults->artist_tag)
       c->artist_tag = g_strdup(defaults->artist_tag);
 
@@ -143,6 +367,86 @@ struct channel_configuration *channel_configuration_new(
 
     if (!c->regex_filter && defaults->regex_filter)
       c->regex_filter = g_strdup(defaults->regex_filter);
+
+    if (!c->regex_exclude && defaults->regex_exclude)
+      c->regex_exclude = g_strdup(defaults->regex_exclude);
+
+    if (!c->type_filter && defaults->type_filter)
+      c->type_filter = g_strdup(defaults->type_filter);
+
+    if (!c->title_filter && defaults->title_filter)
+      c->title_filter = g_strdup(defaults->title_filter);
+
+    if (!c->min_size)
+      c->min_size = defaults->min_size;
+
+    if (!c->max_size)
+      c->max_size = defaults->max_size;
+
+    if (!c->newer_than)
+      c->newer_than = defaults->newer_than;
+
+    if (!c->max_age)
+      c->max_age = defaults->max_age;
+
+    c->max_feed_size = _merge_limit(c->max_feed_size, defaults->max_feed_size);
+    c->max_items = _merge_limit(c->max_items, defaults->max_items);
+    c->max_parse_time =
+        _merge_limit(c->max_parse_time, defaults->max_parse_time);
+
+    if (!c->receive_buffer_size)
+      c->receive_buffer_size = defaults->receive_buffer_size;
+
+    if (!c->write_buffer_size)
+      c->write_buffer_size = defaults->write_buffer_size;
+
+    if (!c->writeback_size)
+      c->writeback_size = defaults->writeback_size;
+
+    if (!c->spool_quota)
+      c->spool_quota = defaults->spool_quota;
+
+    if (!c->feed_connect_timeout)
+      c->feed_connect_timeout = defaults->feed_connect_timeout;
+
+    if (!c->feed_first_byte_timeout)
+      c->feed_first_byte_timeout = defaults->feed_first_byte_timeout;
+
+    if (!c->feed_low_speed_limit)
+      c->feed_low_speed_limit = defaults->feed_low_speed_limit;
+
+    if (!c->feed_low_speed_time)
+      c->feed_low_speed_time = defaults->feed_low_speed_time;
+
+    if (!c->feed_timeout)
+      c->feed_timeout = defaults->feed_timeout;
+
+    if (!c->enclosure_connect_timeout)
+      c->enclosure_connect_timeout = defaults->enclosure_connect_timeout;
+
+    if (!c->enclosure_first_byte_timeout)
+      c->enclosure_first_byte_timeout = defaults->enclosure_first_byte_timeout;
+
+    if (!c->enclosure_low_speed_limit)
+      c->enclosure_low_speed_limit = defaults->enclosure_low_speed_limit;
+
+    if (!c->enclosure_low_speed_time)
+      c->enclosure_low_speed_time = defaults->enclosure_low_speed_time;
+
+    if (!c->enclosure_timeout)
+      c->enclosure_timeout = defaults->enclosure_timeout;
+
+    if (!c->keep_episodes)
+      c->keep_episodes = defaults->keep_episodes;
+
+    if (!c->keep_age)
+      c->keep_age = defaults->keep_age;
+
+    if (!c->keep_size)
+      c->keep_size = defaults->keep_size;
+
+    if (!c->interval)
+      c->interval = defaults->interval;
   }
 
   return c;
@@ -163,7 +467,16 @@ int channel_configuration_verify_keys(GKeyFile *kf, const char *identifier)
   }
 
   for (i = 0; key_list[i]; i++) {
-    if (!strcmp(key_list[i], "id3contentgroup"))
+    if ((!strcmp(key_list[i], "download_order") ||
+         !strcmp(key_list[i], "download_budget") ||
+         !strcmp(key_list[i], "download_time")) &&
+        strcmp(identifier, "*")) {
+      fprintf(stderr,
+              "Key %s in configuration of channel %s is only valid in the "
+              "global configuration.\n",
+              key_list[i], identifier);
+      return -1;
+    } else if (!strcmp(key_list[i], "id3contentgroup"))
       fprintf(stderr, "Key id3contentgroup no longer supported.\n");
     else if (!strcmp(key_list[i], "id3leadartist"))
       fprintf(stderr,
@@ -192,13 +505,46 @@ int channel_configuration_verify_keys(GKeyFile *kf, const char *identifier)
     else if (!(!strcmp(key_list[i], "url") || !strcmp(key_list[i], "spool") ||
                !strcmp(key_list[i], "filename") ||
                !strcmp(key_list[i], "playlist") ||
+               !strcmp(key_list[i], "playlist_format") ||
+               !strcmp(key_list[i], "hook") ||
                !strcmp(key_list[i], "artist_tag") ||
                !strcmp(key_list[i], "title_tag") ||
                !strcmp(key_list[i], "album_tag") ||
                !strcmp(key_list[i], "genre_tag") ||
                !strcmp(key_list[i], "year_tag") ||
                !strcmp(key_list[i], "comment_tag") ||
-               !strcmp(key_list[i], "filter"))) {
+               !strcmp(key_list[i], "filter") ||
+               !strcmp(key_list[i], "exclude") ||
+               !strcmp(key_list[i], "type_filter") ||
+               !strcmp(key_list[i], "title_filter") ||
+               !strcmp(key_list[i], "min_size") ||
+               !strcmp(key_list[i], "max_size") ||
+               !strcmp(key_list[i], "newer_than") ||
+               !strcmp(key_list[i], "max_age") ||
+               !strcmp(key_list[i], "max_feed_size") ||
+               !strcmp(key_list[i], "max_items") ||
+               !strcmp(key_list[i], "max_parse_time") ||
+               !strcmp(key_list[i], "receive_buffer") ||
+               !strcmp(key_list[i], "write_buffer") ||
+               !strcmp(key_list[i], "writeback") ||
+               !strcmp(key_list[i], "spool_quota") ||
+               !strcmp(key_list[i], "feed_connect_timeout") ||
+               !strcmp(key_list[i], "feed_first_byte_timeout") ||
+               !strcmp(key_list[i], "feed_low_speed_limit") ||
+               !strcmp(key_list[i], "feed_low_speed_time") ||
+               !strcmp(key_list[i], "feed_timeout") ||
+               !strcmp(key_list[i], "enclosure_connect_timeout") ||
+               !strcmp(key_list[i], "enclosure_first_byte_timeout") ||
+               !strcmp(key_list[i], "enclosure_low_speed_limit") ||
+               !strcmp(key_list[i], "enclosure_low_speed_time") ||
+               !strcmp(key_list[i], "enclosure_timeout") ||
+               !strcmp(key_list[i], "keep_episodes") ||
+               !strcmp(key_list[i], "keep_age") ||
+               !strcmp(key_list[i], "keep_size") ||
+               !strcmp(key_list[i], "interval") ||
+               !strcmp(key_list[i], "download_order") ||
+               !strcmp(key_list[i], "download_budget") ||
+               !strcmp(key_list[i], "download_time"))) {
       fprintf(stderr, "Invalid key %s in configuration of channel %s.\n",
               key_list[i], identifier);
       return -1;
@@ -28,6 +28,9 @@ struct channel_configuration {
   gchar *spool_directory;
   gchar *filename_pattern;
   gchar *playlist;
+  gchar *playlist_format;
+  gchar *hook;
+  gchar *download_order;
   gchar *artist_tag;
   gchar *title_tag;
   gchar *album_tag;
@@ -35,6 +38,36 @@ struct channel_configuration {
   gchar *year_tag;
   gchar *comment_tag;
   gchar *regex_filter;
+  gchar *regex_exclude;
+  gchar *type_filter;
+  gchar *title_filter;
+  gint64 min_size;
+  gint64 max_size;
+  gint64 newer_than;
+  gint64 max_age;
+  gint64 max_feed_size;
+  gint64 max_items;
+  gint64 max_parse_time;
+  gint64 receive_buffer_size;
+  gint64 write_buffer_size;
+  gint64 writeback_size;
+  gint64 spool_quota;
+  gint64 feed_connect_timeout;
+  gint64 feed_first_byte_timeout;
+  gint64 feed_low_speed_limit;
+  gint64 feed_low_speed_time;
+  gint64 feed_timeout;
+  gint64 enclosure_connect_timeout;
+  gint64 enclosure_first_byte_timeout;
+  gint64 enclosure_low_speed_limit;
+  gint64 enclosure_low_speed_time;
+  gint64 enclosure_timeout;
+  gint64 keep_episodes;
+  gint64 keep_age;
+  gint64 keep_size;
+  gint64 interval;
+  gint64 download_budget;
+  gint64 download_time;
 };
 
 struct channel_configuration *channel_configuration_new(
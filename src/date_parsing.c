@@ -25,7 +25,6 @@
 #include "date_parsing.h"
 
 #include <ctype.h>
-#include <stdio.h>
 #include <string.h>
 
 static const char *days[7] = {
@@ -35,18 +34,95 @@ static const char *days[7] = {
 static const char *months[12] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun",
                                   "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
 
-GDate *parse_rfc822_date(const char *rfc822_date_str)
+static const struct {
+  const char *name;
+  int offset; /* hours east of UTC */
+} zones[] = { { "UT", 0 },   { "UTC", 0 },  { "GMT", 0 },  { "Z", 0 },
+              { "EST", -5 }, { "EDT", -4 }, { "CST", -6 }, { "CDT", -5 },
+              { "MST", -7 }, { "MDT", -6 }, { "PST", -8 }, { "PDT", -7 } };
+
+static const char *_skip_space(const char *s)
+{
+  while (isspace(*s))
+    s++;
+
+  return s;
+}
+
+/* Parses a run of at most 'max_digits' digits. Returns NULL if there are no
+   digits. */
+static const char *_parse_int(const char *s, int max_digits, int *n)
+{
+  int i;
+
+  if (!isdigit(*s))
+    return NULL;
+
+  for (*n = 0, i = 0; i < max_digits && isdigit(*s); i++, s++)
+    *n = *n * 10 + (*s - '0');
+
+  return s;
+}
+
+/* Parses the optional time-of-day and zone that follow the date. Missing or
+   unrecognised parts are left at zero. */
+static void _parse_time_of_day(const char *s, rfc822_time *t)
+{
+  const char *p;
+  int i, n, sign;
+
+  s = _skip_space(s);
+
+  if (!(p = _parse_int(s, 2, &t->hour)) || *p != ':' ||
+      !(p = _parse_int(p + 1, 2, &t->minute))) {
+    t->hour = t->minute = 0;
+    return;
+  }
+
+  if (*p == ':' && (s = _parse_int(p + 1, 2, &n))) {
+    t->second = n;
+    p = s;
+  }
+
+  if (t->hour > 23 || t->minute > 59 || t->second > 60) {
+    t->hour = t->minute = t->second = 0;
+    return;
+  }
+
+  p = _skip_space(p);
+
+  if (*p == '+' || *p == '-') {
+    sign = (*p == '-') ? -1 : 1;
+
+    if (_parse_int(p + 1, 4, &n))
+      t->utc_offset = sign * ((n / 100) * 3600 + (n % 100) * 60);
+  } else {
+    for (i = 0; i < sizeof(zones) / sizeof(zones[0]); i++) {
+      size_t len = strlen(zones[i].name);
+
+      if (!strncmp(p, zones[i].name, len) && !isalpha(p[len])) {
+        t->utc_offset = zones[i].offset * 3600;
+        break;
+      }
+    }
+  }
+}
+
+/* Parses an RFC 822 date such as 'Thu, 01 Oct 2015 09:53:38 GMT'. The day
+   of the week, the time of day and the zone are optional. Returns FALSE if
+   the string does not start with a valid date. */
+gboolean parse_rfc822_time(const char *rfc822_date_str, rfc822_time *t)
 {
   const char *dstr = rfc822_date_str;
-  int i = 0;
-  int day, month, year;
-  char mstr[20];
+  int i;
+  int day, year;
 
-  while (isspace(*dstr))
-    dstr++;
+  memset(t, 0, sizeof(*t));
+
+  dstr = _skip_space(dstr);
 
   if (*dstr == '\0')
-    return NULL;
+    return FALSE;
 
   /* Skip past any valid day, field */
   for (i = 0; i < sizeof(days) / sizeof(days[0]); i++) {
@@ -55,37 +131,34 @@ GDate *parse_rfc822_date(const char *rfc822_date_str)
   }
 
   if (i < sizeof(days) / sizeof(days[0])) {
-    dstr += 3;
-
-    while (isspace(*dstr))
-      dstr++;
-
-    if (*dstr == '\0')
-      return NULL;
+    dstr = _skip_space(dstr + 3);
 
     if (*dstr == ',')
       dstr++;
 
-    while (isspace(*dstr))
-      dstr++;
-
-    if (*dstr == '\0')
-      return NULL;
+    dstr = _skip_space(dstr);
   }
 
   /* Decode day, month, year */
-  if (sscanf(dstr, "%d %s %d", &day, mstr, &year) != 3)
-    return NULL;
+  if (!(dstr = _parse_int(dstr, 2, &day)))
+    return FALSE;
+
+  dstr = _skip_space(dstr);
 
   for (i = 0; i < sizeof(months) / sizeof(months[0]); i++) {
-    if (strncmp(mstr, months[i], 3) == 0)
+    if (strncmp(dstr, months[i], 3) == 0)
       break;
   }
 
   if (i == sizeof(months) / sizeof(months[0]))
-    return NULL;
+    return FALSE;
+
+  /* Allow the month name to be spelled out in full. */
+  while (isalpha(*dstr))
+    dstr++;
 
-  month = i + 1;
+  if (!(dstr = _parse_int(_skip_space(dstr), 4, &year)))
+    return FALSE;
 
   if (year < 1900) {
     if (year < 50)
@@ -94,8 +167,39 @@ GDate *parse_rfc822_date(const char *rfc822_date_str)
       year += 1900;
   }
 
-  if (!g_date_valid_dmy(day, month, year))
+  if (!g_date_valid_dmy(day, i + 1, year))
+    return FALSE;
+
+  t->day = day;
+  t->month = i + 1;
+  t->year = year;
+
+  _parse_time_of_day(dstr, t);
+
+  return TRUE;
+}
+
+GDate *parse_rfc822_date(const char *rfc822_date_str)
+{
+  rfc822_time t;
+
+  if (!parse_rfc822_time(rfc822_date_str, &t))
     return NULL;
 
-  return g_date_new_dmy(day, month, year);
+  return g_date_new_dmy(t.day, t.month, t.year);
+}
+
+/* Converts a parsed date to seconds since the Unix epoch. */
+gint64 rfc822_time_to_unix(const rfc822_time *t)
+{
+  GDate date;
+  GDate epoch;
+
+  g_date_clear(&date, 1);
+  g_date_set_dmy(&date, t->day, t->month, t->year);
+  g_date_clear(&epoch, 1);
+  g_date_set_dmy(&epoch, 1, 1, 1970);
+
+  return (gint64)g_date_days_between(&epoch, &date) * 24 * 60 * 60 +
+         t->hour * 60 * 60 + t->minute * 60 + t->second - t->utc_offset;
 }
@@ -23,6 +23,18 @@
 
 #include <glib.h>
 
+typedef struct _rfc822_time {
+  GDateYear year;
+  GDateMonth month;
+  GDateDay day;
+  int hour;
+  int minute;
+  int second;
+  int utc_offset; /* seconds east of UTC */
+} rfc822_time;
+
 GDate *parse_rfc822_date(const char *rfc822_date_str);
+gboolean parse_rfc822_time(const char *rfc822_date_str, rfc822_time *t);
+gint64 rfc822_time_to_unix(const rfc822_time *t);
 
 #endif /* DATE_PARSING_H */
@@ -22,12 +22,21 @@
 #include "config.h"
 #endif /* HAVE_CONFIG_H */
 
-#include "date_parsing.h"
 #include "filenames.h"
 #include "patterns.h"
 
+#include <limits.h>
+#include <string.h>
+
+#ifndef NAME_MAX
+#define NAME_MAX 255
+#endif /* NAME_MAX */
+
+/* Longest extension, including the dot, that is preserved when a filename
+   is truncated. Anything longer is unlikely to be a real extension. */
+#define MAX_EXTENSION_LENGTH 16
+
 static gchar *guess_filename_from_url(const gchar *url);
-static gchar *sanitise_filename(const gchar *filename);
 
 /* Determine filename of enclosure. */
 /* Chop off ? and # and anything following that from the basename. */
@@ -43,15 +52,157 @@ static gchar *guess_filename_from_url(const gchar *url)
   return guess;
 }
 
-/* Removes unsafe and undesirable characters from a filename. The caller
-   must free the returned string with g_free(). */
-static gchar *sanitise_filename(const gchar *filename)
+/* Characters that are unsafe or undesirable in filenames. */
+static const gboolean bad_characters[128] = {
+  ['/'] = TRUE,  ['\\'] = TRUE, ['?'] = TRUE, ['%'] = TRUE,  ['*'] = TRUE,
+  [':'] = TRUE,  ['|'] = TRUE,  ['"'] = TRUE, ['<'] = TRUE,  ['>'] = TRUE,
+  [','] = TRUE,  ['\''] = TRUE, ['\n'] = TRUE, ['\t'] = TRUE, ['\r'] = TRUE
+};
+
+/* Returns the length of a valid UTF-8 sequence starting at 's' or zero if
+   the sequence is invalid. 'n' is the number of bytes available. */
+static gsize _utf8_sequence_length(const gchar *s, gsize n)
+{
+  gunichar c = g_utf8_get_char_validated(s, n);
+
+  if (c == (gunichar)-1 || c == (gunichar)-2)
+    return 0;
+
+  return g_utf8_skip[*(const guchar *)s];
+}
+
+/* Returns the largest length no greater than 'length' that does not split a
+   UTF-8 sequence in 's'. */
+static gsize _utf8_truncate(const gchar *s, gsize length)
+{
+  while (length > 0 && (((const guchar *)s)[length] & 0xc0) == 0x80)
+    length--;
+
+  return length;
+}
+
+/* Returns the offset of the extension in a filename, or 'length' if the
+   filename has no extension that is worth preserving. */
+static gsize _extension_offset(const gchar *filename, gsize length)
+{
+  const gchar *dot = strrchr(filename, '.');
+
+  if (!dot || dot == filename ||
+      length - (dot - filename) > MAX_EXTENSION_LENGTH)
+    return length;
+
+  return dot - filename;
+}
+
+/* Shortens a filename in place to at most 'max_length' bytes by truncating
+   the part before the extension. Returns the new length. */
+static gsize _truncate_filename(gchar *filename, gsize length, gsize max_length)
+{
+  gsize extension = _extension_offset(filename, length);
+  gsize extension_length = length - extension;
+  gsize stem_length;
+
+  if (length <= max_length)
+    return length;
+
+  if (extension_length >= max_length)
+    extension_length = 0;
+
+  stem_length = _utf8_truncate(filename, max_length - extension_length);
+  memmove(filename + stem_length, filename + length - extension_length,
+          extension_length);
+  filename[stem_length + extension_length] = '\0';
+
+  return stem_length + extension_length;
+}
+
+/* Removes unsafe and undesirable characters and invalid UTF-8 from a
+   filename in place and truncates it to at most NAME_MAX bytes. The names
+   "." and ".." are replaced by the empty string. Returns the new length of
+   the filename. */
+gsize sanitise_filename(gchar *filename)
 {
-  static const gchar *bad_characters = "/\\?%*:|\"<>,'\n\t\r";
-  gchar **parts = g_strsplit_set(filename, bad_characters, -1);
-  gchar *new_filename = g_strjoinv(NULL, parts);
-  g_strfreev(parts);
-  return new_filename;
+  const gchar *r = filename;
+  gchar *w = filename;
+  gsize n = strlen(filename);
+  gsize length;
+
+  while (*r) {
+    if (!(*r & 0x80)) {
+      if (!bad_characters[(guchar)*r])
+        *w++ = *r;
+      r++;
+    } else {
+      length = _utf8_sequence_length(r, filename + n - r);
+
+      if (length == 0)
+        r++;
+      else
+        while (length--)
+          *w++ = *r++;
+    }
+  }
+
+  *w = '\0';
+  length = w - filename;
+
+  if (strcmp(filename, ".") == 0 || strcmp(filename, "..") == 0) {
+    filename[0] = '\0';
+    return 0;
+  }
+
+  return _truncate_filename(filename, length, NAME_MAX);
+}
+
+/* Builds a variant of a filename with a suffix " (N)" before the
+   extension, shortening the filename if necessary to keep it within
+   NAME_MAX bytes. The caller must free the returned string with g_free(). */
+gchar *build_numbered_filename(const gchar *filename, int number)
+{
+  gsize length = strlen(filename);
+  gsize extension = _extension_offset(filename, length);
+  gsize extension_length = length - extension;
+  gsize stem_length = extension;
+  gchar suffix[16];
+  gsize suffix_length;
+  GString *buffer;
+
+  suffix_length = g_snprintf(suffix, sizeof(suffix), " (%d)", number);
+
+  /* Make room for the suffix if necessary. */
+  if (stem_length + suffix_length + extension_length > NAME_MAX)
+    stem_length = _utf8_truncate(filename,
+                                 NAME_MAX - suffix_length - extension_length);
+
+  buffer = g_string_sized_new(stem_length + suffix_length + extension_length);
+  g_string_append_len(buffer, filename, stem_length);
+  g_string_append(buffer, suffix);
+  g_string_append(buffer, filename + extension);
+
+  return g_string_free(buffer, FALSE);
+}
+
+/* Builds the filename of an enclosure from a compiled filename pattern
+   and stores it in 'buffer', replacing its previous contents, so that the
+   buffer can be reused across enclosures. If 'program' is NULL, the
+   filename is guessed from the enclosure URL. */
+void build_enclosure_basename(const pattern_program *program, GString *buffer,
+                              const channel_info *channel_info,
+                              const rss_item *item)
+{
+  gchar *filename;
+
+  g_string_truncate(buffer, 0);
+
+  if (program)
+    pattern_program_expand(program, buffer, channel_info, item);
+  else {
+    filename = guess_filename_from_url(item->enclosure->url);
+    g_string_append(buffer, filename);
+    g_free(filename);
+  }
+
+  g_string_truncate(buffer, sanitise_filename(buffer->str));
 }
 
 gchar *build_enclosure_filename(const char *spool_directory,
@@ -59,21 +210,19 @@ gchar *build_enclosure_filename(const char *spool_directory,
                                 const channel_info *channel_info,
                                 const rss_item *item)
 {
-  gchar *filename;
-  gchar *sanitised_filename;
+  pattern_program *program;
+  GString *buffer;
   gchar *pathname;
 
-  if (filename_pattern)
-    filename =
-        expand_string_with_patterns(filename_pattern, channel_info, item);
-  else
-    filename = guess_filename_from_url(item->enclosure->url);
+  program = filename_pattern ? pattern_program_new(filename_pattern) : NULL;
+  buffer = g_string_new(NULL);
 
-  sanitised_filename = sanitise_filename(filename);
-  g_free(filename);
+  build_enclosure_basename(program, buffer, channel_info, item);
+  pathname = g_build_filename(spool_directory, buffer->str, NULL);
 
-  pathname = g_build_filename(spool_directory, sanitised_filename, NULL);
-  g_free(sanitised_filename);
+  g_string_free(buffer, TRUE);
+  if (program)
+    pattern_program_free(program);
 
   return pathname;
 }
@@ -21,11 +21,17 @@
 #ifndef FILENAME_PATTERN_H
 #define FILENAME_PATTERN_H
 
+#include "patterns.h"
 #include "rss.h"
 
+gsize sanitise_filename(gchar *filename);
+gchar *build_numbered_filename(const gchar *filename, int number);
 gchar *build_enclosure_filename(const char *spool_directory,
                                 const char *filename_pattern,
                                 const channel_info *channel_info,
                                 const rss_item *item);
+void build_enclosure_basename(const pattern_program *program, GString *buffer,
+                              const channel_info *channel_info,
+                              const rss_item *item);
 
 #endif /* FILENAME_PATTERN_H */
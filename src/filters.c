@@ -0,0 +1,303 @@
+/*
+  Copyright (C) 2005-2020 Marius L. Jøhndal
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include "date_parsing.h"
+#include "filters.h"
+
+#include <stdio.h>
+#include <time.h>
+
+/* Appends the alternation of all patterns in 'patterns' to 's'. Each pattern
+   is wrapped in a non-capturing group so that alternatives in one pattern
+   do not leak into the next. The patterns must have been checked with
+   _check_patterns(). */
+static void _append_alternation(GString *s, const gchar *const *patterns)
+{
+  int i;
+
+  for (i = 0; patterns[i]; i++) {
+    if (i > 0)
+      g_string_append_c(s, '|');
+
+    /* A \Q without a matching \E would otherwise quote the rest of the
+       expression. An \E on its own is ignored. */
+    g_string_append(s, "(?:");
+    g_string_append(s, patterns[i]);
+    g_string_append(s, "\\E)");
+  }
+}
+
+/* Combines include and exclude patterns into a single regular expression
+   that matches a string if it matches at least one include pattern (or
+   there are none) and no exclude pattern. Exclude patterns become a negative
+   lookahead anchored at the start of the string so that the whole
+   expression can be evaluated in one pass. */
+static gchar *_combine_patterns(const gchar *const *include,
+                                const gchar *const *exclude)
+{
+  GString *s = g_string_new(NULL);
+
+  if (exclude && exclude[0]) {
+    g_string_append(s, "^(?!(?s:.*?)(?:");
+    _append_alternation(s, exclude);
+    g_string_append(s, "))");
+
+    if (include && include[0]) {
+      g_string_append(s, "(?s:.*?)(?:");
+      _append_alternation(s, include);
+      g_string_append_c(s, ')');
+    }
+  } else if (include && include[0])
+    _append_alternation(s, include);
+
+  return g_string_free(s, FALSE);
+}
+
+/* Checks that each pattern is valid on its own. Patterns with
+   backreferences are rejected since capturing groups are numbered across
+   the combined expression, where a backreference would refer to the wrong
+   group. */
+static gboolean _check_patterns(const gchar *const *patterns,
+                                GRegexCompileFlags compile_options)
+{
+  GError *error = NULL;
+  GRegex *regex;
+  gboolean valid = TRUE;
+  int i;
+
+  for (i = 0; patterns && patterns[i]; i++) {
+    regex = g_regex_new(patterns[i], compile_options, 0, &error);
+
+    if (error) {
+      fprintf(stderr, "Error compiling regular expression %s: %s\n",
+              patterns[i], error->message);
+      g_clear_error(&error);
+      valid = FALSE;
+      continue;
+    }
+
+    if (g_regex_get_max_backref(regex) > 0) {
+      fprintf(stderr,
+              "Error compiling regular expression %s: backreferences are "
+              "not supported in filters.\n",
+              patterns[i]);
+      valid = FALSE;
+    }
+
+    g_regex_unref(regex);
+  }
+
+  return valid;
+}
+
+/* Creates a filter that matches the URLs of enclosures against regular
+   expressions. An enclosure passes the filter if its URL matches at least
+   one of the patterns in 'include' and none of the patterns in 'exclude'.
+   Either may be NULL. Letters in the patterns match both upper and lower
+   case letters if 'caseless' is TRUE. Returns NULL if a pattern is
+   invalid. */
+enclosure_filter *enclosure_filter_new(const gchar *const *include,
+                                       const gchar *const *exclude,
+                                       gboolean caseless)
+{
+  GError *error = NULL;
+  GRegexCompileFlags compile_options = G_REGEX_OPTIMIZE;
+  enclosure_filter *e;
+  gchar *pattern;
+  GRegex *regex;
+
+  if (caseless)
+    compile_options |= G_REGEX_CASELESS;
+
+  if (!_check_patterns(include, compile_options) ||
+      !_check_patterns(exclude, compile_options))
+    return NULL;
+
+  pattern = _combine_patterns(include, exclude);
+
+  regex = g_regex_new(pattern, compile_options, 0, &error);
+
+  if (error) {
+    /* Patterns can still clash with each other, for example by using the
+       same group name. */
+    fprintf(stderr, "Error combining regular expressions: %s\n",
+            error->message);
+    g_error_free(error);
+    g_free(pattern);
+    return NULL;
+  }
+
+  g_free(pattern);
+
+  e = g_malloc(sizeof(struct _enclosure_filter));
+  e->regex = regex;
+  e->type_regex = NULL;
+  e->title_regex = NULL;
+  e->min_size = 0;
+  e->max_size = 0;
+  e->min_julian_day = 0;
+  e->max_age = 0;
+
+  return e;
+}
+
+void enclosure_filter_free(enclosure_filter *e)
+{
+  g_regex_unref(e->regex);
+
+  if (e->type_regex)
+    g_regex_unref(e->type_regex);
+
+  if (e->title_regex)
+    g_regex_unref(e->title_regex);
+
+  g_free(e);
+}
+
+static GRegex *_compile_caseless(const gchar *pattern)
+{
+  GError *error = NULL;
+  GRegex *regex;
+
+  regex = g_regex_new(pattern, G_REGEX_OPTIMIZE | G_REGEX_CASELESS, 0, &error);
+
+  if (error) {
+    fprintf(stderr, "Error compiling regular expression %s: %s\n", pattern,
+            error->message);
+    g_error_free(error);
+    return NULL;
+  }
+
+  return regex;
+}
+
+/* Restricts the filter to enclosures whose MIME type matches 'pattern'.
+   Matching is case-insensitive. Returns FALSE if the pattern is invalid. */
+gboolean enclosure_filter_set_type_pattern(enclosure_filter *e,
+                                           const gchar *pattern)
+{
+  if (e->type_regex)
+    g_regex_unref(e->type_regex);
+
+  e->type_regex = _compile_caseless(pattern);
+
+  return e->type_regex != NULL;
+}
+
+/* Restricts the filter to items whose title matches 'pattern'. Matching is
+   case-insensitive. Returns FALSE if the pattern is invalid. */
+gboolean enclosure_filter_set_title_pattern(enclosure_filter *e,
+                                            const gchar *pattern)
+{
+  if (e->title_regex)
+    g_regex_unref(e->title_regex);
+
+  e->title_regex = _compile_caseless(pattern);
+
+  return e->title_regex != NULL;
+}
+
+/* Restricts the filter to enclosures whose advertised length is at least
+   'min_size' and at most 'max_size' bytes. Zero means no bound. */
+void enclosure_filter_set_size_range(enclosure_filter *e, gint64 min_size,
+                                     gint64 max_size)
+{
+  e->min_size = min_size;
+  e->max_size = max_size;
+}
+
+/* Restricts the filter to items published after the day
+   'newer_than_julian_day' and no more than 'max_age' seconds ago. The age
+   is worked out when an item is matched, so that the cutoff moves along
+   in a long-running process. Zero means no bound. */
+void enclosure_filter_set_date_range(enclosure_filter *e,
+                                     guint32 newer_than_julian_day,
+                                     gint64 max_age)
+{
+  e->min_julian_day = 0;
+
+  if (newer_than_julian_day)
+    e->min_julian_day = newer_than_julian_day + 1;
+
+  e->max_age = max_age;
+}
+
+static gboolean _date_match(const enclosure_filter *filter,
+                            const rss_item *item)
+{
+  GDate date;
+
+  if (!item->pub_time)
+    return TRUE;
+
+  if (filter->max_age && rfc822_time_to_unix(item->pub_time) <
+                             (gint64)time(NULL) - filter->max_age)
+    return FALSE;
+
+  if (!filter->min_julian_day)
+    return TRUE;
+
+  g_date_clear(&date, 1);
+  g_date_set_dmy(&date, item->pub_time->day, item->pub_time->month,
+                 item->pub_time->year);
+
+  return g_date_get_julian(&date) >= filter->min_julian_day;
+}
+
+/* Returns TRUE if the item's enclosure passes the filter, FALSE otherwise.
+   Predicates that depend on information the feed does not supply, such as
+   the length or MIME type of the enclosure, do not exclude the item. */
+gboolean enclosure_filter_match(const enclosure_filter *filter,
+                                const rss_item *item)
+{
+  const enclosure *enclosure;
+
+  g_assert(filter);
+  g_assert(item);
+  g_assert(item->enclosure);
+
+  enclosure = item->enclosure;
+
+  if (!enclosure->url)
+    return FALSE;
+
+  if (filter->min_size && enclosure->length > 0 &&
+      enclosure->length < filter->min_size)
+    return FALSE;
+
+  if (filter->max_size && enclosure->length > filter->max_size)
+    return FALSE;
+
+  if (filter->type_regex && enclosure->type &&
+      !g_regex_match(filter->type_regex, enclosure->type, 0, NULL))
+    return FALSE;
+
+  if (filter->title_regex && item->title &&
+      !g_regex_match(filter->title_regex, item->title, 0, NULL))
+    return FALSE;
+
+  if (!_date_match(filter, item))
+    return FALSE;
+
+  return g_regex_match(filter->regex, enclosure->url, 0, NULL);
+}
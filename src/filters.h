@@ -0,0 +1,51 @@
+/*
+  Copyright (C) 2005-2020 Marius L. Jøhndal
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+
+#ifndef FILTERS_H
+#define FILTERS_H
+
+#include "rss.h"
+
+struct _enclosure_filter {
+  GRegex *regex;
+  GRegex *type_regex;
+  GRegex *title_regex;
+  gint64 min_size;
+  gint64 max_size;
+  guint32 min_julian_day;
+  gint64 max_age; /* seconds */
+};
+
+enclosure_filter *enclosure_filter_new(const gchar *const *include,
+                                       const gchar *const *exclude,
+                                       gboolean caseless);
+void enclosure_filter_free(enclosure_filter *e);
+gboolean enclosure_filter_set_type_pattern(enclosure_filter *e,
+                                           const gchar *pattern);
+gboolean enclosure_filter_set_title_pattern(enclosure_filter *e,
+                                            const gchar *pattern);
+void enclosure_filter_set_size_range(enclosure_filter *e, gint64 min_size,
+                                     gint64 max_size);
+void enclosure_filter_set_date_range(enclosure_filter *e,
+                                     guint32 newer_than_julian_day,
+                                     gint64 max_age);
+gboolean enclosure_filter_match(const enclosure_filter *filter,
+                                const rss_item *item);
+
+#endif /* FILTERS_H */
@@ -102,7 +102,7 @@ const xmlNode *libxmlutil_child_node_by_name(const xmlNode *node,
 {
   for (node = node->children; node; node = node->next)
     if (node->type == XML_ELEMENT_NODE && !strcmp((char *)node->name, name) &&
-        (!ns || !strcmp((char *)node->ns->href, ns)))
+        (!ns || (node->ns && !strcmp((char *)node->ns->href, ns))))
       return node;
 
   return NULL;
@@ -0,0 +1,344 @@
+/*
+  Copyright (C) 2005-2020 Marius L. Jøhndal
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include "metrics.h"
+#include "utils.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/* Metrics on the channels updated by castget in the text format of
+   Prometheus. Counters and histograms add up every update run. Counts are
+   collected here until they are saved to the totals kept in the schedule,
+   so that they carry over from one run of castget to the next. */
+struct _metrics {
+  urlget_stats feed;       /* counts not saved to the totals yet */
+  urlget_stats enclosures;
+  gint64 downloads;
+  gint64 runs;
+  gint64 last_run;          /* start of the last run in microseconds */
+  gint64 last_run_duration; /* in microseconds */
+  guint left;               /* enclosures left by the last run */
+  GHashTable *channels;     /* identifier -> struct _channel_metrics */
+};
+
+struct _channel_metrics {
+  gint64 pending;      /* new items not downloaded at the last update */
+  gint64 last_success; /* seconds since the epoch, or 0 */
+};
+
+metrics *metrics_new(void)
+{
+  metrics *m = g_malloc0(sizeof(struct _metrics));
+
+  m->channels = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+
+  return m;
+}
+
+void metrics_free(metrics *m)
+{
+  g_hash_table_destroy(m->channels);
+  g_free(m);
+}
+
+static struct _channel_metrics *_get_channel(metrics *m,
+                                             const gchar *identifier)
+{
+  struct _channel_metrics *cm = g_hash_table_lookup(m->channels, identifier);
+
+  if (!cm) {
+    cm = g_malloc0(sizeof(struct _channel_metrics));
+    g_hash_table_insert(m->channels, g_strdup(identifier), cm);
+  }
+
+  return cm;
+}
+
+/* Records the time the feed of a channel was last retrieved in seconds
+   since the epoch. Channels that are not updated by a run keep the time
+   they were given. */
+void metrics_set_last_success(metrics *m, const gchar *identifier, gint64 t)
+{
+  _get_channel(m, identifier)->last_success = t;
+}
+
+/* Adds the measurements from the last update of a channel. */
+void metrics_add_channel(metrics *m, const gchar *identifier,
+                         const channel *c)
+{
+  const channel_stats *stats = &c->stats;
+  struct _channel_metrics *cm = _get_channel(m, identifier);
+
+  urlget_stats_add(&m->feed, &stats->feed);
+  urlget_stats_add(&m->enclosures, &stats->enclosures);
+  m->downloads += stats->downloads;
+
+  cm->pending =
+      MAX(stats->items_new - stats->items_filtered - stats->downloads, 0);
+}
+
+/* Records a completed run that started at 'started' and took 'duration'
+   microseconds. */
+void metrics_add_run(metrics *m, gint64 started, gint64 duration, guint left)
+{
+  m->runs++;
+  m->last_run = started;
+  m->last_run_duration = duration;
+  m->left = left;
+}
+
+static void _add_count(schedule *s, gboolean save, const gchar *prefix,
+                       const gchar *name, gint64 *counts, gsize n)
+{
+  gchar *key = g_strconcat(prefix, name, NULL);
+  gint64 *totals;
+  gsize i;
+
+  if (save) {
+    schedule_add_counts(s, key, counts, n);
+  } else {
+    totals = g_new(gint64, n);
+    schedule_get_counts(s, key, totals, n);
+
+    for (i = 0; i < n; i++)
+      counts[i] += totals[i];
+
+    g_free(totals);
+  }
+
+  g_free(key);
+}
+
+static void _add_stats(schedule *s, gboolean save, const gchar *prefix,
+                       urlget_stats *stats)
+{
+  _add_count(s, save, prefix, "transfers", &stats->transfers, 1);
+  _add_count(s, save, prefix, "failures", stats->failures,
+             URLGET_NUM_ERROR_CLASSES);
+  _add_count(s, save, prefix, "durations", stats->durations,
+             URLGET_DURATION_BUCKETS);
+  _add_count(s, save, prefix, "bytes", &stats->bytes, 1);
+  _add_count(s, save, prefix, "total_time", &stats->total_time, 1);
+}
+
+/* Adds the counts in 'm' to the totals in 's' if 'save' is set, and the
+   totals in 's' to the counts in 'm' otherwise. */
+static void _add_totals(metrics *m, schedule *s, gboolean save)
+{
+  _add_stats(s, save, "feed_", &m->feed);
+  _add_stats(s, save, "download_", &m->enclosures);
+  _add_count(s, save, "", "downloads", &m->downloads, 1);
+  _add_count(s, save, "", "runs", &m->runs, 1);
+}
+
+/* Moves the counts collected since the last call to the totals kept in
+   's'. They are written to its file, added to those of any other process,
+   by the next call to schedule_save(). */
+void metrics_save_totals(metrics *m, schedule *s)
+{
+  _add_totals(m, s, TRUE);
+
+  memset(&m->feed, 0, sizeof(urlget_stats));
+  memset(&m->enclosures, 0, sizeof(urlget_stats));
+  m->downloads = 0;
+  m->runs = 0;
+}
+
+static void _append_header(GString *s, const gchar *name, const gchar *type,
+                           const gchar *help)
+{
+  g_string_append_printf(s, "# HELP castget_%s %s\n", name, help);
+  g_string_append_printf(s, "# TYPE castget_%s %s\n", name, type);
+}
+
+/* Appends a label value. Backslashes, double quotes and line feeds are
+   escaped. */
+static void _append_label(GString *s, const gchar *value)
+{
+  const gchar *p;
+
+  g_string_append_c(s, '"');
+
+  for (p = value; *p; p++) {
+    if (*p == '"' || *p == '\\')
+      g_string_append_printf(s, "\\%c", *p);
+    else if (*p == '\n')
+      g_string_append(s, "\\n");
+    else
+      g_string_append_c(s, *p);
+  }
+
+  g_string_append_c(s, '"');
+}
+
+static void _append_histogram(GString *s, const gchar *name,
+                              const urlget_stats *stats)
+{
+  gchar buffer[G_ASCII_DTOSTR_BUF_SIZE];
+  gint64 count = 0, bound;
+  int i;
+
+  for (i = 0; i < URLGET_DURATION_BUCKETS; i++) {
+    count += stats->durations[i];
+    bound = urlget_duration_bucket(i);
+
+    g_string_append_printf(s, "castget_%s_bucket{le=\"%s\"} %" G_GINT64_FORMAT
+                           "\n", name,
+                           bound < 0 ? "+Inf"
+                                     : g_ascii_formatd(buffer, sizeof(buffer),
+                                                       "%g", bound / 1000.0),
+                           count);
+  }
+
+  g_string_append_printf(s, "castget_%s_sum ", name);
+  append_seconds(s, stats->total_time);
+  g_string_append_printf(s, "\ncastget_%s_count %" G_GINT64_FORMAT "\n", name,
+                         stats->transfers);
+}
+
+static void _append_failures(GString *s, const gchar *kind,
+                             const urlget_stats *stats)
+{
+  int i;
+
+  for (i = 0; i < URLGET_NUM_ERROR_CLASSES; i++)
+    g_string_append_printf(s,
+                           "castget_transfer_failures_total{kind=\"%s\","
+                           "class=\"%s\"} %" G_GINT64_FORMAT "\n",
+                           kind, urlget_error_class_name(i),
+                           stats->failures[i]);
+}
+
+static void _append_channels(GString *s, GList *identifiers, metrics *m,
+                             gboolean last_success)
+{
+  GList *l;
+  struct _channel_metrics *cm;
+
+  for (l = identifiers; l; l = l->next) {
+    cm = g_hash_table_lookup(m->channels, l->data);
+
+    if (last_success && !cm->last_success)
+      continue;
+
+    g_string_append(s, last_success
+                           ? "castget_channel_last_success_timestamp_seconds"
+                           : "castget_items_pending");
+    g_string_append(s, "{channel=");
+    _append_label(s, l->data);
+    g_string_append_printf(s, "} %" G_GINT64_FORMAT "\n",
+                           last_success ? cm->last_success : cm->pending);
+  }
+}
+
+static int _metrics_write(FILE *f, gpointer user_data, int debug)
+{
+  metrics *m = (metrics *)user_data;
+  GString *s = g_string_new(NULL);
+  GList *identifiers;
+  int ret = 0;
+
+  _append_header(s, "feed_fetch_duration_seconds", "histogram",
+                 "Time taken to retrieve feeds.");
+  _append_histogram(s, "feed_fetch_duration_seconds", &m->feed);
+
+  _append_header(s, "download_duration_seconds", "histogram",
+                 "Time taken to download enclosures.");
+  _append_histogram(s, "download_duration_seconds", &m->enclosures);
+
+  _append_header(s, "feed_bytes_total", "counter",
+                 "Bytes received retrieving feeds.");
+  g_string_append_printf(s, "castget_feed_bytes_total %" G_GINT64_FORMAT "\n",
+                         m->feed.bytes);
+
+  _append_header(s, "download_bytes_total", "counter",
+                 "Bytes received downloading enclosures.");
+  g_string_append_printf(s,
+                         "castget_download_bytes_total %" G_GINT64_FORMAT "\n",
+                         m->enclosures.bytes);
+
+  _append_header(s, "downloads_total", "counter", "Enclosures downloaded.");
+  g_string_append_printf(s, "castget_downloads_total %" G_GINT64_FORMAT "\n",
+                         m->downloads);
+
+  _append_header(s, "transfer_failures_total", "counter",
+                 "Failed transfers by kind and class of error.");
+  _append_failures(s, "feed", &m->feed);
+  _append_failures(s, "enclosure", &m->enclosures);
+
+  identifiers = g_list_sort(g_hash_table_get_keys(m->channels),
+                            (GCompareFunc)strcmp);
+
+  _append_header(s, "items_pending", "gauge",
+                 "New items not downloaded at the last update of a channel.");
+  _append_channels(s, identifiers, m, FALSE);
+
+  _append_header(s, "channel_last_success_timestamp_seconds", "gauge",
+                 "Time the feed of a channel was last retrieved.");
+  _append_channels(s, identifiers, m, TRUE);
+
+  g_list_free(identifiers);
+
+  _append_header(s, "enclosures_left", "gauge",
+                 "Enclosures left for a later run by the download budget.");
+  g_string_append_printf(s, "castget_enclosures_left %u\n", m->left);
+
+  _append_header(s, "runs_total", "counter", "Update runs completed.");
+  g_string_append_printf(s, "castget_runs_total %" G_GINT64_FORMAT "\n",
+                         m->runs);
+
+  _append_header(s, "last_run_timestamp_seconds", "gauge",
+                 "Time the last update run started.");
+  g_string_append(s, "castget_last_run_timestamp_seconds ");
+  append_seconds(s, m->last_run);
+  g_string_append_c(s, '\n');
+
+  _append_header(s, "last_run_duration_seconds", "gauge",
+                 "Time taken by the last update run.");
+  g_string_append(s, "castget_last_run_duration_seconds ");
+  append_seconds(s, m->last_run_duration);
+  g_string_append_c(s, '\n');
+
+  if (fwrite(s->str, 1, s->len, f) != s->len)
+    ret = -1;
+
+  g_string_free(s, TRUE);
+
+  return ret;
+}
+
+/* Writes the metrics to 'filename', replacing the file atomically so that
+   a collector never sees half of them. Counters and histograms include the
+   totals in 'totals' if it is given. Returns 0 on success. */
+int metrics_write(metrics *m, schedule *totals, const gchar *filename,
+                  int debug)
+{
+  struct _metrics current = *m;
+
+  if (totals)
+    _add_totals(&current, totals, FALSE);
+
+  return write_by_temporary_file(filename, _metrics_write, &current, NULL,
+                                 debug);
+}
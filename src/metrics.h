@@ -0,0 +1,41 @@
+/*
+  Copyright (C) 2005-2020 Marius L. Jøhndal
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "channel.h"
+#include "schedule.h"
+
+#include <glib.h>
+
+typedef struct _metrics metrics;
+
+metrics *metrics_new(void);
+void metrics_free(metrics *m);
+void metrics_set_last_success(metrics *m, const gchar *identifier, gint64 t);
+void metrics_add_channel(metrics *m, const gchar *identifier,
+                         const channel *c);
+void metrics_add_run(metrics *m, gint64 started, gint64 duration,
+                     guint left);
+void metrics_save_totals(metrics *m, schedule *s);
+int metrics_write(metrics *m, schedule *totals, const gchar *filename,
+                  int debug);
+
+#endif /* METRICS_H */
@@ -22,95 +22,117 @@
 #include "config.h"
 #endif /* HAVE_CONFIG_H */
 
-#include "date_parsing.h"
 #include "patterns.h"
 
-static gchar *expand_date_pattern(const rss_item *item);
-static gchar *expand_title_pattern(const rss_item *item);
-static gchar *expand_channel_title_pattern(const channel_info *info);
-static gchar *expand_pattern(const channel_info *channel_info,
-                             const rss_item *item, const gchar *pattern);
+#include <string.h>
 
-/* Expands a 'date' pattern to the value of the item's pub_date. Returns
-   an empty string if pub_date is absent or invalid. Formats the date
-   on the format 'YYYY-MM-DD'. Caller must free returned string with g_free. */
-static gchar *expand_date_pattern(const rss_item *item)
-{
-  gchar str_date[20];  // FIXME: suspicious
+enum pattern_field {
+  FIELD_LITERAL,
+  FIELD_NONE,
+  FIELD_DATE,
+  FIELD_TIME,
+  FIELD_TITLE,
+  FIELD_CHANNEL_TITLE,
+  FIELD_GUID,
+  FIELD_BASENAME,
+  FIELD_EXTENSION,
+  FIELD_INDEX
+};
 
-  if (item->pub_date) {
-    GDate *rfc822_date = parse_rfc822_date(item->pub_date);
+static const struct {
+  const gchar *name;
+  enum pattern_field field;
+} field_names[] = { { "date", FIELD_DATE },
+                    { "time", FIELD_TIME },
+                    { "title", FIELD_TITLE },
+                    { "channel_title", FIELD_CHANNEL_TITLE },
+                    { "guid", FIELD_GUID },
+                    { "basename", FIELD_BASENAME },
+                    { "extension", FIELD_EXTENSION },
+                    { "index", FIELD_INDEX } };
 
-    if (rfc822_date) {
-      g_date_strftime(str_date, sizeof(str_date), "%Y-%m-%d", rfc822_date);
-      g_date_free(rfc822_date);
-      return g_strdup(str_date);
-    }
-  }
+/* Filename extensions for common enclosure MIME types. */
+static const struct {
+  const gchar *type;
+  const gchar *extension;
+} extensions[] = { { "audio/mpeg", "mp3" },       { "audio/mp3", "mp3" },
+                   { "audio/x-mp3", "mp3" },      { "audio/mpeg3", "mp3" },
+                   { "audio/mp4", "m4a" },        { "audio/x-m4a", "m4a" },
+                   { "audio/m4a", "m4a" },        { "audio/aac", "aac" },
+                   { "audio/x-aac", "aac" },      { "audio/ogg", "ogg" },
+                   { "audio/vorbis", "ogg" },     { "audio/opus", "opus" },
+                   { "audio/flac", "flac" },      { "audio/x-flac", "flac" },
+                   { "audio/wav", "wav" },        { "audio/x-wav", "wav" },
+                   { "video/mp4", "mp4" },        { "video/x-m4v", "m4v" },
+                   { "video/quicktime", "mov" },  { "video/webm", "webm" },
+                   { "video/ogg", "ogv" },        { "video/mpeg", "mpg" },
+                   { "video/x-matroska", "mkv" }, { "application/pdf", "pdf" },
+                   { "application/epub+zip", "epub" } };
 
-  return g_strdup("");
-}
+#define INDEX_WIDTH 3
 
-/* Expands a 'title' pattern to the value of the item's title. Returns
-   an empty string if title is absent. Caller must free returned string with
-   g_free. */
-static gchar *expand_title_pattern(const rss_item *item)
-{
-  if (item->title)
-    return g_strdup(item->title);
-  else
-    return g_strdup("");
-}
+typedef struct _pattern_token {
+  enum pattern_field field;
+  const gchar *literal;
+  gsize length;
+} pattern_token;
 
-/* Expands a 'channel_title' pattern to the value of the channel's title.
-   Returns an empty string if title is absent. Caller must free returned string
-   with g_free. */
-static gchar *expand_channel_title_pattern(const channel_info *info)
+struct _pattern_program {
+  gchar *string;
+  GArray *tokens;
+};
+
+static enum pattern_field _lookup_field(const gchar *name)
 {
-  if (info->title)
-    return g_strdup(info->title);
-  else
-    return g_strdup("");
+  int i;
+
+  for (i = 0; i < G_N_ELEMENTS(field_names); i++)
+    if (g_ascii_strcasecmp(name, field_names[i].name) == 0)
+      return field_names[i].field;
+
+  return FIELD_NONE;
 }
 
-/* Expands a pattern to values from the RSS field's item. Returns an empty
-   string if pattern is invalid or if it cannot be expanded. Caller must free
-   returned string with g_free. */
-static gchar *expand_pattern(const channel_info *channel_info,
-                             const rss_item *item, const gchar *pattern)
+static void _add_token(pattern_program *program, enum pattern_field field,
+                       const gchar *literal, gsize length)
 {
-  if (g_ascii_strcasecmp(pattern, "date") == 0)
-    return expand_date_pattern(item);
-  else if (g_ascii_strcasecmp(pattern, "title") == 0)
-    return expand_title_pattern(item);
-  else if (g_ascii_strcasecmp(pattern, "channel_title") == 0)
-    return expand_channel_title_pattern(channel_info);
-  else
-    return g_strdup("");
+  pattern_token token = { field, literal, length };
+
+  /* Unknown fields expand to nothing, so there is no point in keeping
+     them. */
+  if (field == FIELD_NONE || (field == FIELD_LITERAL && length == 0))
+    return;
+
+  g_array_append_val(program->tokens, token);
 }
 
 #define DIM(a) sizeof(a) / sizeof(a[0])
 
-gchar *expand_string_with_patterns(const gchar *string,
-                                   const channel_info *channel_info,
-                                   const rss_item *item)
+/* Compiles a string with patterns on the form %(field) into a list of
+   tokens that can be expanded repeatedly without parsing the string again.
+   Anything that is not a pattern is kept as a literal. A pattern that is
+   not terminated extends to the end of the string. */
+pattern_program *pattern_program_new(const gchar *string)
 {
   enum { STATE_COPY, STATE_FIELD, STATE_DONE } state = STATE_COPY;
-  GString *parts;
+  pattern_program *program;
   gchar fieldname[80];
   int fieldname_idx = 0;
-  gchar *expanded_field;
-  const gchar *cp_start = string;
-  const gchar *cp_end = string;
+  const gchar *cp_start;
+  const gchar *cp_end;
+
+  program = g_malloc(sizeof(struct _pattern_program));
+  program->string = g_strdup(string);
+  program->tokens = g_array_new(FALSE, FALSE, sizeof(pattern_token));
 
-  parts = g_string_new(NULL);
+  cp_start = cp_end = program->string;
 
   while (state != STATE_DONE) {
     switch (state) {
     case STATE_COPY:
       /* Process */
-      if ((*cp_end == '\0' || *cp_end == '%') && cp_end > cp_start)
-        g_string_append_len(parts, cp_start, cp_end - cp_start);
+      if (*cp_end == '\0' || *cp_end == '%')
+        _add_token(program, FIELD_LITERAL, cp_start, cp_end - cp_start);
 
       /* State update */
       if (*cp_end == '%') {
@@ -124,9 +146,7 @@ gchar *expand_string_with_patterns(const gchar *string,
       /* Process */
       if (*cp_end == '\0' || *cp_end == ')') {
         fieldname[fieldname_idx] = '\0';
-        expanded_field = expand_pattern(channel_info, item, fieldname);
-        g_string_append(parts, expanded_field);
-        g_free(expanded_field);
+        _add_token(program, _lookup_field(fieldname), NULL, 0);
       } else if ((*cp_end != '(') && (fieldname_idx < DIM(fieldname) - 1))
         fieldname[fieldname_idx++] = *cp_end;
       /* State update */
@@ -143,7 +163,141 @@ gchar *expand_string_with_patterns(const gchar *string,
     ++cp_end;
   }
 
+  return program;
+}
+
+void pattern_program_free(pattern_program *program)
+{
+  g_array_free(program->tokens, TRUE);
+  g_free(program->string);
+  g_free(program);
+}
+
+/* Locates the last path component of a URL, ignoring any query or
+   fragment. */
+static const gchar *_url_basename(const gchar *url, gsize *length)
+{
+  const gchar *end = url + strcspn(url, "?#");
+  const gchar *start = end;
+
+  while (start > url && start[-1] != '/')
+    start--;
+
+  *length = end - start;
+
+  return start;
+}
+
+static void _append_extension(GString *buffer, const enclosure *enclosure)
+{
+  const gchar *basename;
+  const gchar *dot;
+  gsize length;
+  int i;
+
+  if (enclosure->type)
+    for (i = 0; i < G_N_ELEMENTS(extensions); i++)
+      if (g_ascii_strcasecmp(enclosure->type, extensions[i].type) == 0) {
+        g_string_append(buffer, extensions[i].extension);
+        return;
+      }
+
+  /* Fall back on the extension in the URL. */
+  if (enclosure->url) {
+    basename = _url_basename(enclosure->url, &length);
+    dot = g_strrstr_len(basename, length, ".");
+
+    if (dot)
+      g_string_append_len(buffer, dot + 1, basename + length - dot - 1);
+  }
+}
+
+/* Appends the expansion of a single token to 'buffer'. Fields that are
+   absent from the feed or invalid expand to nothing. */
+static void _expand_token(const pattern_token *token, GString *buffer,
+                          const channel_info *channel_info,
+                          const rss_item *item)
+{
+  gsize length;
+  const gchar *s;
+
+  switch (token->field) {
+  case FIELD_LITERAL:
+    g_string_append_len(buffer, token->literal, token->length);
+    break;
+  case FIELD_DATE:
+    /* Formats the date on the format 'YYYY-MM-DD'. */
+    if (item->pub_time)
+      g_string_append_printf(buffer, "%04d-%02d-%02d", item->pub_time->year,
+                             item->pub_time->month, item->pub_time->day);
+    break;
+  case FIELD_TIME:
+    /* Formats the time of day on the format 'HH-MM-SS'. */
+    if (item->pub_time)
+      g_string_append_printf(buffer, "%02d-%02d-%02d", item->pub_time->hour,
+                             item->pub_time->minute, item->pub_time->second);
+    break;
+  case FIELD_TITLE:
+    if (item->title)
+      g_string_append(buffer, item->title);
+    break;
+  case FIELD_CHANNEL_TITLE:
+    if (channel_info->title)
+      g_string_append(buffer, channel_info->title);
+    break;
+  case FIELD_GUID:
+    if (item->guid)
+      g_string_append(buffer, item->guid);
+    break;
+  case FIELD_BASENAME:
+    if (item->enclosure && item->enclosure->url) {
+      s = _url_basename(item->enclosure->url, &length);
+      g_string_append_len(buffer, s, length);
+    }
+    break;
+  case FIELD_EXTENSION:
+    if (item->enclosure)
+      _append_extension(buffer, item->enclosure);
+    break;
+  case FIELD_INDEX:
+    g_string_append_printf(buffer, "%0*d", INDEX_WIDTH, item->index);
+    break;
+  case FIELD_NONE:
+    break;
+  }
+}
+
+/* Expands a compiled pattern with values from the channel and the item and
+   appends the result to 'buffer'. */
+void pattern_program_expand(const pattern_program *program, GString *buffer,
+                            const channel_info *channel_info,
+                            const rss_item *item)
+{
+  int i;
+
+  for (i = 0; i < program->tokens->len; i++)
+    _expand_token(&g_array_index(program->tokens, pattern_token, i), buffer,
+                  channel_info, item);
+}
+
+/* Expands a string with patterns. This is a convenience function for strings
+   that are only expanded once. Caller must free returned string with
+   g_free. */
+gchar *expand_string_with_patterns(const gchar *string,
+                                   const channel_info *channel_info,
+                                   const rss_item *item)
+{
+  pattern_program *program;
+  GString *buffer;
+
+  program = pattern_program_new(string);
+  buffer = g_string_new(NULL);
+
+  pattern_program_expand(program, buffer, channel_info, item);
+
+  pattern_program_free(program);
+
   /* Free GString but keep actual string data. Caller must free this using
      g_free() */
-  return g_string_free(parts, FALSE);
+  return g_string_free(buffer, FALSE);
 }
@@ -22,6 +22,13 @@
 
 #include "rss.h"
 
+typedef struct _pattern_program pattern_program;
+
+pattern_program *pattern_program_new(const gchar *string);
+void pattern_program_free(pattern_program *program);
+void pattern_program_expand(const pattern_program *program, GString *buffer,
+                            const channel_info *channel_info,
+                            const rss_item *item);
 gchar *expand_string_with_patterns(const gchar *string,
                                    const channel_info *channel_info,
                                    const rss_item *item);
@@ -0,0 +1,313 @@
+/*
+  Copyright (C) 2005-2020 Marius L. Jøhndal
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include "playlist.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Largest number of entries collected for a playlist before they are
+   written. */
+#define PLAYLIST_BATCH_SIZE 16
+
+/* A playlist file that is kept open until it is replaced. */
+struct _playlist {
+  gchar *filename;
+  int fd;
+  gboolean extended; /* write extended M3U */
+  GString *batch;    /* entries not yet written */
+  guint entries;     /* number of entries in 'batch' */
+};
+
+/* Playlists are written to in batches through a single descriptor per
+   playlist. Each batch is written with a single write() while holding an
+   exclusive lock on the file, so that entries from concurrent castget
+   processes do not interleave. Entries are meant to be written as soon as
+   no more are on their way, with playlist_writer_flush_playlist(), so that
+   a batch only builds up while entries arrive faster than they can be
+   written. A playlist writer may be shared between threads. */
+struct _playlist_writer {
+  GMutex lock;
+  GHashTable *playlists; /* filename -> playlist */
+};
+
+static void _playlist_free(struct _playlist *p)
+{
+  if (p->fd >= 0)
+    close(p->fd);
+
+  g_string_free(p->batch, TRUE);
+  g_free(p->filename);
+  g_free(p);
+}
+
+static gboolean _write_all(int fd, const gchar *buffer, gsize length)
+{
+  ssize_t n;
+
+  while (length > 0) {
+    n = write(fd, buffer, length);
+
+    if (n < 0 && errno == EINTR)
+      continue;
+
+    if (n <= 0)
+      return FALSE;
+
+    buffer += n;
+    length -= n;
+  }
+
+  return TRUE;
+}
+
+/* Opens the playlist file for appending. */
+static int _playlist_open_file(const gchar *filename)
+{
+  int fd = g_open(filename, O_WRONLY | O_CREAT | O_APPEND, 0666);
+
+  if (fd < 0)
+    fprintf(stderr, "Error opening playlist file %s: %s.\n", filename,
+            strerror(errno));
+
+  return fd;
+}
+
+/* Opens the playlist file again if it has been removed or replaced since it
+   was opened, for instance by a player that rotates its playlists, so that
+   entries are not appended to a file nobody will read. */
+static int _playlist_reopen(struct _playlist *p)
+{
+  struct stat current, opened;
+  int fd;
+
+  if (p->fd >= 0 && g_stat(p->filename, &current) == 0 &&
+      fstat(p->fd, &opened) == 0 && current.st_dev == opened.st_dev &&
+      current.st_ino == opened.st_ino)
+    return 0;
+
+  fd = _playlist_open_file(p->filename);
+
+  if (fd < 0)
+    return -1;
+
+  if (p->fd >= 0)
+    close(p->fd);
+
+  p->fd = fd;
+
+  return 0;
+}
+
+/* Writes the pending entries of a playlist to disk. An extended playlist
+   gets a header if the file is empty. */
+static int _playlist_flush(struct _playlist *p)
+{
+  struct stat fileinfo;
+  gboolean ok;
+
+  if (p->entries == 0)
+    return 0;
+
+  if (_playlist_reopen(p) != 0) {
+    g_string_truncate(p->batch, 0);
+    p->entries = 0;
+    return -1;
+  }
+
+  if (flock(p->fd, LOCK_EX) != 0) {
+    fprintf(stderr, "Error locking playlist file %s: %s.\n", p->filename,
+            strerror(errno));
+    return -1;
+  }
+
+  if (p->extended && fstat(p->fd, &fileinfo) == 0 && fileinfo.st_size == 0)
+    g_string_prepend(p->batch, "#EXTM3U\n");
+
+  ok = _write_all(p->fd, p->batch->str, p->batch->len);
+
+  if (!ok)
+    fprintf(stderr, "Error writing playlist file %s: %s.\n", p->filename,
+            strerror(errno));
+
+  flock(p->fd, LOCK_UN);
+
+  /* Entries that could not be written are dropped rather than written
+     twice. */
+  g_string_truncate(p->batch, 0);
+  p->entries = 0;
+
+  return ok ? 0 : -1;
+}
+
+playlist_writer *playlist_writer_new(void)
+{
+  playlist_writer *w = g_malloc(sizeof(struct _playlist_writer));
+
+  g_mutex_init(&w->lock);
+  w->playlists = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+                                       (GDestroyNotify)_playlist_free);
+
+  return w;
+}
+
+/* Writes all pending entries and closes the playlists. */
+void playlist_writer_free(playlist_writer *w)
+{
+  playlist_writer_flush(w);
+
+  g_hash_table_destroy(w->playlists);
+  g_mutex_clear(&w->lock);
+  g_free(w);
+}
+
+/* Looks up a playlist and opens it the first time it is used. Returns NULL
+   if it cannot be opened. */
+static struct _playlist *_playlist_open(playlist_writer *w,
+                                        const gchar *filename)
+{
+  struct _playlist *p;
+  int fd;
+
+  p = g_hash_table_lookup(w->playlists, filename);
+
+  if (p)
+    return p;
+
+  fd = _playlist_open_file(filename);
+
+  if (fd < 0)
+    return NULL;
+
+  p = g_malloc(sizeof(struct _playlist));
+  p->filename = g_strdup(filename);
+  p->fd = fd;
+  p->extended = FALSE;
+  p->batch = g_string_new(NULL);
+  p->entries = 0;
+
+  g_hash_table_insert(w->playlists, p->filename, p);
+
+  return p;
+}
+
+/* Appends the title to an extended M3U entry. The title must fit on a
+   single line. */
+static void _append_title(GString *s, const gchar *title)
+{
+  for (; *title; title++)
+    g_string_append_c(s, (*title == '\n' || *title == '\r') ? ' ' : *title);
+}
+
+/* Adds a media file to a playlist. In an extended playlist, the entry is
+   given a title and a duration in seconds, or -1 if the duration is
+   unknown. If there is no title, the filename is used instead. The entry
+   is written with the next batch, at the latest once PLAYLIST_BATCH_SIZE
+   entries are pending. */
+int playlist_writer_add(playlist_writer *w, const gchar *playlist,
+                        gboolean extended, const gchar *media_file,
+                        const gchar *title, long duration)
+{
+  struct _playlist *p;
+  gchar *basename;
+  int ret = 0;
+
+  g_mutex_lock(&w->lock);
+
+  p = _playlist_open(w, playlist);
+
+  if (!p) {
+    g_mutex_unlock(&w->lock);
+    return -1;
+  }
+
+  p->extended = extended;
+
+  if (extended) {
+    g_string_append_printf(p->batch, "#EXTINF:%ld,", MAX(duration, -1));
+
+    if (title && *title)
+      _append_title(p->batch, title);
+    else {
+      basename = g_path_get_basename(media_file);
+      _append_title(p->batch, basename);
+      g_free(basename);
+    }
+
+    g_string_append_c(p->batch, '\n');
+  }
+
+  g_string_append_printf(p->batch, "%s\n", media_file);
+  p->entries++;
+
+  if (p->entries >= PLAYLIST_BATCH_SIZE)
+    ret = _playlist_flush(p);
+
+  g_mutex_unlock(&w->lock);
+
+  return ret;
+}
+
+/* Writes the pending entries of a playlist, if there are any. */
+int playlist_writer_flush_playlist(playlist_writer *w, const gchar *playlist)
+{
+  struct _playlist *p;
+  int ret = 0;
+
+  g_mutex_lock(&w->lock);
+
+  p = g_hash_table_lookup(w->playlists, playlist);
+
+  if (p)
+    ret = _playlist_flush(p);
+
+  g_mutex_unlock(&w->lock);
+
+  return ret;
+}
+
+/* Writes the pending entries of all playlists. */
+int playlist_writer_flush(playlist_writer *w)
+{
+  GHashTableIter iter;
+  gpointer p;
+  int ret = 0;
+
+  g_mutex_lock(&w->lock);
+
+  g_hash_table_iter_init(&iter, w->playlists);
+
+  while (g_hash_table_iter_next(&iter, NULL, &p))
+    if (_playlist_flush(p) != 0)
+      ret = -1;
+
+  g_mutex_unlock(&w->lock);
+
+  return ret;
+}
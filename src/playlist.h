@@ -0,0 +1,35 @@
+/*
+  Copyright (C) 2005-2020 Marius L. Jøhndal
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+
+#ifndef PLAYLIST_H
+#define PLAYLIST_H
+
+#include <glib.h>
+
+typedef struct _playlist_writer playlist_writer;
+
+playlist_writer *playlist_writer_new(void);
+void playlist_writer_free(playlist_writer *w);
+int playlist_writer_add(playlist_writer *w, const gchar *playlist,
+                        gboolean extended, const gchar *media_file,
+                        const gchar *title, long duration);
+int playlist_writer_flush_playlist(playlist_writer *w, const gchar *playlist);
+int playlist_writer_flush(playlist_writer *w);
+
+#endif /* PLAYLIST_H */
@@ -0,0 +1,405 @@
+/*
+  Copyright (C) 2005-2020 Marius L. Jøhndal
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include "playlist.h"
+#include "postprocess.h"
+#include "trace.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+#ifdef HAVE_TAGLIB
+#include <taglib/tag_c.h>
+#endif /* HAVE_TAGLIB */
+
+/* Number of jobs per worker that may be waiting before submitting another
+   job blocks. This keeps downloads from running far ahead of slow
+   post-processing. */
+#define PENDING_JOBS_PER_WORKER 4
+
+/* The work to be done on a downloaded enclosure. The settings are copied
+   from the channel configuration as the job may outlive it. */
+struct _job {
+  gchar *filename;
+  gchar *title;
+  long duration;
+  gchar *playlist;
+  gboolean extended_playlist;
+  gchar *hook;
+  gchar *artist_tag;
+  gchar *title_tag;
+  gchar *album_tag;
+  gchar *genre_tag;
+  gchar *year_tag;
+  gchar *comment_tag;
+};
+
+/* A queue of jobs that must be run one at a time in the order they were
+   submitted. Jobs that add to the same playlist share a strand so that the
+   playlist lists enclosures in the order they were downloaded. A strand is
+   handed to the thread pool when it receives its first job and runs until
+   it is empty. */
+struct _strand {
+  gchar *playlist; /* NULL if the strand is not shared */
+  GQueue jobs;
+};
+
+struct _postprocessor {
+  GThreadPool *pool;
+  playlist_writer *playlists;
+  GMutex lock;
+  GCond done;
+  GHashTable *strands; /* playlist -> strand with jobs left to run */
+  guint pending;       /* jobs submitted but not yet finished */
+  guint max_pending;
+  int verbose;
+};
+
+#ifdef HAVE_TAGLIB
+/* TagLib keeps the strings it hands out in a global list. */
+static GMutex taglib_lock;
+#endif /* HAVE_TAGLIB */
+
+static struct _job *_job_new(const gchar *filename, const enclosure *e,
+                             const struct channel_configuration *cfg)
+{
+  struct _job *job = g_malloc(sizeof(struct _job));
+
+  job->filename = g_strdup(filename);
+  job->title = g_strdup(e->title);
+  job->duration = e->duration;
+  job->playlist = g_strdup(cfg->playlist);
+  job->extended_playlist = cfg->playlist_format &&
+                           !strcmp(cfg->playlist_format, "extm3u");
+  job->hook = g_strdup(cfg->hook);
+  job->artist_tag = g_strdup(cfg->artist_tag);
+  job->title_tag = g_strdup(cfg->title_tag);
+  job->album_tag = g_strdup(cfg->album_tag);
+  job->genre_tag = g_strdup(cfg->genre_tag);
+  job->year_tag = g_strdup(cfg->year_tag);
+  job->comment_tag = g_strdup(cfg->comment_tag);
+
+  return job;
+}
+
+static void _job_free(struct _job *job)
+{
+  g_free(job->filename);
+  g_free(job->title);
+  g_free(job->playlist);
+  g_free(job->hook);
+  g_free(job->artist_tag);
+  g_free(job->title_tag);
+  g_free(job->album_tag);
+  g_free(job->genre_tag);
+  g_free(job->year_tag);
+  g_free(job->comment_tag);
+  g_free(job);
+}
+
+#ifdef HAVE_TAGLIB
+static void _set_tags(const struct _job *job, int verbose)
+{
+  if (job->artist_tag || job->title_tag || job->album_tag || job->genre_tag ||
+      job->year_tag || job->comment_tag) {
+    TagLib_File *file;
+    TagLib_Tag *tag;
+
+    file = taglib_file_new(job->filename);
+
+    if (file == NULL) {
+      fprintf(stderr, "Error setting tags for file %s.\n", job->filename);
+      return;
+    }
+
+    tag = taglib_file_tag(file);
+
+    if (job->artist_tag) {
+      taglib_tag_set_artist(tag, job->artist_tag);
+
+      if (verbose)
+        printf(" * Set artist tag to %s.\n", job->artist_tag);
+    }
+
+    if (job->title_tag) {
+      taglib_tag_set_title(tag, job->title_tag);
+
+      if (verbose)
+        printf(" * Set title tag to %s.\n", job->title_tag);
+    }
+
+    if (job->album_tag) {
+      taglib_tag_set_album(tag, job->album_tag);
+
+      if (verbose)
+        printf(" * Set album tag to %s.\n", job->album_tag);
+    }
+
+    if (job->genre_tag) {
+      taglib_tag_set_genre(tag, job->genre_tag);
+
+      if (verbose)
+        printf(" * Set genre tag to %s.\n", job->genre_tag);
+    }
+
+    if (job->year_tag) {
+      taglib_tag_set_year(tag, g_ascii_strtoull(job->year_tag, NULL, 10));
+
+      if (verbose)
+        printf(" * Set year tag to %s.\n", job->year_tag);
+    }
+
+    if (job->comment_tag) {
+      taglib_tag_set_comment(tag, job->comment_tag);
+
+      if (verbose)
+        printf(" * Set comment tag to %s.\n", job->comment_tag);
+    }
+
+    if (!taglib_file_save(file))
+      fprintf(stderr, "Error setting tags for file %s.\n", job->filename);
+
+    g_mutex_lock(&taglib_lock);
+    taglib_tag_free_strings();
+    g_mutex_unlock(&taglib_lock);
+
+    taglib_file_free(file);
+  }
+}
+#endif /* HAVE_TAGLIB */
+
+/* Runs the user's hook with the filename of the enclosure as its last
+   argument. */
+static int _run_hook(const gchar *hook, const gchar *filename)
+{
+  gchar **hook_argv, **argv;
+  gint hook_argc, status, i;
+  GError *error = NULL;
+  int ret = 0;
+
+  if (!g_shell_parse_argv(hook, &hook_argc, &hook_argv, &error)) {
+    fprintf(stderr, "Error parsing hook %s: %s.\n", hook, error->message);
+    g_error_free(error);
+    return -1;
+  }
+
+  argv = g_new(gchar *, hook_argc + 2);
+
+  for (i = 0; i < hook_argc; i++)
+    argv[i] = hook_argv[i];
+
+  argv[hook_argc] = (gchar *)filename;
+  argv[hook_argc + 1] = NULL;
+
+  if (!g_spawn_sync(NULL, argv, NULL, G_SPAWN_SEARCH_PATH, NULL, NULL, NULL,
+                    NULL, &status, &error)) {
+    fprintf(stderr, "Error running hook %s: %s.\n", hook, error->message);
+    g_error_free(error);
+    ret = -1;
+  } else if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    fprintf(stderr, "Hook %s failed for file %s.\n", hook, filename);
+    ret = -1;
+  }
+
+  g_free(argv);
+  g_strfreev(hook_argv);
+
+  return ret;
+}
+
+/* Tags the enclosure, then adds it to the playlist and finally runs the
+   hook, so that neither the playlist nor the hook sees the file before it
+   has been tagged. */
+static void _run_job(postprocessor *p, const struct _job *job)
+{
+  gint64 t;
+
+#ifdef HAVE_TAGLIB
+  t = trace_begin();
+  _set_tags(job, p->verbose);
+  trace_end(t, "postprocess", "set_tags", job->filename);
+#endif /* HAVE_TAGLIB */
+
+  if (job->playlist) {
+    t = trace_begin();
+
+    if (playlist_writer_add(p->playlists, job->playlist,
+                            job->extended_playlist, job->filename, job->title,
+                            job->duration) == 0 &&
+        p->verbose)
+      printf(" * Added downloaded enclosure %s to playlist %s.\n",
+             job->filename, job->playlist);
+
+    trace_end(t, "postprocess", "playlist_add", job->filename);
+  }
+
+  if (job->hook) {
+    t = trace_begin();
+    _run_hook(job->hook, job->filename);
+    trace_end(t, "postprocess", "run_hook", job->filename);
+  }
+}
+
+/* Runs the jobs of a strand until there are none left, and then writes the
+   playlist entries they added. */
+static void _strand_run(gpointer data, gpointer user_data)
+{
+  struct _strand *strand = (struct _strand *)data;
+  postprocessor *p = (postprocessor *)user_data;
+  struct _job *job;
+  gint64 t;
+
+  for (;;) {
+    g_mutex_lock(&p->lock);
+
+    job = g_queue_pop_head(&strand->jobs);
+
+    if (!job && strand->playlist)
+      g_hash_table_remove(p->strands, strand->playlist);
+
+    g_mutex_unlock(&p->lock);
+
+    if (!job)
+      break;
+
+    _run_job(p, job);
+    _job_free(job);
+
+    g_mutex_lock(&p->lock);
+    p->pending--;
+    g_cond_broadcast(&p->done);
+    g_mutex_unlock(&p->lock);
+  }
+
+  if (strand->playlist) {
+    t = trace_begin();
+    playlist_writer_flush_playlist(p->playlists, strand->playlist);
+    trace_end(t, "postprocess", "playlist_flush", strand->playlist);
+  }
+
+  g_free(strand->playlist);
+  g_free(strand);
+}
+
+/* Creates a post-processor that runs jobs on up to 'workers' threads.
+   Returns NULL on failure. */
+postprocessor *postprocessor_new(int workers, int verbose)
+{
+  postprocessor *p;
+  GError *error = NULL;
+
+  p = g_malloc(sizeof(struct _postprocessor));
+
+  p->pool = g_thread_pool_new(_strand_run, p, workers, FALSE, &error);
+
+  if (!p->pool) {
+    fprintf(stderr, "Error starting post-processing threads: %s.\n",
+            error->message);
+    g_error_free(error);
+    g_free(p);
+    return NULL;
+  }
+
+  p->playlists = playlist_writer_new();
+  g_mutex_init(&p->lock);
+  g_cond_init(&p->done);
+  p->strands = g_hash_table_new(g_str_hash, g_str_equal);
+  p->pending = 0;
+  p->max_pending = workers * PENDING_JOBS_PER_WORKER;
+  p->verbose = verbose;
+
+  return p;
+}
+
+/* Queues tagging, playlist update and hook for a downloaded enclosure as
+   set up in the channel configuration. Blocks while too many jobs are
+   waiting. */
+void postprocessor_submit(postprocessor *p, const gchar *filename,
+                          const enclosure *enclosure,
+                          const struct channel_configuration *cfg)
+{
+  struct _job *job = _job_new(filename, enclosure, cfg);
+  struct _strand *strand = NULL;
+
+  g_mutex_lock(&p->lock);
+
+  while (p->pending >= p->max_pending)
+    g_cond_wait(&p->done, &p->lock);
+
+  p->pending++;
+
+  if (job->playlist) {
+    strand = g_hash_table_lookup(p->strands, job->playlist);
+
+    if (strand) {
+      /* The strand is already running and will get to the job. */
+      g_queue_push_tail(&strand->jobs, job);
+      g_mutex_unlock(&p->lock);
+      return;
+    }
+  }
+
+  strand = g_malloc(sizeof(struct _strand));
+  strand->playlist = g_strdup(job->playlist);
+  g_queue_init(&strand->jobs);
+  g_queue_push_tail(&strand->jobs, job);
+
+  if (strand->playlist)
+    g_hash_table_insert(p->strands, strand->playlist, strand);
+
+  g_mutex_unlock(&p->lock);
+
+  g_thread_pool_push(p->pool, strand, NULL);
+}
+
+static void _wait_idle(postprocessor *p)
+{
+  g_mutex_lock(&p->lock);
+
+  while (p->pending > 0)
+    g_cond_wait(&p->done, &p->lock);
+
+  g_mutex_unlock(&p->lock);
+}
+
+/* Waits for all submitted jobs to finish and writes the playlist entries
+   they added. */
+void postprocessor_sync(postprocessor *p)
+{
+  _wait_idle(p);
+  playlist_writer_flush(p->playlists);
+}
+
+/* Waits for all submitted jobs to finish, writes what is left of the
+   playlists and frees the post-processor. */
+void postprocessor_free(postprocessor *p)
+{
+  _wait_idle(p);
+
+  g_thread_pool_free(p->pool, FALSE, TRUE);
+  playlist_writer_free(p->playlists);
+  g_hash_table_destroy(p->strands);
+  g_cond_clear(&p->done);
+  g_mutex_clear(&p->lock);
+  g_free(p);
+}
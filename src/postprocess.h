@@ -0,0 +1,37 @@
+/*
+  Copyright (C) 2005-2020 Marius L. Jøhndal
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+
+#ifndef POSTPROCESS_H
+#define POSTPROCESS_H
+
+#include "channel.h"
+#include "configuration.h"
+
+#include <glib.h>
+
+typedef struct _postprocessor postprocessor;
+
+postprocessor *postprocessor_new(int workers, int verbose);
+void postprocessor_submit(postprocessor *p, const gchar *filename,
+                          const enclosure *enclosure,
+                          const struct channel_configuration *cfg);
+void postprocessor_sync(postprocessor *p);
+void postprocessor_free(postprocessor *p);
+
+#endif /* POSTPROCESS_H */
@@ -22,21 +22,71 @@
 #endif /* HAVE_CONFIG_H */
 
 #include "progress.h"
+#include "utils.h"
 
-#include <glib.h>
 #include <math.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+
+/* Widest line drawn unless COLUMNS asks for less. */
+#define MAX_WIDTH 79
+
+/* Number of transfers shown at a time. The others are summed up on a line
+   of their own. */
+#define MAX_TRANSFERS_SHOWN 8
+
+/* Shortest time between redraws of a progress display, and between
+   progress events for a transfer, in microseconds. */
+#define DISPLAY_INTERVAL (G_USEC_PER_SEC / 5)
+
+/* Returns the width of the terminal as given by the COLUMNS environment
+   variable, restricted to avoid insane values. */
+static int _columns(void)
+{
+  gchar **environ;
+  const gchar *columns;
+  char *endptr;
+  long num;
+  int width = MAX_WIDTH;
+
+  environ = g_get_environ();
+  columns = g_environ_getenv(environ, "COLUMNS");
+
+  if (columns) {
+    num = strtol(columns, &endptr, 10);
+
+    if ((endptr != columns) && (endptr == columns + strlen(columns)) &&
+        (num > 0))
+      width = MIN(width, (int)num);
+  }
+
+  g_strfreev(environ);
+
+  return width;
+}
+
+/* Fills 'buffer' with a bar of 'width' characters of which 'num' are
+   filled in. */
+static void _fill_bar(char *buffer, int width, int num)
+{
+  int i;
+
+  for (i = 0; i < width; i++)
+    buffer[i] = (i < num ? '#' : ' ');
+
+  buffer[width] = 0;
+}
 
 /* This code was inspired/guided by the progress-bar implementation found in
    curl (src/tool_cb_prg.c) by Daniel Stenberg, in turn building on an
-   implementation by Lars Aas. */
-int progress_bar_cb(void *clientp, double dltotal, double dlnow, double ultotal,
-                    double ulnow)
+   implementation by Lars Aas. It can be used as CURLOPT_XFERINFOFUNCTION
+   for a single transfer. */
+int progress_bar_cb(void *clientp, curl_off_t dltotal, curl_off_t dlnow,
+                    curl_off_t ultotal, curl_off_t ulnow)
 {
   double fraction;
   int num;
-  int i;
 
   progress_bar *pb = (progress_bar *)clientp;
 
@@ -45,25 +95,22 @@ int progress_bar_cb(void *clientp, double dltotal, double dlnow, double ultotal,
   g_assert(ulnow == 0);
 
   if (pb->width > 0) {
-    if (dltotal == 0.0) {
+    if (dltotal == 0) {
       fraction = 0.0;
       num = 0;
     } else {
-      long total;
-      long position;
+      gint64 total;
+      gint64 position;
 
-      total = (long)dltotal + pb->resume_from;
-      position = MIN((long)dlnow + pb->resume_from, total);
+      total = (gint64)dltotal + pb->resume_from;
+      position = MIN((gint64)dlnow + pb->resume_from, total);
 
       fraction = (double)position / (double)total;
       num = (int)((double)pb->width * fraction);
     }
 
     if (num != pb->previous_num) {
-      for (i = 0; i < pb->width; i++)
-        pb->buffer[i] = (i < num ? '#' : ' ');
-
-      pb->buffer[pb->width] = 0;
+      _fill_bar(pb->buffer, pb->width, num);
 
       fprintf(pb->f, "\r%s %3d%%", pb->buffer, (int)(fraction * 100.0));
       fflush(pb->f);
@@ -75,39 +122,18 @@ int progress_bar_cb(void *clientp, double dltotal, double dlnow, double ultotal,
   return 0;
 }
 
-progress_bar *progress_bar_new(long resume_from)
+progress_bar *progress_bar_new(gint64 resume_from)
 {
   progress_bar *pb;
-  gchar **environ;
-  const gchar *columns;
 
   pb = (progress_bar *)g_malloc(sizeof(struct _progress_bar));
   pb->resume_from = resume_from;
   pb->f = stdout;
-  pb->width = 79;
   pb->previous_num = -1;
 
-  /* Try to grab the COLUMNS environment variable to initialize pb->with with a
-     suitable value. */
-  environ = g_get_environ();
-  columns = g_environ_getenv(environ, "COLUMNS");
-
-  if (columns) {
-    char *endptr;
-    long num = strtol(columns, &endptr, 10);
-    if ((endptr != columns) && (endptr == columns + strlen(columns)) &&
-        (num > 0)) {
-      pb->width = MIN(
-          pb->width,
-          (int)num);  // restrict width of progress bar to avoid insane values
-    }
-  }
-
-  g_strfreev(environ);
-
   /* Leave a margin for printing the percentages (the longest string is
      " 100%"). */
-  pb->width = MAX(0, pb->width - 5);
+  pb->width = MAX(0, _columns() - 5);
 
   /* Allocate space for progress bar string + terminating zero. */
   pb->buffer = g_malloc(pb->width + 1);
@@ -121,3 +147,314 @@ void progress_bar_free(progress_bar *pb)
   g_free(pb->buffer);
   g_free(pb);
 }
+
+/* Shows the progress of transfers on 'f'. With PROGRESS_BARS, transfers in
+   progress are shown as a block of lines that is redrawn in place if 'f' is
+   a terminal, and a line is left behind for each transfer that has been on
+   screen once it finishes. With PROGRESS_EVENTS, a JSON object is written
+   on a line of its own when a transfer starts, as it progresses and when it
+   finishes. Either way, output is limited to one update every
+   DISPLAY_INTERVAL. */
+progress_display *progress_display_new(FILE *f, progress_format format)
+{
+  progress_display *d;
+
+  d = g_malloc(sizeof(struct _progress_display));
+  d->f = f;
+  d->format = format;
+  d->redraw = format == PROGRESS_BARS && isatty(fileno(f));
+  d->width = _columns();
+  d->interval = DISPLAY_INTERVAL;
+  d->last_draw = 0;
+  d->lines = 0;
+  d->next_id = 1;
+  d->transfers = g_ptr_array_new();
+
+  return d;
+}
+
+static void _transfer_free(progress_transfer *t)
+{
+  g_free(t->url);
+  g_free(t->label);
+  g_free(t);
+}
+
+void progress_display_free(progress_display *d)
+{
+  guint i;
+
+  for (i = 0; i < d->transfers->len; i++)
+    _transfer_free(g_ptr_array_index(d->transfers, i));
+
+  g_ptr_array_free(d->transfers, TRUE);
+  g_free(d);
+}
+
+/* Returns the average rate of a transfer in bytes per second. */
+static gint64 _rate(const progress_transfer *t, gint64 now)
+{
+  if (now <= t->started)
+    return 0;
+
+  return (t->received - t->resume_from) * G_USEC_PER_SEC / (now - t->started);
+}
+
+static void _append_time(GString *s, gint64 seconds)
+{
+  if (seconds >= 60 * 60)
+    g_string_append_printf(s, "%d:%02d:%02d", (int)(seconds / (60 * 60)),
+                           (int)(seconds / 60 % 60), (int)(seconds % 60));
+  else
+    g_string_append_printf(s, "%d:%02d", (int)(seconds / 60),
+                           (int)(seconds % 60));
+}
+
+/* Appends a line for a transfer: its label, a bar, the percentage done,
+   the rate and either the estimated time left or, once the transfer has
+   finished, the time it took. */
+static void _append_line(GString *s, const progress_display *d,
+                         const progress_transfer *t, gint64 now, int done)
+{
+  GString *stats = g_string_new(NULL);
+  gchar *rate;
+  char *bar;
+  gint64 bytes_per_second = _rate(t, now);
+  int percent = -1;
+  int label_width, bar_width;
+
+  if (t->total > 0)
+    percent = (int)(MIN(t->received, t->total) * 100 / t->total);
+
+  if (percent >= 0)
+    g_string_append_printf(stats, " %3d%%", percent);
+  else
+    g_string_append(stats, "     ");
+
+  rate = g_format_size(bytes_per_second);
+  g_string_append_printf(stats, " %10s/s ", rate);
+  g_free(rate);
+
+  if (done)
+    _append_time(stats, (now - t->started) / G_USEC_PER_SEC);
+  else if (percent >= 0 && bytes_per_second > 0) {
+    g_string_append(stats, "ETA ");
+    _append_time(stats, (t->total - MIN(t->received, t->total)) /
+                            bytes_per_second);
+  } else
+    g_string_append(stats, "ETA --:--");
+
+  /* The label gets a third of the line and the bar what is left. */
+  label_width = d->width / 3;
+  bar_width = MAX(d->width - label_width - (int)stats->len - 3, 0);
+
+  g_string_append_printf(s, "%-*.*s", label_width, label_width, t->label);
+
+  if (bar_width > 0) {
+    bar = g_malloc(bar_width + 1);
+    _fill_bar(bar, bar_width,
+              percent >= 0 ? (int)((gint64)bar_width * percent / 100) : 0);
+    g_string_append_printf(s, " [%s]", bar);
+    g_free(bar);
+  }
+
+  g_string_append_len(s, stats->str, stats->len);
+  g_string_append_c(s, '\n');
+
+  g_string_free(stats, TRUE);
+}
+
+/* Removes the lines drawn by the last redraw. */
+static void _erase(progress_display *d)
+{
+  if (d->lines) {
+    fprintf(d->f, "\033[%dA\r\033[J", d->lines);
+    d->lines = 0;
+  }
+}
+
+static void _redraw(progress_display *d, gint64 now)
+{
+  GString *s = g_string_new(NULL);
+  progress_transfer *t;
+  guint i;
+  int lines = 0;
+
+  for (i = 0; i < d->transfers->len && i < MAX_TRANSFERS_SHOWN; i++) {
+    t = g_ptr_array_index(d->transfers, i);
+    _append_line(s, d, t, now, 0);
+    t->shown = 1;
+    lines++;
+  }
+
+  if (d->transfers->len > MAX_TRANSFERS_SHOWN) {
+    g_string_append_printf(s, "... and %u more\n",
+                           d->transfers->len - MAX_TRANSFERS_SHOWN);
+    lines++;
+  }
+
+  _erase(d);
+  fwrite(s->str, 1, s->len, d->f);
+  fflush(d->f);
+
+  d->lines = lines;
+  d->last_draw = now;
+
+  g_string_free(s, TRUE);
+}
+
+/* Writes an event about a transfer. 'members' are added to the object
+   after the name of the event and the identifier of the transfer. */
+static void _write_event(progress_display *d, const progress_transfer *t,
+                         const gchar *event, const GString *members)
+{
+  GString *s = g_string_new(NULL);
+  gchar buffer[G_ASCII_DTOSTR_BUF_SIZE];
+
+  g_string_append_printf(s, "{\"event\": \"%s\", \"id\": %" G_GINT64_FORMAT,
+                         event, t->id);
+  g_string_append_len(s, members->str, members->len);
+  g_string_append_printf(
+      s, ", \"time\": %s}\n",
+      g_ascii_formatd(buffer, sizeof(buffer), "%.3f",
+                      (gdouble)g_get_real_time() / G_USEC_PER_SEC));
+
+  fwrite(s->str, 1, s->len, d->f);
+  fflush(d->f);
+
+  g_string_free(s, TRUE);
+}
+
+/* Starts showing a transfer of 'url' that resumes at 'resume_from'. */
+progress_transfer *progress_display_start(progress_display *d,
+                                          const gchar *url,
+                                          gint64 resume_from)
+{
+  progress_transfer *t;
+  GString *members;
+  const gchar *p, *end;
+
+  t = g_malloc(sizeof(struct _progress_transfer));
+  t->id = d->next_id++;
+  t->url = g_strdup(url);
+  t->resume_from = resume_from;
+  t->total = 0;
+  t->received = resume_from;
+  t->started = g_get_monotonic_time();
+  t->last_event = t->started;
+  t->shown = 0;
+
+  /* The label is the last part of the path, or the whole URL if that is
+     empty. */
+  end = strchr(url, '?');
+
+  if (!end)
+    end = url + strlen(url);
+
+  p = g_strrstr_len(url, end - url, "/");
+
+  if (p && p + 1 < end)
+    t->label = g_strndup(p + 1, end - p - 1);
+  else
+    t->label = g_strdup(url);
+
+  g_ptr_array_add(d->transfers, t);
+
+  if (d->format == PROGRESS_EVENTS) {
+    members = g_string_new(", \"url\": ");
+    append_json_string(members, url);
+    g_string_append_printf(members, ", \"offset\": %" G_GINT64_FORMAT,
+                           resume_from);
+    _write_event(d, t, "start", members);
+    g_string_free(members, TRUE);
+  }
+
+  return t;
+}
+
+static void _append_progress(GString *s, const progress_transfer *t,
+                             gint64 now)
+{
+  gint64 rate = _rate(t, now);
+
+  g_string_append_printf(s, ", \"received\": %" G_GINT64_FORMAT, t->received);
+
+  if (t->total > 0)
+    g_string_append_printf(s, ", \"total\": %" G_GINT64_FORMAT, t->total);
+  else
+    g_string_append(s, ", \"total\": null");
+
+  g_string_append_printf(s, ", \"rate\": %" G_GINT64_FORMAT, rate);
+
+  if (t->total > 0 && rate > 0)
+    g_string_append_printf(s, ", \"eta\": %" G_GINT64_FORMAT,
+                           (t->total - MIN(t->received, t->total)) / rate);
+  else
+    g_string_append(s, ", \"eta\": null");
+}
+
+/* Records that 'received' bytes out of 'total' have arrived so far, not
+   counting what was there before the transfer resumed. 'total' is 0 if the
+   length of the content is not known. The display is updated unless it
+   was updated too recently. */
+void progress_display_update(progress_display *d, progress_transfer *t,
+                             gint64 total, gint64 received)
+{
+  gint64 now;
+  GString *members;
+
+  t->total = total > 0 ? total + t->resume_from : 0;
+  t->received = received + t->resume_from;
+
+  now = g_get_monotonic_time();
+
+  if (d->format == PROGRESS_EVENTS) {
+    if (now - t->last_event < d->interval)
+      return;
+
+    members = g_string_new(NULL);
+    _append_progress(members, t, now);
+    _write_event(d, t, "progress", members);
+    g_string_free(members, TRUE);
+
+    t->last_event = now;
+  } else if (d->redraw) {
+    if (now - d->last_draw >= d->interval)
+      _redraw(d, now);
+  } else if (now - t->started >= d->interval)
+    /* Only transfers that take a while are worth a line. */
+    t->shown = 1;
+}
+
+/* Stops showing a transfer, which is freed. */
+void progress_display_finish(progress_display *d, progress_transfer *t,
+                             int failed)
+{
+  gint64 now = g_get_monotonic_time();
+  GString *s;
+
+  g_ptr_array_remove(d->transfers, t);
+
+  if (d->format == PROGRESS_EVENTS) {
+    s = g_string_new(NULL);
+    _append_progress(s, t, now);
+    g_string_append_printf(s, ", \"failed\": %s",
+                           failed ? "true" : "false");
+    _write_event(d, t, "done", s);
+    g_string_free(s, TRUE);
+  } else {
+    /* The block is drawn again on the next update, so that anything else
+       printed in the meantime is not overwritten. */
+    _erase(d);
+
+    if (t->shown) {
+      s = g_string_new(NULL);
+      _append_line(s, d, t, now, 1);
+      fwrite(s->str, 1, s->len, d->f);
+      fflush(d->f);
+      g_string_free(s, TRUE);
+    }
+  }
+
+  _transfer_free(t);
+}
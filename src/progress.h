@@ -20,19 +20,63 @@
 #ifndef PROGRESS_H
 #define PROGRESS_H
 
+#include <curl/curl.h>
+#include <glib.h>
 #include <stdio.h>
 
 typedef struct _progress_bar {
   FILE *f;
-  long resume_from;
+  gint64 resume_from;
   int width;
   int previous_num;
   char *buffer;
 } progress_bar;
 
-progress_bar *progress_bar_new(long resume_from);
+/* How a progress display shows transfers. */
+typedef enum {
+  PROGRESS_BARS,  /* a line with a bar for each transfer */
+  PROGRESS_EVENTS /* a JSON object on a line of its own for each event */
+} progress_format;
+
+/* A transfer shown by a progress display. Sizes include the part of the
+   content that was there before the transfer resumed it. */
+typedef struct _progress_transfer {
+  gint64 id;
+  gchar *url;
+  gchar *label;        /* last part of the path of the URL */
+  gint64 resume_from;
+  gint64 total;        /* length of the content, or 0 if unknown */
+  gint64 received;
+  gint64 started;      /* monotonic time in microseconds */
+  gint64 last_event;   /* when progress was last reported */
+  int shown;           /* the transfer has been on screen */
+} progress_transfer;
+
+typedef struct _progress_display {
+  FILE *f;
+  progress_format format;
+  int redraw;      /* lines can be redrawn in place */
+  int width;
+  gint64 interval; /* shortest time between redraws in microseconds */
+  gint64 last_draw;
+  int lines;       /* number of lines drawn by the last redraw */
+  gint64 next_id;
+  GPtrArray *transfers; /* transfers in progress, oldest first */
+} progress_display;
+
+progress_bar *progress_bar_new(gint64 resume_from);
 void progress_bar_free(progress_bar *pb);
-int progress_bar_cb(void *clientp, double dltotal, double dlnow, double ultotal,
-                    double ulnow);
+int progress_bar_cb(void *clientp, curl_off_t dltotal, curl_off_t dlnow,
+                    curl_off_t ultotal, curl_off_t ulnow);
+
+progress_display *progress_display_new(FILE *f, progress_format format);
+void progress_display_free(progress_display *d);
+progress_transfer *progress_display_start(progress_display *d,
+                                          const gchar *url,
+                                          gint64 resume_from);
+void progress_display_update(progress_display *d, progress_transfer *t,
+                             gint64 total, gint64 received);
+void progress_display_finish(progress_display *d, progress_transfer *t,
+                             int failed);
 
 #endif /* PROGRESS_H */
@@ -0,0 +1,225 @@
+/*
+  Copyright (C) 2005-2020 Marius L. Jøhndal
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include "queue.h"
+
+#include <string.h>
+
+struct _queued {
+  gint64 size;      /* bytes, or 0 if unknown */
+  gint64 published; /* seconds since the epoch, or 0 if unknown */
+  guint owner;      /* position of the owner among the owners */
+  guint rank;       /* position among the downloads of the same owner */
+  download_func download;
+  gpointer data; /* freed with g_free() */
+};
+
+struct _owner {
+  guint index; /* position in the order the owners were first seen */
+  guint downloads;
+  gboolean failed;
+};
+
+/* Downloads from all channels that are updated together. Each download
+   belongs to an owner, normally a channel. The downloads are run in the
+   order of the queue, which decides which downloads fit in the budget for
+   the run. */
+struct _download_queue {
+  download_order order;
+  GArray *downloads;
+  GHashTable *owners;  /* owner -> struct _owner */
+  GPtrArray *by_index; /* struct _owner by index */
+};
+
+/* Parses the name of a download order. Returns -1 if it is invalid. */
+int download_order_parse(const gchar *s, download_order *order)
+{
+  if (!strcmp(s, "feed"))
+    *order = DOWNLOAD_ORDER_FEED;
+  else if (!strcmp(s, "newest"))
+    *order = DOWNLOAD_ORDER_NEWEST;
+  else if (!strcmp(s, "smallest"))
+    *order = DOWNLOAD_ORDER_SMALLEST;
+  else if (!strcmp(s, "round-robin"))
+    *order = DOWNLOAD_ORDER_ROUND_ROBIN;
+  else
+    return -1;
+
+  return 0;
+}
+
+download_queue *download_queue_new(download_order order)
+{
+  download_queue *q = g_malloc(sizeof(struct _download_queue));
+
+  q->order = order;
+  q->downloads = g_array_new(FALSE, FALSE, sizeof(struct _queued));
+  q->owners = g_hash_table_new(g_direct_hash, g_direct_equal);
+  q->by_index = g_ptr_array_new_with_free_func(g_free);
+
+  return q;
+}
+
+static void _clear(download_queue *q)
+{
+  guint i;
+
+  for (i = 0; i < q->downloads->len; i++)
+    g_free(g_array_index(q->downloads, struct _queued, i).data);
+
+  g_array_set_size(q->downloads, 0);
+  g_hash_table_remove_all(q->owners);
+  g_ptr_array_set_size(q->by_index, 0);
+}
+
+void download_queue_free(download_queue *q)
+{
+  _clear(q);
+  g_array_free(q->downloads, TRUE);
+  g_hash_table_destroy(q->owners);
+  g_ptr_array_free(q->by_index, TRUE);
+  g_free(q);
+}
+
+/* Adds a download to the queue. 'size' and 'published' are 0 if they are
+   unknown. The queue takes over 'data'. */
+void download_queue_add(download_queue *q, gconstpointer owner, gint64 size,
+                        gint64 published, download_func download,
+                        gpointer data)
+{
+  struct _owner *o;
+  struct _queued d;
+
+  o = g_hash_table_lookup(q->owners, owner);
+
+  if (!o) {
+    o = g_malloc(sizeof(struct _owner));
+    o->index = q->by_index->len;
+    o->downloads = 0;
+    o->failed = FALSE;
+    g_hash_table_insert(q->owners, (gpointer)owner, o);
+    g_ptr_array_add(q->by_index, o);
+  }
+
+  d.size = MAX(size, 0);
+  d.published = MAX(published, 0);
+  d.owner = o->index;
+  d.rank = o->downloads++;
+  d.download = download;
+  d.data = data;
+
+  g_array_append_val(q->downloads, d);
+}
+
+/* Orders downloads with a known value of a key before those without one. */
+static gint _compare_known(gint64 a, gint64 b, gboolean ascending)
+{
+  if (a == b)
+    return 0;
+  else if (!a || !b)
+    return a ? -1 : 1;
+  else if (ascending)
+    return a < b ? -1 : 1;
+  else
+    return a > b ? -1 : 1;
+}
+
+static gint _compare(gconstpointer a, gconstpointer b, gpointer user_data)
+{
+  const struct _queued *x = a, *y = b;
+  download_order order = *(download_order *)user_data;
+  gint r = 0;
+
+  switch (order) {
+  case DOWNLOAD_ORDER_FEED:
+    break;
+
+  case DOWNLOAD_ORDER_NEWEST:
+    r = _compare_known(x->published, y->published, FALSE);
+    break;
+
+  case DOWNLOAD_ORDER_SMALLEST:
+    r = _compare_known(x->size, y->size, TRUE);
+    break;
+
+  case DOWNLOAD_ORDER_ROUND_ROBIN:
+    if (x->rank != y->rank)
+      r = x->rank < y->rank ? -1 : 1;
+    break;
+  }
+
+  /* Ties are broken by the order the downloads were added in. */
+  if (!r && x->owner != y->owner)
+    r = x->owner < y->owner ? -1 : 1;
+
+  if (!r && x->rank != y->rank)
+    r = x->rank < y->rank ? -1 : 1;
+
+  return r;
+}
+
+/* Runs the queued downloads in order and empties the queue. No download is
+   started once 'max_bytes' have been downloaded or 'max_time' seconds have
+   passed, and downloads known to be larger than what is left of
+   'max_bytes' are skipped. A download that is still running when
+   'max_time' is up is stopped. A limit of zero means that no limit applies.
+   The remaining downloads of an owner are dropped once one of them fails.
+   Returns the number of downloads left out because of the limits. */
+guint download_queue_run(download_queue *q, gint64 max_bytes,
+                         gint64 max_time)
+{
+  struct _queued *d;
+  struct _owner *o;
+  gint64 deadline, downloaded = 0, size;
+  guint i, left = 0;
+
+  g_array_sort_with_data(q->downloads, _compare, &q->order);
+
+  deadline = g_get_monotonic_time() + max_time * G_USEC_PER_SEC;
+
+  for (i = 0; i < q->downloads->len; i++) {
+    d = &g_array_index(q->downloads, struct _queued, i);
+    o = g_ptr_array_index(q->by_index, d->owner);
+
+    if (o->failed)
+      continue;
+
+    if ((max_time && g_get_monotonic_time() >= deadline) ||
+        (max_bytes &&
+         (downloaded >= max_bytes || downloaded + d->size > max_bytes))) {
+      left++;
+      continue;
+    }
+
+    size = 0;
+
+    if (d->download(d->data, max_time ? deadline : 0, &size) < 0)
+      o->failed = TRUE;
+
+    downloaded += size;
+  }
+
+  _clear(q);
+
+  return left;
+}
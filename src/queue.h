@@ -0,0 +1,50 @@
+/*
+  Copyright (C) 2005-2020 Marius L. Jøhndal
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#include <glib.h>
+
+/* The order in which queued enclosures are downloaded. */
+typedef enum {
+  DOWNLOAD_ORDER_FEED,       /* channel by channel, in feed order */
+  DOWNLOAD_ORDER_NEWEST,     /* most recently published first */
+  DOWNLOAD_ORDER_SMALLEST,   /* smallest first */
+  DOWNLOAD_ORDER_ROUND_ROBIN /* one from each channel in turn */
+} download_order;
+
+typedef struct _download_queue download_queue;
+
+/* Downloads a queued enclosure and sets 'size' to the number of bytes
+   downloaded. The download must end by 'deadline', in microseconds of
+   monotonic time, unless it is zero. Returns -1 if no more enclosures
+   should be downloaded for the same owner. */
+typedef int (*download_func)(gpointer data, gint64 deadline, gint64 *size);
+
+int download_order_parse(const gchar *s, download_order *order);
+download_queue *download_queue_new(download_order order);
+void download_queue_free(download_queue *q);
+void download_queue_add(download_queue *q, gconstpointer owner, gint64 size,
+                        gint64 published, download_func download,
+                        gpointer data);
+guint download_queue_run(download_queue *q, gint64 max_bytes,
+                         gint64 max_time);
+
+#endif /* QUEUE_H */
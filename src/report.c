@@ -0,0 +1,169 @@
+/*
+  Copyright (C) 2005-2020 Marius L. Jøhndal
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include "report.h"
+#include "utils.h"
+
+#include <glib/gprintf.h>
+#include <stdio.h>
+
+/* A report on a run in JSON. Channels are added as they are updated, and
+   the report is completed when it is written. */
+struct _report {
+  gint64 started;           /* wall clock time in microseconds */
+  gint64 started_monotonic; /* monotonic time in microseconds */
+  GString *channels;        /* JSON objects separated by commas */
+  guint num_channels;
+  guint left; /* enclosures left for a later run */
+};
+
+/* Starts a JSON object with measurements of transfers. The caller adds
+   further members and closes it. */
+static void _append_transfers(GString *s, const urlget_stats *stats)
+{
+  g_string_append_printf(s, "{\"transfers\": %" G_GINT64_FORMAT,
+                         stats->transfers);
+  g_string_append_printf(s, ", \"bytes\": %" G_GINT64_FORMAT, stats->bytes);
+  g_string_append(s, ", \"dns\": ");
+  append_seconds(s, stats->dns_time);
+  g_string_append(s, ", \"connect\": ");
+  append_seconds(s, stats->connect_time);
+  g_string_append(s, ", \"tls\": ");
+  append_seconds(s, stats->tls_time);
+  g_string_append(s, ", \"first_byte\": ");
+  append_seconds(s, stats->first_byte_time);
+  g_string_append(s, ", \"total\": ");
+  append_seconds(s, stats->total_time);
+}
+
+report *report_new(void)
+{
+  report *r = g_malloc(sizeof(struct _report));
+
+  r->started = g_get_real_time();
+  r->started_monotonic = g_get_monotonic_time();
+  r->channels = g_string_new(NULL);
+  r->num_channels = 0;
+  r->left = 0;
+
+  return r;
+}
+
+void report_free(report *r)
+{
+  g_string_free(r->channels, TRUE);
+  g_free(r);
+}
+
+/* Adds the measurements from the last update of a channel. */
+void report_add_channel(report *r, const gchar *identifier, const channel *c,
+                        gboolean failed)
+{
+  const channel_stats *stats = &c->stats;
+  GString *s = r->channels;
+  gchar buffer[G_ASCII_DTOSTR_BUF_SIZE];
+  gdouble throughput = 0;
+
+  if (r->num_channels++)
+    g_string_append(s, ",\n");
+
+  g_string_append(s, "    {\"id\": ");
+  append_json_string(s, identifier);
+  g_string_append(s, ", \"url\": ");
+  append_json_string(s, c->url);
+  g_string_append_printf(s, ", \"failed\": %s", failed ? "true" : "false");
+
+  g_string_append(s, ",\n     \"feed\": ");
+  _append_transfers(s, &stats->feed);
+  g_string_append(s, ", \"parse\": ");
+  append_seconds(s, stats->parse_time);
+  g_string_append(s, "}");
+
+  g_string_append_printf(s,
+                         ",\n     \"items\": {\"seen\": %" G_GINT64_FORMAT
+                         ", \"new\": %" G_GINT64_FORMAT
+                         ", \"filtered\": %" G_GINT64_FORMAT "}",
+                         stats->items_seen, stats->items_new,
+                         stats->items_filtered);
+
+  if (stats->enclosures.total_time)
+    throughput = (gdouble)stats->enclosures.bytes * G_USEC_PER_SEC /
+                 stats->enclosures.total_time;
+
+  g_string_append(s, ",\n     \"enclosures\": ");
+  _append_transfers(s, &stats->enclosures);
+  g_string_append_printf(s, ", \"downloaded\": %" G_GINT64_FORMAT,
+                         stats->downloads);
+  g_string_append_printf(
+      s, ", \"throughput\": %s}",
+      g_ascii_formatd(buffer, sizeof(buffer), "%.0f", throughput));
+
+  g_string_append_printf(s, ",\n     \"failures\": %" G_GINT64_FORMAT,
+                         stats->failures);
+  g_string_append(s, ", \"save\": ");
+  append_seconds(s, stats->save_time);
+  g_string_append(s, "}");
+}
+
+/* Records the number of enclosures that were left for a later run. */
+void report_set_left(report *r, guint left)
+{
+  r->left = left;
+}
+
+static int _report_write(FILE *f, gpointer user_data, int debug)
+{
+  report *r = (report *)user_data;
+  GString *s;
+  int ret = 0;
+
+  s = g_string_new("{\n  \"started\": ");
+  append_seconds(s, r->started);
+  g_string_append(s, ",\n  \"duration\": ");
+  append_seconds(s, g_get_monotonic_time() - r->started_monotonic);
+  g_string_append_printf(s, ",\n  \"left\": %u", r->left);
+  g_string_append(s, ",\n  \"channels\": [");
+
+  if (r->num_channels) {
+    g_string_append_c(s, '\n');
+    g_string_append_len(s, r->channels->str, r->channels->len);
+    g_string_append(s, "\n  ");
+  }
+
+  g_string_append(s, "]\n}\n");
+
+  if (fwrite(s->str, 1, s->len, f) != s->len)
+    ret = -1;
+
+  g_string_free(s, TRUE);
+
+  return ret;
+}
+
+/* Completes the report and writes it to 'filename', replacing the file
+   atomically so that a reader never sees half a report. Returns 0 on
+   success. */
+int report_write(report *r, const gchar *filename, int debug)
+{
+  return write_by_temporary_file(filename, _report_write, r, NULL, debug);
+}
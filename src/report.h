@@ -0,0 +1,36 @@
+/*
+  Copyright (C) 2005-2020 Marius L. Jøhndal
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+
+#ifndef REPORT_H
+#define REPORT_H
+
+#include "channel.h"
+
+#include <glib.h>
+
+typedef struct _report report;
+
+report *report_new(void);
+void report_free(report *r);
+void report_add_channel(report *r, const gchar *identifier, const channel *c,
+                        gboolean failed);
+void report_set_left(report *r, guint left);
+int report_write(report *r, const gchar *filename, int debug);
+
+#endif /* REPORT_H */
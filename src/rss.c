@@ -24,6 +24,7 @@
 #include "htmlent.h"
 #include "libxmlutil.h"
 #include "rss.h"
+#include "trace.h"
 #include "urlget.h"
 #include "utils.h"
 
@@ -34,6 +35,11 @@
 #include <unistd.h>
 
 #define MRSS_NAMESPACE "http://search.yahoo.com/mrss"
+#define ITUNES_NAMESPACE "http://www.itunes.com/dtds/podcast-1.0.dtd"
+
+/* Number of the most recent items whose publication dates are used to
+   estimate how often a feed has new items. */
+#define CADENCE_ITEMS 10
 
 static char *_dup_child_node_value(const xmlNode *node, const gchar *tag)
 {
@@ -47,12 +53,165 @@ static char *_dup_child_node_value(const xmlNode *node, const gchar *tag)
     return NULL;
 }
 
+/* Finds a child node in the mrss namespace. The namespace is officially
+   spelled with a trailing slash, but older feeds omit it. */
+static const xmlNode *_mrss_child_node(const xmlNode *node, const char *name)
+{
+  const xmlNode *n;
+
+  if (!node)
+    return NULL;
+
+  n = libxmlutil_child_node_by_name(node, MRSS_NAMESPACE "/", name);
+
+  if (!n)
+    n = libxmlutil_child_node_by_name(node, MRSS_NAMESPACE, name);
+
+  return n;
+}
+
+/* Copies the most specific mrss "hash" tag in an item to its enclosure. A
+   hash may be given for the content, for a group of contents or for the
+   item as a whole. The algorithm defaults to MD5. */
+static void _read_mrss_hash(enclosure *e, const xmlNode *item)
+{
+  const xmlNode *group = _mrss_child_node(item, "group");
+  const xmlNode *nodes[4];
+  const xmlNode *hash = NULL;
+  int i;
+
+  nodes[0] = _mrss_child_node(item, "content");
+  nodes[1] = _mrss_child_node(group, "content");
+  nodes[2] = group;
+  nodes[3] = item;
+
+  for (i = 0; i < G_N_ELEMENTS(nodes) && !hash; i++)
+    hash = _mrss_child_node(nodes[i], "hash");
+
+  if (!hash)
+    return;
+
+  e->hash = libxmlutil_dup_value(hash);
+  e->hash_algorithm = libxmlutil_dup_attr(hash, "algo");
+
+  if (e->hash)
+    g_strstrip(e->hash);
+
+  if (!e->hash_algorithm)
+    e->hash_algorithm = strdup("md5");
+}
+
+/* Parses a duration given either as a number of seconds or as [[H:]M:]S
+   as in itunes:duration. Returns -1 if the duration is invalid. */
+static long _parse_duration(const char *s)
+{
+  long duration = 0, n;
+  char *end;
+  int fields = 0;
+
+  for (;;) {
+    while (g_ascii_isspace(*s))
+      s++;
+
+    if (!g_ascii_isdigit(*s))
+      return -1;
+
+    n = strtol(s, &end, 10);
+
+    if (fields > 0 && n >= 60)
+      return -1;
+
+    duration = duration * 60 + n;
+    fields++;
+    s = end;
+
+    /* Ignore fractions of a second. */
+    if (*s == '.')
+      while (g_ascii_isdigit(*++s))
+        ;
+
+    while (g_ascii_isspace(*s))
+      s++;
+
+    if (*s == '\0')
+      break;
+    else if (*s != ':' || fields == 3)
+      return -1;
+
+    s++;
+  }
+
+  return duration;
+}
+
+/* Reads the episode number from the itunes "episode" tag. Returns 0 if
+   there is none or it is not a positive number. */
+static int _read_episode(const xmlNode *item)
+{
+  const xmlNode *n;
+  char *value, *end;
+  long episode = 0;
+
+  n = libxmlutil_child_node_by_name(item, ITUNES_NAMESPACE, "episode");
+
+  if (n) {
+    value = libxmlutil_dup_value(n);
+
+    if (value) {
+      g_strstrip(value);
+      episode = strtol(value, &end, 10);
+
+      if (end == value || *end || episode < 0 || episode > G_MAXINT)
+        episode = 0;
+
+      free(value);
+    }
+  }
+
+  return (int)episode;
+}
+
+/* Reads the duration of an enclosure from the mrss "duration" attribute or
+   the itunes "duration" tag. Returns -1 if neither gives a valid
+   duration. */
+static long _read_duration(const xmlNode *mrss_content, const xmlNode *item)
+{
+  const xmlNode *n;
+  char *value;
+  long duration = -1;
+
+  if (mrss_content) {
+    value = libxmlutil_dup_attr(mrss_content, "duration");
+
+    if (value) {
+      duration = _parse_duration(value);
+      free(value);
+    }
+  }
+
+  if (duration < 0) {
+    n = libxmlutil_child_node_by_name(item, ITUNES_NAMESPACE, "duration");
+
+    if (n) {
+      value = libxmlutil_dup_value(n);
+
+      if (value) {
+        duration = _parse_duration(value);
+        free(value);
+      }
+    }
+  }
+
+  return duration;
+}
+
 static void _item_iterator(const void *user_data, int i, const xmlNode *node)
 {
   rss_file *f = (rss_file *)user_data;
   const xmlNode *encl;
   const xmlNode *mrss_content;
   const xmlNode *mrss_group;
+  const xmlNode *mrss_title;
 
   /* Allocate item structure. */
   f->items[i] = (rss_item *)malloc(sizeof(struct _rss_item));
@@ -62,18 +221,30 @@ static void _item_iterator(const void *user_data, int i, const xmlNode *node)
   f->items[i]->link = _dup_child_node_value(node, "link");
   f->items[i]->description = _dup_child_node_value(node, "description");
   f->items[i]->pub_date = _dup_child_node_value(node, "pubDate");
+  f->items[i]->guid = _dup_child_node_value(node, "guid");
+  f->items[i]->index = _read_episode(node);
+
+  /* Parse the publication date once so that filters and filename patterns
+     need not do it over and over again. */
+  f->items[i]->pub_time = NULL;
+
+  if (f->items[i]->pub_date) {
+    f->items[i]->pub_time = g_new(rfc822_time, 1);
+
+    if (!parse_rfc822_time(f->items[i]->pub_date, f->items[i]->pub_time)) {
+      g_free(f->items[i]->pub_time);
+      f->items[i]->pub_time = NULL;
+    }
+  }
 
   /* Look for mrss information first, if there is any. It may be
      located either directly under the "item" tag, or inside an mrss
      "group" tag. */
-  mrss_content = libxmlutil_child_node_by_name(node, MRSS_NAMESPACE, "content");
+  mrss_content = _mrss_child_node(node, "content");
 
   if (!mrss_content) {
-    mrss_group = libxmlutil_child_node_by_name(node, MRSS_NAMESPACE, "group");
-
-    if (mrss_group)
-      mrss_content =
-          libxmlutil_child_node_by_name(mrss_group, MRSS_NAMESPACE, "content");
+    mrss_group = _mrss_child_node(node, "group");
+    mrss_content = _mrss_child_node(mrss_group, "content");
   }
 
   /* Figure out if there is an "enclosure" tag here. */
@@ -86,6 +257,9 @@ static void _item_iterator(const void *user_data, int i, const xmlNode *node)
     f->items[i]->enclosure->url = NULL;
     f->items[i]->enclosure->length = 0;
     f->items[i]->enclosure->type = NULL;
+    f->items[i]->enclosure->hash = NULL;
+    f->items[i]->enclosure->hash_algorithm = NULL;
+    f->items[i]->enclosure->title = NULL;
 
     /* Now read attributes. Prefer mrss over enclosure. */
     if (mrss_content) {
@@ -107,6 +281,22 @@ static void _item_iterator(const void *user_data, int i, const xmlNode *node)
         f->items[i]->enclosure->type = libxmlutil_dup_attr(encl, "type");
     }
 
+    _read_mrss_hash(f->items[i]->enclosure, node);
+
+    /* The title of the media itself is preferred over that of the item. */
+    mrss_title = _mrss_child_node(mrss_content, "title");
+
+    if (!mrss_title)
+      mrss_title = _mrss_child_node(node, "title");
+
+    if (mrss_title)
+      f->items[i]->enclosure->title = libxmlutil_dup_value(mrss_title);
+
+    if (!f->items[i]->enclosure->title && f->items[i]->title)
+      f->items[i]->enclosure->title = strdup(f->items[i]->title);
+
+    f->items[i]->enclosure->duration = _read_duration(mrss_content, node);
+
     /* Clean up garbage values from the feed */
     if (f->items[i]->enclosure->length < 0)
       f->items[i]->enclosure->length = 0;
@@ -114,9 +304,133 @@ static void _item_iterator(const void *user_data, int i, const xmlNode *node)
     f->items[i]->enclosure = NULL;
 }
 
+static void _skip_hour_iterator(const void *user_data, int i,
+                                const xmlNode *node)
+{
+  feed_hints *hints = (feed_hints *)user_data;
+  char *value, *end;
+  long hour;
+
+  value = libxmlutil_dup_value(node);
+
+  if (value) {
+    hour = strtol(g_strstrip(value), &end, 10);
+
+    /* Some feeds count the hours from 1 to 24. */
+    if (end != value && *end == '\0' && hour >= 0 && hour <= 24)
+      hints->skip_hours |= 1u << (hour % 24);
+
+    free(value);
+  }
+}
+
+static void _skip_day_iterator(const void *user_data, int i,
+                               const xmlNode *node)
+{
+  static const char *const days[] = { "Sunday",   "Monday", "Tuesday",
+                                      "Wednesday", "Thursday", "Friday",
+                                      "Saturday" };
+  feed_hints *hints = (feed_hints *)user_data;
+  char *value;
+  int day;
+
+  value = libxmlutil_dup_value(node);
+
+  if (value) {
+    for (day = 0; day < 7; day++)
+      if (!g_ascii_strcasecmp(g_strstrip(value), days[day]))
+        hints->skip_days |= 1u << day;
+
+    free(value);
+  }
+}
+
+static gint _compare_times(gconstpointer a, gconstpointer b)
+{
+  gint64 x = *(const gint64 *)a, y = *(const gint64 *)b;
+
+  return x < y ? -1 : x > y;
+}
+
+/* Estimates the time between new items in a feed as the median of the
+   intervals between the publication dates of its most recent items.
+   Returns 0 if there are too few dated items. */
+static gint64 _estimate_cadence(const rss_file *f)
+{
+  GArray *times, *intervals;
+  gint64 t, cadence = 0;
+  int i;
+
+  times = g_array_new(FALSE, FALSE, sizeof(gint64));
+  intervals = g_array_new(FALSE, FALSE, sizeof(gint64));
+
+  for (i = 0; i < f->num_items; i++)
+    if (f->items[i]->pub_time) {
+      t = rfc822_time_to_unix(f->items[i]->pub_time);
+      g_array_append_val(times, t);
+    }
+
+  g_array_sort(times, _compare_times);
+
+  for (i = MAX((int)times->len - CADENCE_ITEMS, 0) + 1; i < times->len; i++) {
+    t = g_array_index(times, gint64, i) - g_array_index(times, gint64, i - 1);
+
+    /* Items published together count as one. */
+    if (t > 0)
+      g_array_append_val(intervals, t);
+  }
+
+  if (intervals->len > 0) {
+    g_array_sort(intervals, _compare_times);
+    cadence = g_array_index(intervals, gint64, intervals->len / 2);
+  }
+
+  g_array_free(intervals, TRUE);
+  g_array_free(times, TRUE);
+
+  return cadence;
+}
+
+/* Reads the hints in the channel element on when the feed is worth fetching
+   again. */
+static void _read_hints(rss_file *f, const xmlNode *channel)
+{
+  const xmlNode *n;
+  char *value, *end;
+  long ttl;
+
+  memset(&f->hints, 0, sizeof(feed_hints));
+
+  value = _dup_child_node_value(channel, "ttl");
+
+  if (value) {
+    /* The ttl is given in minutes. */
+    ttl = strtol(g_strstrip(value), &end, 10);
+
+    if (end != value && *end == '\0' && ttl > 0)
+      f->hints.ttl = (gint64)ttl * 60;
+
+    free(value);
+  }
+
+  n = libxmlutil_child_node_by_name(channel, NULL, "skipHours");
+
+  if (n)
+    libxmlutil_iterate_by_tag_name(n, "hour", &f->hints, _skip_hour_iterator);
+
+  n = libxmlutil_child_node_by_name(channel, NULL, "skipDays");
+
+  if (n)
+    libxmlutil_iterate_by_tag_name(n, "day", &f->hints, _skip_day_iterator);
+
+  f->hints.cadence = _estimate_cadence(f);
+}
+
 static rss_file *rss_parse(const gchar *url, const xmlNode *root_element,
-                           gchar *fetched_time)
+                           gchar *fetched_time, const feed_limits *limits)
 {
+  int num_items;
+
   const char *version_string;
   const xmlNode *channel;
   rss_file *f;
@@ -146,12 +460,22 @@ static rss_file *rss_parse(const gchar *url, const xmlNode *root_element,
   channel = libxmlutil_child_node_by_name(root_element, NULL, "channel");
 
   if (channel) {
+    num_items = libxmlutil_count_by_tag_name(channel, "item");
+
+    if (limits && limits->max_items && num_items > limits->max_items) {
+      fprintf(stderr,
+              "Error parsing RSS file %s: %d items exceeds the limit of "
+              "%" G_GINT64_FORMAT " items.\n",
+              url, num_items, limits->max_items);
+      return NULL;
+    }
+
     /* Allocate RSS file structure and room for pointers to all entries. */
     f = (rss_file *)malloc(sizeof(struct _rss_file));
 
     f->fetched_time = g_strdup(fetched_time);
 
-    f->num_items = libxmlutil_count_by_tag_name(channel, "item");
+    f->num_items = num_items;
     f->items = (rss_item **)malloc(sizeof(rss_item *) * f->num_items);
 
     f->version = version;
@@ -163,6 +487,8 @@ static rss_file *rss_parse(const gchar *url, const xmlNode *root_element,
     f->channel_info.language = _dup_child_node_value(channel, "language");
 
     libxmlutil_iterate_by_tag_name(channel, "item", f, _item_iterator);
+
+    _read_hints(f, channel);
   } else
     f = NULL;
 
@@ -203,21 +529,100 @@ static xmlEntityPtr _get_entity(void *ctxt, const xmlChar *name)
   return entity;
 }
 
-rss_file *rss_open_file(const char *filename)
-{
+#define RSS_PARSE_CHUNK_SIZE 65536
+
+/* Parses an XML document incrementally, as it is read from a file or
+   received from a server, so that the time spent parsing can be bounded. */
+struct _rss_parser {
   xmlParserCtxtPtr ctxt;
+  const feed_limits *limits;
+  gint64 parse_time; /* microseconds spent parsing so far */
+  int stopped;       /* the rest of the document is ignored */
+  int timed_out;
+};
+
+static void _rss_parser_init(struct _rss_parser *p, const char *filename,
+                             const feed_limits *limits)
+{
+  p->ctxt = xmlCreatePushParserCtxt(NULL, NULL, NULL, 0, filename);
+  p->ctxt->sax->getEntity = _get_entity;
+  p->limits = limits;
+  p->parse_time = 0;
+  p->stopped = 0;
+  p->timed_out = 0;
+}
+
+/* Frees the parser along with whatever it has built of the document. */
+static void _rss_parser_free(struct _rss_parser *p)
+{
+  if (p->ctxt->myDoc)
+    xmlFreeDoc(p->ctxt->myDoc);
+
+  xmlFreeParserCtxt(p->ctxt);
+}
+
+/* Passes the next part of the document to the parser. Returns 1 once
+   parsing has stopped because of an error or the time limit, after which
+   further parts are ignored. */
+static int _rss_parser_feed(struct _rss_parser *p, const char *buffer,
+                            size_t n)
+{
+  gint64 started, t;
+
+  if (p->stopped)
+    return 1;
+
+  started = g_get_monotonic_time();
+  t = trace_begin();
+
+  if (xmlParseChunk(p->ctxt, buffer, n, 0))
+    p->stopped = 1;
+
+  p->parse_time += g_get_monotonic_time() - started;
+  trace_end(t, "feed", "xml_parse", NULL);
+
+  if (p->limits && p->limits->max_parse_time &&
+      p->parse_time > p->limits->max_parse_time * G_USEC_PER_SEC) {
+    p->stopped = 1;
+    p->timed_out = 1;
+  }
+
+  return p->stopped;
+}
+
+/* Finishes parsing and builds the feed from the document. Returns NULL if
+   the document is not well-formed or if parsing exceeded the time limit.
+   The parser is freed in either case. */
+static rss_file *_rss_parser_close(struct _rss_parser *p, const char *url)
+{
   xmlDocPtr doc;
   rss_file *f;
   xmlNode *root_element = NULL;
   gchar *fetched_time;
+  gint64 started, t;
+
+  started = g_get_monotonic_time();
+  t = trace_begin();
+
+  if (!p->timed_out)
+    xmlParseChunk(p->ctxt, NULL, 0, 1);
+
+  doc = p->ctxt->myDoc;
+  p->ctxt->myDoc = NULL;
+
+  if (p->timed_out || !p->ctxt->wellFormed) {
+    if (p->timed_out)
+      fprintf(stderr,
+              "Error parsing RSS file %s: parsing exceeded the time limit of "
+              "%" G_GINT64_FORMAT " seconds.\n",
+              url, p->limits->max_parse_time);
+    else
+      fprintf(stderr, "Error parsing RSS file %s.\n", url);
 
-  ctxt = xmlNewParserCtxt();
-  ctxt->sax->getEntity = _get_entity;
-  doc = xmlSAXParseFile(ctxt->sax, filename, 0);
+    if (doc)
+      xmlFreeDoc(doc);
 
-  if (!doc) {
-    fprintf(stderr, "Error parsing RSS file %s.\n", filename);
-    xmlFreeParserCtxt(ctxt);
+    xmlFreeParserCtxt(p->ctxt);
 
     return NULL;
   }
@@ -226,9 +631,9 @@ rss_file *rss_open_file(const char *filename)
 
   if (!root_element) {
     xmlFreeDoc(doc);
-    xmlFreeParserCtxt(ctxt);
+    xmlFreeParserCtxt(p->ctxt);
 
-    fprintf(stderr, "Error parsing RSS file %s.\n", filename);
+    fprintf(stderr, "Error parsing RSS file %s.\n", url);
     return NULL;
   }
 
@@ -237,38 +642,93 @@ rss_file *rss_open_file(const char *filename)
 
   if (!fetched_time) {
     xmlFreeDoc(doc);
-    xmlFreeParserCtxt(ctxt);
+    xmlFreeParserCtxt(p->ctxt);
 
     g_fprintf(stderr, "Error retrieving current time.\n");
     return NULL;
   }
 
-  f = rss_parse(filename, root_element, fetched_time);
+  f = rss_parse(url, root_element, fetched_time, p->limits);
 
   xmlFreeDoc(doc);
-  xmlFreeParserCtxt(ctxt);
+  xmlFreeParserCtxt(p->ctxt);
   g_free(fetched_time);
 
+  trace_end(t, "feed", "rss_parse", url);
+
+  if (f)
+    f->parse_time = p->parse_time + g_get_monotonic_time() - started;
+
   return f;
 }
 
+static rss_file *_rss_open(const char *filename, const char *url,
+                           const feed_limits *limits)
+{
+  struct _rss_parser p;
+  FILE *f;
+  char buffer[RSS_PARSE_CHUNK_SIZE];
+  size_t n;
+
+  f = fopen(filename, "rb");
+
+  if (!f) {
+    fprintf(stderr, "Error opening RSS file %s.\n", url);
+    return NULL;
+  }
+
+  _rss_parser_init(&p, filename, limits);
+
+  while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0)
+    if (_rss_parser_feed(&p, buffer, n))
+      break;
+
+  fclose(f);
+
+  return _rss_parser_close(&p, url);
+}
+
+rss_file *rss_open_file(const char *filename, const feed_limits *limits)
+{
+  return _rss_open(filename, filename, limits);
+}
+
+struct _rss_open_url_data {
+  const char *url;
+  const feed_limits *limits;
+  urlget_stats *stats;
+};
+
 static int _rss_open_url_cb(FILE *f, gpointer user_data, int debug)
 {
-  gchar *url = (gchar *)user_data;
+  struct _rss_open_url_data *d = (struct _rss_open_url_data *)user_data;
 
-  return urlget_file(url, f, debug);
+  return urlget_file(d->url, f, d->limits ? d->limits->max_feed_size : 0,
+                     d->limits ? &d->limits->timeouts : NULL, d->stats,
+                     debug);
 }
 
-rss_file *rss_open_url(const char *url, int debug)
+/* Retrieves and parses a feed. Measurements of the transfer are added to
+   'stats' unless it is NULL. */
+rss_file *rss_open_url(const char *url, const feed_limits *limits,
+                       urlget_stats *stats, int debug)
 {
   rss_file *f;
-  gchar *rss_filename;
+  gchar *rss_filename = NULL;
+  struct _rss_open_url_data d = { url, limits, stats };
+
+  if (write_by_temporary_file(NULL, _rss_open_url_cb, &d, &rss_filename,
+                              debug)) {
+    /* The partially downloaded feed is of no use to anyone. */
+    if (rss_filename) {
+      unlink(rss_filename);
+      g_free(rss_filename);
+    }
 
-  if (write_by_temporary_file(NULL, _rss_open_url_cb, (gpointer)url,
-                              &rss_filename, debug))
     return NULL;
+  }
 
-  f = rss_open_file(rss_filename);
+  f = _rss_open(rss_filename, url, limits);
 
   unlink(rss_filename);
   g_free(rss_filename);
@@ -276,6 +736,81 @@ rss_file *rss_open_url(const char *url, int debug)
   return f;
 }
 
+/* A feed being retrieved by rss_open_url_async(). */
+struct _rss_open_url_request {
+  gchar *url;
+  struct _rss_parser parser;
+  rss_open_func done;
+  void *user_data;
+};
+
+static size_t _rss_open_url_write_cb(void *buffer, size_t size, size_t nmemb,
+                                     void *user_data)
+{
+  struct _rss_open_url_request *r =
+      (struct _rss_open_url_request *)user_data;
+
+  /* The transfer is stopped as soon as parsing has stopped. The error is
+     reported once the transfer has finished. */
+  if (_rss_parser_feed(&r->parser, buffer, size * nmemb))
+    return URLGET_WRITE_DECLINED;
+
+  return size * nmemb;
+}
+
+static void _rss_open_url_done_cb(int result, void *user_data)
+{
+  struct _rss_open_url_request *r =
+      (struct _rss_open_url_request *)user_data;
+  rss_file *f = NULL;
+
+  /* A transfer stopped by the parser failed because of the document. */
+  if (result && !r->parser.stopped)
+    _rss_parser_free(&r->parser);
+  else
+    f = _rss_parser_close(&r->parser, r->url);
+
+  r->done(f, r->user_data);
+
+  g_free(r->url);
+  g_free(r);
+}
+
+/* Starts retrieving a feed like rss_open_url() but returns right away. The
+   feed is parsed as it arrives, so that nothing but the parser state is
+   kept for a transfer in progress. Once transfer_engine_run() has been
+   called on 'engine' and the transfer has finished, 'done' is called with
+   the feed, or with NULL if it could not be retrieved or parsed. 'limits',
+   'stats' and 'progress', which may be NULL, must remain valid until then.
+   Returns 0 if the transfer has been started and 1 if it could not be, in
+   which case 'done' is never called. */
+int rss_open_url_async(transfer_engine *engine, const char *url,
+                       const feed_limits *limits, urlget_stats *stats,
+                       int debug, progress_display *progress,
+                       rss_open_func done, void *user_data)
+{
+  struct _rss_open_url_request *r;
+
+  r = g_malloc(sizeof(struct _rss_open_url_request));
+  r->url = g_strdup(url);
+  r->done = done;
+  r->user_data = user_data;
+
+  _rss_parser_init(&r->parser, url, limits);
+
+  if (urlget_buffer_async(engine, url, r, _rss_open_url_write_cb, NULL, 0,
+                          limits ? limits->max_feed_size : 0, 0,
+                          limits ? &limits->timeouts : NULL, stats, debug,
+                          progress, _rss_open_url_done_cb)) {
+    xmlFreeParserCtxt(r->parser.ctxt);
+    g_free(r->url);
+    g_free(r);
+    return 1;
+  }
+
+  return 0;
+}
+
 void rss_close(rss_file *f)
 {
   int i;
@@ -291,6 +826,15 @@ void rss_close(rss_file *f)
       if (item->enclosure->type)
         free(item->enclosure->type);
 
+      if (item->enclosure->hash)
+        free(item->enclosure->hash);
+
+      if (item->enclosure->hash_algorithm)
+        free(item->enclosure->hash_algorithm);
+
+      if (item->enclosure->title)
+        free(item->enclosure->title);
+
       free(item->enclosure);
     }
 
@@ -300,6 +844,11 @@ void rss_close(rss_file *f)
     if (item->pub_date)
       free(item->pub_date);
 
+    if (item->guid)
+      free(item->guid);
+
+    g_free(item->pub_time);
+
     free(item);
   }
 
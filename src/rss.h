@@ -21,12 +21,17 @@
 #define RSS_H
 
 #include "channel.h"
+#include "date_parsing.h"
+#include "transfer.h"
 
 typedef struct _rss_item {
   char *title;
   char *link;
   char *description;
   char *pub_date;
+  char *guid;
+  rfc822_time *pub_time; /* parsed pub_date, NULL if missing or invalid */
+  int index;             /* episode number from the feed, or 0 if none */
   enclosure *enclosure;
 } rss_item;
 
@@ -43,10 +48,19 @@ typedef struct _rss_file {
   rss_item **items;
   channel_info channel_info;
   gchar *fetched_time;
+  feed_hints hints;
+  gint64 parse_time; /* microseconds spent parsing the feed */
 } rss_file;
 
-rss_file *rss_open_file(const char *filename);
-rss_file *rss_open_url(const char *url, int debug);
+typedef void (*rss_open_func)(rss_file *f, void *user_data);
+
+rss_file *rss_open_file(const char *filename, const feed_limits *limits);
+rss_file *rss_open_url(const char *url, const feed_limits *limits,
+                       urlget_stats *stats, int debug);
+int rss_open_url_async(transfer_engine *engine, const char *url,
+                       const feed_limits *limits, urlget_stats *stats,
+                       int debug, progress_display *progress,
+                       rss_open_func done, void *user_data);
 void rss_close(rss_file *f);
 
 #endif /* RSS_H */
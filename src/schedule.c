@@ -0,0 +1,366 @@
+/*
+  Copyright (C) 2005-2020 Marius L. Jøhndal
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include "schedule.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/file.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Fraction of the time between new items that castget waits before it
+   fetches a feed again. */
+#define CADENCE_FRACTION 4
+
+/* Longest time that hints from a feed can put off the next update. */
+#define MAX_HINT_DELAY (12 * 60 * 60)
+
+/* The time each channel is next due to be updated and the estimated time
+   between new items in its feed. These are kept apart from the channel
+   files so that channels that are not due can be skipped without reading
+   their download history.
+
+   Several castget processes may share the schedule, for example when runs
+   from cron overlap. Each process only writes back the channels it has
+   changed, merging them into the file as it is at the time.
+
+   The schedule also keeps counts that add up over every run, such as the
+   totals behind the metrics, in the group "*" that no channel can use.
+   Each process only adds what it has counted itself to the counts in the
+   file when it saves. */
+#define COUNTS_GROUP "*"
+
+struct _schedule {
+  gchar *filename;
+  GKeyFile *kf;
+  GHashTable *changed; /* identifiers of channels changed since the last
+                          save */
+  GHashTable *counts;  /* name -> GArray of gint64 added since the last
+                          save */
+};
+
+/* Reads the schedule from 'filename'. A schedule that does not exist yet
+   or cannot be read starts out empty. */
+schedule *schedule_load(const gchar *filename)
+{
+  schedule *s;
+  GError *error = NULL;
+
+  s = g_malloc(sizeof(struct _schedule));
+  s->filename = g_strdup(filename);
+  s->kf = g_key_file_new();
+  s->changed = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+  s->counts = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                    (GDestroyNotify)g_array_unref);
+
+  if (!g_key_file_load_from_file(s->kf, filename, G_KEY_FILE_NONE, &error)) {
+    if (!g_error_matches(error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+      fprintf(stderr, "Error reading schedule %s: %s.\n", filename,
+              error->message);
+
+    g_error_free(error);
+  }
+
+  return s;
+}
+
+void schedule_free(schedule *s)
+{
+  g_hash_table_destroy(s->counts);
+  g_hash_table_destroy(s->changed);
+  g_key_file_free(s->kf);
+  g_free(s->filename);
+  g_free(s);
+}
+
+static gint64 _get_time(const schedule *s, const gchar *identifier,
+                        const gchar *key)
+{
+  gint64 t = g_key_file_get_int64(s->kf, identifier, key, NULL);
+
+  return MAX(t, 0);
+}
+
+/* Returns the time the channel is next due to be updated in seconds since
+   the epoch, or 0 if it is due already. */
+gint64 schedule_get_next_update(const schedule *s, const gchar *identifier)
+{
+  return _get_time(s, identifier, "next_update");
+}
+
+/* Returns the last estimate of the time between new items in the feed of
+   the channel, or 0 if there is none. */
+gint64 schedule_get_cadence(const schedule *s, const gchar *identifier)
+{
+  return _get_time(s, identifier, "cadence");
+}
+
+static void _changed(schedule *s, const gchar *identifier)
+{
+  g_hash_table_replace(s->changed, g_strdup(identifier), NULL);
+}
+
+void schedule_set(schedule *s, const gchar *identifier, gint64 next_update,
+                  gint64 cadence)
+{
+  _changed(s, identifier);
+  g_key_file_set_int64(s->kf, identifier, "next_update", next_update);
+
+  if (cadence)
+    g_key_file_set_int64(s->kf, identifier, "cadence", cadence);
+  else
+    g_key_file_remove_key(s->kf, identifier, "cadence", NULL);
+}
+
+/* Returns the time the feed of the channel was last retrieved in seconds
+   since the epoch, or 0 if it never was. */
+gint64 schedule_get_last_success(const schedule *s, const gchar *identifier)
+{
+  return _get_time(s, identifier, "last_success");
+}
+
+void schedule_set_last_success(schedule *s, const gchar *identifier,
+                               gint64 t)
+{
+  _changed(s, identifier);
+  g_key_file_set_int64(s->kf, identifier, "last_success", t);
+}
+
+/* Adds the 'n' counts stored as 'name' in 'kf' to 'counts'. Counts that
+   are missing are taken to be 0. */
+static void _add_stored_counts(GKeyFile *kf, const gchar *name,
+                               gint64 *counts, gsize n)
+{
+  gchar **values;
+  gsize i, length = 0;
+
+  values = g_key_file_get_string_list(kf, COUNTS_GROUP, name, &length, NULL);
+
+  for (i = 0; i < n && i < length; i++)
+    counts[i] += g_ascii_strtoll(values[i], NULL, 10);
+
+  g_strfreev(values);
+}
+
+static void _store_counts(GKeyFile *kf, const gchar *name,
+                          const gint64 *counts, gsize n)
+{
+  GString *value = g_string_new(NULL);
+  gsize i;
+
+  for (i = 0; i < n; i++)
+    g_string_append_printf(value, "%" G_GINT64_FORMAT ";", counts[i]);
+
+  g_key_file_set_value(kf, COUNTS_GROUP, name, value->str);
+  g_string_free(value, TRUE);
+}
+
+/* Returns the 'n' counts kept as 'name', including those added since the
+   schedule was last saved. */
+void schedule_get_counts(const schedule *s, const gchar *name,
+                         gint64 *counts, gsize n)
+{
+  GArray *added = g_hash_table_lookup(s->counts, name);
+  gsize i;
+
+  memset(counts, 0, n * sizeof(gint64));
+  _add_stored_counts(s->kf, name, counts, n);
+
+  for (i = 0; added && i < n && i < added->len; i++)
+    counts[i] += g_array_index(added, gint64, i);
+}
+
+/* Adds 'n' counts to those kept as 'name'. */
+void schedule_add_counts(schedule *s, const gchar *name,
+                         const gint64 *counts, gsize n)
+{
+  GArray *added = g_hash_table_lookup(s->counts, name);
+  gsize i;
+
+  if (!added) {
+    added = g_array_new(FALSE, TRUE, sizeof(gint64));
+    g_hash_table_insert(s->counts, g_strdup(name), added);
+  }
+
+  if (added->len < n)
+    g_array_set_size(added, n);
+
+  for (i = 0; i < n; i++)
+    g_array_index(added, gint64, i) += counts[i];
+}
+
+/* Adds the counts in 'added' to those stored as 'name' in 'kf', keeping
+   any that are stored beyond them. */
+static void _merge_counts(GKeyFile *kf, const gchar *name, GArray *added)
+{
+  gchar **values;
+  gint64 *counts;
+  gsize n = 0;
+
+  values = g_key_file_get_string_list(kf, COUNTS_GROUP, name, &n, NULL);
+  g_strfreev(values);
+  n = MAX(n, added->len);
+
+  counts = g_new0(gint64, n);
+  memcpy(counts, added->data, added->len * sizeof(gint64));
+  _add_stored_counts(kf, name, counts, n);
+  _store_counts(kf, name, counts, n);
+  g_free(counts);
+}
+
+/* Replaces the entries for a channel in 'to' with those in 'from'. */
+static void _copy_channel(GKeyFile *from, GKeyFile *to,
+                          const gchar *identifier)
+{
+  gchar **keys, *value;
+  int i;
+
+  g_key_file_remove_group(to, identifier, NULL);
+  keys = g_key_file_get_keys(from, identifier, NULL, NULL);
+
+  for (i = 0; keys && keys[i]; i++) {
+    value = g_key_file_get_value(from, identifier, keys[i], NULL);
+    g_key_file_set_value(to, identifier, keys[i], value);
+    g_free(value);
+  }
+
+  g_strfreev(keys);
+}
+
+/* Writes the channels changed and the counts added since the schedule was
+   loaded or last saved back to its file. The file is read again and the
+   changes are merged into it while a lock is held, so that entries written
+   by other processes in the meantime are kept, and the schedule then
+   reflects them too. Returns -1 on error. */
+int schedule_save(schedule *s)
+{
+  gchar *lock_filename, *data, *identifier, *name;
+  gsize length;
+  GKeyFile *kf;
+  GHashTableIter iter;
+  GArray *added;
+  GError *error = NULL;
+  int fd, ret = 0;
+
+  if (g_hash_table_size(s->changed) == 0 &&
+      g_hash_table_size(s->counts) == 0)
+    return 0;
+
+  /* The schedule itself is replaced when it is written, so the lock is
+     held on a file next to it. */
+  lock_filename = g_strconcat(s->filename, ".lock", NULL);
+  fd = g_open(lock_filename, O_RDWR | O_CREAT, 0644);
+
+  if (fd < 0 || flock(fd, LOCK_EX) != 0) {
+    fprintf(stderr, "Error locking schedule %s: %s.\n", s->filename,
+            strerror(errno));
+
+    if (fd >= 0)
+      close(fd);
+
+    g_free(lock_filename);
+    return -1;
+  }
+
+  kf = g_key_file_new();
+  g_key_file_load_from_file(kf, s->filename, G_KEY_FILE_NONE, NULL);
+
+  g_hash_table_iter_init(&iter, s->changed);
+  while (g_hash_table_iter_next(&iter, (gpointer *)&identifier, NULL))
+    _copy_channel(s->kf, kf, identifier);
+
+  g_hash_table_iter_init(&iter, s->counts);
+  while (g_hash_table_iter_next(&iter, (gpointer *)&name, (gpointer *)&added))
+    _merge_counts(kf, name, added);
+
+  data = g_key_file_to_data(kf, &length, NULL);
+
+  /* The file is replaced in a single step. */
+  if (g_file_set_contents(s->filename, data, length, &error)) {
+    g_key_file_free(s->kf);
+    s->kf = kf;
+    g_hash_table_remove_all(s->changed);
+    g_hash_table_remove_all(s->counts);
+  } else {
+    fprintf(stderr, "Error writing schedule %s: %s.\n", s->filename,
+            error->message);
+    g_error_free(error);
+    g_key_file_free(kf);
+    ret = -1;
+  }
+
+  g_free(data);
+
+  flock(fd, LOCK_UN);
+  close(fd);
+  g_free(lock_filename);
+
+  return ret;
+}
+
+static gboolean _skipped(gint64 t, const feed_hints *hints)
+{
+  time_t time = (time_t)t;
+  struct tm tm;
+
+  if (!gmtime_r(&time, &tm))
+    return FALSE;
+
+  return (hints->skip_hours & (1u << tm.tm_hour)) ||
+         (hints->skip_days & (1u << tm.tm_wday));
+}
+
+/* Works out when a channel that was updated at 'now' is next due. The
+   channel is updated again after 'interval' seconds unless the hints from
+   its feed ask for a longer wait. The ttl of the feed is respected, and a
+   feed that rarely has new items is fetched less often, but neither puts
+   off the update by more than MAX_HINT_DELAY. The update is then moved out
+   of the hours and days the feed asks to skip. */
+gint64 schedule_next_update(gint64 now, gint64 interval,
+                            const feed_hints *hints)
+{
+  gint64 delay = interval, next;
+  int hours;
+
+  if (!hints)
+    return now + delay;
+
+  delay = MAX(delay, MIN(hints->ttl, MAX_HINT_DELAY));
+  delay = MAX(delay, MIN(hints->cadence / CADENCE_FRACTION, MAX_HINT_DELAY));
+
+  next = now + delay;
+
+  /* Move on an hour at a time, but give up if the feed asks to skip every
+     hour of the week. */
+  for (hours = 0; hours < 7 * 24 && _skipped(next, hints); hours++)
+    next += 60 * 60 - next % (60 * 60);
+
+  if (hours == 7 * 24)
+    next = now + delay;
+
+  return next;
+}
@@ -0,0 +1,46 @@
+/*
+  Copyright (C) 2005-2020 Marius L. Jøhndal
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+
+#ifndef SCHEDULE_H
+#define SCHEDULE_H
+
+#include "channel.h"
+
+#include <glib.h>
+
+typedef struct _schedule schedule;
+
+schedule *schedule_load(const gchar *filename);
+void schedule_free(schedule *s);
+gint64 schedule_get_next_update(const schedule *s, const gchar *identifier);
+gint64 schedule_get_cadence(const schedule *s, const gchar *identifier);
+void schedule_set(schedule *s, const gchar *identifier, gint64 next_update,
+                  gint64 cadence);
+gint64 schedule_get_last_success(const schedule *s, const gchar *identifier);
+void schedule_set_last_success(schedule *s, const gchar *identifier,
+                               gint64 t);
+void schedule_get_counts(const schedule *s, const gchar *name,
+                         gint64 *counts, gsize n);
+void schedule_add_counts(schedule *s, const gchar *name,
+                         const gint64 *counts, gsize n);
+int schedule_save(schedule *s);
+gint64 schedule_next_update(gint64 now, gint64 interval,
+                            const feed_hints *hints);
+
+#endif /* SCHEDULE_H */
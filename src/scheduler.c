@@ -0,0 +1,152 @@
+/*
+  Copyright (C) 2005-2020 Marius L. Jøhndal
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include "scheduler.h"
+
+struct _task {
+  gint64 due;
+  guint64 sequence; /* order of submission, breaks ties between tasks */
+  gpointer data;
+};
+
+/* The tasks are kept in a binary min-heap ordered by the time they are
+   due. Tasks that are due at the same time are run in the order they were
+   added. */
+struct _scheduler {
+  GArray *heap;
+  guint64 next_sequence;
+};
+
+static gboolean _task_before(const struct _task *a, const struct _task *b)
+{
+  return a->due < b->due || (a->due == b->due && a->sequence < b->sequence);
+}
+
+static void _swap(GArray *heap, guint i, guint j)
+{
+  struct _task t = g_array_index(heap, struct _task, i);
+
+  g_array_index(heap, struct _task, i) = g_array_index(heap, struct _task, j);
+  g_array_index(heap, struct _task, j) = t;
+}
+
+scheduler *scheduler_new(void)
+{
+  scheduler *s = g_malloc(sizeof(struct _scheduler));
+
+  s->heap = g_array_new(FALSE, FALSE, sizeof(struct _task));
+  s->next_sequence = 0;
+
+  return s;
+}
+
+/* Frees the scheduler. The data of tasks that are still scheduled is left
+   to the caller. */
+void scheduler_free(scheduler *s)
+{
+  g_array_free(s->heap, TRUE);
+  g_free(s);
+}
+
+/* Schedules 'data' to be returned by scheduler_pop() at time 'due'. */
+void scheduler_add(scheduler *s, gint64 due, gpointer data)
+{
+  struct _task t;
+  guint i, parent;
+
+  t.due = due;
+  t.sequence = s->next_sequence++;
+  t.data = data;
+
+  g_array_append_val(s->heap, t);
+
+  for (i = s->heap->len - 1; i > 0; i = parent) {
+    parent = (i - 1) / 2;
+
+    if (!_task_before(&g_array_index(s->heap, struct _task, i),
+                      &g_array_index(s->heap, struct _task, parent)))
+      break;
+
+    _swap(s->heap, i, parent);
+  }
+}
+
+/* Returns the data of the task that is due first without removing it, and
+   sets 'due' to the time it is due. Returns NULL if no tasks are
+   scheduled. */
+gpointer scheduler_peek(const scheduler *s, gint64 *due)
+{
+  struct _task *first;
+
+  if (s->heap->len == 0)
+    return NULL;
+
+  first = &g_array_index(s->heap, struct _task, 0);
+
+  if (due)
+    *due = first->due;
+
+  return first->data;
+}
+
+/* Removes the task that is due first and returns its data. Sets 'due' to
+   the time it is due. Returns NULL if no tasks are scheduled. */
+gpointer scheduler_pop(scheduler *s, gint64 *due)
+{
+  struct _task first;
+  guint i, child, n;
+
+  if (s->heap->len == 0)
+    return NULL;
+
+  first = g_array_index(s->heap, struct _task, 0);
+
+  n = s->heap->len - 1;
+  g_array_index(s->heap, struct _task, 0) =
+      g_array_index(s->heap, struct _task, n);
+  g_array_set_size(s->heap, n);
+
+  for (i = 0; (child = 2 * i + 1) < n; i = child) {
+    if (child + 1 < n &&
+        _task_before(&g_array_index(s->heap, struct _task, child + 1),
+                     &g_array_index(s->heap, struct _task, child)))
+      child++;
+
+    if (!_task_before(&g_array_index(s->heap, struct _task, child),
+                      &g_array_index(s->heap, struct _task, i)))
+      break;
+
+    _swap(s->heap, i, child);
+  }
+
+  if (due)
+    *due = first.due;
+
+  return first.data;
+}
+
+/* Returns the number of tasks that are scheduled. */
+guint scheduler_size(const scheduler *s)
+{
+  return s->heap->len;
+}
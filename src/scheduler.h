@@ -0,0 +1,34 @@
+/*
+  Copyright (C) 2005-2020 Marius L. Jøhndal
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <glib.h>
+
+typedef struct _scheduler scheduler;
+
+scheduler *scheduler_new(void);
+void scheduler_free(scheduler *s);
+void scheduler_add(scheduler *s, gint64 due, gpointer data);
+gpointer scheduler_peek(const scheduler *s, gint64 *due);
+gpointer scheduler_pop(scheduler *s, gint64 *due);
+guint scheduler_size(const scheduler *s);
+
+#endif /* SCHEDULER_H */
@@ -0,0 +1,294 @@
+/*
+  Copyright (C) 2005-2020 Marius L. Jøhndal
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include "filenames.h"
+#include "spool.h"
+
+#include <glib/gstdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/types.h>
+
+/* Highest number tried when searching for a free filename. */
+#define MAX_COLLISION_SUFFIX 9999
+
+/* Size of a file that has not been looked up yet. */
+#define SIZE_UNKNOWN -1
+
+/* An index of the files in a spool directory. The directory is read once
+   when the index is created, and the index is then kept up to date as
+   enclosures are written so that existence and collision checks do not
+   need to touch the file system. Sizes are only looked up when asked
+   for. */
+struct _spool_index {
+  gchar *directory;
+  GHashTable *files; /* filename -> gint64 size or SIZE_UNKNOWN */
+  gint64 total_size; /* sum of all known sizes, or SIZE_UNKNOWN */
+  gchar *key;        /* key in spool_indexes if shared, or NULL */
+  int users;         /* channels using a shared index */
+};
+
+/* Indexes opened with spool_index_open() by the real path of their
+   directory, so that channels that share a spool directory also share its
+   index and see each other's files. */
+static GHashTable *spool_indexes = NULL;
+
+static gint64 *_size_new(gint64 size)
+{
+  gint64 *p = g_new(gint64, 1);
+
+  *p = size;
+
+  return p;
+}
+
+/* Reads the contents of 'directory' and returns an index of it, or NULL if
+   the directory cannot be read. */
+spool_index *spool_index_new(const gchar *directory)
+{
+  spool_index *s;
+  GDir *dir;
+  const gchar *name;
+
+  dir = g_dir_open(directory, 0, NULL);
+
+  if (!dir)
+    return NULL;
+
+  s = g_malloc(sizeof(struct _spool_index));
+  s->directory = g_strdup(directory);
+  s->files = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+  s->total_size = SIZE_UNKNOWN;
+  s->key = NULL;
+  s->users = 0;
+
+  while ((name = g_dir_read_name(dir)))
+    g_hash_table_insert(s->files, g_strdup(name), _size_new(SIZE_UNKNOWN));
+
+  g_dir_close(dir);
+
+  return s;
+}
+
+void spool_index_free(spool_index *s)
+{
+  g_hash_table_destroy(s->files);
+  g_free(s->directory);
+  g_free(s);
+}
+
+/* Returns the index of 'directory' shared by every channel that has opened
+   it and not closed it yet, reading the directory if there is none. Returns
+   NULL if the directory cannot be read. */
+spool_index *spool_index_open(const gchar *directory)
+{
+  spool_index *s;
+  char *path = realpath(directory, NULL);
+  const gchar *key = path ? path : directory;
+
+  if (!spool_indexes)
+    spool_indexes = g_hash_table_new(g_str_hash, g_str_equal);
+
+  s = g_hash_table_lookup(spool_indexes, key);
+
+  if (!s) {
+    s = spool_index_new(directory);
+
+    if (s) {
+      s->key = g_strdup(key);
+      g_hash_table_insert(spool_indexes, s->key, s);
+    }
+  }
+
+  if (s)
+    s->users++;
+
+  free(path);
+
+  return s;
+}
+
+/* Closes an index opened with spool_index_open(). The index is freed once
+   every channel that opened it has closed it, so that the directory is
+   read again next time. */
+void spool_index_close(spool_index *s)
+{
+  if (--s->users > 0)
+    return;
+
+  g_hash_table_remove(spool_indexes, s->key);
+  g_free(s->key);
+  spool_index_free(s);
+}
+
+const gchar *spool_index_directory(const spool_index *s)
+{
+  return s->directory;
+}
+
+/* Returns TRUE if the spool directory contains a file named 'filename'. */
+gboolean spool_index_contains(const spool_index *s, const gchar *filename)
+{
+  return g_hash_table_lookup(s->files, filename) != NULL;
+}
+
+/* Returns the size of a file in the spool directory or -1 if the file does
+   not exist or its size cannot be determined. The size is looked up the
+   first time it is asked for and remembered afterwards. */
+gint64 spool_index_size(spool_index *s, const gchar *filename)
+{
+  gint64 *size = g_hash_table_lookup(s->files, filename);
+  gchar *pathname;
+  struct stat fileinfo;
+
+  if (!size)
+    return -1;
+
+  if (*size == SIZE_UNKNOWN) {
+    pathname = g_build_filename(s->directory, filename, NULL);
+
+    if (g_stat(pathname, &fileinfo) == 0)
+      *size = fileinfo.st_size;
+
+    g_free(pathname);
+  }
+
+  return *size;
+}
+
+/* Returns the total size of the files in the spool directory. This looks up
+   the size of every file the first time it is called, and is cheap
+   afterwards. */
+gint64 spool_index_total_size(spool_index *s)
+{
+  GHashTableIter iter;
+  gpointer filename;
+  gint64 size;
+
+  if (s->total_size == SIZE_UNKNOWN) {
+    s->total_size = 0;
+
+    g_hash_table_iter_init(&iter, s->files);
+
+    while (g_hash_table_iter_next(&iter, &filename, NULL)) {
+      size = spool_index_size(s, filename);
+
+      if (size > 0)
+        s->total_size += size;
+    }
+  }
+
+  return s->total_size;
+}
+
+/* Returns the number of bytes available to unprivileged users on the file
+   system of the spool directory, or -1 if it cannot be determined. This
+   always asks the file system as other programs may use the same file
+   system. */
+gint64 spool_index_free_space(const spool_index *s)
+{
+  struct statvfs info;
+
+  if (statvfs(s->directory, &info) != 0)
+    return -1;
+
+  return (gint64)info.f_bavail * info.f_frsize;
+}
+
+/* Subtracts the size of a file from the total if both are known. */
+static void _forget_size(spool_index *s, const gchar *filename)
+{
+  gint64 *size = g_hash_table_lookup(s->files, filename);
+
+  if (size && *size > 0 && s->total_size != SIZE_UNKNOWN)
+    s->total_size -= *size;
+}
+
+/* Records that a file named 'filename' with the given size now exists in
+   the spool directory. */
+void spool_index_add(spool_index *s, const gchar *filename, gint64 size)
+{
+  _forget_size(s, filename);
+
+  if (size > 0 && s->total_size != SIZE_UNKNOWN)
+    s->total_size += size;
+
+  g_hash_table_insert(s->files, g_strdup(filename), _size_new(size));
+}
+
+/* Records that a file named 'filename' no longer exists in the spool
+   directory. */
+void spool_index_remove(spool_index *s, const gchar *filename)
+{
+  _forget_size(s, filename);
+
+  g_hash_table_remove(s->files, filename);
+}
+
+/* Returns TRUE if neither 'filename' nor, if 'partial' is set, a partial
+   file for it exists. */
+static gboolean _is_free(const spool_index *s, const gchar *filename,
+                         gboolean partial)
+{
+  gchar *partial_filename;
+  gboolean available;
+
+  if (spool_index_contains(s, filename))
+    return FALSE;
+
+  if (!partial)
+    return TRUE;
+
+  partial_filename = g_strconcat(filename, PARTIAL_SUFFIX, NULL);
+  available = !spool_index_contains(s, partial_filename);
+  g_free(partial_filename);
+
+  return available;
+}
+
+/* Returns 'filename' if no file with that name exists in the spool
+   directory. Otherwise returns the first filename on the form
+   "name (N).ext", with N = 2, 3, ..., that does not exist, or NULL if there
+   is none. If 'partial' is set, the partial file for the filename must not
+   exist either. The caller must free the returned string with g_free(). */
+gchar *spool_index_free_filename(const spool_index *s, const gchar *filename,
+                                 gboolean partial)
+{
+  gchar *candidate;
+  int i;
+
+  if (_is_free(s, filename, partial))
+    return g_strdup(filename);
+
+  for (i = 2; i <= MAX_COLLISION_SUFFIX; i++) {
+    candidate = build_numbered_filename(filename, i);
+
+    if (_is_free(s, candidate, partial))
+      return candidate;
+
+    g_free(candidate);
+  }
+
+  return NULL;
+}
@@ -0,0 +1,44 @@
+/*
+  Copyright (C) 2005-2020 Marius L. Jøhndal
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+
+#ifndef SPOOL_H
+#define SPOOL_H
+
+#include <glib.h>
+
+/* Suffix of files that hold incomplete downloads. */
+#define PARTIAL_SUFFIX ".part"
+
+typedef struct _spool_index spool_index;
+
+spool_index *spool_index_new(const gchar *directory);
+void spool_index_free(spool_index *s);
+spool_index *spool_index_open(const gchar *directory);
+void spool_index_close(spool_index *s);
+const gchar *spool_index_directory(const spool_index *s);
+gboolean spool_index_contains(const spool_index *s, const gchar *filename);
+gint64 spool_index_size(spool_index *s, const gchar *filename);
+gint64 spool_index_total_size(spool_index *s);
+gint64 spool_index_free_space(const spool_index *s);
+void spool_index_add(spool_index *s, const gchar *filename, gint64 size);
+void spool_index_remove(spool_index *s, const gchar *filename);
+gchar *spool_index_free_filename(const spool_index *s, const gchar *filename,
+                                 gboolean partial);
+
+#endif /* SPOOL_H */
@@ -0,0 +1,259 @@
+/*
+  Copyright (C) 2005-2020 Marius L. Jøhndal
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include "trace.h"
+#include "utils.h"
+
+#include <stdio.h>
+#include <unistd.h>
+
+/* Spans of time recorded for profiling a run, written in the trace event
+   format of Chrome so that they can be inspected in Perfetto or
+   chrome://tracing. Nothing is recorded until trace_open() has been called,
+   and trace_begin() then returns 0 so that the matching trace_end() does
+   nothing either. Spans may be recorded from any thread. */
+static gchar *trace_filename = NULL;
+static GString *trace_events = NULL; /* JSON objects separated by commas */
+static gint64 trace_started;
+static GMutex trace_lock;
+static int trace_threads;      /* threads that have recorded a span */
+static int trace_first_thread; /* first thread of the current trace */
+static gsize trace_flushed;     /* length of trace_events after a flush */
+
+/* Number identifying the calling thread in traces, or 0 if it has none
+   yet. Numbers are not reused, so a thread left over from an earlier trace
+   gets a new one. */
+static GPrivate trace_thread = G_PRIVATE_INIT(NULL);
+
+/* Returns the identifier of the calling thread. A thread is named in the
+   trace the first time it records a span. Must be called with the lock
+   held. */
+static int _thread_id(void)
+{
+  int id = GPOINTER_TO_INT(g_private_get(&trace_thread));
+
+  if (id && id >= trace_first_thread)
+    return id;
+
+  id = ++trace_threads;
+  g_private_set(&trace_thread, GINT_TO_POINTER(id));
+
+  if (trace_events->len)
+    g_string_append(trace_events, ",\n");
+
+  g_string_append_printf(trace_events,
+                         "{\"name\": \"thread_name\", \"ph\": \"M\", "
+                         "\"pid\": %d, \"tid\": %d, \"args\": {\"name\": "
+                         "\"%s %d\"}}",
+                         (int)getpid(), id,
+                         id == trace_first_thread ? "main" : "thread", id);
+
+  return id;
+}
+
+/* Starts recording spans to be written to 'filename' by trace_close().
+   Returns 0 on success. */
+int trace_open(const gchar *filename)
+{
+  if (trace_events)
+    return -1;
+
+  trace_filename = g_strdup(filename);
+  trace_events = g_string_new(NULL);
+  trace_started = g_get_monotonic_time();
+  trace_first_thread = trace_threads + 1;
+  trace_flushed = 0;
+
+  /* The thread that opens the trace is the main thread. */
+  g_mutex_lock(&trace_lock);
+  _thread_id();
+  g_mutex_unlock(&trace_lock);
+
+  return 0;
+}
+
+/* Writes the spans recorded so far to the trace file. Returns 0 on
+   success. */
+static int _write(void)
+{
+  GString *s;
+  GError *error = NULL;
+  int ret = 0;
+
+  s = g_string_new("{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+  g_string_append_len(s, trace_events->str, trace_events->len);
+  g_string_append(s, "\n]}\n");
+
+  /* The file is replaced in a single step. */
+  if (!g_file_set_contents(trace_filename, s->str, s->len, &error)) {
+    fprintf(stderr, "Error writing trace %s: %s.\n", trace_filename,
+            error->message);
+    g_error_free(error);
+    ret = -1;
+  }
+
+  g_string_free(s, TRUE);
+
+  return ret;
+}
+
+/* Writes the spans recorded so far and starts the trace over, so that a
+   process that runs for a long time does not keep every span in memory.
+   The file then holds the spans recorded since the previous call. The
+   calling thread becomes the main thread of the new trace. Returns 0 on
+   success. */
+int trace_flush(void)
+{
+  int ret;
+
+  if (!trace_events)
+    return 0;
+
+  g_mutex_lock(&trace_lock);
+
+  ret = _write();
+  g_string_truncate(trace_events, 0);
+
+  /* Threads are named again in the new trace. */
+  trace_first_thread = trace_threads + 1;
+  _thread_id();
+  trace_flushed = trace_events->len;
+
+  g_mutex_unlock(&trace_lock);
+
+  return ret;
+}
+
+/* Stops recording and writes the spans recorded so far. A trace that has
+   been flushed is left as it is if nothing was recorded since. All threads
+   that record spans must have finished. Returns 0 on success. */
+int trace_close(void)
+{
+  int ret = 0;
+
+  if (!trace_events)
+    return 0;
+
+  if (trace_events->len != trace_flushed)
+    ret = _write();
+
+  g_string_free(trace_events, TRUE);
+  trace_events = NULL;
+  g_free(trace_filename);
+  trace_filename = NULL;
+
+  return ret;
+}
+
+/* Returns the time at which a span starts, or 0 if tracing is off. */
+gint64 trace_begin(void)
+{
+  if (!trace_events)
+    return 0;
+
+  return g_get_monotonic_time();
+}
+
+/* Appends an event. Must be called with the lock held. */
+static void _append_event(const gchar *phase, gint64 ts, const gchar *category,
+                          const gchar *name, const gchar *detail)
+{
+  GString *s = trace_events;
+  int tid = _thread_id();
+
+  g_string_append(s, ",\n{\"name\": ");
+  append_json_string(s, name);
+  g_string_append(s, ", \"cat\": ");
+  append_json_string(s, category);
+  g_string_append_printf(s,
+                         ", \"ph\": \"%s\", \"ts\": %" G_GINT64_FORMAT
+                         ", \"pid\": %d, \"tid\": %d",
+                         phase, ts - trace_started, (int)getpid(), tid);
+
+  if (detail) {
+    g_string_append(s, ", \"args\": {\"detail\": ");
+    append_json_string(s, detail);
+    g_string_append_c(s, '}');
+  }
+}
+
+/* Records a span that started at 'begin', as returned by trace_begin(), and
+   ends now. 'detail', which may be NULL, tells spans with the same name
+   apart, for example by URL or filename. */
+void trace_end(gint64 begin, const gchar *category, const gchar *name,
+               const gchar *detail)
+{
+  if (!begin)
+    return;
+
+  trace_span(begin, g_get_monotonic_time() - begin, category, name, detail);
+}
+
+/* Records a span of 'duration' microseconds that started at 'begin' in
+   monotonic time. Spans recorded by one thread must nest. */
+void trace_span(gint64 begin, gint64 duration, const gchar *category,
+                const gchar *name, const gchar *detail)
+{
+  if (!trace_events)
+    return;
+
+  g_mutex_lock(&trace_lock);
+
+  _append_event("X", begin, category, name, detail);
+  g_string_append_printf(trace_events, ", \"dur\": %" G_GINT64_FORMAT "}",
+                         MAX(duration, 0));
+
+  g_mutex_unlock(&trace_lock);
+}
+
+/* Records a span like trace_span() that may overlap other spans of the same
+   thread, such as a transfer run alongside others. Spans with the same 'id'
+   are shown on their own track and must nest. */
+void trace_async_span(gconstpointer id, gint64 begin, gint64 duration,
+                      const gchar *category, const gchar *name,
+                      const gchar *detail)
+{
+  if (!trace_events)
+    return;
+
+  g_mutex_lock(&trace_lock);
+
+  _append_event("b", begin, category, name, detail);
+  g_string_append_printf(trace_events, ", \"id\": \"%p\"}", id);
+  _append_event("e", begin + MAX(duration, 0), category, name, NULL);
+  g_string_append_printf(trace_events, ", \"id\": \"%p\"}", id);
+
+  g_mutex_unlock(&trace_lock);
+}
+
+/* Records a span like trace_end() that may overlap other spans of the same
+   thread. See trace_async_span(). */
+void trace_async_end(gconstpointer id, gint64 begin, const gchar *category,
+                     const gchar *name, const gchar *detail)
+{
+  if (!begin)
+    return;
+
+  trace_async_span(id, begin, g_get_monotonic_time() - begin, category, name,
+                   detail);
+}
@@ -0,0 +1,39 @@
+/*
+  Copyright (C) 2005-2020 Marius L. Jøhndal
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <glib.h>
+
+int trace_open(const gchar *filename);
+int trace_flush(void);
+int trace_close(void);
+gint64 trace_begin(void);
+void trace_end(gint64 begin, const gchar *category, const gchar *name,
+               const gchar *detail);
+void trace_span(gint64 begin, gint64 duration, const gchar *category,
+                const gchar *name, const gchar *detail);
+void trace_async_end(gconstpointer id, gint64 begin, const gchar *category,
+                     const gchar *name, const gchar *detail);
+void trace_async_span(gconstpointer id, gint64 begin, gint64 duration,
+                      const gchar *category, const gchar *name,
+                      const gchar *detail);
+
+#endif /* TRACE_H */
@@ -0,0 +1,285 @@
+/*
+  Copyright (C) 2005-2020 Marius L. Jøhndal
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include "transfer.h"
+
+#include <stdio.h>
+
+/* Limits on the number of connections kept open at the same time. Further
+   transfers wait in libcurl until a connection becomes available, which
+   costs next to nothing, so that thousands of transfers can be added at
+   once without running out of file descriptors or flooding a server. */
+#define MAX_CONNECTIONS 256
+#define MAX_HOST_CONNECTIONS 6
+
+/* Runs any number of transfers concurrently in a single thread. libcurl
+   tells the engine which sockets to watch and when to time out, and the
+   engine waits for these events in a main context of its own, so that it
+   neither depends on nor disturbs a main loop run elsewhere. */
+struct _transfer_engine {
+  CURLM *multi;
+  GMainContext *context;
+  GSource *timer;
+  guint active;
+};
+
+/* A socket watched on behalf of libcurl. */
+struct _transfer_socket {
+  GIOChannel *channel;
+  GSource *source;
+};
+
+/* A transfer in progress. */
+struct _transfer {
+  transfer_done_func done;
+  gpointer user_data;
+};
+
+/* Hands finished transfers back to their owners. */
+static void _transfer_engine_check_done(transfer_engine *e)
+{
+  CURLMsg *msg;
+  CURL *easyhandle;
+  CURLcode result;
+  struct _transfer *t;
+  int pending;
+
+  while ((msg = curl_multi_info_read(e->multi, &pending))) {
+    if (msg->msg != CURLMSG_DONE)
+      continue;
+
+    easyhandle = msg->easy_handle;
+    result = msg->data.result;
+
+    curl_easy_getinfo(easyhandle, CURLINFO_PRIVATE, (char **)&t);
+    curl_multi_remove_handle(e->multi, easyhandle);
+    e->active--;
+
+    t->done(easyhandle, result, t->user_data);
+
+    curl_easy_cleanup(easyhandle);
+    g_free(t);
+  }
+}
+
+static gboolean _transfer_engine_socket_cb(GIOChannel *channel,
+                                           GIOCondition condition,
+                                           gpointer user_data)
+{
+  transfer_engine *e = (transfer_engine *)user_data;
+  int flags = 0;
+  int running;
+
+  if (condition & (G_IO_IN | G_IO_HUP))
+    flags |= CURL_CSELECT_IN;
+
+  if (condition & G_IO_OUT)
+    flags |= CURL_CSELECT_OUT;
+
+  if (condition & G_IO_ERR)
+    flags |= CURL_CSELECT_ERR;
+
+  curl_multi_socket_action(e->multi, g_io_channel_unix_get_fd(channel),
+                           flags, &running);
+
+  _transfer_engine_check_done(e);
+
+  /* The watch is removed through _transfer_engine_watch() when libcurl no
+     longer needs it. */
+  return TRUE;
+}
+
+static gboolean _transfer_engine_timeout_cb(gpointer user_data)
+{
+  transfer_engine *e = (transfer_engine *)user_data;
+  int running;
+
+  /* The timer fires only once, and libcurl may set a new one below. */
+  g_source_unref(e->timer);
+  e->timer = NULL;
+
+  curl_multi_socket_action(e->multi, CURL_SOCKET_TIMEOUT, 0, &running);
+
+  _transfer_engine_check_done(e);
+
+  return FALSE;
+}
+
+static void _transfer_socket_free(struct _transfer_socket *s)
+{
+  g_source_destroy(s->source);
+  g_source_unref(s->source);
+  g_io_channel_unref(s->channel);
+  g_free(s);
+}
+
+/* Called by libcurl to start, change or stop watching a socket. */
+static int _transfer_engine_watch(CURL *easyhandle, curl_socket_t fd,
+                                  int what, void *user_data, void *socket_data)
+{
+  transfer_engine *e = (transfer_engine *)user_data;
+  struct _transfer_socket *s = (struct _transfer_socket *)socket_data;
+  GIOCondition condition = G_IO_ERR | G_IO_HUP;
+
+  if (what == CURL_POLL_REMOVE) {
+    if (s) {
+      _transfer_socket_free(s);
+      curl_multi_assign(e->multi, fd, NULL);
+    }
+
+    return 0;
+  }
+
+  if (what & CURL_POLL_IN)
+    condition |= G_IO_IN;
+
+  if (what & CURL_POLL_OUT)
+    condition |= G_IO_OUT;
+
+  if (s) {
+    g_source_destroy(s->source);
+    g_source_unref(s->source);
+  } else {
+    s = g_malloc(sizeof(struct _transfer_socket));
+    s->channel = g_io_channel_unix_new(fd);
+    curl_multi_assign(e->multi, fd, s);
+  }
+
+  s->source = g_io_create_watch(s->channel, condition);
+  g_source_set_callback(s->source, (GSourceFunc)_transfer_engine_socket_cb, e,
+                        NULL);
+  g_source_attach(s->source, e->context);
+
+  return 0;
+}
+
+/* Called by libcurl to set or cancel the timer that drives timeouts and
+   transfers that are not waiting for a socket. */
+static int _transfer_engine_set_timer(CURLM *multi, long timeout_ms,
+                                      void *user_data)
+{
+  transfer_engine *e = (transfer_engine *)user_data;
+
+  if (e->timer) {
+    g_source_destroy(e->timer);
+    g_source_unref(e->timer);
+    e->timer = NULL;
+  }
+
+  if (timeout_ms >= 0) {
+    e->timer = g_timeout_source_new(timeout_ms);
+    g_source_set_callback(e->timer, _transfer_engine_timeout_cb, e, NULL);
+    g_source_attach(e->timer, e->context);
+  }
+
+  return 0;
+}
+
+transfer_engine *transfer_engine_new(void)
+{
+  transfer_engine *e;
+
+  e = g_malloc(sizeof(struct _transfer_engine));
+
+  e->multi = curl_multi_init();
+
+  if (!e->multi) {
+    fprintf(stderr, "Error initialising libcurl.\n");
+    g_free(e);
+    return NULL;
+  }
+
+  e->context = g_main_context_new();
+  e->timer = NULL;
+  e->active = 0;
+
+  curl_multi_setopt(e->multi, CURLMOPT_SOCKETFUNCTION, _transfer_engine_watch);
+  curl_multi_setopt(e->multi, CURLMOPT_SOCKETDATA, e);
+  curl_multi_setopt(e->multi, CURLMOPT_TIMERFUNCTION,
+                    _transfer_engine_set_timer);
+  curl_multi_setopt(e->multi, CURLMOPT_TIMERDATA, e);
+
+#if LIBCURL_VERSION_NUM >= 0x071e00
+  curl_multi_setopt(e->multi, CURLMOPT_MAX_TOTAL_CONNECTIONS,
+                    (long)MAX_CONNECTIONS);
+  curl_multi_setopt(e->multi, CURLMOPT_MAX_HOST_CONNECTIONS,
+                    (long)MAX_HOST_CONNECTIONS);
+#endif
+
+  return e;
+}
+
+/* Frees the engine. Transfers that have not finished are abandoned without
+   calling their completion functions. */
+void transfer_engine_free(transfer_engine *e)
+{
+  curl_multi_cleanup(e->multi);
+
+  if (e->timer) {
+    g_source_destroy(e->timer);
+    g_source_unref(e->timer);
+  }
+
+  g_main_context_unref(e->context);
+  g_free(e);
+}
+
+/* Starts a transfer that has been set up on 'easyhandle'. The engine takes
+   over the handle, and 'done' is called from transfer_engine_run() once the
+   transfer has finished. Returns 0 on success and 1 if the transfer could
+   not be started, in which case the handle is left to the caller. */
+int transfer_engine_add(transfer_engine *e, CURL *easyhandle,
+                        transfer_done_func done, gpointer user_data)
+{
+  struct _transfer *t;
+
+  t = g_malloc(sizeof(struct _transfer));
+  t->done = done;
+  t->user_data = user_data;
+
+  curl_easy_setopt(easyhandle, CURLOPT_PRIVATE, t);
+
+  if (curl_multi_add_handle(e->multi, easyhandle) != CURLM_OK) {
+    fprintf(stderr, "Error starting transfer.\n");
+    g_free(t);
+    return 1;
+  }
+
+  e->active++;
+
+  return 0;
+}
+
+/* Runs the transfers until all of them, including any added by completion
+   functions, have finished. */
+void transfer_engine_run(transfer_engine *e)
+{
+  while (e->active)
+    g_main_context_iteration(e->context, TRUE);
+}
+
+/* Returns the number of transfers that have not finished. */
+guint transfer_engine_active(const transfer_engine *e)
+{
+  return e->active;
+}
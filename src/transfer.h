@@ -0,0 +1,41 @@
+/*
+  Copyright (C) 2005-2020 Marius L. Jøhndal
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+
+#ifndef TRANSFER_H
+#define TRANSFER_H
+
+#include <curl/curl.h>
+#include <glib.h>
+
+typedef struct _transfer_engine transfer_engine;
+
+/* Called when a transfer has finished. The easy handle may be queried for
+   information about the transfer but is cleaned up by the engine once the
+   function returns. */
+typedef void (*transfer_done_func)(CURL *easyhandle, CURLcode result,
+                                   gpointer user_data);
+
+transfer_engine *transfer_engine_new(void);
+void transfer_engine_free(transfer_engine *e);
+int transfer_engine_add(transfer_engine *e, CURL *easyhandle,
+                        transfer_done_func done, gpointer user_data);
+void transfer_engine_run(transfer_engine *e);
+guint transfer_engine_active(const transfer_engine *e);
+
+#endif /* TRANSFER_H */
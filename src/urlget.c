@@ -22,6 +22,7 @@
 #endif /* HAVE_CONFIG_H */
 
 #include "progress.h"
+#include "trace.h"
 #include "urlget.h"
 
 #include <curl/curl.h>
@@ -29,74 +30,717 @@
 #include <stdlib.h>
 #include <string.h>
 
-int urlget_file(const char *url, FILE *f, int debug)
+/* Timeouts that apply unless the caller sets them. Without them, a server
+   that accepts a connection and then sends nothing, or next to nothing,
+   holds up the transfer indefinitely. */
+#define DEFAULT_CONNECT_TIMEOUT 30
+#define DEFAULT_FIRST_BYTE_TIMEOUT 60
+#define DEFAULT_LOW_SPEED_LIMIT 1024
+#define DEFAULT_LOW_SPEED_TIME 60
+
+/* Upper bounds of the buckets in urlget_stats.durations in milliseconds.
+   The last bucket has no bound and takes every transfer that is slower. */
+static const gint64 duration_buckets[URLGET_DURATION_BUCKETS - 1] = {
+  50, 100, 250, 500, 1000, 2500, 5000, 10000, 30000, 60000, 300000
+};
+
+static const char *error_class_names[URLGET_NUM_ERROR_CLASSES] = {
+  "dns", "connect", "tls", "timeout", "receive", "http", "size", "other"
+};
+
+struct _urlget_sink {
+  CURL *easyhandle;
+  void *user_data;
+  size_t (*write_buffer)(void *buffer, size_t size, size_t nmemb,
+                         void *user_data);
+  int (*start)(gint64 content_length, void *user_data);
+  int started;
+  int declined;
+  gint64 max_size;
+  gint64 received;
+  int size_exceeded;
+};
+
+/* A request in progress. */
+struct _urlget_request {
+  struct _urlget_sink sink;
+  char errbuf[CURL_ERROR_SIZE];
+  gchar *user_agent;
+  const char *url;
+  long resume_from;
+  progress_display *progress;
+  progress_transfer *shown; /* the transfer on the display, once started */
+  gint64 first_byte_timeout; /* seconds */
+  gint64 waiting_since;      /* when the wait for the first data began */
+  int first_byte_timed_out;
+  gint64 complete_length; /* from Content-Range when resuming, or -1 */
+  urlget_stats *stats;
+};
+
+/* State shared between transfers once urlget_init() has been called. */
+static CURLSH *share = NULL;
+
+/* Returns the length of the content announced by the server or -1 if it is
+   unknown. */
+static gint64 _content_length(CURL *easyhandle)
+{
+#if LIBCURL_VERSION_NUM >= 0x073700
+  curl_off_t length = -1;
+
+  if (curl_easy_getinfo(easyhandle, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T,
+                        &length) != CURLE_OK)
+    return -1;
+#else
+  double length = -1;
+
+  if (curl_easy_getinfo(easyhandle, CURLINFO_CONTENT_LENGTH_DOWNLOAD,
+                        &length) != CURLE_OK)
+    return -1;
+#endif
+
+  return (gint64)length;
+}
+
+/* Passes data on to the caller's write function, or writes it to the
+   caller's stream if there is none, while keeping track of the amount of
+   data received. Aborts the transfer once the size limit is exceeded. This
+   complements CURLOPT_MAXFILESIZE, which only takes effect when the server
+   announces the size of the content up front. Before the first data is
+   passed on, the caller's start function is told the length of the
+   content, and the transfer is aborted if it declines it. The caller's
+   write function may also decline the rest of the content. */
+static size_t _urlget_write_cb(void *buffer, size_t size, size_t nmemb,
+                               void *user_data)
+{
+  struct _urlget_sink *sink = (struct _urlget_sink *)user_data;
+  size_t n = size * nmemb;
+
+  if (!sink->started) {
+    sink->started = 1;
+
+    if (sink->start &&
+        sink->start(_content_length(sink->easyhandle), sink->user_data)) {
+      sink->declined = 1;
+      return 0;
+    }
+  }
+
+  if (sink->max_size && sink->received + n > sink->max_size) {
+    sink->size_exceeded = 1;
+    return 0;
+  }
+
+  sink->received += n;
+
+  if (sink->write_buffer) {
+    n = sink->write_buffer(buffer, size, nmemb, sink->user_data);
+
+    if (n == URLGET_WRITE_DECLINED) {
+      sink->declined = 1;
+      return 0;
+    }
+
+    return n;
+  } else
+    return fwrite(buffer, size, nmemb, (FILE *)sink->user_data);
+}
+
+/* Picks up the complete length of the content from the Content-Range
+   header of a response to a resumed request, where it follows the slash.
+   This is how a server that refuses the range with 416 says how long the
+   content is. Only the last response counts when redirects are
+   followed. */
+static size_t _urlget_header_cb(char *buffer, size_t size, size_t nitems,
+                                void *user_data)
+{
+  struct _urlget_request *r = (struct _urlget_request *)user_data;
+  size_t n = size * nitems;
+  const char *p, *end = buffer + n;
+  gint64 length = 0;
+
+  if (n >= 5 && !g_ascii_strncasecmp(buffer, "HTTP/", 5))
+    r->complete_length = -1;
+  else if (n > 14 && !g_ascii_strncasecmp(buffer, "Content-Range:", 14)) {
+    p = memchr(buffer, '/', n);
+
+    if (p && ++p < end && g_ascii_isdigit(*p)) {
+      for (; p < end && g_ascii_isdigit(*p) && length < G_MAXINT64 / 10; p++)
+        length = length * 10 + (*p - '0');
+
+      r->complete_length = length;
+    }
+  }
+
+  return n;
+}
+
+/* Returns the time from the start of a transfer until the given point in
+   microseconds, or 0 if the transfer did not get there. */
+#if LIBCURL_VERSION_NUM >= 0x073d00
+static gint64 _elapsed(CURL *easyhandle, CURLINFO info)
+{
+  curl_off_t t = 0;
+
+  curl_easy_getinfo(easyhandle, info, &t);
+
+  return (gint64)t;
+}
+
+#define ELAPSED(easyhandle, info) _elapsed(easyhandle, info##_T)
+#else
+static gint64 _elapsed(CURL *easyhandle, CURLINFO info)
+{
+  double t = 0;
+
+  curl_easy_getinfo(easyhandle, info, &t);
+
+  return (gint64)(t * G_USEC_PER_SEC);
+}
+
+#define ELAPSED(easyhandle, info) _elapsed(easyhandle, info)
+#endif
+
+const char *urlget_error_class_name(urlget_error_class c)
 {
-  return urlget_buffer(url, (void *)f, NULL, 0, debug, NULL);
+  return error_class_names[c];
+}
+
+/* Returns the upper bound of bucket 'i' of urlget_stats.durations in
+   milliseconds, or -1 for the last bucket, which has no bound. */
+gint64 urlget_duration_bucket(int i)
+{
+  return i < URLGET_DURATION_BUCKETS - 1 ? duration_buckets[i] : -1;
+}
+
+/* Adds the measurements in 'other' to 'stats'. */
+void urlget_stats_add(urlget_stats *stats, const urlget_stats *other)
+{
+  int i;
+
+  stats->transfers += other->transfers;
+
+  for (i = 0; i < URLGET_NUM_ERROR_CLASSES; i++)
+    stats->failures[i] += other->failures[i];
+
+  for (i = 0; i < URLGET_DURATION_BUCKETS; i++)
+    stats->durations[i] += other->durations[i];
+
+  stats->bytes += other->bytes;
+  stats->dns_time += other->dns_time;
+  stats->connect_time += other->connect_time;
+  stats->tls_time += other->tls_time;
+  stats->first_byte_time += other->first_byte_time;
+  stats->total_time += other->total_time;
+}
+
+static urlget_error_class _error_class(CURLcode code)
+{
+  switch (code) {
+  case CURLE_COULDNT_RESOLVE_PROXY:
+  case CURLE_COULDNT_RESOLVE_HOST:
+    return URLGET_ERROR_DNS;
+
+  case CURLE_COULDNT_CONNECT:
+    return URLGET_ERROR_CONNECT;
+
+  case CURLE_SSL_CONNECT_ERROR:
+  case CURLE_PEER_FAILED_VERIFICATION:
+  case CURLE_SSL_CERTPROBLEM:
+  case CURLE_SSL_CIPHER:
+  case CURLE_SSL_CACERT_BADFILE:
+    return URLGET_ERROR_TLS;
+
+  case CURLE_OPERATION_TIMEDOUT:
+    return URLGET_ERROR_TIMEOUT;
+
+  case CURLE_PARTIAL_FILE:
+  case CURLE_GOT_NOTHING:
+  case CURLE_SEND_ERROR:
+  case CURLE_RECV_ERROR:
+    return URLGET_ERROR_RECEIVE;
+
+  case CURLE_HTTP_RETURNED_ERROR:
+    return URLGET_ERROR_HTTP;
+
+  case CURLE_FILESIZE_EXCEEDED:
+    return URLGET_ERROR_SIZE;
+
+  default:
+    return URLGET_ERROR_OTHER;
+  }
+}
+
+/* Adds the time spent in each phase of a finished transfer to 'stats'.
+   libcurl reports the time from the start of the transfer until each
+   phase ended. */
+static void _urlget_add_stats(urlget_stats *stats, CURL *easyhandle,
+                              gint64 received)
+{
+  gint64 dns, connect, tls, pretransfer, starttransfer, total;
+  int i;
+
+  dns = ELAPSED(easyhandle, CURLINFO_NAMELOOKUP_TIME);
+  connect = MAX(ELAPSED(easyhandle, CURLINFO_CONNECT_TIME), dns);
+  tls = MAX(ELAPSED(easyhandle, CURLINFO_APPCONNECT_TIME), connect);
+  pretransfer = MAX(ELAPSED(easyhandle, CURLINFO_PRETRANSFER_TIME), tls);
+  starttransfer = ELAPSED(easyhandle, CURLINFO_STARTTRANSFER_TIME);
+
+  stats->transfers++;
+  stats->bytes += received;
+  stats->dns_time += dns;
+  stats->connect_time += connect - dns;
+  stats->tls_time += tls - connect;
+
+  if (starttransfer > pretransfer)
+    stats->first_byte_time += starttransfer - pretransfer;
+
+  total = ELAPSED(easyhandle, CURLINFO_TOTAL_TIME);
+  stats->total_time += total;
+
+  for (i = 0; i < URLGET_DURATION_BUCKETS - 1; i++)
+    if (total <= duration_buckets[i] * 1000)
+      break;
+
+  stats->durations[i]++;
+}
+
+/* Records the phases of a finished transfer in the trace. The transfer is
+   taken to have ended now. */
+static void _urlget_trace(CURL *easyhandle, const char *url)
+{
+  gint64 end, start, dns, connect, tls, pretransfer, starttransfer, total;
+
+  end = trace_begin();
+
+  if (!end)
+    return;
+
+  dns = ELAPSED(easyhandle, CURLINFO_NAMELOOKUP_TIME);
+  connect = MAX(ELAPSED(easyhandle, CURLINFO_CONNECT_TIME), dns);
+  tls = MAX(ELAPSED(easyhandle, CURLINFO_APPCONNECT_TIME), connect);
+  pretransfer = MAX(ELAPSED(easyhandle, CURLINFO_PRETRANSFER_TIME), tls);
+  starttransfer =
+      MAX(ELAPSED(easyhandle, CURLINFO_STARTTRANSFER_TIME), pretransfer);
+  total = MAX(ELAPSED(easyhandle, CURLINFO_TOTAL_TIME), starttransfer);
+  start = end - total;
+
+  trace_async_span(easyhandle, start, total, "network", "transfer", url);
+  trace_async_span(easyhandle, start, dns, "network", "dns", NULL);
+  trace_async_span(easyhandle, start + dns, connect - dns, "network",
+                   "connect", NULL);
+
+  if (tls > connect)
+    trace_async_span(easyhandle, start + connect, tls - connect, "network",
+                     "tls", NULL);
+
+  trace_async_span(easyhandle, start + pretransfer,
+                   starttransfer - pretransfer, "network", "first_byte",
+                   NULL);
+  trace_async_span(easyhandle, start + starttransfer, total - starttransfer,
+                   "network", "receive", NULL);
+}
+
+/* Aborts a transfer if no content has arrived within the first byte
+   timeout, and passes progress on to the progress display if there is one.
+   libcurl calls this about once a second while a transfer is running, even
+   if nothing happens, and more often as data arrives. */
+static int _urlget_xferinfo_cb(void *clientp, curl_off_t dltotal,
+                               curl_off_t dlnow, curl_off_t ultotal,
+                               curl_off_t ulnow)
+{
+  struct _urlget_request *r = (struct _urlget_request *)clientp;
+  gint64 now;
+
+  if (!r->sink.started) {
+    now = g_get_monotonic_time();
+
+    if (!r->waiting_since)
+      r->waiting_since = now;
+    else if (now - r->waiting_since >
+             r->first_byte_timeout * G_USEC_PER_SEC) {
+      r->first_byte_timed_out = 1;
+      return 1;
+    }
+  }
+
+  /* Transfers are shown once content arrives so that those waiting for a
+     connection do not crowd the display. */
+  if (r->progress && r->sink.started) {
+    if (!r->shown)
+      r->shown =
+          progress_display_start(r->progress, r->url, r->resume_from);
+
+    progress_display_update(r->progress, r->shown, dltotal, dlnow);
+  }
+
+  return 0;
 }
 
+#if LIBCURL_VERSION_NUM < 0x072000
+/* Older versions of libcurl only report progress in doubles. */
+static int _urlget_progress_cb(void *clientp, double dltotal, double dlnow,
+                               double ultotal, double ulnow)
+{
+  return _urlget_xferinfo_cb(clientp, (curl_off_t)dltotal, (curl_off_t)dlnow,
+                             (curl_off_t)ultotal, (curl_off_t)ulnow);
+}
+#endif
+
+static void _urlget_set_timeouts(struct _urlget_request *r, CURL *easyhandle,
+                                 const urlget_timeouts *timeouts)
+{
+  gint64 connect = DEFAULT_CONNECT_TIMEOUT;
+  gint64 low_speed_limit = DEFAULT_LOW_SPEED_LIMIT;
+  gint64 low_speed_time = DEFAULT_LOW_SPEED_TIME;
+  gint64 total = 0, left; /* milliseconds */
+
+  r->first_byte_timeout = DEFAULT_FIRST_BYTE_TIMEOUT;
+
+  if (timeouts) {
+    if (timeouts->connect)
+      connect = timeouts->connect;
+
+    if (timeouts->first_byte)
+      r->first_byte_timeout = timeouts->first_byte;
+
+    if (timeouts->low_speed_limit)
+      low_speed_limit = timeouts->low_speed_limit;
+
+    if (timeouts->low_speed_time)
+      low_speed_time = timeouts->low_speed_time;
+
+    if (timeouts->total)
+      total = timeouts->total * 1000;
+
+    if (timeouts->deadline) {
+      left = (timeouts->deadline - g_get_monotonic_time()) / 1000;
+      left = MAX(left, 1);
+
+      if (!total || left < total)
+        total = left;
+    }
+
+    if (total)
+      curl_easy_setopt(easyhandle, CURLOPT_TIMEOUT_MS, (long)total);
+  }
+
+  curl_easy_setopt(easyhandle, CURLOPT_CONNECTTIMEOUT, (long)connect);
+  curl_easy_setopt(easyhandle, CURLOPT_LOW_SPEED_LIMIT, (long)low_speed_limit);
+  curl_easy_setopt(easyhandle, CURLOPT_LOW_SPEED_TIME, (long)low_speed_time);
+}
+
+/* Sets up sharing of DNS lookups, TLS sessions and, where libcurl supports
+   it, open connections between transfers, so that a connection to a server
+   can be reused by later transfers. Transfers must not run in more than one
+   thread at a time while sharing is enabled, but any number of them may run
+   in a single transfer engine. Returns 0 on success and 1 on failure. */
+int urlget_init(void)
+{
+  if (curl_global_init(CURL_GLOBAL_DEFAULT) != CURLE_OK) {
+    fprintf(stderr, "Error initialising libcurl.\n");
+    return 1;
+  }
+
+  share = curl_share_init();
+
+  if (share) {
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+#if LIBCURL_VERSION_NUM >= 0x073900
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+#endif
+  }
+
+  return 0;
+}
+
+/* Closes shared connections and releases what urlget_init() set up. */
+void urlget_cleanup(void)
+{
+  if (share) {
+    curl_share_cleanup(share);
+    share = NULL;
+  }
+
+  curl_global_cleanup();
+}
+
+int urlget_file(const char *url, FILE *f, gint64 max_size,
+                const urlget_timeouts *timeouts, urlget_stats *stats,
+                int debug)
+{
+  return urlget_buffer(url, (void *)f, NULL, NULL, 0, max_size, 0, timeouts,
+                       stats, debug, NULL);
+}
+
+/* Sets up a request to retrieve 'url'. Returns NULL if libcurl could not be
+   initialised. */
+static CURL *_urlget_request_init(
+    struct _urlget_request *r, const char *url, void *user_data,
+    size_t (*write_buffer)(void *buffer, size_t size, size_t nmemb,
+                           void *user_data),
+    int (*start)(gint64 content_length, void *user_data), long resume_from,
+    gint64 max_size, gint64 buffer_size, const urlget_timeouts *timeouts,
+    urlget_stats *stats, int debug, progress_display *progress)
+{
+  CURL *easyhandle;
+
+  easyhandle = curl_easy_init();
+
+  if (!easyhandle)
+    return NULL;
+
+  r->sink.easyhandle = easyhandle;
+  r->sink.user_data = user_data;
+  r->sink.write_buffer = write_buffer;
+  r->sink.start = start;
+  r->sink.started = 0;
+  r->sink.declined = 0;
+  r->sink.max_size = max_size;
+  r->sink.received = 0;
+  r->sink.size_exceeded = 0;
+  r->url = url;
+  r->resume_from = resume_from;
+  r->progress = progress;
+  r->shown = NULL;
+  r->waiting_since = 0;
+  r->first_byte_timed_out = 0;
+  r->complete_length = -1;
+  r->stats = stats;
+
+  /* Construct user agent string. */
+  r->user_agent = g_strdup_printf("%s (%s rss enclosure downloader)",
+                                  PACKAGE_STRING, PACKAGE);
+
+  curl_easy_setopt(easyhandle, CURLOPT_URL, url);
+  curl_easy_setopt(easyhandle, CURLOPT_ERRORBUFFER, r->errbuf);
+  curl_easy_setopt(easyhandle, CURLOPT_WRITEFUNCTION, _urlget_write_cb);
+  curl_easy_setopt(easyhandle, CURLOPT_WRITEDATA, &r->sink);
+
+  if (share)
+    curl_easy_setopt(easyhandle, CURLOPT_SHARE, share);
+
+  if (max_size)
+    curl_easy_setopt(easyhandle, CURLOPT_MAXFILESIZE_LARGE,
+                     (curl_off_t)max_size);
+
+  /* libcurl clamps the size to the range it supports. */
+  if (buffer_size)
+    curl_easy_setopt(easyhandle, CURLOPT_BUFFERSIZE, (long)buffer_size);
+
+  curl_easy_setopt(easyhandle, CURLOPT_FOLLOWLOCATION, 1);
+
+  /* Never save an error page in place of the content. */
+  curl_easy_setopt(easyhandle, CURLOPT_FAILONERROR, 1);
+  curl_easy_setopt(easyhandle, CURLOPT_USERAGENT, r->user_agent);
+  curl_easy_setopt(easyhandle, CURLOPT_ACCEPT_ENCODING, "");
+
+  _urlget_set_timeouts(r, easyhandle, timeouts);
+
+  /* The progress function also enforces the first byte timeout. */
+  curl_easy_setopt(easyhandle, CURLOPT_NOPROGRESS, 0);
+#if LIBCURL_VERSION_NUM >= 0x072000
+  curl_easy_setopt(easyhandle, CURLOPT_XFERINFOFUNCTION, _urlget_xferinfo_cb);
+  curl_easy_setopt(easyhandle, CURLOPT_XFERINFODATA, r);
+#else
+  curl_easy_setopt(easyhandle, CURLOPT_PROGRESSFUNCTION, _urlget_progress_cb);
+  curl_easy_setopt(easyhandle, CURLOPT_PROGRESSDATA, r);
+#endif
+
+  if (resume_from) {
+    curl_easy_setopt(easyhandle, CURLOPT_RESUME_FROM_LARGE,
+                     (curl_off_t)resume_from);
+    curl_easy_setopt(easyhandle, CURLOPT_HEADERFUNCTION, _urlget_header_cb);
+    curl_easy_setopt(easyhandle, CURLOPT_HEADERDATA, r);
+  }
+
+  curl_easy_setopt(easyhandle, CURLOPT_VERBOSE, debug);
+
+  return easyhandle;
+}
+
+/* Returns the class of the error that a request failed with. */
+static urlget_error_class _urlget_error_class(const struct _urlget_request *r,
+                                              CURLcode success)
+{
+  if (success == CURLE_ABORTED_BY_CALLBACK && r->first_byte_timed_out)
+    return URLGET_ERROR_TIMEOUT;
+  else if (success == CURLE_WRITE_ERROR && r->sink.size_exceeded)
+    return URLGET_ERROR_SIZE;
+  else
+    return _error_class(success);
+}
+
+/* Reports the outcome of a request and releases what
+   _urlget_request_init() set up, except for the easy handle. Returns the
+   result of the request as described for urlget_buffer(). */
+static int _urlget_request_finish(struct _urlget_request *r,
+                                  CURL *easyhandle, CURLcode success)
+{
+  long response_code = 0;
+  int refused, ignored, ret = 0;
+
+  curl_easy_getinfo(easyhandle, CURLINFO_RESPONSE_CODE, &response_code);
+
+  if (r->stats)
+    _urlget_add_stats(r->stats, easyhandle, r->sink.received);
+
+  _urlget_trace(easyhandle, r->url);
+
+  /* A server answers a request to resume at or past the end of the content
+     with 416. This is not an error when the caller already has all of it,
+     which the caller decides if the server does not say how long the
+     content is. libcurl only fails such a request if the server does say
+     so. */
+  refused = response_code == 416 && r->resume_from &&
+            (success == CURLE_OK || success == CURLE_HTTP_RETURNED_ERROR);
+
+  /* A server that does not support ranges sends the content from the
+     start, which libcurl stops before any of it is passed on. */
+  ignored = success == CURLE_RANGE_ERROR && r->resume_from;
+
+  /* Take the transfer off the display before any error is printed. */
+  if (r->shown)
+    progress_display_finish(r->progress, r->shown,
+                            success != CURLE_OK && !refused && !ignored);
+
+  if (ignored) {
+    ret = URLGET_RANGE_IGNORED;
+  } else if (refused) {
+    if (r->complete_length < 0)
+      ret = URLGET_RANGE_NOT_SATISFIABLE;
+    else if (r->complete_length == r->resume_from)
+      ret = URLGET_RANGE_AT_END;
+    else
+      ret = URLGET_RANGE_MISMATCH;
+  } else if (success != CURLE_OK) {
+    if (r->stats && !(success == CURLE_WRITE_ERROR && r->sink.declined))
+      r->stats->failures[_urlget_error_class(r, success)]++;
+
+    if (success == CURLE_WRITE_ERROR && r->sink.declined) {
+      /* The caller explains why it declined the transfer. */
+    } else if (success == CURLE_ABORTED_BY_CALLBACK &&
+               r->first_byte_timed_out) {
+      fprintf(stderr,
+              "Error retrieving %s: no data received within %" G_GINT64_FORMAT
+              " seconds.\n",
+              r->url, r->first_byte_timeout);
+    } else if (success == CURLE_FILESIZE_EXCEEDED ||
+               (success == CURLE_WRITE_ERROR && r->sink.size_exceeded)) {
+      gchar *size = g_format_size(r->sink.max_size);
+      fprintf(stderr, "Error retrieving %s: size limit of %s exceeded.\n",
+              r->url, size);
+      g_free(size);
+    } else if (success == CURLE_WRITE_ERROR) {
+      fprintf(stderr, "Error retrieving %s: %s: ", r->url, r->errbuf);
+      perror(NULL);
+      fprintf(stderr, "\n");
+    } else
+      fprintf(stderr, "Error retrieving %s: %s\n", r->url, r->errbuf);
+
+    ret = 1;
+  }
+
+  g_free(r->user_agent);
+
+  return ret;
+}
+
+/* Retrieves a URL and passes the content to 'write_buffer'. Returns 0 on
+   success, one of the URLGET_RANGE_* results if the server refuses or is
+   unable to resume at 'resume_from', and 1 on any other error, including a
+   transfer that exceeds one of 'timeouts'. If 'timeouts' is NULL, the
+   defaults apply. Measurements of the transfer are added to 'stats' unless
+   it is NULL, and the transfer is shown on 'progress' unless it is NULL. */
 int urlget_buffer(const char *url, void *user_data,
                   size_t (*write_buffer)(void *buffer, size_t size,
                                          size_t nmemb, void *user_data),
-                  long resume_from, int debug, progress_bar *pb)
+                  int (*start)(gint64 content_length, void *user_data),
+                  long resume_from, gint64 max_size, gint64 buffer_size,
+                  const urlget_timeouts *timeouts, urlget_stats *stats,
+                  int debug, progress_display *progress)
 {
   CURL *easyhandle;
   CURLcode success;
-  char errbuf[CURL_ERROR_SIZE];
-  int ret = 0;
-  gchar *user_agent;
+  struct _urlget_request r;
+  int ret;
 
-  /* Construct user agent string. */
-  user_agent = g_strdup_printf("%s (%s rss enclosure downloader)",
-                               PACKAGE_STRING, PACKAGE);
+  easyhandle = _urlget_request_init(&r, url, user_data, write_buffer, start,
+                                    resume_from, max_size, buffer_size,
+                                    timeouts, stats, debug, progress);
 
-  /* Initialise curl. */
-  easyhandle = curl_easy_init();
+  if (!easyhandle)
+    return 1;
 
-  if (easyhandle) {
-    curl_easy_setopt(easyhandle, CURLOPT_URL, url);
-    curl_easy_setopt(easyhandle, CURLOPT_ERRORBUFFER, errbuf);
-    curl_easy_setopt(easyhandle, CURLOPT_WRITEFUNCTION, write_buffer);
-    curl_easy_setopt(easyhandle, CURLOPT_WRITEDATA, user_data);
-    curl_easy_setopt(easyhandle, CURLOPT_FOLLOWLOCATION, 1);
-    curl_easy_setopt(easyhandle, CURLOPT_USERAGENT, user_agent);
-    curl_easy_setopt(easyhandle, CURLOPT_ACCEPT_ENCODING, "");
-
-    if (pb) {
-      curl_easy_setopt(easyhandle, CURLOPT_NOPROGRESS, 0);
-      curl_easy_setopt(easyhandle, CURLOPT_PROGRESSFUNCTION, progress_bar_cb);
-      curl_easy_setopt(easyhandle, CURLOPT_PROGRESSDATA, pb);
-    } else
-      curl_easy_setopt(easyhandle, CURLOPT_NOPROGRESS, 1);
+  success = curl_easy_perform(easyhandle);
 
-    if (resume_from)
-      curl_easy_setopt(easyhandle, CURLOPT_RESUME_FROM_LARGE,
-                       (curl_off_t)resume_from);
+  ret = _urlget_request_finish(&r, easyhandle, success);
 
-    curl_easy_setopt(easyhandle, CURLOPT_VERBOSE, debug);
+  curl_easy_cleanup(easyhandle);
 
-    success = curl_easy_perform(easyhandle);
+  return ret;
+}
 
-    curl_easy_cleanup(easyhandle);
+/* A request made by urlget_buffer_async(). */
+struct _urlget_async_request {
+  struct _urlget_request r;
+  gchar *url;
+  urlget_done_func done;
+};
 
-    if (success != CURLE_OK) {
-      if (pb)
-        /* Insert an extra CR on stdout as we may have started printing a
-           progress bar there. */
-        fprintf(stdout, "\n");
+static void _urlget_async_done_cb(CURL *easyhandle, CURLcode result,
+                                  gpointer user_data)
+{
+  struct _urlget_async_request *a = (struct _urlget_async_request *)user_data;
+  int ret;
 
-      if (success == CURLE_WRITE_ERROR) {
-        fprintf(stderr, "Error retrieving %s: %s: ", url, errbuf);
-        perror(NULL);
-        fprintf(stderr, "\n");
-      } else
-        fprintf(stderr, "Error retrieving %s: %s\n", url, errbuf);
+  ret = _urlget_request_finish(&a->r, easyhandle, result);
 
-      ret = 1;
-    }
-  } else
-    ret = 1;
+  a->done(ret, a->r.sink.user_data);
 
-  g_free(user_agent);
+  g_free(a->url);
+  g_free(a);
+}
 
-  return ret;
+/* Starts retrieving a URL like urlget_buffer() but returns right away. The
+   transfer runs when transfer_engine_run() is called on 'engine', and
+   'done' is then called with the result and 'user_data'. Returns 0 if the
+   transfer has been started and 1 if it could not be, in which case 'done'
+   is never called. */
+int urlget_buffer_async(transfer_engine *engine, const char *url,
+                        void *user_data,
+                        size_t (*write_buffer)(void *buffer, size_t size,
+                                               size_t nmemb, void *user_data),
+                        int (*start)(gint64 content_length, void *user_data),
+                        long resume_from, gint64 max_size, gint64 buffer_size,
+                        const urlget_timeouts *timeouts, urlget_stats *stats,
+                        int debug, progress_display *progress,
+                        urlget_done_func done)
+{
+  CURL *easyhandle;
+  struct _urlget_async_request *a;
+
+  a = g_malloc(sizeof(struct _urlget_async_request));
+  a->url = g_strdup(url);
+  a->done = done;
+
+  easyhandle = _urlget_request_init(&a->r, a->url, user_data, write_buffer,
+                                    start, resume_from, max_size, buffer_size,
+                                    timeouts, stats, debug, progress);
+
+  if (!easyhandle) {
+    g_free(a->url);
+    g_free(a);
+    return 1;
+  }
+
+  if (transfer_engine_add(engine, easyhandle, _urlget_async_done_cb, a)) {
+    curl_easy_cleanup(easyhandle);
+    g_free(a->r.user_agent);
+    g_free(a->url);
+    g_free(a);
+    return 1;
+  }
+
+  return 0;
 }
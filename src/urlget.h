@@ -21,11 +21,88 @@
 #define URLGET_H
 
 #include "progress.h"
+#include "transfer.h"
 
-int urlget_file(const char *url, FILE *f, int debug);
+#include <glib.h>
+
+/* Results of urlget_buffer() other than success (0) and failure (1) when
+   the server refuses to resume a transfer. */
+#define URLGET_RANGE_NOT_SATISFIABLE 2 /* the length was not given */
+#define URLGET_RANGE_AT_END 3          /* the content ends at the offset */
+#define URLGET_RANGE_MISMATCH 4        /* the content has another length */
+#define URLGET_RANGE_IGNORED 5         /* ranges are not supported */
+
+/* Returned by a write function to stop a transfer whose content it has no
+   use for. The transfer fails, but the caller reports why. */
+#define URLGET_WRITE_DECLINED ((size_t)-1)
+
+typedef void (*urlget_done_func)(int result, void *user_data);
+
+/* Timeouts for a transfer in seconds. A value of zero selects the
+   default. */
+typedef struct _urlget_timeouts {
+  gint64 connect;         /* to establish a connection */
+  gint64 first_byte;      /* until the first data of the content arrives */
+  gint64 low_speed_limit; /* bytes per second, with low_speed_time */
+  gint64 low_speed_time;  /* time the speed may stay below the limit */
+  gint64 total;           /* for the whole transfer, no limit by default */
+  gint64 deadline; /* monotonic time in microseconds by which the transfer
+                      must end, or 0 */
+} urlget_timeouts;
+
+/* Classes of errors that transfers fail with. */
+typedef enum {
+  URLGET_ERROR_DNS,
+  URLGET_ERROR_CONNECT,
+  URLGET_ERROR_TLS,
+  URLGET_ERROR_TIMEOUT,
+  URLGET_ERROR_RECEIVE,
+  URLGET_ERROR_HTTP,
+  URLGET_ERROR_SIZE,
+  URLGET_ERROR_OTHER,
+  URLGET_NUM_ERROR_CLASSES
+} urlget_error_class;
+
+/* Number of buckets that transfers are counted in by duration. */
+#define URLGET_DURATION_BUCKETS 12
+
+/* Measurements of transfers in bytes and microseconds. The phases of each
+   transfer are added up. */
+typedef struct _urlget_stats {
+  gint64 transfers;
+  gint64 failures[URLGET_NUM_ERROR_CLASSES];
+  gint64 durations[URLGET_DURATION_BUCKETS]; /* transfers by duration */
+  gint64 bytes;           /* content received */
+  gint64 dns_time;        /* resolving the host name */
+  gint64 connect_time;    /* establishing the connection */
+  gint64 tls_time;        /* the TLS handshake */
+  gint64 first_byte_time; /* from sending the request to the first byte */
+  gint64 total_time;
+} urlget_stats;
+
+const char *urlget_error_class_name(urlget_error_class c);
+gint64 urlget_duration_bucket(int i);
+void urlget_stats_add(urlget_stats *stats, const urlget_stats *other);
+int urlget_init(void);
+void urlget_cleanup(void);
+int urlget_file(const char *url, FILE *f, gint64 max_size,
+                const urlget_timeouts *timeouts, urlget_stats *stats,
+                int debug);
 int urlget_buffer(const char *url, void *user_data,
                   size_t (*write_buffer)(void *buffer, size_t size,
                                          size_t nmemb, void *user_data),
-                  long resume_from, int debug, progress_bar *pb);
+                  int (*start)(gint64 content_length, void *user_data),
+                  long resume_from, gint64 max_size, gint64 buffer_size,
+                  const urlget_timeouts *timeouts, urlget_stats *stats,
+                  int debug, progress_display *progress);
+int urlget_buffer_async(transfer_engine *engine, const char *url,
+                        void *user_data,
+                        size_t (*write_buffer)(void *buffer, size_t size,
+                                               size_t nmemb, void *user_data),
+                        int (*start)(gint64 content_length, void *user_data),
+                        long resume_from, gint64 max_size, gint64 buffer_size,
+                        const urlget_timeouts *timeouts, urlget_stats *stats,
+                        int debug, progress_display *progress,
+                        urlget_done_func done);
 
 #endif /* URLGET_H */
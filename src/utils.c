@@ -24,6 +24,7 @@
 #include "utils.h"
 
 #include <errno.h>
+#include <fcntl.h>
 #include <glib/gprintf.h>
 #include <glib/gstdio.h>
 #include <string.h>
@@ -44,7 +45,10 @@ int write_by_temporary_file(const gchar *filename,
   if (filename) {
     tmp_filename_used = g_strconcat(filename, ".XXXXXX", NULL);
 
-    fd = g_mkstemp(tmp_filename_used);
+    /* The file replaces 'filename', so it is created with the usual
+       permissions rather than only being readable by its owner, or
+       programs such as a metrics collector could not read it. */
+    fd = g_mkstemp_full(tmp_filename_used, O_RDWR, 0666);
 
     if (fd < 0) {
       perror("Error opening temporary file");
@@ -120,3 +124,32 @@ gchar *get_rfc822_time(void)
   else
     return NULL;
 }
+
+/* Appends a string as a JSON string literal. */
+void append_json_string(GString *s, const gchar *value)
+{
+  const gchar *p;
+
+  g_string_append_c(s, '"');
+
+  for (p = value; *p; p++) {
+    if (*p == '"' || *p == '\\')
+      g_string_append_printf(s, "\\%c", *p);
+    else if ((guchar)*p < 0x20)
+      g_string_append_printf(s, "\\u%04x", (guchar)*p);
+    else
+      g_string_append_c(s, *p);
+  }
+
+  g_string_append_c(s, '"');
+}
+
+/* Appends a time in microseconds as seconds. The decimal separator does
+   not depend on the locale. */
+void append_seconds(GString *s, gint64 usec)
+{
+  gchar buffer[G_ASCII_DTOSTR_BUF_SIZE];
+
+  g_string_append(s, g_ascii_formatd(buffer, sizeof(buffer), "%.6f",
+                                     (gdouble)usec / G_USEC_PER_SEC));
+}
@@ -29,5 +29,7 @@ int write_by_temporary_file(const gchar *filename,
                             gpointer user_data, gchar **used_filename,
                             int debug);
 gchar *get_rfc822_time(void);
+void append_json_string(GString *s, const gchar *value);
+void append_seconds(GString *s, gint64 usec);
 
 #endif /* UTILS_H */
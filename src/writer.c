@@ -0,0 +1,273 @@
+/*
+  Copyright (C) 2005-2020 Marius L. Jøhndal
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include "writer.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+/* Alignment of the write buffer. This matches the page size on most
+   systems so that buffered data is handed to the kernel in whole pages. */
+#define WRITER_ALIGNMENT 4096
+
+/* Chunks of at least this size are written directly rather than copied into
+   the buffer: a write() call of this size costs less than the copy. */
+#define WRITER_DIRECT_SIZE (64 << 10)
+
+/* A writer collects the many small pieces of data that arrive during a
+   transfer in a large buffer and hands them to the kernel in as few write()
+   calls as possible. Large chunks of data bypass it entirely, and are
+   written together with whatever is buffered in a single writev() call.
+
+   If 'writeback_size' is set, the writer also keeps the amount of dirty
+   data in the page cache bounded during large downloads: once that much
+   data has been written, writeback of it is started, and the range written
+   before it is waited for and dropped from the page cache. */
+struct _writer {
+  int fd;
+  gchar *buffer;
+  gsize buffer_size;
+  gsize used;
+  gint64 offset; /* file offset of the start of the buffer */
+  gint64 writeback_size;
+  gint64 writeback_start; /* start of data not yet submitted for writeback */
+  gint64 previous_start;  /* range submitted for writeback last time */
+  gint64 previous_length;
+  int error; /* errno of the first failed write, or zero */
+};
+
+static gboolean _write_all(writer *w, const gchar *data, gsize length)
+{
+  ssize_t n;
+
+  while (length > 0) {
+    n = write(w->fd, data, length);
+
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+
+      w->error = errno;
+      return FALSE;
+    }
+
+    data += n;
+    length -= n;
+    w->offset += n;
+  }
+
+  return TRUE;
+}
+
+/* Writes out the buffered data followed by 'length' bytes of 'data', and
+   empties the buffer. */
+static gboolean _write_through(writer *w, const gchar *data, gsize length)
+{
+  struct iovec iov[2];
+  int first = 0;
+  ssize_t n;
+
+  iov[0].iov_base = w->buffer;
+  iov[0].iov_len = w->used;
+  iov[1].iov_base = (void *)data;
+  iov[1].iov_len = length;
+
+  if (!w->used)
+    first = 1;
+
+  w->used = 0;
+
+  while (first < 2) {
+    n = writev(w->fd, iov + first, 2 - first);
+
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+
+      w->error = errno;
+      return FALSE;
+    }
+
+    w->offset += n;
+
+    for (; first < 2 && (gsize)n >= iov[first].iov_len; first++)
+      n -= iov[first].iov_len;
+
+    if (first < 2) {
+      iov[first].iov_base = (gchar *)iov[first].iov_base + n;
+      iov[first].iov_len -= n;
+    }
+  }
+
+  return TRUE;
+}
+
+/* Drops a range that has been written back from the page cache. */
+static void _drop_range(writer *w, gint64 start, gint64 length)
+{
+  if (!length)
+    return;
+
+#ifdef HAVE_SYNC_FILE_RANGE
+  sync_file_range(w->fd, start, length,
+                  SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+                      SYNC_FILE_RANGE_WAIT_AFTER);
+#endif /* HAVE_SYNC_FILE_RANGE */
+
+#ifdef HAVE_POSIX_FADVISE
+  posix_fadvise(w->fd, start, length, POSIX_FADV_DONTNEED);
+#endif /* HAVE_POSIX_FADVISE */
+}
+
+static void _writeback(writer *w)
+{
+  gint64 length = w->offset - w->writeback_start;
+
+  if (!w->writeback_size || length < w->writeback_size)
+    return;
+
+#ifdef HAVE_SYNC_FILE_RANGE
+  sync_file_range(w->fd, w->writeback_start, length, SYNC_FILE_RANGE_WRITE);
+#endif /* HAVE_SYNC_FILE_RANGE */
+
+  _drop_range(w, w->previous_start, w->previous_length);
+
+  w->previous_start = w->writeback_start;
+  w->previous_length = length;
+  w->writeback_start = w->offset;
+}
+
+/* Creates a writer for the file descriptor 'fd', whose current position is
+   'offset'. A 'buffer_size' of zero selects the default buffer size, and a
+   'writeback_size' of zero leaves writeback to the kernel. Returns NULL if
+   the buffer cannot be allocated. */
+writer *writer_new(int fd, gint64 offset, gint64 buffer_size,
+                   gint64 writeback_size)
+{
+  writer *w;
+  void *buffer;
+
+  if (buffer_size <= 0)
+    buffer_size = WRITER_DEFAULT_BUFFER_SIZE;
+
+  /* Round the buffer size up to a whole number of pages. */
+  buffer_size = (buffer_size + WRITER_ALIGNMENT - 1) &
+                ~(gint64)(WRITER_ALIGNMENT - 1);
+
+  if (posix_memalign(&buffer, WRITER_ALIGNMENT, buffer_size) != 0)
+    return NULL;
+
+  w = g_malloc(sizeof(struct _writer));
+  w->fd = fd;
+  w->buffer = buffer;
+  w->buffer_size = buffer_size;
+  w->used = 0;
+  w->offset = offset;
+  w->writeback_size = writeback_size;
+  w->writeback_start = offset;
+  w->previous_start = offset;
+  w->previous_length = 0;
+  w->error = 0;
+
+  return w;
+}
+
+/* Writes out any buffered data. Returns FALSE if writing fails. */
+gboolean writer_flush(writer *w)
+{
+  gboolean ok;
+
+  if (w->error)
+    return FALSE;
+
+  if (!w->used)
+    return TRUE;
+
+  ok = _write_all(w, w->buffer, w->used);
+  w->used = 0;
+
+  _writeback(w);
+
+  return ok;
+}
+
+/* Appends data to the file. Returns FALSE if writing fails, in which case
+   writer_error() returns the cause. */
+gboolean writer_write(writer *w, const void *data, gsize length)
+{
+  const gchar *p = (const gchar *)data;
+
+  if (w->error)
+    return FALSE;
+
+  /* Write large chunks directly, along with anything already buffered. */
+  if (length >= MIN(w->buffer_size, WRITER_DIRECT_SIZE)) {
+    if (!_write_through(w, p, length))
+      return FALSE;
+
+    _writeback(w);
+    return TRUE;
+  }
+
+  /* Flush the buffer if the chunk does not fit into what is left of it. */
+  if (length > w->buffer_size - w->used && !writer_flush(w))
+    return FALSE;
+
+  memcpy(w->buffer + w->used, p, length);
+  w->used += length;
+
+  return TRUE;
+}
+
+/* Returns the file offset that the next byte will be written to. */
+gint64 writer_offset(const writer *w)
+{
+  return w->offset + w->used;
+}
+
+/* Returns the errno value of the first failed write, or zero. */
+int writer_error(const writer *w)
+{
+  return w->error;
+}
+
+/* Flushes and frees the writer without closing the file descriptor. Returns
+   FALSE if any write has failed. */
+gboolean writer_free(writer *w)
+{
+  gboolean ok = writer_flush(w);
+
+  if (w->writeback_size) {
+    _drop_range(w, w->previous_start, w->previous_length);
+    _drop_range(w, w->writeback_start, w->offset - w->writeback_start);
+  }
+
+  free(w->buffer);
+  g_free(w);
+
+  return ok;
+}
@@ -0,0 +1,38 @@
+/*
+  Copyright (C) 2005-2020 Marius L. Jøhndal
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+
+#ifndef WRITER_H
+#define WRITER_H
+
+#include <glib.h>
+
+/* Default size of the write buffer. */
+#define WRITER_DEFAULT_BUFFER_SIZE (1 << 20)
+
+typedef struct _writer writer;
+
+writer *writer_new(int fd, gint64 offset, gint64 buffer_size,
+                   gint64 writeback_size);
+gboolean writer_write(writer *w, const void *data, gsize length);
+gboolean writer_flush(writer *w);
+gint64 writer_offset(const writer *w);
+int writer_error(const writer *w);
+gboolean writer_free(writer *w);
+
+#endif /* WRITER_H */
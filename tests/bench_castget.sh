@@ -0,0 +1,213 @@
+#!/bin/sh
+#
+# Runs castget end to end against bench_server and prints the wall-clock
+# time, CPU time, requests served, data sent, enclosures saved and, if
+# strace is installed, the number of system calls for each scenario. Run
+# with 'make bench'.
+#
+# Usage: bench_castget.sh [--update FILE] CASTGET BENCH_SERVER [SCENARIO...]
+#
+# The scenarios are:
+#
+#   channels  1000 channels with 20 items each, most recent item only
+#   backlog   10 channels with 500 items each
+#   resume    20 large enclosures whose first download is cut off
+#   slow      50 channels with latency, limited bandwidth and 5% errors
+#
+# All scenarios are run if none are given. BENCH_PORT sets the port the
+# server listens on (default 8780).
+#
+# Every scenario checks that the expected number of enclosures was saved
+# and that each holds exactly what the server sent. The measurements are
+# then compared with bench_castget.baseline next to this script. A
+# scenario fails if it takes more than BENCH_TOLERANCE (default 5) times
+# the wall-clock or CPU time of the baseline, or makes more than
+# BENCH_SYSCALL_TOLERANCE (default 1.2) times as many system calls. System
+# calls are only compared if both the run and the baseline counted them.
+# Set BENCH_TOLERANCE=0 to check the enclosures only. The script exits
+# with status 1 if any scenario fails.
+#
+# Run with --update FILE to write a new baseline to FILE instead.
+#
+
+set -e
+
+if [ "$1" = --update ]; then
+  update=$2
+  shift 2
+else
+  update=
+fi
+
+if [ $# -lt 2 ]; then
+  echo "Usage: $0 [--update FILE] CASTGET BENCH_SERVER [SCENARIO...]" >&2
+  exit 1
+fi
+
+castget=$1
+server=$2
+shift 2
+
+port=${BENCH_PORT:-8780}
+tolerance=${BENCH_TOLERANCE:-5}
+syscall_tolerance=${BENCH_SYSCALL_TOLERANCE:-1.2}
+baseline=$(dirname "$0")/bench_castget.baseline
+work=$(mktemp -d "${TMPDIR:-/tmp}/castget-bench-XXXXXX")
+trap 'rm -rf "$work"' EXIT
+
+if command -v strace >/dev/null 2>&1; then
+  strace=strace
+else
+  strace=
+fi
+
+failed=0
+: > "$work/results"
+
+# Writes a configuration file with CHANNELS channels.
+configure() {
+  i=0
+  : > "$work/castgetrc"
+
+  while [ $i -lt $1 ]; do
+    printf '[c%d]\nurl=http://127.0.0.1:%d/feed/%d.xml\nspool=%s\n\n' \
+      $i $port $i "$work/spool" >> "$work/castgetrc"
+    i=$((i + 1))
+  done
+}
+
+# start SERVER_OPTIONS COMMAND...
+#
+# Runs a command with castget starting from scratch under the server, and
+# prints the line with its measurements.
+start() {
+  options=$1
+  shift
+
+  rm -rf "$work/home" "$work/spool"
+  mkdir -p "$work/home" "$work/spool"
+
+  HOME="$work/home" "$server" --port $port $options -- "$@" \
+    2>> "$work/log" | tail -n 1
+}
+
+# check_files FILES SIZE
+#
+# Prints what is wrong with the enclosures in the spool directory, if
+# anything. There must be FILES of them, each holding SIZE bytes of the
+# letters a to z repeated, as sent by the server.
+check_files() {
+  files=$(find "$work/spool" -type f | wc -l)
+
+  yes abcdefghijklmnopqrstuvwxyz | tr -d '\n' | head -c $2 \
+    > "$work/expected"
+  expected=$(cksum < "$work/expected" | awk '{ print $1 }')
+
+  bad=$(find "$work/spool" -type f -exec cksum {} + |
+          awk -v crc=$expected -v size=$2 \
+            '$1 != crc || $2 != size { n++ } END { print n + 0 }')
+
+  if [ $files -ne $1 ]; then
+    echo "$files files saved, expected $1"
+  elif [ $bad -ne 0 ]; then
+    echo "wrong contents in $bad of $files files"
+  fi
+}
+
+# compare NAME WALL CPU SYSCALLS
+#
+# Prints how the measurements compare with the baseline.
+compare() {
+  [ -f "$baseline" ] || { echo "no baseline"; return; }
+
+  awk -v name=$1 -v wall=$2 -v cpu=$3 -v syscalls=$4 \
+      -v tolerance=$tolerance -v syscall_tolerance=$syscall_tolerance '
+    $1 == name {
+      found = 1
+
+      if (tolerance > 0 && wall > $2 * tolerance)
+        print "slower (baseline " $2 " s)"
+      else if (tolerance > 0 && cpu > $3 * tolerance)
+        print "more CPU time (baseline " $3 " s)"
+      else if (syscalls != "-" && $4 != "-" &&
+               syscalls > $4 * syscall_tolerance)
+        print "more system calls (baseline " $4 ")"
+    }
+    END { if (!found) print "no baseline" }' "$baseline"
+}
+
+# run NAME CHANNELS FILES SIZE SERVER_OPTIONS CASTGET_OPTIONS
+run() {
+  configure $2
+
+  result=$(start "--size $4 $5" "$castget" -q -C "$work/castgetrc" $6)
+  problem=$(check_files $3 $4)
+  files=$(find "$work/spool" -type f | wc -l)
+
+  syscalls=-
+  if [ -n "$strace" ]; then
+    start "--size $4 $5" $strace -f -c -o "$work/strace" \
+      "$castget" -q -C "$work/castgetrc" $6 > /dev/null
+    syscalls=$(awk '$NF == "total" { print $4 }' "$work/strace")
+  fi
+
+  name=$1
+  set -- $result
+  cpu=$(awk -v user=$2 -v sys=$3 'BEGIN { printf "%.3f", user + sys }')
+  echo "$name $1 $cpu $syscalls" >> "$work/results"
+
+  if [ -z "$problem" ] && [ -z "$update" ]; then
+    problem=$(compare $name $1 $cpu $syscalls)
+
+    # Scenarios missing from the baseline are not counted as failures.
+    [ "$problem" != "no baseline" ] || problem=
+  fi
+
+  [ -z "$problem" ] || failed=$((failed + 1))
+
+  printf '%-10s %9s %9s %9s %9s %9s %7s %10s%s\n' $name $1 $2 $3 $4 $5 \
+    $files $syscalls "${problem:+  $problem}"
+}
+
+if [ $# -eq 0 ]; then
+  set -- channels backlog resume slow
+fi
+
+printf '%-10s %9s %9s %9s %9s %9s %7s %10s\n' scenario "wall s" "user s" \
+  "sys s" requests "MiB" files syscalls
+
+for scenario in "$@"; do
+  case $scenario in
+    channels)
+      run channels 1000 1000 16384 "--items 20" "-1" ;;
+    backlog)
+      run backlog 10 5000 32768 "--items 500" "" ;;
+    resume)
+      run resume 10 20 8388608 "--items 2 --drop-after 1048576" "" ;;
+    slow)
+      # Every feed is fetched before the enclosures, and 5% of the 98
+      # requests fail: two feeds and two enclosures.
+      run slow 50 46 65536 "--items 5 --latency 100 --bandwidth 1048576 \
+        --error-rate 5" "-1" ;;
+    *)
+      echo "$0: unknown scenario $scenario" >&2
+      exit 1 ;;
+  esac
+done
+
+if [ -s "$work/log" ]; then
+  echo
+  echo "Errors:"
+  sed 's|http://[^ ]*|URL|' "$work/log" | sort | uniq -c | sort -rn
+fi
+
+if [ -n "$update" ]; then
+  { echo "# scenario wall_s cpu_s syscalls"; cat "$work/results"; } \
+    > "$update"
+fi
+
+if [ $failed -gt 0 ]; then
+  echo
+  echo "$failed scenarios failed."
+  exit 1
+fi
@@ -0,0 +1,359 @@
+/* Measures the functions that run for every item of a feed in list and
+   catch-up modes: building enclosure filenames, expanding filename
+   patterns and parsing publication dates. Reports the time and the number
+   of allocations per call over a mix of realistic inputs, and compares
+   them with bench_items.baseline in $srcdir, so that it runs as part of
+   'make check'.
+
+   A benchmark fails if it makes more allocations per call than the
+   baseline. If BENCH_TOLERANCE is set to more than 0, it also fails if it
+   takes more than that many times as long. Times depend too much on the
+   machine and the build to be compared by default, so 'make bench' sets
+   BENCH_TOLERANCE to 5 and 'make check' leaves it unset. Allocations are
+   counted on glibc only, by replacing malloc, calloc and realloc. Much of
+   the allocation happens inside glib, so allocations are only compared if
+   the baseline was made with the same version of glib.
+
+   Run with --update FILE to write a new baseline to FILE. */
+
+#include "../src/date_parsing.h"
+#include "../src/filenames.h"
+#include "../src/patterns.h"
+#include "mocks.h"
+
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Each benchmark runs for at least this long, in batches that go through
+   every combination of inputs the same number of times. */
+#define MIN_DURATION (G_USEC_PER_SEC / 5)
+#define BATCH (NUM_ITEMS * 20)
+
+#if defined(__GLIBC__) && !defined(__SANITIZE_ADDRESS__)
+#define COUNT_ALLOCATIONS 1
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static gint64 allocations = 0;
+
+void *malloc(size_t size)
+{
+  allocations++;
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+  allocations++;
+  return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+  allocations++;
+  return __libc_realloc(ptr, size);
+}
+#else
+#define COUNT_ALLOCATIONS 0
+
+static gint64 allocations = 0;
+#endif
+
+static char *titles[] = {
+  "Episode 112: Interview with the author of \"The Long Road\"",
+  "Weekly news roundup – 14 March",
+  "Q&A: Your questions about taxes/pensions answered",
+  "Bonus episode",
+  "Les nouvelles du jour : l'économie française",
+  "Part 3 of 5 – What happened at the 2019 conference? (Live)",
+};
+
+static char *dates[] = {
+  "Thu, 01 Oct 2015 09:53:38 GMT",
+  "Mon, 6 Jan 2020 07:00:00 -0500",
+  "Fri, 13 Mar 2020 23:59:59 +0100",
+  "Sat, 29 Feb 2020 12:00:00 PST",
+  "1 Apr 2019 08:30 EST",
+  "Wed, 31 Dec 1997 23:59:60 Z",
+  "Tue, 10 Sep 2019 05:00:00 +0000",
+  "not a date",
+};
+
+static enclosure enclosures[] = {
+  { "http://media.example.com/feeds/show/episode112.mp3", 48234112,
+    "audio/mpeg", NULL, NULL, NULL, 3600 },
+  { "https://cdn.example.org/audio/2020/03/14/roundup.m4a?source=rss", 23001,
+    "audio/mp4", NULL, NULL, NULL, -1 },
+  { "http://example.net/download", 0, "audio/ogg", NULL, NULL, NULL, -1 },
+};
+
+static const char *patterns[] = {
+  "%(title).mp3",
+  "%(date) - %(title).%(extension)",
+  "%(channel_title)/%(date)_%(index) %(basename)",
+  "episode-%(time)-%(guid)",
+};
+
+#define NUM_ITEMS (G_N_ELEMENTS(titles) * G_N_ELEMENTS(dates))
+
+static channel_info *info;
+static rss_item *items[NUM_ITEMS];
+static pattern_program *programs[G_N_ELEMENTS(patterns)];
+
+static void _setup(void)
+{
+  int i;
+
+  info = mock_channel_info_new("The Example Show");
+
+  for (i = 0; i < NUM_ITEMS; i++) {
+    items[i] = mock_rss_item_new(titles[i % G_N_ELEMENTS(titles)],
+                                 dates[i % G_N_ELEMENTS(dates)]);
+    items[i]->enclosure = &enclosures[i % G_N_ELEMENTS(enclosures)];
+    items[i]->guid = enclosures[i % G_N_ELEMENTS(enclosures)].url;
+    items[i]->index = i;
+  }
+
+  for (i = 0; i < G_N_ELEMENTS(patterns); i++)
+    programs[i] = pattern_program_new(patterns[i]);
+}
+
+static void _teardown(void)
+{
+  int i;
+
+  for (i = 0; i < G_N_ELEMENTS(patterns); i++)
+    pattern_program_free(programs[i]);
+
+  for (i = 0; i < NUM_ITEMS; i++)
+    mock_rss_item_free(items[i]);
+
+  mock_channel_info_free(info);
+}
+
+static void _bench_parse_rfc822_date(int i)
+{
+  GDate *date = parse_rfc822_date(dates[i % G_N_ELEMENTS(dates)]);
+
+  if (date)
+    g_date_free(date);
+}
+
+static void _bench_expand_string_with_patterns(int i)
+{
+  g_free(expand_string_with_patterns(patterns[i % G_N_ELEMENTS(patterns)],
+                                     info, items[i % NUM_ITEMS]));
+}
+
+static void _bench_build_enclosure_filename(int i)
+{
+  g_free(build_enclosure_filename("/home/user/podcasts/example",
+                                  patterns[i % G_N_ELEMENTS(patterns)], info,
+                                  items[i % NUM_ITEMS]));
+}
+
+/* The compiled form of the patterns is what castget uses when it updates
+   a channel, so it is measured alongside expand_string_with_patterns. */
+static void _bench_pattern_program_expand(int i)
+{
+  static GString *buffer = NULL;
+
+  if (!buffer)
+    buffer = g_string_sized_new(256);
+
+  g_string_truncate(buffer, 0);
+  pattern_program_expand(programs[i % G_N_ELEMENTS(patterns)], buffer, info,
+                         items[i % NUM_ITEMS]);
+}
+
+typedef struct {
+  const char *name;
+  void (*run)(int i);
+  double ns;          /* per call */
+  double allocations; /* per call */
+} benchmark;
+
+static benchmark benchmarks[] = {
+  { "parse_rfc822_date", _bench_parse_rfc822_date },
+  { "expand_string_with_patterns", _bench_expand_string_with_patterns },
+  { "pattern_program_expand", _bench_pattern_program_expand },
+  { "build_enclosure_filename", _bench_build_enclosure_filename },
+};
+
+static void _measure(benchmark *b)
+{
+  gint64 started, elapsed, calls = 0, before;
+  int i;
+
+  /* Warm up caches and any state kept between calls. */
+  for (i = 0; i < BATCH; i++)
+    b->run(i);
+
+  before = allocations;
+  started = g_get_monotonic_time();
+
+  do {
+    for (i = 0; i < BATCH; i++)
+      b->run(calls + i);
+
+    calls += BATCH;
+    elapsed = g_get_monotonic_time() - started;
+  } while (elapsed < MIN_DURATION);
+
+  b->ns = (double)elapsed * 1000 / calls;
+  b->allocations = (double)(allocations - before) / calls;
+}
+
+static benchmark *_find(const char *name)
+{
+  int i;
+
+  for (i = 0; i < G_N_ELEMENTS(benchmarks); i++) {
+    if (!strcmp(benchmarks[i].name, name))
+      return &benchmarks[i];
+  }
+
+  return NULL;
+}
+
+static int _write_baseline(const char *filename)
+{
+  GString *s = g_string_new("# benchmark ns/op allocations/op\n");
+  GError *error = NULL;
+  int i;
+
+  g_string_append_printf(s, "# glib %u.%u.%u\n", glib_major_version,
+                         glib_minor_version, glib_micro_version);
+
+  for (i = 0; i < G_N_ELEMENTS(benchmarks); i++)
+    g_string_append_printf(s, "%s %.0f %.2f\n", benchmarks[i].name,
+                           benchmarks[i].ns, benchmarks[i].allocations);
+
+  if (!g_file_set_contents(filename, s->str, s->len, &error)) {
+    fprintf(stderr, "Error writing baseline: %s\n", error->message);
+    g_error_free(error);
+    g_string_free(s, TRUE);
+    return 1;
+  }
+
+  g_string_free(s, TRUE);
+
+  return 0;
+}
+
+/* Compares the measurements with a baseline file. Returns the number of
+   benchmarks that regressed. */
+static int _check_baseline(const char *filename, double tolerance)
+{
+  gchar *contents, **lines, name[64];
+  GError *error = NULL;
+  double ns, allocations;
+  benchmark *b;
+  guint major, minor, micro;
+  gboolean same_glib = FALSE;
+  int i, failed = 0;
+
+  if (!g_file_get_contents(filename, &contents, NULL, &error)) {
+    fprintf(stderr, "Error reading baseline: %s\n", error->message);
+    g_error_free(error);
+    return 1;
+  }
+
+  printf("\n%-28s %10s %10s %10s %10s\n", "benchmark", "ns/op", "baseline",
+         "allocs/op", "baseline");
+
+  lines = g_strsplit(contents, "\n", -1);
+
+  for (i = 0; lines[i]; i++) {
+    if (sscanf(lines[i], "# glib %u.%u.%u", &major, &minor, &micro) == 3)
+      same_glib = major == glib_major_version &&
+                  minor == glib_minor_version && micro == glib_micro_version;
+
+    if (lines[i][0] == '#' || !lines[i][0])
+      continue;
+
+    if (sscanf(lines[i], "%63s %lf %lf", name, &ns, &allocations) != 3) {
+      fprintf(stderr, "Error reading baseline: malformed line '%s'.\n",
+              lines[i]);
+      failed++;
+      continue;
+    }
+
+    b = _find(name);
+
+    if (!b) {
+      fprintf(stderr, "Error reading baseline: unknown benchmark %s.\n",
+              name);
+      failed++;
+      continue;
+    }
+
+    printf("%-28s %10.0f %10.0f %10.2f %10.2f", name, b->ns, ns,
+           b->allocations, allocations);
+
+    /* Allocation counts do not depend on the machine, so any increase is a
+       regression. */
+    if (COUNT_ALLOCATIONS && same_glib &&
+        b->allocations > allocations + 0.005) {
+      printf("  more allocations");
+      failed++;
+    } else if (tolerance > 0 && b->ns > ns * tolerance) {
+      printf("  slower");
+      failed++;
+    }
+
+    printf("\n");
+  }
+
+  if (COUNT_ALLOCATIONS && !same_glib)
+    printf("\nAllocations not compared: the baseline was not made with glib "
+           "%u.%u.%u.\n",
+           glib_major_version, glib_minor_version, glib_micro_version);
+
+  g_strfreev(lines);
+  g_free(contents);
+
+  return failed;
+}
+
+int main(int argc, char *argv[])
+{
+  const char *srcdir = getenv("srcdir");
+  const char *tolerance = getenv("BENCH_TOLERANCE");
+  gchar *baseline;
+  int i, result;
+
+  if (argc > 1 && (argc != 3 || strcmp(argv[1], "--update"))) {
+    fprintf(stderr, "Usage: %s [--update FILE]\n", argv[0]);
+    return 1;
+  }
+
+  _setup();
+
+  for (i = 0; i < G_N_ELEMENTS(benchmarks); i++) {
+    _measure(&benchmarks[i]);
+
+    printf("%-28s %10.0f ns/op", benchmarks[i].name, benchmarks[i].ns);
+
+    if (COUNT_ALLOCATIONS)
+      printf(" %10.2f allocs/op", benchmarks[i].allocations);
+
+    printf("\n");
+  }
+
+  _teardown();
+
+  if (argc == 3)
+    return _write_baseline(argv[2]);
+
+  baseline = g_build_filename(srcdir ? srcdir : ".", "bench_items.baseline",
+                              NULL);
+  result = _check_baseline(baseline, tolerance ? atof(tolerance) : 0);
+  g_free(baseline);
+
+  return result ? 1 : 0;
+}
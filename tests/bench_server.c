@@ -0,0 +1,485 @@
+/* A local stand-in for the servers castget retrieves feeds and enclosures
+   from, for benchmarks that should not depend on real origins. Serves
+   generated feeds at /feed/N.xml and the enclosures they refer to at
+   /enclosure/N/M.mp3. The number of items in each feed, the size of
+   enclosures, the latency before each response, the bandwidth of each
+   connection and the share of requests that fail are configurable, and
+   enclosure downloads can be cut off part of the way through to exercise
+   resuming. Ranges of enclosures are supported.
+
+   If a command is given after '--', it is run once the server is
+   listening, and a line with the wall-clock time, user and system CPU
+   time of the command in seconds, the number of requests served and the
+   number of MiB sent is printed when it exits. Otherwise the server runs
+   until it is killed. See bench_castget.sh for the scenarios that use
+   it. */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <glib.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BODY_CHUNK 65536
+#define MAX_HEADER 8192
+
+static gint port = 8780;
+static gint items = 10;
+static gint64 size = 1 << 20;
+static gint latency = 0;
+static gint64 bandwidth = 0;
+static gint error_rate = 0;
+static gint64 drop_after = 0;
+
+static GMutex stats_mutex;
+static gint64 requests = 0;
+static gint64 bytes_sent = 0;
+
+/* Enclosure content repeats the alphabet so that a resumed download can be
+   checked. The buffer is long enough to start a chunk at any letter. */
+static gchar pattern[BODY_CHUNK + 26];
+
+static int _send(int fd, const gchar *data, gsize length)
+{
+  ssize_t n;
+
+  while (length > 0) {
+    n = send(fd, data, length, MSG_NOSIGNAL);
+
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+
+      return -1;
+    }
+
+    data += n;
+    length -= n;
+
+    g_mutex_lock(&stats_mutex);
+    bytes_sent += n;
+    g_mutex_unlock(&stats_mutex);
+  }
+
+  return 0;
+}
+
+/* Sends 'length' bytes of enclosure content starting at 'offset', or
+   'length' bytes of 'data' if it is not NULL, no faster than the
+   configured bandwidth. */
+static int _send_body(int fd, const gchar *data, gint64 offset,
+                      gint64 length)
+{
+  gint64 started = g_get_monotonic_time();
+  gint64 sent = 0, chunk, due, now;
+
+  while (sent < length) {
+    chunk = MIN(length - sent, BODY_CHUNK);
+
+    /* Send about ten chunks a second when the bandwidth is limited. */
+    if (bandwidth > 0)
+      chunk = MIN(chunk, MAX(bandwidth / 10, 1));
+
+    if (data) {
+      if (_send(fd, data + sent, chunk) < 0)
+        return -1;
+    } else if (_send(fd, pattern + (offset + sent) % 26, chunk) < 0)
+      return -1;
+
+    sent += chunk;
+
+    if (bandwidth > 0) {
+      due = started + sent * G_USEC_PER_SEC / bandwidth;
+      now = g_get_monotonic_time();
+
+      if (due > now)
+        g_usleep(due - now);
+    }
+  }
+
+  return 0;
+}
+
+static int _send_status(int fd, const char *status, int keep_alive)
+{
+  gchar *response;
+  int result;
+
+  response = g_strdup_printf("HTTP/1.1 %s\r\n"
+                             "Content-Length: 0\r\n"
+                             "Connection: %s\r\n\r\n",
+                             status, keep_alive ? "keep-alive" : "close");
+  result = _send(fd, response, strlen(response));
+  g_free(response);
+
+  return result;
+}
+
+static GString *_feed(int channel)
+{
+  static const char *days[] = { "Sun", "Mon", "Tue", "Wed",
+                                "Thu", "Fri", "Sat" };
+  static const char *months[] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                                  "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+  GString *s = g_string_new(NULL);
+  time_t t;
+  struct tm tm;
+  int i;
+
+  g_string_append_printf(s,
+                         "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                         "<rss version=\"2.0\">\n"
+                         "<channel>\n"
+                         "<title>Channel %d</title>\n"
+                         "<link>http://127.0.0.1:%d/</link>\n"
+                         "<description>A generated channel</description>\n",
+                         channel, port);
+
+  /* Items are listed newest first, one a day. */
+  for (i = items; i > 0; i--) {
+    t = (time_t)1577836800 - (time_t)(items - i) * 86400;
+    gmtime_r(&t, &tm);
+
+    g_string_append_printf(
+        s,
+        "<item>\n"
+        "<title>Episode %d of channel %d</title>\n"
+        "<guid>http://127.0.0.1:%d/episode/%d/%d</guid>\n"
+        "<pubDate>%s, %02d %s %d %02d:%02d:%02d +0000</pubDate>\n"
+        "<enclosure url=\"http://127.0.0.1:%d/enclosure/%d/%d.mp3\" "
+        "length=\"%" G_GINT64_FORMAT "\" type=\"audio/mpeg\"/>\n"
+        "</item>\n",
+        i, channel, port, channel, i, days[tm.tm_wday], tm.tm_mday,
+        months[tm.tm_mon], tm.tm_year + 1900, tm.tm_hour, tm.tm_min,
+        tm.tm_sec, port, channel, i, size);
+  }
+
+  g_string_append(s, "</channel>\n</rss>\n");
+
+  return s;
+}
+
+/* Answers one request. Returns -1 if the connection should be closed. */
+static int _respond(int fd, const gchar *path, gint64 range, int keep_alive)
+{
+  gchar *headers;
+  GString *feed;
+  gint64 length;
+  int channel, item, n, result;
+
+  if (sscanf(path, "/feed/%d.xml%n", &channel, &n) == 1 && !path[n]) {
+    feed = _feed(channel);
+    headers = g_strdup_printf("HTTP/1.1 200 OK\r\n"
+                              "Content-Type: application/rss+xml\r\n"
+                              "Content-Length: %" G_GSIZE_FORMAT "\r\n"
+                              "Connection: %s\r\n\r\n",
+                              feed->len,
+                              keep_alive ? "keep-alive" : "close");
+    result = _send(fd, headers, strlen(headers));
+
+    if (!result)
+      result = _send_body(fd, feed->str, 0, feed->len);
+
+    g_free(headers);
+    g_string_free(feed, TRUE);
+
+    return result;
+  }
+
+  if (sscanf(path, "/enclosure/%d/%d.mp3%n", &channel, &item, &n) != 2 ||
+      path[n])
+    return _send_status(fd, "404 Not Found", keep_alive);
+
+  if (range >= size) {
+    headers = g_strdup_printf("HTTP/1.1 416 Range Not Satisfiable\r\n"
+                              "Content-Range: bytes */%" G_GINT64_FORMAT
+                              "\r\n"
+                              "Content-Length: 0\r\n"
+                              "Connection: %s\r\n\r\n",
+                              size, keep_alive ? "keep-alive" : "close");
+  } else if (range > 0) {
+    headers = g_strdup_printf(
+        "HTTP/1.1 206 Partial Content\r\n"
+        "Content-Type: audio/mpeg\r\n"
+        "Content-Range: bytes %" G_GINT64_FORMAT "-%" G_GINT64_FORMAT
+        "/%" G_GINT64_FORMAT "\r\n"
+        "Content-Length: %" G_GINT64_FORMAT "\r\n"
+        "Connection: %s\r\n\r\n",
+        range, size - 1, size, size - range,
+        keep_alive ? "keep-alive" : "close");
+  } else {
+    headers = g_strdup_printf("HTTP/1.1 200 OK\r\n"
+                              "Content-Type: audio/mpeg\r\n"
+                              "Content-Length: %" G_GINT64_FORMAT "\r\n"
+                              "Connection: %s\r\n\r\n",
+                              size, keep_alive ? "keep-alive" : "close");
+    range = 0;
+  }
+
+  result = _send(fd, headers, strlen(headers));
+  g_free(headers);
+
+  if (result < 0 || range >= size)
+    return result;
+
+  /* Downloads from the start are cut off to simulate a dropped
+     connection. Resumed downloads are let through. */
+  length = size - range;
+
+  if (!range && drop_after > 0 && drop_after < length) {
+    _send_body(fd, NULL, 0, drop_after);
+    return -1;
+  }
+
+  return _send_body(fd, NULL, range, length);
+}
+
+/* Reads the request headers into 'buffer'. Returns the length of the
+   headers, or -1 if the connection was closed. */
+static int _read_request(int fd, gchar *buffer, int *filled)
+{
+  gchar *end;
+  ssize_t n;
+
+  for (;;) {
+    buffer[*filled] = '\0';
+    end = strstr(buffer, "\r\n\r\n");
+
+    if (end)
+      return end + 4 - buffer;
+
+    if (*filled == MAX_HEADER)
+      return -1;
+
+    n = recv(fd, buffer + *filled, MAX_HEADER - *filled, 0);
+
+    if (n < 0 && errno == EINTR)
+      continue;
+
+    if (n <= 0)
+      return -1;
+
+    *filled += n;
+  }
+}
+
+static gpointer _serve(gpointer data)
+{
+  int fd = GPOINTER_TO_INT(data);
+  gchar buffer[MAX_HEADER + 1];
+  gchar path[1024];
+  const gchar *line;
+  gint64 range, n;
+  int filled = 0, length, keep_alive, fail;
+
+  while ((length = _read_request(fd, buffer, &filled)) > 0) {
+    if (sscanf(buffer, "GET %1023s HTTP/1.%*d", path) != 1) {
+      _send_status(fd, "400 Bad Request", 0);
+      break;
+    }
+
+    range = 0;
+    keep_alive = 1;
+
+    for (line = strstr(buffer, "\r\n"); line && line < buffer + length;
+         line = strstr(line + 2, "\r\n")) {
+      if (!g_ascii_strncasecmp(line + 2, "Range: bytes=", 13))
+        range = g_ascii_strtoll(line + 15, NULL, 10);
+      else if (!g_ascii_strncasecmp(line + 2, "Connection: close", 17))
+        keep_alive = 0;
+    }
+
+    /* Requests that are pipelined are kept for the next round. */
+    memmove(buffer, buffer + length, filled - length);
+    filled -= length;
+
+    g_mutex_lock(&stats_mutex);
+    n = requests++;
+    g_mutex_unlock(&stats_mutex);
+
+    if (latency > 0)
+      g_usleep(latency * 1000);
+
+    /* Exactly error_rate out of every 100 requests fail, spread out
+       evenly. */
+    fail = (n + 1) * error_rate / 100 != n * error_rate / 100;
+
+    if (fail) {
+      if (_send_status(fd, "503 Service Unavailable", keep_alive) < 0)
+        break;
+    } else if (_respond(fd, path, range, keep_alive) < 0)
+      break;
+
+    if (!keep_alive)
+      break;
+  }
+
+  close(fd);
+
+  return NULL;
+}
+
+static gpointer _accept(gpointer data)
+{
+  int listener = GPOINTER_TO_INT(data);
+  int fd, on = 1;
+
+  for (;;) {
+    fd = accept(listener, NULL, NULL);
+
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+
+      perror("Error accepting connection");
+      break;
+    }
+
+    /* Headers and body are sent separately, which would otherwise be held
+       back waiting for acknowledgements. */
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+    g_thread_unref(g_thread_new("connection", _serve, GINT_TO_POINTER(fd)));
+  }
+
+  return NULL;
+}
+
+static int _listen(void)
+{
+  struct sockaddr_in address;
+  int fd, on = 1;
+
+  fd = socket(AF_INET, SOCK_STREAM, 0);
+
+  if (fd < 0) {
+    perror("Error creating socket");
+    return -1;
+  }
+
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  address.sin_port = htons(port);
+
+  if (bind(fd, (struct sockaddr *)&address, sizeof(address)) < 0 ||
+      listen(fd, 128) < 0) {
+    perror("Error listening");
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+/* Runs a command and prints how long it took. Returns its exit status. */
+static int _run(char *argv[])
+{
+  struct rusage usage;
+  gint64 started, wall;
+  pid_t pid;
+  int status;
+
+  started = g_get_monotonic_time();
+  pid = fork();
+
+  if (pid < 0) {
+    perror("Error starting command");
+    return 1;
+  }
+
+  if (!pid) {
+    execvp(argv[0], argv);
+    perror("Error starting command");
+    _exit(127);
+  }
+
+  if (wait4(pid, &status, 0, &usage) < 0) {
+    perror("Error waiting for command");
+    return 1;
+  }
+
+  wall = g_get_monotonic_time() - started;
+
+  g_mutex_lock(&stats_mutex);
+  printf("%.3f %.3f %.3f %" G_GINT64_FORMAT " %.1f\n",
+         (double)wall / G_USEC_PER_SEC,
+         usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6,
+         usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6, requests,
+         (double)bytes_sent / (1 << 20));
+  g_mutex_unlock(&stats_mutex);
+
+  return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
+
+int main(int argc, char *argv[])
+{
+  GOptionContext *context;
+  GError *error = NULL;
+  int listener, i;
+
+  GOptionEntry options[] = {
+    { "port", 'p', 0, G_OPTION_ARG_INT, &port, "port to listen on" },
+    { "items", 'i', 0, G_OPTION_ARG_INT, &items, "number of items per feed" },
+    { "size", 's', 0, G_OPTION_ARG_INT64, &size,
+      "size of each enclosure in bytes" },
+    { "latency", 'l', 0, G_OPTION_ARG_INT, &latency,
+      "delay before each response in milliseconds" },
+    { "bandwidth", 'b', 0, G_OPTION_ARG_INT64, &bandwidth,
+      "bytes per second on each connection, or 0 for no limit" },
+    { "error-rate", 'e', 0, G_OPTION_ARG_INT, &error_rate,
+      "percentage of requests that fail with 503" },
+    { "drop-after", 'd', 0, G_OPTION_ARG_INT64, &drop_after,
+      "cut off downloads of enclosures from the start after this many "
+      "bytes" },
+    { NULL }
+  };
+
+  context = g_option_context_new("[-- COMMAND [ARGUMENT...]]");
+  g_option_context_add_main_entries(context, options, NULL);
+
+  if (!g_option_context_parse(context, &argc, &argv, &error)) {
+    g_print("option parsing failed: %s\n", error->message);
+    exit(1);
+  }
+
+  g_option_context_free(context);
+
+  if (items < 0 || size < 0 || latency < 0 || bandwidth < 0 ||
+      error_rate < 0 || error_rate > 100 || drop_after < 0) {
+    g_print("option parsing failed: values must not be negative, and the "
+            "error rate is a percentage.\n");
+    exit(1);
+  }
+
+  for (i = 0; i < sizeof(pattern); i++)
+    pattern[i] = 'a' + i % 26;
+
+  listener = _listen();
+
+  if (listener < 0)
+    return 1;
+
+  for (i = 1; i < argc && !strcmp(argv[i], "--"); i++)
+    ;
+
+  if (i == argc) {
+    _accept(GINT_TO_POINTER(listener));
+    return 1;
+  }
+
+  g_thread_unref(g_thread_new("accept", _accept, GINT_TO_POINTER(listener)));
+
+  return _run(argv + i);
+}
@@ -0,0 +1,137 @@
+/* Compares the enclosure write path through stdio, as used before the
+   writer was introduced, with the writer. Data is written in the chunk
+   sizes that libcurl typically hands to its write callback. Run with
+   'make bench'. An optional argument gives the amount of data to write in
+   MiB. */
+
+#include "../src/writer.h"
+
+#include <fcntl.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+typedef struct {
+  gint64 wall;   /* microseconds */
+  gint64 cpu;    /* microseconds of user and system time */
+  long switches; /* context switches */
+} sample;
+
+static gint64 _timeval_us(const struct timeval *tv)
+{
+  return (gint64)tv->tv_sec * G_USEC_PER_SEC + tv->tv_usec;
+}
+
+/* Removes the output of the previous run and flushes dirty pages so that
+   each run starts from the same state and is not charged for the work left
+   behind by the one before it. */
+static void _start(const char *filename, sample *s, struct rusage *usage)
+{
+  g_unlink(filename);
+  sync();
+
+  getrusage(RUSAGE_SELF, usage);
+  s->wall = g_get_monotonic_time();
+}
+
+static void _stop(sample *s, const struct rusage *before)
+{
+  struct rusage after;
+
+  s->wall = g_get_monotonic_time() - s->wall;
+  getrusage(RUSAGE_SELF, &after);
+
+  s->cpu = _timeval_us(&after.ru_utime) - _timeval_us(&before->ru_utime) +
+           _timeval_us(&after.ru_stime) - _timeval_us(&before->ru_stime);
+  s->switches = after.ru_nvcsw - before->ru_nvcsw + after.ru_nivcsw -
+                before->ru_nivcsw;
+}
+
+static void _report(const char *name, gsize chunk_size, gint64 total,
+                    const sample *s)
+{
+  printf("%-24s %6zu %10.1f %10.1f %8ld\n", name, chunk_size,
+         (double)total / (1 << 20) / ((double)s->wall / G_USEC_PER_SEC),
+         (double)s->cpu / 1000, s->switches);
+}
+
+static void _bench_stdio(const char *filename, const gchar *data,
+                         gsize chunk_size, gint64 total, sample *s)
+{
+  struct rusage usage;
+  FILE *f;
+  gint64 i;
+
+  _start(filename, s, &usage);
+
+  f = fopen(filename, "wb");
+  for (i = 0; i < total; i += chunk_size)
+    fwrite(data, 1, chunk_size, f);
+  fclose(f);
+
+  _stop(s, &usage);
+}
+
+static void _bench_writer(const char *filename, const gchar *data,
+                          gsize chunk_size, gint64 total,
+                          gint64 writeback_size, sample *s)
+{
+  struct rusage usage;
+  writer *w;
+  gint64 i;
+  int fd;
+
+  _start(filename, s, &usage);
+
+  fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  w = writer_new(fd, 0, 0, writeback_size);
+  for (i = 0; i < total; i += chunk_size)
+    writer_write(w, data, chunk_size);
+  writer_free(w);
+  close(fd);
+
+  _stop(s, &usage);
+}
+
+int main(int argc, char *argv[])
+{
+  static const gsize chunk_sizes[] = { 1024, 16384, 102400 };
+  gint64 total = (argc > 1 ? atoi(argv[1]) : 256) * (gint64)(1 << 20);
+  gchar *filename;
+  gchar *data;
+  sample s;
+  int i;
+  int fd;
+
+  fd = g_file_open_tmp("castget-bench-XXXXXX", &filename, NULL);
+  if (fd < 0)
+    return 1;
+  close(fd);
+
+  data = g_malloc(chunk_sizes[G_N_ELEMENTS(chunk_sizes) - 1]);
+  memset(data, 'x', chunk_sizes[G_N_ELEMENTS(chunk_sizes) - 1]);
+
+  printf("%-24s %6s %10s %10s %8s\n", "path", "chunk", "MiB/s", "cpu ms",
+         "ctxsw");
+
+  for (i = 0; i < G_N_ELEMENTS(chunk_sizes); i++) {
+    _bench_stdio(filename, data, chunk_sizes[i], total, &s);
+    _report("stdio", chunk_sizes[i], total, &s);
+
+    _bench_writer(filename, data, chunk_sizes[i], total, 0, &s);
+    _report("writer", chunk_sizes[i], total, &s);
+
+    _bench_writer(filename, data, chunk_sizes[i], total, 8 << 20, &s);
+    _report("writer (writeback 8M)", chunk_sizes[i], total, &s);
+  }
+
+  g_unlink(filename);
+  g_free(filename);
+  g_free(data);
+
+  return 0;
+}
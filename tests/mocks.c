@@ -12,12 +12,25 @@ rss_item *mock_rss_item_new(char *item_title, char *item_pub_date)
   mock_item->description = NULL;
   mock_item->pub_date = item_pub_date;
   mock_item->enclosure = NULL;
+  mock_item->guid = NULL;
+  mock_item->index = 0;
+  mock_item->pub_time = NULL;
+
+  if (item_pub_date) {
+    mock_item->pub_time = g_new(rfc822_time, 1);
+
+    if (!parse_rfc822_time(item_pub_date, mock_item->pub_time)) {
+      g_free(mock_item->pub_time);
+      mock_item->pub_time = NULL;
+    }
+  }
 
   return mock_item;
 }
 
 void mock_rss_item_free(rss_item *item)
 {
+  g_free(item->pub_time);
   g_free(item);
 }
 
@@ -0,0 +1,833 @@
+#include "../src/channel.h"
+#include "../src/queue.h"
+#include "../src/spool.h"
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/* Creates a spool directory with files 1.mp3 to 5.mp3 of 100 bytes each and
+   a channel file recording that they were downloaded a day apart, 1.mp3
+   being the oldest. A sixth enclosure has been deleted already. */
+static channel *channel_helper(gchar **directory)
+{
+  gchar *channel_file, *filename, *name;
+  GString *history;
+  gchar buffer[100] = { 0 };
+  gint64 now = g_get_real_time() / G_USEC_PER_SEC;
+  channel *c;
+  int i;
+
+  *directory = g_dir_make_tmp("castget-XXXXXX", NULL);
+  g_assert(*directory);
+
+  history = g_string_new("<channel version=\"1.0\">\n"
+                         "<enclosure url=\"http://example.com/0.mp3\"/>\n");
+
+  for (i = 1; i <= 5; i++) {
+    name = g_strdup_printf("%d.mp3", i);
+    filename = g_build_filename(*directory, name, NULL);
+    g_assert(g_file_set_contents(filename, buffer, sizeof(buffer), NULL));
+
+    g_string_append_printf(history,
+                           "<enclosure url=\"http://example.com/%s\" "
+                           "filename=\"%s\" size=\"100\" "
+                           "timestamp=\"%" G_GINT64_FORMAT "\"/>\n",
+                           name, name, now - (6 - i) * 24 * 60 * 60);
+
+    g_free(filename);
+    g_free(name);
+  }
+
+  g_string_append(history, "</channel>\n");
+
+  channel_file = g_build_filename(*directory, "channel.xml", NULL);
+  g_assert(g_file_set_contents(channel_file, history->str, -1, NULL));
+
+  c = channel_new("http://example.com/feed.xml", channel_file, *directory,
+                  NULL, 0);
+  g_assert(c);
+
+  g_free(channel_file);
+  g_string_free(history, TRUE);
+
+  return c;
+}
+
+static void channel_helper_free(channel *c, gchar *directory)
+{
+  const gchar *name;
+  gchar *filename;
+  GDir *dir;
+
+  channel_free(c);
+
+  dir = g_dir_open(directory, 0, NULL);
+  g_assert(dir);
+
+  while ((name = g_dir_read_name(dir))) {
+    filename = g_build_filename(directory, name, NULL);
+    g_unlink(filename);
+    g_free(filename);
+  }
+
+  g_dir_close(dir);
+  g_rmdir(directory);
+  g_free(directory);
+}
+
+static gboolean file_exists(const gchar *directory, const gchar *name)
+{
+  gchar *filename = g_build_filename(directory, name, NULL);
+  gboolean exists = g_file_test(filename, G_FILE_TEST_EXISTS);
+
+  g_free(filename);
+
+  return exists;
+}
+
+static void test_channel_retention_episodes()
+{
+  retention_policy policy = { 2, 0, 0 };
+  gchar *directory;
+  channel *c = channel_helper(&directory);
+  download_record *r;
+
+  g_assert_cmpint(channel_apply_retention(c, NULL, NULL, &policy, 0), ==, 3);
+
+  g_assert(!file_exists(directory, "1.mp3"));
+  g_assert(!file_exists(directory, "3.mp3"));
+  g_assert(file_exists(directory, "4.mp3"));
+  g_assert(file_exists(directory, "5.mp3"));
+
+  /* Deleted enclosures are remembered so that they are not downloaded
+     again. */
+  r = g_hash_table_lookup(c->downloaded_enclosures, "http://example.com/1.mp3");
+  g_assert(r);
+  g_assert(!r->filename);
+
+  g_assert_cmpint(channel_apply_retention(c, NULL, NULL, &policy, 0), ==, 0);
+
+  channel_helper_free(c, directory);
+}
+
+static void test_channel_retention_age_and_size()
+{
+  retention_policy age = { 0, 3 * 24 * 60 * 60 - 60, 0 };
+  retention_policy size = { 0, 0, 150 };
+  gchar *directory;
+  channel *c = channel_helper(&directory);
+
+  /* 3.mp3 was downloaded three days ago. */
+  g_assert_cmpint(channel_apply_retention(c, NULL, NULL, &age, 0), ==, 3);
+  g_assert(file_exists(directory, "4.mp3"));
+
+  g_assert_cmpint(channel_apply_retention(c, NULL, NULL, &size, 0), ==, 1);
+  g_assert(!file_exists(directory, "4.mp3"));
+  g_assert(file_exists(directory, "5.mp3"));
+
+  channel_helper_free(c, directory);
+}
+
+static void test_channel_retention_current_update()
+{
+  retention_policy policy = { 1, 0, 0 };
+  gchar *directory;
+  channel *c = channel_helper(&directory);
+
+  /* Pretend that all the enclosures were downloaded by the last update. */
+  c->update_started = g_get_real_time() / G_USEC_PER_SEC - 10 * 24 * 60 * 60;
+
+  g_assert_cmpint(channel_apply_retention(c, NULL, NULL, &policy, 0), ==, 0);
+  g_assert(file_exists(directory, "1.mp3"));
+
+  channel_helper_free(c, directory);
+}
+
+/* Creates an empty spool directory with a feed listing 'items'. Enclosure
+   URLs in the items may refer to files in the spool directory as
+   file://%1$s/. */
+static channel *download_helper(gchar **directory, const gchar *items,
+                                const gchar *filename_pattern)
+{
+  gchar *feed, *feed_file, *channel_file, *template;
+  channel *c;
+
+  *directory = g_dir_make_tmp("castget-XXXXXX", NULL);
+  g_assert(*directory);
+
+  template = g_strdup_printf(
+      "<?xml version=\"1.0\"?>"
+      "<rss version=\"2.0\" "
+      "xmlns:itunes=\"http://www.itunes.com/dtds/podcast-1.0.dtd\" "
+      "xmlns:media=\"http://search.yahoo.com/mrss/\">"
+      "<channel><title>Channel</title>%s</channel></rss>",
+      items);
+  feed = g_strdup_printf(template, *directory);
+  feed_file = g_build_filename(*directory, "feed.xml", NULL);
+  g_assert(g_file_set_contents(feed_file, feed, -1, NULL));
+
+  channel_file = g_build_filename(*directory, "channel.xml", NULL);
+  c = channel_new(feed_file, channel_file, *directory, filename_pattern, 0);
+  g_assert(c);
+
+  g_free(channel_file);
+  g_free(feed_file);
+  g_free(feed);
+  g_free(template);
+
+  return c;
+}
+
+static void write_file(const gchar *directory, const gchar *name,
+                       const gchar *contents)
+{
+  gchar *filename = g_build_filename(directory, name, NULL);
+
+  g_assert(g_file_set_contents(filename, contents, -1, NULL));
+  g_free(filename);
+}
+
+/* Items without an episode number are numbered in the order they are
+   downloaded, and the numbering continues on the next update. */
+static void test_channel_index()
+{
+  download_options options = { 0 };
+  gchar *directory, *channel_file;
+  channel *c;
+
+  c = download_helper(
+      &directory,
+      "<item><enclosure url=\"file://%1$s/origin-c\"/></item>"
+      "<item><itunes:episode>7</itunes:episode>"
+      "<enclosure url=\"file://%1$s/origin-b\"/></item>"
+      "<item><enclosure url=\"file://%1$s/origin-a\"/></item>",
+      "%(index).mp3");
+  write_file(directory, "origin-a", "a");
+  write_file(directory, "origin-b", "b");
+  write_file(directory, "origin-c", "c");
+
+  g_assert_cmpint(channel_update(c, NULL, NULL, 0, 0, 0, 0, NULL, NULL,
+                                 &options, 0, NULL),
+                  ==, 0);
+
+  g_assert(file_exists(directory, "001.mp3"));
+  g_assert(file_exists(directory, "007.mp3"));
+  g_assert(file_exists(directory, "002.mp3"));
+  g_assert_cmpint(c->last_index, ==, 2);
+
+  channel_file = g_strdup(c->channel_filename);
+  channel_free(c);
+
+  c = channel_new("unused", channel_file, directory, NULL, 0);
+  g_assert(c);
+  g_assert_cmpint(c->last_index, ==, 2);
+
+  g_free(channel_file);
+  channel_helper_free(c, directory);
+}
+
+/* Channel files without a number continue from the number of enclosures
+   downloaded. */
+static void test_channel_index_upgrade()
+{
+  gchar *directory;
+  channel *c = channel_helper(&directory);
+
+  g_assert_cmpint(c->last_index, ==, 6);
+
+  channel_helper_free(c, directory);
+}
+
+/* Stands in for another process that saves a file under the name the
+   first download was going to use while it is in progress. */
+static void take_filename_cb(void *user_data, channel_action action,
+                             channel_info *channel_info, enclosure *enclosure,
+                             const char *filename)
+{
+  int *taken = (int *)user_data;
+
+  if (action == CCA_ENCLOSURE_DOWNLOAD_START && !*taken) {
+    g_assert(g_file_set_contents(filename, "other", -1, NULL));
+    *taken = 1;
+  }
+}
+
+static void assert_file_contents(const gchar *directory, const gchar *name,
+                                 const gchar *expected)
+{
+  gchar *filename = g_build_filename(directory, name, NULL);
+  gchar *contents;
+
+  g_assert(g_file_get_contents(filename, &contents, NULL, NULL));
+  g_assert_cmpstr(contents, ==, expected);
+
+  g_free(contents);
+  g_free(filename);
+}
+
+/* Channels that share a spool directory and name their enclosures alike
+   never overwrite each other's files, or files that appear while they
+   download. */
+static void test_channel_shared_spool()
+{
+  download_options options = { 0 };
+  gchar *directory, *feed, *feed_file, *channel_file;
+  download_queue *q;
+  channel *c1, *c2;
+  int taken = 0;
+
+  c1 = download_helper(&directory,
+                       "<item><enclosure url=\"file://%1$s/origin-a\"/>"
+                       "</item>",
+                       "episode.mp3");
+  write_file(directory, "origin-a", "a");
+  write_file(directory, "origin-b", "b");
+
+  /* A partial file left behind by someone else is not touched either. */
+  write_file(directory, "episode.mp3.part", "stale");
+
+  feed = g_strdup_printf("<?xml version=\"1.0\"?><rss version=\"2.0\">"
+                         "<channel><title>Other</title><item><enclosure "
+                         "url=\"file://%s/origin-b\"/></item></channel>"
+                         "</rss>",
+                         directory);
+  write_file(directory, "other.xml", feed);
+  feed_file = g_build_filename(directory, "other.xml", NULL);
+  channel_file = g_build_filename(directory, "other-channel.xml", NULL);
+  c2 = channel_new(feed_file, channel_file, directory, "episode.mp3", 0);
+  g_assert(c2);
+
+  q = download_queue_new(DOWNLOAD_ORDER_FEED);
+  g_assert_cmpint(channel_queue_downloads(c1, &taken, take_filename_cb, 0, 0,
+                                          NULL, NULL, &options, 0, NULL, q,
+                                          NULL),
+                  ==, 0);
+  g_assert_cmpint(channel_queue_downloads(c2, NULL, NULL, 0, 0, NULL, NULL,
+                                          &options, 0, NULL, q, NULL),
+                  ==, 0);
+  g_assert_cmpint(download_queue_run(q, 0, 0), ==, 0);
+
+  /* Both channels used the same index of the spool directory. */
+  g_assert(c1->spool);
+  g_assert(c1->spool == c2->spool);
+
+  channel_end_update(c1);
+  channel_end_update(c2);
+  download_queue_free(q);
+
+  g_assert(taken);
+  /* The first download could not use episode.mp3 as its partial file was
+     taken, nor episode (2).mp3 once it was taken while downloading, but
+     could then be saved as episode.mp3. */
+  assert_file_contents(directory, "episode.mp3.part", "stale");
+  assert_file_contents(directory, "episode (2).mp3", "other");
+  assert_file_contents(directory, "episode.mp3", "a");
+  assert_file_contents(directory, "episode (3).mp3", "b");
+  g_assert(!file_exists(directory, "episode (2).mp3.part"));
+  g_assert(!file_exists(directory, "episode (3).mp3.part"));
+
+  channel_free(c2);
+  g_free(channel_file);
+  g_free(feed_file);
+  g_free(feed);
+  channel_helper_free(c1, directory);
+}
+
+/* How a range_server answers requests for ranges. */
+typedef enum {
+  RANGE_REFUSE,        /* 416 without the length of the content */
+  RANGE_REFUSE_LENGTH, /* 416 with the length in Content-Range */
+  RANGE_IGNORE,        /* 200 with all of the content */
+  RANGE_SERVE          /* 206 with the rest of the content */
+} range_mode;
+
+/* A minimal HTTP server that serves 'content', answers requests for ranges
+   as 'mode' says, and cuts off every response after 'drop_after' bytes of
+   content unless it is 0. */
+typedef struct {
+  int fd;
+  int port;
+  const gchar *content;
+  range_mode mode;
+  gsize drop_after;
+  int requests;
+  GThread *thread;
+} range_server;
+
+static gpointer range_server_run(gpointer data)
+{
+  range_server *s = (range_server *)data;
+  gchar request[4096], *headers, *range;
+  gsize used, length = strlen(s->content), offset, sent;
+  ssize_t n;
+  int conn;
+
+  while ((conn = accept(s->fd, NULL, NULL)) >= 0) {
+    used = 0;
+    request[0] = '\0';
+
+    while (!strstr(request, "\r\n\r\n") && used < sizeof(request) - 1 &&
+           (n = read(conn, request + used, sizeof(request) - 1 - used)) > 0) {
+      used += n;
+      request[used] = '\0';
+    }
+
+    range = strstr(request, "Range: bytes=");
+    offset = range ? g_ascii_strtoull(range + strlen("Range: bytes="), NULL,
+                                      10)
+                   : 0;
+
+    if (!range || s->mode == RANGE_IGNORE) {
+      offset = 0;
+      headers = g_strdup_printf("HTTP/1.1 200 OK\r\nContent-Length: %zu\r\n"
+                                "Connection: close\r\n\r\n",
+                                length);
+    } else if (s->mode == RANGE_SERVE && offset < length)
+      headers = g_strdup_printf("HTTP/1.1 206 Partial Content\r\n"
+                                "Content-Range: bytes %zu-%zu/%zu\r\n"
+                                "Content-Length: %zu\r\n"
+                                "Connection: close\r\n\r\n",
+                                offset, length - 1, length, length - offset);
+    else {
+      offset = length;
+      headers = s->mode == RANGE_REFUSE
+                    ? g_strdup("HTTP/1.1 416 Range Not Satisfiable\r\n"
+                               "Content-Length: 0\r\n"
+                               "Connection: close\r\n\r\n")
+                    : g_strdup_printf("HTTP/1.1 416 Range Not Satisfiable\r\n"
+                                      "Content-Range: bytes */%zu\r\n"
+                                      "Content-Length: 0\r\n"
+                                      "Connection: close\r\n\r\n",
+                                      length);
+    }
+
+    sent = length - offset;
+    if (s->drop_after && sent > s->drop_after)
+      sent = s->drop_after;
+
+    g_assert(write(conn, headers, strlen(headers)) == strlen(headers));
+    g_assert(write(conn, s->content + offset, sent) == sent);
+    g_free(headers);
+    close(conn);
+    s->requests++;
+  }
+
+  return NULL;
+}
+
+static void range_server_start(range_server *s, const gchar *content,
+                               range_mode mode, gsize drop_after)
+{
+  struct sockaddr_in address = { 0 };
+  socklen_t length = sizeof(address);
+
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  s->fd = socket(AF_INET, SOCK_STREAM, 0);
+  g_assert(s->fd >= 0);
+  g_assert(bind(s->fd, (struct sockaddr *)&address, sizeof(address)) == 0);
+  g_assert(listen(s->fd, 4) == 0);
+  g_assert(getsockname(s->fd, (struct sockaddr *)&address, &length) == 0);
+
+  s->port = ntohs(address.sin_port);
+  s->content = content;
+  s->mode = mode;
+  s->drop_after = drop_after;
+  s->requests = 0;
+  s->thread = g_thread_new("range_server", range_server_run, s);
+}
+
+static void range_server_stop(range_server *s)
+{
+  shutdown(s->fd, SHUT_RDWR);
+  g_thread_join(s->thread);
+  close(s->fd);
+}
+
+/* Creates a channel with one item whose enclosure of 'length' bytes is
+   served by 's' as episode.mp3. 'extra' is added to the item. */
+static channel *server_helper(gchar **directory, range_server *s,
+                              gsize length, const gchar *extra)
+{
+  gchar *items;
+  channel *c;
+
+  items = g_strdup_printf("<item><enclosure "
+                          "url=\"http://127.0.0.1:%d/episode.mp3\" "
+                          "length=\"%zu\"/>%s</item>",
+                          s->port, length, extra ? extra : "");
+  c = download_helper(directory, items, "episode.mp3");
+  g_free(items);
+
+  return c;
+}
+
+/* Resumes the download of a 10 byte enclosure from a partial file holding
+   'part', and checks that the enclosure ends up complete after
+   'requests' requests. */
+static void resume_helper(const gchar *part, range_mode mode, int requests)
+{
+  download_options options = { 0 };
+  const gchar *content = "0123456789";
+  gchar *directory;
+  range_server s;
+  channel *c;
+
+  range_server_start(&s, content, mode, 0);
+  c = server_helper(&directory, &s, strlen(content), NULL);
+  write_file(directory, "episode.mp3.part", part);
+
+  g_assert_cmpint(channel_update(c, NULL, NULL, 0, 0, 0, 1, NULL, NULL,
+                                 &options, 0, NULL),
+                  ==, 0);
+
+  range_server_stop(&s);
+  g_assert_cmpint(s.requests, ==, requests);
+
+  assert_file_contents(directory, "episode.mp3", content);
+  g_assert(!file_exists(directory, "episode.mp3.part"));
+
+  channel_helper_free(c, directory);
+}
+
+/* A partial file that is as long as the enclosure is complete. */
+static void test_channel_resume_complete()
+{
+  resume_helper("0123456789", RANGE_REFUSE_LENGTH, 1);
+  resume_helper("0123456789", RANGE_REFUSE, 1);
+}
+
+/* A partial file that is longer than the enclosure cannot belong to it, so
+   the download starts over. */
+static void test_channel_resume_past_end()
+{
+  resume_helper("abcdefghijklmnopqrst", RANGE_REFUSE_LENGTH, 2);
+  resume_helper("abcdefghijklmnopqrst", RANGE_REFUSE, 2);
+}
+
+/* A partial file is resumed from where it ends. */
+static void test_channel_resume_partial()
+{
+  resume_helper("0123", RANGE_SERVE, 1);
+}
+
+/* A server that does not support ranges sends the whole enclosure again,
+   so the download starts over. */
+static void test_channel_resume_ignored()
+{
+  resume_helper("0123", RANGE_IGNORE, 2);
+}
+
+/* Downloads a 10 byte enclosure from a server that cuts off every response
+   after 'drop_after' bytes, and checks that it took 'requests' requests.
+   Returns the channel, whose history is saved, and the URL of the
+   enclosure. */
+static channel *dropped_helper(gchar **directory, gchar **url,
+                               gsize drop_after, int requests)
+{
+  download_options options = { 0 };
+  range_server s;
+  channel *c;
+
+  range_server_start(&s, "0123456789", RANGE_SERVE, drop_after);
+  c = server_helper(directory, &s, 10, NULL);
+  *url = g_strdup_printf("http://127.0.0.1:%d/episode.mp3", s.port);
+
+  channel_update(c, NULL, NULL, 0, 0, 0, 0, NULL, NULL, &options, 0, NULL);
+
+  range_server_stop(&s);
+  g_assert_cmpint(s.requests, ==, requests);
+
+  return c;
+}
+
+/* A download that the server cuts off is resumed from where it stopped,
+   and is only recorded in the download history once it has the length the
+   server gave. */
+static void test_channel_resume_dropped()
+{
+  gchar *directory, *url, *history;
+  download_record *r;
+  channel *c;
+
+  c = dropped_helper(&directory, &url, 4, 3);
+
+  assert_file_contents(directory, "episode.mp3", "0123456789");
+  g_assert(!file_exists(directory, "episode.mp3.part"));
+
+  r = g_hash_table_lookup(c->downloaded_enclosures, url);
+  g_assert(r);
+  g_assert_cmpint(r->size, ==, 10);
+
+  g_assert(g_file_get_contents(c->channel_filename, &history, NULL, NULL));
+  g_assert(strstr(history, url));
+
+  g_free(history);
+  g_free(url);
+  channel_helper_free(c, directory);
+
+  /* Once it stops making progress often enough, it is left partial and
+     not recorded. */
+  c = dropped_helper(&directory, &url, 1, 4);
+
+  assert_file_contents(directory, "episode.mp3.part", "0123");
+  g_assert(!file_exists(directory, "episode.mp3"));
+  g_assert(!g_hash_table_lookup(c->downloaded_enclosures, url));
+
+  if (g_file_get_contents(c->channel_filename, &history, NULL, NULL)) {
+    g_assert(!strstr(history, url));
+    g_free(history);
+  }
+
+  g_free(url);
+  channel_helper_free(c, directory);
+}
+
+
+/* Returns a media:hash element with the MD5 digest of 'content'. */
+static gchar *hash_element(const gchar *content)
+{
+  gchar *md5, *element;
+
+  md5 = g_compute_checksum_for_string(G_CHECKSUM_MD5, content, -1);
+  element = g_strdup_printf("<media:hash>%s</media:hash>", md5);
+  g_free(md5);
+
+  return element;
+}
+
+/* Checks that the enclosure at 'url' is recorded as rejected after
+   'received' was received. */
+static void assert_rejected(channel *c, const gchar *url,
+                            const gchar *received)
+{
+  download_record *r = g_hash_table_lookup(c->downloaded_enclosures, url);
+  gchar *sha256;
+
+  g_assert(r);
+  g_assert(!r->filename);
+  g_assert_cmpint(r->size, ==, 0);
+
+  sha256 = g_compute_checksum_for_string(G_CHECKSUM_SHA256, received, -1);
+  g_assert_cmpstr(r->sha256, ==, sha256);
+  g_free(sha256);
+}
+
+/* An enclosure that does not match the hash in the feed is discarded and
+   recorded so that it is not downloaded again, and the items after it are
+   still downloaded. */
+static void test_channel_hash()
+{
+  download_options options = { 0 };
+  const gchar *content = "0123456789";
+  gchar *directory, *items, *good, *bad, *url;
+  download_record *r;
+  range_server s;
+  channel *c;
+
+  range_server_start(&s, content, RANGE_SERVE, 0);
+
+  bad = hash_element("9876543210");
+  good = hash_element(content);
+  items = g_strdup_printf(
+      "<item><enclosure url=\"http://127.0.0.1:%1$d/bad.mp3\"/>%2$s</item>"
+      "<item><enclosure url=\"http://127.0.0.1:%1$d/good.mp3\"/>%3$s</item>",
+      s.port, bad, good);
+  c = download_helper(&directory, items, "episode.mp3");
+
+  g_assert_cmpint(channel_update(c, NULL, NULL, 0, 0, 0, 0, NULL, NULL,
+                                 &options, 0, NULL),
+                  ==, 0);
+  g_assert_cmpint(s.requests, ==, 2);
+
+  url = g_strdup_printf("http://127.0.0.1:%d/bad.mp3", s.port);
+  assert_rejected(c, url, content);
+  g_free(url);
+
+  url = g_strdup_printf("http://127.0.0.1:%d/good.mp3", s.port);
+  r = g_hash_table_lookup(c->downloaded_enclosures, url);
+  g_assert(r);
+  g_assert_cmpstr(r->filename, ==, "episode.mp3");
+  g_free(url);
+
+  assert_file_contents(directory, "episode.mp3", content);
+  g_assert(!file_exists(directory, "episode.mp3.part"));
+  g_assert(!file_exists(directory, "episode (2).mp3"));
+
+  /* Neither is downloaded again. */
+  g_assert_cmpint(channel_update(c, NULL, NULL, 0, 0, 0, 0, NULL, NULL,
+                                 &options, 0, NULL),
+                  ==, 0);
+  g_assert_cmpint(s.requests, ==, 2);
+
+  range_server_stop(&s);
+
+  g_free(items);
+  g_free(good);
+  g_free(bad);
+  channel_helper_free(c, directory);
+}
+
+/* The part of an enclosure that was downloaded before it was resumed is
+   included in the check against the hash in the feed. */
+static void test_channel_resume_hash()
+{
+  download_options options = { 0 };
+  const gchar *content = "0123456789";
+  const gchar *parts[] = { "0123", "abcd" };
+  gchar *directory, *hash, *url;
+  range_server s;
+  channel *c;
+  int i;
+
+  hash = hash_element(content);
+
+  for (i = 0; i < G_N_ELEMENTS(parts); i++) {
+    range_server_start(&s, content, RANGE_SERVE, 0);
+    c = server_helper(&directory, &s, strlen(content), hash);
+    url = g_strdup_printf("http://127.0.0.1:%d/episode.mp3", s.port);
+    write_file(directory, "episode.mp3.part", parts[i]);
+
+    g_assert_cmpint(channel_update(c, NULL, NULL, 0, 0, 0, 1, NULL, NULL,
+                                   &options, 0, NULL),
+                    ==, 0);
+
+    range_server_stop(&s);
+    g_assert_cmpint(s.requests, ==, 1);
+    g_assert(!file_exists(directory, "episode.mp3.part"));
+
+    if (i == 0)
+      assert_file_contents(directory, "episode.mp3", content);
+    else {
+      g_assert(!file_exists(directory, "episode.mp3"));
+      assert_rejected(c, url, "abcd456789");
+    }
+
+    g_free(url);
+    channel_helper_free(c, directory);
+  }
+
+  g_free(hash);
+}
+
+/* Returns the total size of the files in 'directory'. */
+static gint64 spool_size(const gchar *directory)
+{
+  spool_index *s = spool_index_open(directory);
+  gint64 size;
+
+  g_assert(s);
+  size = spool_index_total_size(s);
+  spool_index_close(s);
+
+  return size;
+}
+
+/* An enclosure whose length in the feed does not fit in the spool quota is
+   skipped without being requested, and smaller enclosures after it are
+   still downloaded. */
+static void test_channel_spool_quota()
+{
+  download_options options = { 0 };
+  const gchar *content = "0123456789";
+  gchar *directory, *items, *url;
+  range_server s;
+  channel *c;
+
+  range_server_start(&s, content, RANGE_SERVE, 0);
+
+  items = g_strdup_printf(
+      "<item><enclosure url=\"http://127.0.0.1:%1$d/big.mp3\" "
+      "length=\"100000\"/></item>"
+      "<item><enclosure url=\"http://127.0.0.1:%1$d/small.mp3\" "
+      "length=\"10\"/></item>",
+      s.port);
+  c = download_helper(&directory, items, "episode.mp3");
+  options.spool_quota = spool_size(directory) + 500;
+
+  g_assert_cmpint(channel_update(c, NULL, NULL, 0, 0, 0, 0, NULL, NULL,
+                                 &options, 0, NULL),
+                  ==, 0);
+
+  range_server_stop(&s);
+  g_assert_cmpint(s.requests, ==, 1);
+
+  url = g_strdup_printf("http://127.0.0.1:%d/big.mp3", s.port);
+  g_assert(!g_hash_table_lookup(c->downloaded_enclosures, url));
+  g_free(url);
+
+  assert_file_contents(directory, "episode.mp3", content);
+  g_assert(!file_exists(directory, "episode.mp3.part"));
+  g_assert(!file_exists(directory, "episode (2).mp3.part"));
+
+  g_free(items);
+  channel_helper_free(c, directory);
+}
+
+/* An enclosure that the server says does not fit in the spool quota is
+   declined as soon as the server says so, and leaves nothing behind. */
+static void test_channel_spool_quota_declined()
+{
+  download_options options = { 0 };
+  gchar *directory, *items, *url;
+  range_server s;
+  channel *c;
+
+  range_server_start(&s, "0123456789", RANGE_SERVE, 0);
+
+  /* The feed does not give the length. */
+  url = g_strdup_printf("http://127.0.0.1:%d/episode.mp3", s.port);
+  items = g_strdup_printf("<item><enclosure url=\"%s\"/></item>", url);
+  c = download_helper(&directory, items, "episode.mp3");
+  options.spool_quota = spool_size(directory) + 5;
+
+  g_assert_cmpint(channel_update(c, NULL, NULL, 0, 0, 0, 0, NULL, NULL,
+                                 &options, 0, NULL),
+                  ==, 0);
+
+  range_server_stop(&s);
+  g_assert_cmpint(s.requests, ==, 1);
+
+  g_assert(!g_hash_table_lookup(c->downloaded_enclosures, url));
+  g_assert(!file_exists(directory, "episode.mp3"));
+  g_assert(!file_exists(directory, "episode.mp3.part"));
+  g_assert_cmpint(c->stats.failures, ==, 0);
+
+  g_free(items);
+  g_free(url);
+  channel_helper_free(c, directory);
+}
+
+int main(int argc, char *argv[])
+{
+  g_test_init(&argc, &argv, NULL);
+
+  g_test_add_func("/channel/retention_episodes",
+                  test_channel_retention_episodes);
+  g_test_add_func("/channel/retention_age_and_size",
+                  test_channel_retention_age_and_size);
+  g_test_add_func("/channel/retention_current_update",
+                  test_channel_retention_current_update);
+  g_test_add_func("/channel/index", test_channel_index);
+  g_test_add_func("/channel/index_upgrade", test_channel_index_upgrade);
+  g_test_add_func("/channel/shared_spool", test_channel_shared_spool);
+  g_test_add_func("/channel/resume_complete", test_channel_resume_complete);
+  g_test_add_func("/channel/resume_past_end", test_channel_resume_past_end);
+  g_test_add_func("/channel/resume_partial", test_channel_resume_partial);
+  g_test_add_func("/channel/resume_ignored", test_channel_resume_ignored);
+  g_test_add_func("/channel/resume_dropped", test_channel_resume_dropped);
+  g_test_add_func("/channel/hash", test_channel_hash);
+  g_test_add_func("/channel/resume_hash", test_channel_resume_hash);
+  g_test_add_func("/channel/spool_quota", test_channel_spool_quota);
+  g_test_add_func("/channel/spool_quota_declined",
+                  test_channel_spool_quota_declined);
+
+  return g_test_run();
+}
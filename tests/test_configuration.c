@@ -0,0 +1,67 @@
+#include "../src/configuration.h"
+
+#include <glib.h>
+
+/* Reads the configuration of channel 'identifier' from 'data', with the
+   global configuration in 'defaults'. */
+static struct channel_configuration *
+configuration_helper(const gchar *data, const gchar *identifier,
+                     struct channel_configuration *defaults)
+{
+  struct channel_configuration *c;
+  GKeyFile *kf = g_key_file_new();
+
+  g_assert(g_key_file_load_from_data(kf, data, -1, G_KEY_FILE_NONE, NULL));
+  g_assert_cmpint(channel_configuration_verify_keys(kf, identifier), ==, 0);
+
+  c = channel_configuration_new(kf, identifier, defaults);
+  g_key_file_free(kf);
+
+  return c;
+}
+
+static void test_configuration_numbers()
+{
+  struct channel_configuration *c;
+
+  c = configuration_helper("[c]\n"
+                           "max_feed_size=10M\n"
+                           "max_items=500\n"
+                           "max_parse_time=2m\n"
+                           "newer_than=2019-01-07\n",
+                           "c", NULL);
+  g_assert(c);
+  g_assert_cmpint(c->max_feed_size, ==, 10 << 20);
+  g_assert_cmpint(c->max_items, ==, 500);
+  g_assert_cmpint(c->max_parse_time, ==, 120);
+  g_assert_cmpint(c->newer_than, >, 0);
+  g_assert_cmpint(c->spool_quota, ==, 0);
+
+  channel_configuration_free(c);
+}
+
+/* A value that cannot be parsed does not silently turn into "no limit".
+   The channel is rejected instead. */
+static void test_configuration_invalid_number()
+{
+  const gchar *invalid[] = {
+    "[c]\nmax_feed_size=10MB\n", "[c]\nmax_items=many\n",
+    "[c]\nmax_parse_time=-1\n",  "[c]\nmax_age=2w\n",
+    "[c]\nspool_quota=1.5G\n",   "[c]\nnewer_than=2019-02-30\n",
+  };
+  int i;
+
+  for (i = 0; i < G_N_ELEMENTS(invalid); i++)
+    g_assert(!configuration_helper(invalid[i], "c", NULL));
+}
+
+int main(int argc, char *argv[])
+{
+  g_test_init(&argc, &argv, NULL);
+
+  g_test_add_func("/configuration/numbers", test_configuration_numbers);
+  g_test_add_func("/configuration/invalid_number",
+                  test_configuration_invalid_number);
+
+  return g_test_run();
+}
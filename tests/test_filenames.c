@@ -4,6 +4,7 @@
 #include <glib.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 static void filename_helper(const char *pattern, char *channel_title,
                             char *item_title, char *item_pub_date,
@@ -47,12 +48,87 @@ static void test_build_enclosure_filename()
                   "/spool/invalidname.mp3");
 }
 
+static void sanitise_helper(const char *filename, const char *expected)
+{
+  gchar *s = g_strdup(filename);
+  gsize length = sanitise_filename(s);
+
+  g_assert_cmpstr(s, ==, expected);
+  g_assert_cmpuint(length, ==, strlen(expected));
+
+  g_free(s);
+}
+
+static void test_sanitise_filename()
+{
+  sanitise_helper("", "");
+  sanitise_helper("a/b\\c?d%e*f:g|h\"i<j>k,l'm\nn\to\rp", "abcdefghijklmnop");
+  sanitise_helper("\xc3\xa9t\xc3\xa9.mp3", "\xc3\xa9t\xc3\xa9.mp3");
+  sanitise_helper("bad\xff\xc3utf8.mp3", "badutf8.mp3");
+  sanitise_helper(".", "");
+  sanitise_helper("..", "");
+  sanitise_helper("...", "...");
+}
+
+static void test_sanitise_long_filename()
+{
+  GString *s = g_string_new(NULL);
+  gsize length;
+  int i;
+
+  /* 200 two-byte characters followed by an extension. */
+  for (i = 0; i < 200; i++)
+    g_string_append(s, "\xc3\xa9");
+  g_string_append(s, ".mp3");
+
+  length = sanitise_filename(s->str);
+
+  g_assert_cmpuint(length, <=, 255);
+  g_assert_cmpuint(length, ==, strlen(s->str));
+  g_assert(g_str_has_suffix(s->str, ".mp3"));
+  g_assert(g_utf8_validate(s->str, -1, NULL));
+
+  g_string_free(s, TRUE);
+}
+
+static void test_build_numbered_filename()
+{
+  GString *s = g_string_new(NULL);
+  gchar *filename;
+
+  filename = build_numbered_filename("a.mp3", 2);
+  g_assert_cmpstr(filename, ==, "a (2).mp3");
+  g_free(filename);
+
+  filename = build_numbered_filename("noextension", 10);
+  g_assert_cmpstr(filename, ==, "noextension (10)");
+  g_free(filename);
+
+  /* A filename at the length limit is shortened to make room. */
+  while (s->len < 251)
+    g_string_append_c(s, 'x');
+  g_string_append(s, ".mp3");
+
+  filename = build_numbered_filename(s->str, 2);
+  g_assert_cmpuint(strlen(filename), ==, 255);
+  g_assert(g_str_has_suffix(filename, "x (2).mp3"));
+  g_free(filename);
+
+  g_string_free(s, TRUE);
+}
+
 int main(int argc, char *argv[])
 {
   g_test_init(&argc, &argv, NULL);
 
   g_test_add_func("/filename_patterns/build_enclosure_filename",
                   test_build_enclosure_filename);
+  g_test_add_func("/filename_patterns/sanitise_filename",
+                  test_sanitise_filename);
+  g_test_add_func("/filename_patterns/sanitise_long_filename",
+                  test_sanitise_long_filename);
+  g_test_add_func("/filename_patterns/build_numbered_filename",
+                  test_build_numbered_filename);
 
   return g_test_run();
 }
@@ -0,0 +1,223 @@
+#include "../src/filters.h"
+#include "mocks.h"
+
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static void filter_helper(const gchar *const *include,
+                          const gchar *const *exclude, gboolean caseless,
+                          char *url, gboolean expected_match)
+{
+  enclosure mock_enclosure = { url, 0, NULL };
+  rss_item *mock_item = mock_rss_item_new(NULL, NULL);
+  enclosure_filter *filter = enclosure_filter_new(include, exclude, caseless);
+
+  mock_item->enclosure = &mock_enclosure;
+
+  g_assert(filter);
+  g_assert_cmpint(enclosure_filter_match(filter, mock_item), ==,
+                  expected_match);
+
+  enclosure_filter_free(filter);
+  mock_rss_item_free(mock_item);
+}
+
+static gboolean predicate_helper(enclosure_filter *filter, char *title,
+                                 char *pub_date, long length, char *type)
+{
+  enclosure mock_enclosure = { "http://example.com/a.mp3", length, type };
+  rss_item *mock_item = mock_rss_item_new(title, pub_date);
+  gboolean match;
+
+  mock_item->enclosure = &mock_enclosure;
+  match = enclosure_filter_match(filter, mock_item);
+  mock_rss_item_free(mock_item);
+
+  return match;
+}
+
+static void test_single_include_pattern()
+{
+  const gchar *include[] = { "\\.mp3$", NULL };
+
+  filter_helper(include, NULL, FALSE, "http://example.com/a.mp3", TRUE);
+  filter_helper(include, NULL, FALSE, "http://example.com/a.mp4", FALSE);
+  filter_helper(include, NULL, FALSE, "http://example.com/a.MP3", FALSE);
+  filter_helper(include, NULL, TRUE, "http://example.com/a.MP3", TRUE);
+}
+
+static void test_multiple_include_patterns()
+{
+  const gchar *include[] = { "\\.mp3$", "^https:", "a|b", NULL };
+
+  filter_helper(include, NULL, FALSE, "http://example.com/x.mp3", TRUE);
+  filter_helper(include, NULL, FALSE, "https://example.com/x.ogg", TRUE);
+  filter_helper(include, NULL, FALSE, "http://example.com/b.ogg", TRUE);
+  filter_helper(include, NULL, FALSE, "http://exomple.com/x.ogg", FALSE);
+}
+
+static void test_exclude_patterns()
+{
+  const gchar *exclude[] = { "trailer", "\\.mp4$", NULL };
+
+  filter_helper(NULL, exclude, FALSE, "http://example.com/ep1.mp3", TRUE);
+  filter_helper(NULL, exclude, FALSE, "http://example.com/trailer.mp3", FALSE);
+  filter_helper(NULL, exclude, FALSE, "http://example.com/ep1.mp4", FALSE);
+}
+
+static void test_include_and_exclude_patterns()
+{
+  const gchar *include[] = { "^http://example\\.com/", NULL };
+  const gchar *exclude[] = { "-hd\\.", NULL };
+
+  filter_helper(include, exclude, FALSE, "http://example.com/ep1.mp4", TRUE);
+  filter_helper(include, exclude, FALSE, "http://example.com/ep1-hd.mp4",
+                FALSE);
+  filter_helper(include, exclude, FALSE, "http://example.org/ep1.mp4", FALSE);
+}
+
+static void test_invalid_pattern()
+{
+  const gchar *include[] = { "valid", "(invalid", NULL };
+
+  g_assert(enclosure_filter_new(include, NULL, FALSE) == NULL);
+}
+
+/* Patterns are checked on their own before they are combined. */
+static void test_pattern_isolation()
+{
+  const gchar *unbalanced[] = { "a)|(b", NULL };
+  const gchar *backreference[] = { "(x)", "(a)\\1", NULL };
+  const gchar *quoted[] = { "\\Qa.mp3", "ogg$", NULL };
+
+  g_assert(enclosure_filter_new(unbalanced, NULL, FALSE) == NULL);
+  g_assert(enclosure_filter_new(NULL, unbalanced, FALSE) == NULL);
+  g_assert(enclosure_filter_new(backreference, NULL, FALSE) == NULL);
+
+  filter_helper(quoted, NULL, FALSE, "http://example.com/a.mp3", TRUE);
+  filter_helper(quoted, NULL, FALSE, "http://example.com/aXmp3", FALSE);
+  filter_helper(quoted, NULL, FALSE, "http://example.com/b.ogg", TRUE);
+}
+
+static void test_size_predicates()
+{
+  enclosure_filter *filter = enclosure_filter_new(NULL, NULL, FALSE);
+
+  enclosure_filter_set_size_range(filter, 1000, 5000);
+
+  g_assert(!predicate_helper(filter, NULL, NULL, 999, NULL));
+  g_assert(predicate_helper(filter, NULL, NULL, 1000, NULL));
+  g_assert(predicate_helper(filter, NULL, NULL, 5000, NULL));
+  g_assert(!predicate_helper(filter, NULL, NULL, 5001, NULL));
+
+  /* Unknown length */
+  g_assert(predicate_helper(filter, NULL, NULL, 0, NULL));
+
+  enclosure_filter_free(filter);
+}
+
+static void test_type_predicate()
+{
+  enclosure_filter *filter = enclosure_filter_new(NULL, NULL, FALSE);
+
+  g_assert(enclosure_filter_set_type_pattern(filter, "^audio/"));
+
+  g_assert(predicate_helper(filter, NULL, NULL, 0, "audio/mpeg"));
+  g_assert(predicate_helper(filter, NULL, NULL, 0, "Audio/MPEG"));
+  g_assert(!predicate_helper(filter, NULL, NULL, 0, "video/mp4"));
+
+  /* Unknown type */
+  g_assert(predicate_helper(filter, NULL, NULL, 0, NULL));
+
+  g_assert(!enclosure_filter_set_type_pattern(filter, "(invalid"));
+
+  enclosure_filter_free(filter);
+}
+
+static void test_title_predicate()
+{
+  enclosure_filter *filter = enclosure_filter_new(NULL, NULL, FALSE);
+
+  g_assert(enclosure_filter_set_title_pattern(filter, "^(?!.*trailer)"));
+
+  g_assert(predicate_helper(filter, "Episode 1", NULL, 0, NULL));
+  g_assert(!predicate_helper(filter, "Season 2 Trailer", NULL, 0, NULL));
+
+  enclosure_filter_free(filter);
+}
+
+/* Formats the time 'age' seconds ago as an RFC 822 date. */
+static void _format_age(gchar *buffer, gsize size, time_t age)
+{
+  time_t t = time(NULL) - age;
+  struct tm tm;
+
+  gmtime_r(&t, &tm);
+  strftime(buffer, size, "%d %b %Y %H:%M:%S +0000", &tm);
+}
+
+static void test_date_predicates()
+{
+  enclosure_filter *filter = enclosure_filter_new(NULL, NULL, FALSE);
+  GDate *date = g_date_new_dmy(1, 10, 2015);
+  gchar pub_date[64];
+
+  enclosure_filter_set_date_range(filter, g_date_get_julian(date), 0);
+
+  g_assert(!predicate_helper(filter, NULL, "Wed, 30 Sep 2015 09:53:38 GMT", 0,
+                             NULL));
+  g_assert(!predicate_helper(filter, NULL, "Thu, 01 Oct 2015 09:53:38 GMT", 0,
+                             NULL));
+  g_assert(predicate_helper(filter, NULL, "Fri, 02 Oct 2015 09:53:38 GMT", 0,
+                            NULL));
+
+  /* Missing or invalid date */
+  g_assert(predicate_helper(filter, NULL, NULL, 0, NULL));
+  g_assert(predicate_helper(filter, NULL, "yesterday", 0, NULL));
+
+  /* Relative to now, to the second */
+  enclosure_filter_set_date_range(filter, 0, 12 * 60 * 60);
+
+  _format_age(pub_date, sizeof(pub_date), 2 * 60 * 60);
+  g_assert(predicate_helper(filter, NULL, pub_date, 0, NULL));
+
+  _format_age(pub_date, sizeof(pub_date), 13 * 60 * 60);
+  g_assert(!predicate_helper(filter, NULL, pub_date, 0, NULL));
+
+  enclosure_filter_set_date_range(filter, 0, 7 * 24 * 60 * 60);
+
+  _format_age(pub_date, sizeof(pub_date), 7 * 24 * 60 * 60 - 60);
+  g_assert(predicate_helper(filter, NULL, pub_date, 0, NULL));
+
+  _format_age(pub_date, sizeof(pub_date), 7 * 24 * 60 * 60 + 60 * 60);
+  g_assert(!predicate_helper(filter, NULL, pub_date, 0, NULL));
+
+  /* Missing dates do not exclude the item */
+  g_assert(predicate_helper(filter, NULL, NULL, 0, NULL));
+
+  g_date_free(date);
+  enclosure_filter_free(filter);
+}
+
+int main(int argc, char *argv[])
+{
+  g_test_init(&argc, &argv, NULL);
+
+  g_test_add_func("/filters/single_include_pattern",
+                  test_single_include_pattern);
+  g_test_add_func("/filters/multiple_include_patterns",
+                  test_multiple_include_patterns);
+  g_test_add_func("/filters/exclude_patterns", test_exclude_patterns);
+  g_test_add_func("/filters/include_and_exclude_patterns",
+                  test_include_and_exclude_patterns);
+  g_test_add_func("/filters/invalid_pattern", test_invalid_pattern);
+  g_test_add_func("/filters/pattern_isolation", test_pattern_isolation);
+  g_test_add_func("/filters/size_predicates", test_size_predicates);
+  g_test_add_func("/filters/type_predicate", test_type_predicate);
+  g_test_add_func("/filters/title_predicate", test_title_predicate);
+  g_test_add_func("/filters/date_predicates", test_date_predicates);
+
+  return g_test_run();
+}
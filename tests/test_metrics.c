@@ -0,0 +1,173 @@
+#include "../src/metrics.h"
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static gchar *_write(metrics *m, schedule *totals)
+{
+  gchar *filename, *contents;
+  struct stat st;
+  mode_t mask;
+  int fd;
+
+  fd = g_file_open_tmp("castget-XXXXXX", &filename, NULL);
+  g_assert(fd >= 0);
+  close(fd);
+
+  /* The file must be readable by a metrics collector running as another
+     user. */
+  mask = umask(022);
+  g_assert_cmpint(metrics_write(m, totals, filename, 0), ==, 0);
+  umask(mask);
+
+  g_assert(g_stat(filename, &st) == 0);
+  g_assert_cmpint(st.st_mode & 0777, ==, 0644);
+  g_assert(g_file_get_contents(filename, &contents, NULL, NULL));
+
+  g_unlink(filename);
+  g_free(filename);
+
+  return contents;
+}
+
+static void test_metrics_write()
+{
+  metrics *m;
+  channel c;
+  gchar *contents;
+
+  memset(&c, 0, sizeof(channel));
+  c.stats.feed.transfers = 2;
+  c.stats.feed.bytes = 1000;
+  c.stats.feed.total_time = 300000;
+  c.stats.feed.durations[1] = 1; /* up to 0.1 seconds */
+  c.stats.feed.durations[URLGET_DURATION_BUCKETS - 1] = 1;
+  c.stats.feed.failures[URLGET_ERROR_TIMEOUT] = 1;
+  c.stats.items_new = 5;
+  c.stats.items_filtered = 1;
+  c.stats.enclosures.transfers = 2;
+  c.stats.enclosures.bytes = 4000000;
+  c.stats.downloads = 2;
+
+  m = metrics_new();
+  metrics_set_last_success(m, "b", 0);
+  metrics_set_last_success(m, "a\"\\\n", 1600000000);
+  metrics_add_channel(m, "a\"\\\n", &c);
+  metrics_add_channel(m, "a\"\\\n", &c);
+  metrics_add_run(m, G_GINT64_CONSTANT(1600000000) * G_USEC_PER_SEC,
+                  G_USEC_PER_SEC / 2, 3);
+
+  contents = _write(m, NULL);
+
+  g_assert(strstr(contents, "# TYPE castget_feed_fetch_duration_seconds "
+                            "histogram\n"));
+  g_assert(strstr(contents,
+                  "castget_feed_fetch_duration_seconds_bucket{le=\"0.05\"} 0\n"
+                  "castget_feed_fetch_duration_seconds_bucket{le=\"0.1\"} "
+                  "2\n"));
+  g_assert(strstr(contents,
+                  "castget_feed_fetch_duration_seconds_bucket{le=\"300\"} 2\n"
+                  "castget_feed_fetch_duration_seconds_bucket{le=\"+Inf\"} 4\n"
+                  "castget_feed_fetch_duration_seconds_sum 0.600000\n"
+                  "castget_feed_fetch_duration_seconds_count 4\n"));
+  g_assert(strstr(contents, "castget_download_bytes_total 8000000\n"));
+  g_assert(strstr(contents, "castget_downloads_total 4\n"));
+  g_assert(strstr(contents, "castget_transfer_failures_total{kind=\"feed\","
+                            "class=\"timeout\"} 2\n"));
+  g_assert(strstr(contents,
+                  "castget_transfer_failures_total{kind=\"enclosure\","
+                  "class=\"timeout\"} 0\n"));
+
+  /* Label values are escaped, and channels are listed in order. */
+  g_assert(strstr(contents,
+                  "castget_items_pending{channel=\"a\\\"\\\\\\n\"} 2\n"
+                  "castget_items_pending{channel=\"b\"} 0\n"));
+
+  /* Channels that have never been retrieved have no last success. */
+  g_assert(strstr(contents, "castget_channel_last_success_timestamp_seconds"
+                            "{channel=\"a\\\"\\\\\\n\"} 1600000000\n#"));
+
+  g_assert(strstr(contents, "castget_enclosures_left 3\n"));
+  g_assert(strstr(contents, "castget_runs_total 1\n"));
+  g_assert(strstr(contents, "castget_last_run_duration_seconds 0.500000\n"));
+
+  g_free(contents);
+  metrics_free(m);
+}
+
+/* Counters and histograms carry over from one run to the next through the
+   schedule. */
+static void test_metrics_totals()
+{
+  gchar *directory = g_dir_make_tmp("castget-XXXXXX", NULL);
+  gchar *filename = g_build_filename(directory, "schedule", NULL);
+  gchar *lock_filename = g_build_filename(directory, "schedule.lock", NULL);
+  schedule *s;
+  metrics *m;
+  channel c;
+  gchar *contents;
+  int run;
+
+  g_assert(directory);
+
+  memset(&c, 0, sizeof(channel));
+  c.stats.feed.transfers = 1;
+  c.stats.feed.total_time = 200000;
+  c.stats.feed.durations[2] = 1;
+  c.stats.enclosures.failures[URLGET_ERROR_HTTP] = 1;
+  c.stats.enclosures.bytes = 1000;
+  c.stats.downloads = 1;
+
+  for (run = 1; run <= 2; run++) {
+    s = schedule_load(filename);
+    m = metrics_new();
+    metrics_add_channel(m, "a", &c);
+    metrics_add_run(m, 0, 0, 0);
+    metrics_save_totals(m, s);
+    g_assert_cmpint(schedule_save(s), ==, 0);
+
+    /* Saving again does not count the same run twice. */
+    metrics_save_totals(m, s);
+    g_assert_cmpint(schedule_save(s), ==, 0);
+
+    contents = _write(m, s);
+    metrics_free(m);
+    schedule_free(s);
+  }
+
+  g_assert(strstr(contents,
+                  "castget_feed_fetch_duration_seconds_sum 0.400000\n"
+                  "castget_feed_fetch_duration_seconds_count 2\n"));
+  g_assert(strstr(contents,
+                  "castget_feed_fetch_duration_seconds_bucket{le=\"0.25\"} "
+                  "2\n"));
+  g_assert(strstr(contents, "castget_download_bytes_total 2000\n"));
+  g_assert(strstr(contents, "castget_downloads_total 2\n"));
+  g_assert(strstr(contents,
+                  "castget_transfer_failures_total{kind=\"enclosure\","
+                  "class=\"http\"} 2\n"));
+  g_assert(strstr(contents, "castget_runs_total 2\n"));
+  g_free(contents);
+
+  g_unlink(filename);
+  g_unlink(lock_filename);
+  g_rmdir(directory);
+
+  g_free(lock_filename);
+  g_free(filename);
+  g_free(directory);
+}
+
+int main(int argc, char *argv[])
+{
+  g_test_init(&argc, &argv, NULL);
+
+  g_test_add_func("/metrics/write", test_metrics_write);
+  g_test_add_func("/metrics/totals", test_metrics_totals);
+
+  return g_test_run();
+}
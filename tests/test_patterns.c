@@ -62,6 +62,80 @@ static void test_expand_string_with_pattern_with_slashes()
   pattern_helper("invalid/name", "Channel Title", NULL, NULL, "invalid/name");
 }
 
+static void test_expand_string_with_time_pattern()
+{
+  pattern_helper("%(date)_%(time)", NULL, NULL, "Thu, 01 Oct 2015 09:53:38 GMT",
+                 "2015-10-01_09-53-38");
+  pattern_helper("%(time)", NULL, NULL, "Thu, 01 Oct 2015 09:53 GMT",
+                 "09-53-00");
+  pattern_helper("%(time)", NULL, NULL, "not a date", "");
+}
+
+static void test_expand_string_with_unterminated_pattern()
+{
+  pattern_helper("foo %(title", NULL, "Item Title", NULL, "foo Item Title");
+  pattern_helper("%(TITLE) %(unknown)", NULL, "Item Title", NULL,
+                 "Item Title ");
+}
+
+static void item_pattern_helper(const char *pattern, const char *url,
+                                const char *type, const char *guid, int index,
+                                const char *expected_string)
+{
+  enclosure enclosure = { (char *)url, 0, (char *)type };
+  rss_item *mock_item = mock_rss_item_new(NULL, NULL);
+  channel_info *mock_channel_info = mock_channel_info_new(NULL);
+  gchar *string;
+
+  mock_item->enclosure = &enclosure;
+  mock_item->guid = (char *)guid;
+  mock_item->index = index;
+
+  string = expand_string_with_patterns(pattern, mock_channel_info, mock_item);
+
+  g_assert_cmpstr(string, ==, expected_string);
+
+  g_free(string);
+  mock_rss_item_free(mock_item);
+  mock_channel_info_free(mock_channel_info);
+}
+
+static void test_expand_string_with_enclosure_patterns()
+{
+  item_pattern_helper("%(basename)", "http://example.com/a/ep1.mp3?x=1#y",
+                      NULL, NULL, 0, "ep1.mp3");
+  item_pattern_helper("%(guid).%(extension)", "http://example.com/a/ep1",
+                      "audio/mpeg", "episode-1", 0, "episode-1.mp3");
+  item_pattern_helper("%(extension)", "http://example.com/a/ep1.ogg?x=1",
+                      "application/octet-stream", NULL, 0, "ogg");
+  item_pattern_helper("%(extension)", "http://example.com/a.b/ep1", NULL,
+                      NULL, 0, "");
+  item_pattern_helper("%(index)-%(basename)", "http://example.com/ep7.mp3",
+                      NULL, NULL, 7, "007-ep7.mp3");
+}
+
+static void test_expand_pattern_program_repeatedly()
+{
+  pattern_program *program = pattern_program_new("%(title) [%(date)]");
+  channel_info *mock_channel_info = mock_channel_info_new(NULL);
+  rss_item *first = mock_rss_item_new("One", "Thu, 01 Oct 2015 09:53:38 GMT");
+  rss_item *second = mock_rss_item_new("Two", NULL);
+  GString *buffer = g_string_new(NULL);
+
+  pattern_program_expand(program, buffer, mock_channel_info, first);
+  g_assert_cmpstr(buffer->str, ==, "One [2015-10-01]");
+
+  g_string_truncate(buffer, 0);
+  pattern_program_expand(program, buffer, mock_channel_info, second);
+  g_assert_cmpstr(buffer->str, ==, "Two []");
+
+  g_string_free(buffer, TRUE);
+  mock_rss_item_free(first);
+  mock_rss_item_free(second);
+  mock_channel_info_free(mock_channel_info);
+  pattern_program_free(program);
+}
+
 int main(int argc, char *argv[])
 {
   g_test_init(&argc, &argv, NULL);
@@ -78,6 +152,14 @@ int main(int argc, char *argv[])
                   test_expand_string_with_channel_title_pattern);
   g_test_add_func("/patterns/expand_string_with_pattern_with_slashes",
                   test_expand_string_with_pattern_with_slashes);
+  g_test_add_func("/patterns/expand_string_with_time_pattern",
+                  test_expand_string_with_time_pattern);
+  g_test_add_func("/patterns/expand_string_with_unterminated_pattern",
+                  test_expand_string_with_unterminated_pattern);
+  g_test_add_func("/patterns/expand_string_with_enclosure_patterns",
+                  test_expand_string_with_enclosure_patterns);
+  g_test_add_func("/patterns/expand_pattern_program_repeatedly",
+                  test_expand_pattern_program_repeatedly);
 
   return g_test_run();
 }
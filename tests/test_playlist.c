@@ -0,0 +1,142 @@
+#include "../src/playlist.h"
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static void test_playlist_writer()
+{
+  gchar *directory = g_dir_make_tmp("castget-XXXXXX", NULL);
+  gchar *plain = g_build_filename(directory, "plain.m3u", NULL);
+  gchar *extended = g_build_filename(directory, "extended.m3u", NULL);
+  playlist_writer *w;
+  gchar *contents;
+
+  g_assert(directory);
+
+  w = playlist_writer_new();
+
+  g_assert_cmpint(
+      playlist_writer_add(w, plain, FALSE, "/a/1.mp3", "One", 60), ==, 0);
+  g_assert_cmpint(
+      playlist_writer_add(w, extended, TRUE, "/a/1.mp3", "One\nLine", 60), ==,
+      0);
+  g_assert_cmpint(playlist_writer_add(w, plain, FALSE, "/a/2.mp3", NULL, -1),
+                  ==, 0);
+  g_assert_cmpint(
+      playlist_writer_add(w, extended, TRUE, "/a/2.mp3", NULL, -1), ==, 0);
+
+  /* Entries are not written until the batch is flushed... */
+  g_assert(g_file_get_contents(plain, &contents, NULL, NULL));
+  g_assert_cmpstr(contents, ==, "");
+  g_free(contents);
+
+  /* ...which happens at the latest when the writer is freed. */
+  playlist_writer_free(w);
+
+  g_assert(g_file_get_contents(plain, &contents, NULL, NULL));
+  g_assert_cmpstr(contents, ==, "/a/1.mp3\n/a/2.mp3\n");
+  g_free(contents);
+
+  g_assert(g_file_get_contents(extended, &contents, NULL, NULL));
+  g_assert_cmpstr(contents, ==,
+                  "#EXTM3U\n"
+                  "#EXTINF:60,One Line\n/a/1.mp3\n"
+                  "#EXTINF:-1,2.mp3\n/a/2.mp3\n");
+  g_free(contents);
+
+  /* A playlist that already has entries does not get a second header. */
+  w = playlist_writer_new();
+  playlist_writer_add(w, extended, TRUE, "/a/3.mp3", "Three", 5);
+  playlist_writer_free(w);
+
+  g_assert(g_file_get_contents(extended, &contents, NULL, NULL));
+  g_assert_cmpstr(contents, ==,
+                  "#EXTM3U\n"
+                  "#EXTINF:60,One Line\n/a/1.mp3\n"
+                  "#EXTINF:-1,2.mp3\n/a/2.mp3\n"
+                  "#EXTINF:5,Three\n/a/3.mp3\n");
+  g_free(contents);
+
+  g_unlink(plain);
+  g_unlink(extended);
+  g_rmdir(directory);
+
+  g_free(extended);
+  g_free(plain);
+  g_free(directory);
+}
+
+/* A playlist can be written on its own, and entries go to a new file if
+   the playlist has been removed or replaced since it was opened. */
+static void test_playlist_writer_replaced()
+{
+  gchar *directory = g_dir_make_tmp("castget-XXXXXX", NULL);
+  gchar *plain = g_build_filename(directory, "plain.m3u", NULL);
+  gchar *other = g_build_filename(directory, "other.m3u", NULL);
+  gchar *rotated = g_build_filename(directory, "rotated.m3u", NULL);
+  playlist_writer *w;
+  gchar *contents;
+
+  g_assert(directory);
+
+  w = playlist_writer_new();
+
+  playlist_writer_add(w, plain, TRUE, "/a/1.mp3", "One", 60);
+  playlist_writer_add(w, other, FALSE, "/a/1.mp3", NULL, -1);
+  g_assert_cmpint(playlist_writer_flush_playlist(w, plain), ==, 0);
+
+  g_assert(g_file_get_contents(plain, &contents, NULL, NULL));
+  g_assert_cmpstr(contents, ==, "#EXTM3U\n#EXTINF:60,One\n/a/1.mp3\n");
+  g_free(contents);
+
+  g_assert(g_file_get_contents(other, &contents, NULL, NULL));
+  g_assert_cmpstr(contents, ==, "");
+  g_free(contents);
+
+  /* The playlist is rotated... */
+  g_assert_cmpint(g_rename(plain, rotated), ==, 0);
+  playlist_writer_add(w, plain, TRUE, "/a/2.mp3", "Two", 60);
+  g_assert_cmpint(playlist_writer_flush_playlist(w, plain), ==, 0);
+
+  g_assert(g_file_get_contents(plain, &contents, NULL, NULL));
+  g_assert_cmpstr(contents, ==, "#EXTM3U\n#EXTINF:60,Two\n/a/2.mp3\n");
+  g_free(contents);
+
+  /* ...or deleted. */
+  g_unlink(plain);
+  playlist_writer_add(w, plain, FALSE, "/a/3.mp3", NULL, -1);
+  g_assert_cmpint(playlist_writer_flush_playlist(w, plain), ==, 0);
+
+  g_assert(g_file_get_contents(plain, &contents, NULL, NULL));
+  g_assert_cmpstr(contents, ==, "/a/3.mp3\n");
+  g_free(contents);
+
+  playlist_writer_free(w);
+
+  g_assert(g_file_get_contents(rotated, &contents, NULL, NULL));
+  g_assert_cmpstr(contents, ==, "#EXTM3U\n#EXTINF:60,One\n/a/1.mp3\n");
+  g_free(contents);
+
+  g_unlink(plain);
+  g_unlink(other);
+  g_unlink(rotated);
+  g_rmdir(directory);
+
+  g_free(rotated);
+  g_free(other);
+  g_free(plain);
+  g_free(directory);
+}
+
+int main(int argc, char *argv[])
+{
+  g_test_init(&argc, &argv, NULL);
+
+  g_test_add_func("/playlist/playlist_writer", test_playlist_writer);
+  g_test_add_func("/playlist/playlist_writer_replaced",
+                  test_playlist_writer_replaced);
+
+  return g_test_run();
+}
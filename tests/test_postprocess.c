@@ -0,0 +1,150 @@
+#include "../src/postprocess.h"
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NUM_JOBS 50
+
+static void test_postprocessor_playlist_order()
+{
+  gchar *directory = g_dir_make_tmp("castget-XXXXXX", NULL);
+  gchar *playlists[2];
+  struct channel_configuration cfg;
+  enclosure e;
+  postprocessor *p;
+  gchar *filename, *contents, **lines;
+  int i, j;
+
+  g_assert(directory);
+
+  playlists[0] = g_build_filename(directory, "a.m3u", NULL);
+  playlists[1] = g_build_filename(directory, "b.m3u", NULL);
+
+  memset(&cfg, 0, sizeof(cfg));
+  memset(&e, 0, sizeof(e));
+
+  p = postprocessor_new(4, 0);
+  g_assert(p);
+
+  for (i = 0; i < NUM_JOBS; i++) {
+    cfg.playlist = playlists[i % 2];
+    filename = g_strdup_printf("%d.mp3", i);
+    postprocessor_submit(p, filename, &e, &cfg);
+    g_free(filename);
+  }
+
+  /* Freeing the post-processor waits for all jobs to finish. */
+  postprocessor_free(p);
+
+  /* Each playlist lists its files in the order they were submitted. */
+  for (j = 0; j < 2; j++) {
+    g_assert(g_file_get_contents(playlists[j], &contents, NULL, NULL));
+    lines = g_strsplit(contents, "\n", 0);
+
+    for (i = 0; i < NUM_JOBS / 2; i++) {
+      filename = g_strdup_printf("%d.mp3", 2 * i + j);
+      g_assert_cmpstr(lines[i], ==, filename);
+      g_free(filename);
+    }
+
+    g_assert_cmpstr(lines[NUM_JOBS / 2], ==, "");
+
+    g_strfreev(lines);
+    g_free(contents);
+    g_unlink(playlists[j]);
+    g_free(playlists[j]);
+  }
+
+  g_rmdir(directory);
+  g_free(directory);
+}
+
+/* Playlist entries are written once there are no more jobs for the
+   playlist, without waiting for the post-processor to be synced. */
+static void test_postprocessor_playlist_flush()
+{
+  gchar *directory = g_dir_make_tmp("castget-XXXXXX", NULL);
+  struct channel_configuration cfg;
+  enclosure e;
+  postprocessor *p;
+  gchar *contents = NULL;
+  int i;
+
+  g_assert(directory);
+
+  memset(&cfg, 0, sizeof(cfg));
+  memset(&e, 0, sizeof(e));
+  cfg.playlist = g_build_filename(directory, "a.m3u", NULL);
+
+  p = postprocessor_new(1, 0);
+  g_assert(p);
+
+  postprocessor_submit(p, "1.mp3", &e, &cfg);
+
+  for (i = 0; i < 1000; i++) {
+    g_free(contents);
+    contents = NULL;
+
+    if (g_file_get_contents(cfg.playlist, &contents, NULL, NULL) &&
+        *contents)
+      break;
+
+    g_usleep(G_USEC_PER_SEC / 100);
+  }
+
+  g_assert_cmpstr(contents, ==, "1.mp3\n");
+  g_free(contents);
+
+  postprocessor_free(p);
+
+  g_unlink(cfg.playlist);
+  g_free(cfg.playlist);
+  g_rmdir(directory);
+  g_free(directory);
+}
+
+static void test_postprocessor_hook()
+{
+  gchar *directory = g_dir_make_tmp("castget-XXXXXX", NULL);
+  gchar *filename;
+  struct channel_configuration cfg;
+  enclosure e;
+  postprocessor *p;
+
+  g_assert(directory);
+
+  filename = g_build_filename(directory, "hooked", NULL);
+
+  memset(&cfg, 0, sizeof(cfg));
+  memset(&e, 0, sizeof(e));
+  cfg.hook = "touch";
+
+  p = postprocessor_new(1, 0);
+  g_assert(p);
+
+  postprocessor_submit(p, filename, &e, &cfg);
+  postprocessor_free(p);
+
+  g_assert(g_file_test(filename, G_FILE_TEST_EXISTS));
+
+  g_unlink(filename);
+  g_rmdir(directory);
+  g_free(filename);
+  g_free(directory);
+}
+
+int main(int argc, char *argv[])
+{
+  g_test_init(&argc, &argv, NULL);
+
+  g_test_add_func("/postprocess/playlist_order",
+                  test_postprocessor_playlist_order);
+  g_test_add_func("/postprocess/playlist_flush",
+                  test_postprocessor_playlist_flush);
+  g_test_add_func("/postprocess/hook", test_postprocessor_hook);
+
+  return g_test_run();
+}
@@ -3,10 +3,11 @@
 #include <glib.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 static void test_progress_bar_new()
 {
-  char *old_columns = getenv("COLUMNS");
+  gchar *old_columns = g_strdup(getenv("COLUMNS"));
   progress_bar *pb;
 
   setenv("COLUMNS", "120", 1);
@@ -27,17 +28,21 @@ static void test_progress_bar_new()
   if (old_columns) {
     setenv("COLUMNS", old_columns, 1);
   }
+
+  g_free(old_columns);
 }
 
 static void test_progress_bar_cb()
 {
-  char *old_columns = getenv("COLUMNS");
+  gchar *old_columns = g_strdup(getenv("COLUMNS"));
   progress_bar *pb;
+  FILE *f;
 
   setenv("COLUMNS", "78", 1);
   pb = progress_bar_new(0);
   /* Silence progress bar output by directing it to a temporary file */
-  pb->f = tmpfile();
+  f = tmpfile();
+  pb->f = f;
 
   progress_bar_cb(pb, 300, 0, 0, 0);
   g_assert_cmpstr(pb->buffer, ==,
@@ -61,12 +66,140 @@ static void test_progress_bar_cb()
                   "####################################                        "
                   "             ");
 
-  fclose(pb->f);
+  /* The progress bar writes a final newline when it is freed. */
   progress_bar_free(pb);
+  fclose(f);
 
   if (old_columns) {
     setenv("COLUMNS", old_columns, 1);
   }
+
+  g_free(old_columns);
+}
+
+/* Returns what has been written to a temporary file. */
+static gchar *_contents(FILE *f)
+{
+  GString *s = g_string_new(NULL);
+  char buffer[256];
+  size_t n;
+
+  fflush(f);
+  rewind(f);
+
+  while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0)
+    g_string_append_len(s, buffer, n);
+
+  return g_string_free(s, FALSE);
+}
+
+static void test_progress_display_label()
+{
+  progress_display *d = progress_display_new(stdout, PROGRESS_BARS);
+  progress_transfer *t;
+
+  t = progress_display_start(d, "http://example.com/a/b.mp3?c=/d", 0);
+  g_assert_cmpstr(t->label, ==, "b.mp3");
+  t = progress_display_start(d, "http://example.com/", 0);
+  g_assert_cmpstr(t->label, ==, "http://example.com/");
+
+  g_assert_cmpint(d->transfers->len, ==, 2);
+  progress_display_free(d);
+}
+
+static void test_progress_display_events()
+{
+  FILE *f = tmpfile();
+  progress_display *d = progress_display_new(f, PROGRESS_EVENTS);
+  progress_transfer *t;
+  gchar *contents, *p;
+  gint64 rate;
+
+  t = progress_display_start(d, "http://example.com/\"a\".mp3", 1000000);
+
+  /* Progress is reported at most once per interval. */
+  progress_display_update(d, t, 6000000, 1000000);
+
+  t->started -= 2 * G_USEC_PER_SEC;
+  t->last_event -= d->interval;
+  progress_display_update(d, t, 6000000, 2000000);
+  progress_display_update(d, t, 6000000, 3000000);
+
+  progress_display_finish(d, t, 1);
+  progress_display_free(d);
+
+  contents = _contents(f);
+  fclose(f);
+
+  g_assert(g_str_has_prefix(
+      contents, "{\"event\": \"start\", \"id\": 1, "
+                "\"url\": \"http://example.com/\\\"a\\\".mp3\", "
+                "\"offset\": 1000000, \"time\": "));
+
+  p = strstr(contents, "{\"event\": \"progress\", \"id\": 1, "
+                       "\"received\": 3000000, \"total\": 7000000, "
+                       "\"rate\": ");
+  g_assert(p);
+  g_assert(!strstr(p + strlen("{\"event\": \"progress\""),
+                  "\"event\": \"progress\""));
+
+  /* 2 MB have arrived in a little over two seconds. */
+  rate = g_ascii_strtoll(strstr(p, "\"rate\": ") + 8, &p, 10);
+  g_assert_cmpint(rate, >, 900000);
+  g_assert_cmpint(rate, <=, 1000000);
+  g_assert(g_str_has_prefix(p, ", \"eta\": 4, \"time\": "));
+
+  g_assert(strstr(contents, "{\"event\": \"done\", \"id\": 1, "
+                            "\"received\": 4000000, \"total\": 7000000, "));
+  g_assert(strstr(contents, "\"failed\": true, \"time\": "));
+  g_assert(g_str_has_suffix(contents, "}\n"));
+
+  g_free(contents);
+}
+
+static void test_progress_display_bars()
+{
+  gchar *old_columns = g_strdup(getenv("COLUMNS"));
+  FILE *f = tmpfile();
+  progress_display *d;
+  progress_transfer *t;
+  gchar *contents;
+
+  setenv("COLUMNS", "60", 1);
+  d = progress_display_new(f, PROGRESS_BARS);
+
+  /* Lines are not redrawn in place unless the display is a terminal. */
+  g_assert(!d->redraw);
+  g_assert_cmpint(d->width, ==, 60);
+
+  /* A transfer that finishes quickly leaves nothing behind. */
+  t = progress_display_start(d, "http://example.com/quick.xml", 0);
+  progress_display_update(d, t, 0, 100);
+  progress_display_finish(d, t, 0);
+
+  t = progress_display_start(d, "http://example.com/episode.mp3", 0);
+  t->started -= 2 * G_USEC_PER_SEC;
+  progress_display_update(d, t, 4000, 2000);
+  progress_display_update(d, t, 4000, 4000);
+  progress_display_finish(d, t, 0);
+
+  progress_display_free(d);
+
+  contents = _contents(f);
+  fclose(f);
+
+  g_assert(!strstr(contents, "quick.xml"));
+  g_assert(g_str_has_prefix(contents, "episode.mp3          "
+                                      "[##############] 100% "));
+  g_assert(g_str_has_suffix(contents, "/s 0:02\n"));
+  g_assert_cmpint(g_utf8_strlen(contents, -1), ==, 60);
+
+  g_free(contents);
+
+  if (old_columns)
+    setenv("COLUMNS", old_columns, 1);
+
+  g_free(old_columns);
 }
 
 int main(int argc, char *argv[])
@@ -75,6 +208,9 @@ int main(int argc, char *argv[])
 
   g_test_add_func("/progress/progress_bar_new", test_progress_bar_new);
   g_test_add_func("/progress/progress_bar_cb", test_progress_bar_cb);
+  g_test_add_func("/progress/display_label", test_progress_display_label);
+  g_test_add_func("/progress/display_events", test_progress_display_events);
+  g_test_add_func("/progress/display_bars", test_progress_display_bars);
 
   return g_test_run();
 }
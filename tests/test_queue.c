@@ -0,0 +1,147 @@
+#include "../src/queue.h"
+
+#include <glib.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Downloads run by the fake download function, in order. */
+static GString *download_log;
+
+/* Deadline passed to the last download. */
+static gint64 last_deadline;
+
+struct _fake {
+  const gchar *name;
+  gint64 size;
+  int fail;
+};
+
+static int fake_download(gpointer data, gint64 deadline, gint64 *size)
+{
+  struct _fake *f = (struct _fake *)data;
+
+  last_deadline = deadline;
+
+  g_string_append(download_log, f->name);
+  *size = f->size;
+
+  return f->fail ? -1 : 0;
+}
+
+/* Queues downloads for two channels, 'a' with three items and 'b' with
+   two. Names are channel and position in the feed. */
+static download_queue *queue_helper(download_order order, const gchar *failing)
+{
+  static const struct {
+    const gchar *name;
+    const gchar *owner;
+    gint64 size;
+    gint64 published;
+  } items[] = { { "a1", "a", 300, 1000 }, { "a2", "a", 100, 900 },
+                { "a3", "a", 0, 0 },      { "b1", "b", 200, 1500 },
+                { "b2", "b", 400, 800 } };
+  download_queue *q = download_queue_new(order);
+  struct _fake *f;
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS(items); i++) {
+    f = g_malloc(sizeof(struct _fake));
+    f->name = items[i].name;
+    f->size = items[i].size ? items[i].size : 50;
+    f->fail = failing && !strcmp(failing, f->name);
+
+    download_queue_add(q, items[i].owner, items[i].size, items[i].published,
+                       fake_download, f);
+  }
+
+  g_string_truncate(download_log, 0);
+
+  return q;
+}
+
+static void test_queue_order()
+{
+  static const struct {
+    const gchar *name;
+    const gchar *expected;
+  } orders[] = { { "feed", "a1a2a3b1b2" },
+                 { "newest", "b1a1a2b2a3" },
+                 { "smallest", "a2b1a1b2a3" },
+                 { "round-robin", "a1b1a2b2a3" } };
+  download_order order;
+  download_queue *q;
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS(orders); i++) {
+    g_assert_cmpint(download_order_parse(orders[i].name, &order), ==, 0);
+
+    q = queue_helper(order, NULL);
+    g_assert_cmpuint(download_queue_run(q, 0, 0), ==, 0);
+    g_assert_cmpstr(download_log->str, ==, orders[i].expected);
+    download_queue_free(q);
+  }
+
+  g_assert_cmpint(download_order_parse("random", &order), ==, -1);
+}
+
+static void test_queue_budget()
+{
+  download_queue *q;
+
+  /* Downloads that do not fit in what is left of the budget are skipped,
+     but smaller ones further down the queue are still run. */
+  q = queue_helper(DOWNLOAD_ORDER_FEED, NULL);
+  g_assert_cmpuint(download_queue_run(q, 450, 0), ==, 2);
+  g_assert_cmpstr(download_log->str, ==, "a1a2a3");
+
+  /* The queue is empty once it has been run. */
+  g_string_truncate(download_log, 0);
+  g_assert_cmpuint(download_queue_run(q, 0, 0), ==, 0);
+  g_assert_cmpstr(download_log->str, ==, "");
+  download_queue_free(q);
+
+  /* The remaining downloads of a channel are dropped once one fails. */
+  q = queue_helper(DOWNLOAD_ORDER_ROUND_ROBIN, "a1");
+  g_assert_cmpuint(download_queue_run(q, 0, 0), ==, 0);
+  g_assert_cmpstr(download_log->str, ==, "a1b1b2");
+  download_queue_free(q);
+}
+
+/* Downloads are told when the time for the run is up, so that they stop
+   then rather than only not being started. */
+static void test_queue_time()
+{
+  download_queue *q;
+  gint64 now = g_get_monotonic_time();
+
+  q = queue_helper(DOWNLOAD_ORDER_FEED, NULL);
+  g_assert_cmpuint(download_queue_run(q, 0, 0), ==, 0);
+  g_assert_cmpint(last_deadline, ==, 0);
+  download_queue_free(q);
+
+  q = queue_helper(DOWNLOAD_ORDER_FEED, NULL);
+  g_assert_cmpuint(download_queue_run(q, 0, 60), ==, 0);
+  g_assert_cmpint(last_deadline, >=, now + 60 * G_USEC_PER_SEC);
+  g_assert_cmpint(last_deadline, <=,
+                  g_get_monotonic_time() + 60 * G_USEC_PER_SEC);
+  download_queue_free(q);
+}
+
+int main(int argc, char *argv[])
+{
+  int ret;
+
+  g_test_init(&argc, &argv, NULL);
+
+  download_log = g_string_new(NULL);
+
+  g_test_add_func("/queue/order", test_queue_order);
+  g_test_add_func("/queue/budget", test_queue_budget);
+  g_test_add_func("/queue/time", test_queue_time);
+
+  ret = g_test_run();
+
+  g_string_free(download_log, TRUE);
+
+  return ret;
+}
@@ -0,0 +1,92 @@
+#include "../src/report.h"
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static void test_report_write()
+{
+  report *r;
+  channel c;
+  gchar *filename, *contents;
+  int fd;
+
+  memset(&c, 0, sizeof(channel));
+  c.url = "http://example.com/\"feed\".xml";
+  c.stats.feed.transfers = 1;
+  c.stats.feed.bytes = 1000;
+  c.stats.feed.dns_time = 1500;
+  c.stats.feed.total_time = 250000;
+  c.stats.items_seen = 10;
+  c.stats.items_new = 3;
+  c.stats.items_filtered = 1;
+  c.stats.enclosures.transfers = 2;
+  c.stats.enclosures.bytes = 4000000;
+  c.stats.enclosures.total_time = 2 * G_USEC_PER_SEC;
+  c.stats.downloads = 2;
+
+  fd = g_file_open_tmp("castget-XXXXXX", &filename, NULL);
+  g_assert(fd >= 0);
+  close(fd);
+
+  r = report_new();
+  report_add_channel(r, "a\tb", &c, FALSE);
+  report_add_channel(r, "failed", &c, TRUE);
+  report_set_left(r, 5);
+  g_assert_cmpint(report_write(r, filename, 0), ==, 0);
+  report_free(r);
+
+  g_assert(g_file_get_contents(filename, &contents, NULL, NULL));
+
+  g_assert(strstr(contents, "\"left\": 5,"));
+  g_assert(strstr(contents, "{\"id\": \"a\\u0009b\", "
+                            "\"url\": \"http://example.com/\\\"feed\\\".xml\", "
+                            "\"failed\": false,"));
+  g_assert(strstr(contents, "{\"id\": \"failed\""));
+  g_assert(strstr(contents, "\"failed\": true"));
+  g_assert(strstr(contents, "\"feed\": {\"transfers\": 1, \"bytes\": 1000, "
+                            "\"dns\": 0.001500,"));
+  g_assert(strstr(contents, "\"total\": 0.250000, \"parse\": 0.000000}"));
+  g_assert(strstr(contents,
+                  "\"items\": {\"seen\": 10, \"new\": 3, \"filtered\": 1}"));
+  g_assert(strstr(contents, "\"downloaded\": 2, \"throughput\": 2000000}"));
+
+  g_free(contents);
+  g_unlink(filename);
+  g_free(filename);
+}
+
+/* A run that updates no channels still produces a valid report. */
+static void test_report_empty()
+{
+  report *r;
+  gchar *filename, *contents;
+  int fd;
+
+  fd = g_file_open_tmp("castget-XXXXXX", &filename, NULL);
+  g_assert(fd >= 0);
+  close(fd);
+
+  r = report_new();
+  g_assert_cmpint(report_write(r, filename, 0), ==, 0);
+  report_free(r);
+
+  g_assert(g_file_get_contents(filename, &contents, NULL, NULL));
+  g_assert(g_str_has_suffix(contents, "\"channels\": []\n}\n"));
+
+  g_free(contents);
+  g_unlink(filename);
+  g_free(filename);
+}
+
+int main(int argc, char *argv[])
+{
+  g_test_init(&argc, &argv, NULL);
+
+  g_test_add_func("/report/write", test_report_write);
+  g_test_add_func("/report/empty", test_report_empty);
+
+  return g_test_run();
+}
@@ -0,0 +1,327 @@
+#include "../src/rss.h"
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/* Writes a feed with the given items to a temporary file and returns its
+   filename. */
+static gchar *feed_file_helper(const char *items)
+{
+  gchar *filename;
+  gchar *feed;
+  int fd;
+
+  fd = g_file_open_tmp("castget-XXXXXX", &filename, NULL);
+  g_assert(fd >= 0);
+  close(fd);
+
+  feed = g_strdup_printf(
+      "<?xml version=\"1.0\"?>"
+      "<rss version=\"2.0\" xmlns:media=\"http://search.yahoo.com/mrss/\" "
+      "xmlns:itunes=\"http://www.itunes.com/dtds/podcast-1.0.dtd\">"
+      "<channel><title>Channel</title>%s</channel></rss>",
+      items);
+  g_assert(g_file_set_contents(filename, feed, -1, NULL));
+  g_free(feed);
+
+  return filename;
+}
+
+/* Parses a feed with the given items and returns it. */
+static rss_file *rss_helper(const char *items)
+{
+  gchar *filename;
+  rss_file *f;
+
+  filename = feed_file_helper(items);
+
+  f = rss_open_file(filename, NULL);
+  g_assert(f);
+
+  g_unlink(filename);
+  g_free(filename);
+
+  return f;
+}
+
+static void test_rss_items()
+{
+  rss_file *f = rss_helper(
+      "<item><title>First</title><guid>a</guid>"
+      "<itunes:episode> 12 </itunes:episode>"
+      "<pubDate>Thu, 01 Oct 2015 09:53:38 GMT</pubDate>"
+      "<enclosure url=\"http://example.com/a.mp3\" length=\"10\" "
+      "type=\"audio/mpeg\"/></item>"
+      "<item><title>Second</title><unrelated>x</unrelated>"
+      "<itunes:episode>12b</itunes:episode></item>");
+
+  g_assert_cmpint(f->num_items, ==, 2);
+
+  g_assert_cmpstr(f->items[0]->title, ==, "First");
+  g_assert_cmpstr(f->items[0]->guid, ==, "a");
+  g_assert_cmpint(f->items[0]->index, ==, 12);
+  g_assert(f->items[0]->pub_time);
+  g_assert_cmpint(f->items[0]->pub_time->year, ==, 2015);
+  g_assert_cmpstr(f->items[0]->enclosure->url, ==, "http://example.com/a.mp3");
+  g_assert_cmpint(f->items[0]->enclosure->length, ==, 10);
+  g_assert(!f->items[0]->enclosure->hash);
+
+  g_assert_cmpint(f->items[1]->index, ==, 0);
+  g_assert(!f->items[1]->pub_time);
+  g_assert(!f->items[1]->enclosure);
+
+  rss_close(f);
+}
+
+static void test_rss_mrss_hash()
+{
+  rss_file *f = rss_helper(
+      "<item><media:hash algo=\"sha-1\"> ABCDEF </media:hash>"
+      "<enclosure url=\"http://example.com/a.mp3\"/></item>"
+      "<item><media:hash>0123</media:hash>"
+      "<enclosure url=\"http://example.com/b.mp3\"/></item>"
+      "<item><media:hash>item</media:hash><media:group>"
+      "<media:hash algo=\"sha-256\">group</media:hash></media:group>"
+      "<enclosure url=\"http://example.com/c.mp3\"/></item>");
+
+  g_assert_cmpint(f->num_items, ==, 3);
+
+  g_assert_cmpstr(f->items[0]->enclosure->hash, ==, "ABCDEF");
+  g_assert_cmpstr(f->items[0]->enclosure->hash_algorithm, ==, "sha-1");
+
+  g_assert_cmpstr(f->items[1]->enclosure->hash, ==, "0123");
+  g_assert_cmpstr(f->items[1]->enclosure->hash_algorithm, ==, "md5");
+
+  g_assert_cmpstr(f->items[2]->enclosure->hash, ==, "group");
+  g_assert_cmpstr(f->items[2]->enclosure->hash_algorithm, ==, "sha-256");
+
+  rss_close(f);
+}
+
+static void test_rss_duration()
+{
+  rss_file *f = rss_helper(
+      "<item><title>A</title><itunes:duration>1:02:03</itunes:duration>"
+      "<enclosure url=\"http://example.com/a.mp3\"/></item>"
+      "<item><title>B</title><itunes:duration> 45:30 </itunes:duration>"
+      "<enclosure url=\"http://example.com/b.mp3\"/></item>"
+      "<item><itunes:duration>3600</itunes:duration>"
+      "<enclosure url=\"http://example.com/c.mp3\"/></item>"
+      "<item><itunes:duration>1:75:00</itunes:duration>"
+      "<enclosure url=\"http://example.com/d.mp3\"/></item>"
+      "<item><title>E</title><itunes:duration>10</itunes:duration>"
+      "<media:content url=\"http://example.com/e.mp3\" duration=\"20\">"
+      "<media:title>Media E</media:title></media:content></item>");
+
+  g_assert_cmpint(f->num_items, ==, 5);
+
+  g_assert_cmpint(f->items[0]->enclosure->duration, ==, 3723);
+  g_assert_cmpstr(f->items[0]->enclosure->title, ==, "A");
+  g_assert_cmpint(f->items[1]->enclosure->duration, ==, 2730);
+  g_assert_cmpint(f->items[2]->enclosure->duration, ==, 3600);
+  g_assert(!f->items[2]->enclosure->title);
+  g_assert_cmpint(f->items[3]->enclosure->duration, ==, -1);
+  g_assert_cmpint(f->items[4]->enclosure->duration, ==, 20);
+  g_assert_cmpstr(f->items[4]->enclosure->title, ==, "Media E");
+
+  rss_close(f);
+}
+
+static void test_rss_hints()
+{
+  rss_file *f = rss_helper(
+      "<ttl>90</ttl>"
+      "<skipHours><hour>0</hour><hour> 23 </hour><hour>24</hour>"
+      "<hour>x</hour></skipHours>"
+      "<skipDays><day>Sunday</day><day>saturday</day><day>Funday</day>"
+      "</skipDays>"
+      "<item><pubDate>Wed, 23 Jan 2019 10:00:00 GMT</pubDate></item>"
+      "<item><pubDate>Mon, 21 Jan 2019 10:00:00 GMT</pubDate></item>"
+      "<item><pubDate>Mon, 21 Jan 2019 10:00:00 GMT</pubDate></item>"
+      "<item><pubDate>Mon, 14 Jan 2019 10:00:00 GMT</pubDate></item>"
+      "<item><title>Undated</title></item>"
+      "<item><pubDate>Mon, 07 Jan 2019 10:00:00 GMT</pubDate></item>");
+
+  g_assert_cmpint(f->hints.ttl, ==, 90 * 60);
+  g_assert_cmphex(f->hints.skip_hours, ==, (1u << 0) | (1u << 23));
+  g_assert_cmphex(f->hints.skip_days, ==, (1u << 0) | (1u << 6));
+
+  /* The median of the intervals between distinct publication dates. */
+  g_assert_cmpint(f->hints.cadence, ==, 7 * 24 * 60 * 60);
+
+  rss_close(f);
+
+  f = rss_helper("<ttl>soon</ttl><item><title>A</title></item>");
+
+  g_assert_cmpint(f->hints.ttl, ==, 0);
+  g_assert_cmpint(f->hints.skip_hours, ==, 0);
+  g_assert_cmpint(f->hints.skip_days, ==, 0);
+  g_assert_cmpint(f->hints.cadence, ==, 0);
+
+  rss_close(f);
+}
+
+static void rss_open_cb(rss_file *f, void *user_data)
+{
+  rss_file **result = (rss_file **)user_data;
+
+  *result = f;
+}
+
+/* Feeds retrieved in the background are parsed as they arrive. */
+static void test_rss_open_url_async()
+{
+  transfer_engine *e;
+  rss_file *f = NULL, *missing = (rss_file *)1;
+  gchar *filename, *url;
+  int fd;
+
+  fd = g_file_open_tmp("castget-XXXXXX", &filename, NULL);
+  g_assert(fd >= 0);
+  close(fd);
+
+  g_assert(g_file_set_contents(
+      filename,
+      "<?xml version=\"1.0\"?><rss version=\"2.0\"><channel>"
+      "<title>Channel</title><ttl>30</ttl><item><title>First</title>"
+      "<enclosure url=\"http://example.com/a.mp3\" length=\"10\" "
+      "type=\"audio/mpeg\"/></item></channel></rss>",
+      -1, NULL));
+
+  e = transfer_engine_new();
+  g_assert(e);
+
+  url = g_strconcat("file://", filename, NULL);
+  g_assert_cmpint(
+      rss_open_url_async(e, url, NULL, NULL, 0, NULL, rss_open_cb, &f), ==, 0);
+  g_assert_cmpint(rss_open_url_async(e, "file:///nonexistent/castget", NULL,
+                                     NULL, 0, NULL, rss_open_cb, &missing),
+                  ==, 0);
+
+  transfer_engine_run(e);
+
+  g_assert(f);
+  g_assert(!missing);
+  g_assert_cmpint(f->num_items, ==, 1);
+  g_assert_cmpstr(f->items[0]->enclosure->url, ==, "http://example.com/a.mp3");
+  g_assert_cmpint(f->hints.ttl, ==, 30 * 60);
+
+  rss_close(f);
+  transfer_engine_free(e);
+
+  g_unlink(filename);
+  g_free(filename);
+  g_free(url);
+}
+
+/* The transfer of a feed stops as soon as the feed turns out to be
+   malformed. */
+static void test_rss_open_url_async_malformed()
+{
+  transfer_engine *e;
+  urlget_stats stats = { 0 };
+  rss_file *f = (rss_file *)1;
+  GString *feed;
+  gchar *filename, *url;
+  int fd;
+
+  fd = g_file_open_tmp("castget-XXXXXX", &filename, NULL);
+  g_assert(fd >= 0);
+  close(fd);
+
+  feed = g_string_new("<?xml version=\"1.0\"?><rss version=\"2.0\"><channel>"
+                      "</item>");
+  while (feed->len < 4 << 20)
+    g_string_append(feed, "<title>Padding</title>");
+  g_string_append(feed, "</channel></rss>");
+
+  g_assert(g_file_set_contents(filename, feed->str, feed->len, NULL));
+
+  e = transfer_engine_new();
+  g_assert(e);
+
+  url = g_strconcat("file://", filename, NULL);
+  g_assert_cmpint(
+      rss_open_url_async(e, url, NULL, &stats, 0, NULL, rss_open_cb, &f), ==,
+      0);
+
+  transfer_engine_run(e);
+
+  g_assert(!f);
+  g_assert_cmpint(stats.bytes, <, feed->len);
+
+  transfer_engine_free(e);
+
+  g_unlink(filename);
+  g_string_free(feed, TRUE);
+  g_free(filename);
+  g_free(url);
+}
+
+/* Feeds with more items than allowed are rejected, as are feeds that are
+   larger than allowed when they are retrieved. */
+static void test_rss_limits()
+{
+  feed_limits limits = { 0 };
+  transfer_engine *e;
+  rss_file *f;
+  gchar *filename, *url;
+
+  filename = feed_file_helper("<item><title>A</title></item>"
+                              "<item><title>B</title></item>"
+                              "<item><title>C</title></item>");
+
+  limits.max_items = 3;
+  limits.max_parse_time = 60;
+  f = rss_open_file(filename, &limits);
+  g_assert(f);
+  g_assert_cmpint(f->num_items, ==, 3);
+  rss_close(f);
+
+  limits.max_items = 2;
+  g_assert(!rss_open_file(filename, &limits));
+
+  limits.max_items = 0;
+  url = g_strconcat("file://", filename, NULL);
+
+  limits.max_feed_size = 1 << 20;
+  f = rss_open_url(url, &limits, NULL, 0);
+  g_assert(f);
+  rss_close(f);
+
+  limits.max_feed_size = 64;
+  g_assert(!rss_open_url(url, &limits, NULL, 0));
+
+  f = (rss_file *)1;
+  e = transfer_engine_new();
+  g_assert(e);
+  g_assert_cmpint(
+      rss_open_url_async(e, url, &limits, NULL, 0, NULL, rss_open_cb, &f), ==,
+      0);
+  transfer_engine_run(e);
+  g_assert(!f);
+  transfer_engine_free(e);
+
+  g_unlink(filename);
+  g_free(filename);
+  g_free(url);
+}
+
+int main(int argc, char *argv[])
+{
+  g_test_init(&argc, &argv, NULL);
+
+  g_test_add_func("/rss/items", test_rss_items);
+  g_test_add_func("/rss/mrss_hash", test_rss_mrss_hash);
+  g_test_add_func("/rss/duration", test_rss_duration);
+  g_test_add_func("/rss/hints", test_rss_hints);
+  g_test_add_func("/rss/open_url_async", test_rss_open_url_async);
+  g_test_add_func("/rss/open_url_async_malformed",
+                  test_rss_open_url_async_malformed);
+  g_test_add_func("/rss/limits", test_rss_limits);
+
+  return g_test_run();
+}
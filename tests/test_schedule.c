@@ -0,0 +1,208 @@
+#include "../src/schedule.h"
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdlib.h>
+
+#define HOUR (60 * 60)
+#define DAY (24 * HOUR)
+
+/* Monday 7 January 2019, 10:00 UTC. */
+#define MONDAY_10AM 1546855200
+
+static void test_schedule_next_update()
+{
+  feed_hints hints = { 0 };
+
+  /* Without hints, the interval decides. */
+  g_assert_cmpint(schedule_next_update(MONDAY_10AM, 0, NULL), ==,
+                  MONDAY_10AM);
+  g_assert_cmpint(schedule_next_update(MONDAY_10AM, HOUR, &hints), ==,
+                  MONDAY_10AM + HOUR);
+
+  /* The ttl and the cadence can only put the update off... */
+  hints.ttl = 2 * HOUR;
+  g_assert_cmpint(schedule_next_update(MONDAY_10AM, HOUR, &hints), ==,
+                  MONDAY_10AM + 2 * HOUR);
+  g_assert_cmpint(schedule_next_update(MONDAY_10AM, 3 * HOUR, &hints), ==,
+                  MONDAY_10AM + 3 * HOUR);
+
+  hints.cadence = DAY;
+  g_assert_cmpint(schedule_next_update(MONDAY_10AM, HOUR, &hints), ==,
+                  MONDAY_10AM + 6 * HOUR);
+
+  /* ...and only by so much. */
+  hints.ttl = 0;
+  hints.cadence = 7 * DAY;
+  g_assert_cmpint(schedule_next_update(MONDAY_10AM, HOUR, &hints), ==,
+                  MONDAY_10AM + 12 * HOUR);
+  g_assert_cmpint(schedule_next_update(MONDAY_10AM, 2 * DAY, &hints), ==,
+                  MONDAY_10AM + 2 * DAY);
+
+  /* Skipped hours and days move the update to the next hour that is not
+     skipped. */
+  hints.cadence = 0;
+  hints.skip_hours = (1u << 11) | (1u << 12);
+  g_assert_cmpint(
+      schedule_next_update(MONDAY_10AM, HOUR + HOUR / 2, &hints), ==,
+      MONDAY_10AM + 3 * HOUR);
+
+  hints.skip_hours = 0;
+  hints.skip_days = 1u << 2; /* Tuesday */
+  g_assert_cmpint(schedule_next_update(MONDAY_10AM, DAY, &hints), ==,
+                  MONDAY_10AM + 2 * DAY - 10 * HOUR);
+
+  /* A feed that skips every hour is not taken at its word. */
+  hints.skip_days = 0x7f;
+  g_assert_cmpint(schedule_next_update(MONDAY_10AM, HOUR, &hints), ==,
+                  MONDAY_10AM + HOUR);
+}
+
+static void test_schedule_file()
+{
+  gchar *directory = g_dir_make_tmp("castget-XXXXXX", NULL);
+  gchar *filename = g_build_filename(directory, "schedule", NULL);
+  schedule *s;
+
+  g_assert(directory);
+
+  /* A schedule that does not exist yet is empty. */
+  s = schedule_load(filename);
+  g_assert_cmpint(schedule_get_next_update(s, "a"), ==, 0);
+  g_assert_cmpint(schedule_get_cadence(s, "a"), ==, 0);
+
+  schedule_set(s, "a", MONDAY_10AM, DAY);
+  schedule_set(s, "b", MONDAY_10AM + HOUR, 0);
+  schedule_set_last_success(s, "a", MONDAY_10AM - HOUR);
+  g_assert_cmpint(schedule_save(s), ==, 0);
+  schedule_free(s);
+
+  s = schedule_load(filename);
+  g_assert_cmpint(schedule_get_next_update(s, "a"), ==, MONDAY_10AM);
+  g_assert_cmpint(schedule_get_cadence(s, "a"), ==, DAY);
+  g_assert_cmpint(schedule_get_next_update(s, "b"), ==, MONDAY_10AM + HOUR);
+  g_assert_cmpint(schedule_get_cadence(s, "b"), ==, 0);
+  g_assert_cmpint(schedule_get_last_success(s, "a"), ==, MONDAY_10AM - HOUR);
+  g_assert_cmpint(schedule_get_last_success(s, "b"), ==, 0);
+  schedule_free(s);
+
+  g_unlink(filename);
+  g_free(filename);
+  filename = g_build_filename(directory, "schedule.lock", NULL);
+  g_unlink(filename);
+  g_rmdir(directory);
+
+  g_free(filename);
+  g_free(directory);
+}
+
+/* Processes that share the schedule only write back the channels they have
+   changed. */
+static void test_schedule_merge()
+{
+  gchar *directory = g_dir_make_tmp("castget-XXXXXX", NULL);
+  gchar *filename = g_build_filename(directory, "schedule", NULL);
+  gchar *lock_filename = g_build_filename(directory, "schedule.lock", NULL);
+  schedule *s1, *s2;
+
+  g_assert(directory);
+
+  s1 = schedule_load(filename);
+  schedule_set(s1, "a", MONDAY_10AM, DAY);
+  schedule_set(s1, "b", MONDAY_10AM, 0);
+  g_assert_cmpint(schedule_save(s1), ==, 0);
+
+  s2 = schedule_load(filename);
+
+  schedule_set(s1, "a", MONDAY_10AM + HOUR, 0);
+  g_assert_cmpint(schedule_save(s1), ==, 0);
+
+  schedule_set(s2, "b", MONDAY_10AM + DAY, 0);
+  schedule_set_last_success(s2, "c", MONDAY_10AM);
+  g_assert_cmpint(schedule_save(s2), ==, 0);
+
+  /* The saved schedule takes in what the other process wrote. */
+  g_assert_cmpint(schedule_get_next_update(s2, "a"), ==, MONDAY_10AM + HOUR);
+  g_assert_cmpint(schedule_get_cadence(s2, "a"), ==, 0);
+  schedule_free(s2);
+  schedule_free(s1);
+
+  s1 = schedule_load(filename);
+  g_assert_cmpint(schedule_get_next_update(s1, "a"), ==, MONDAY_10AM + HOUR);
+  g_assert_cmpint(schedule_get_next_update(s1, "b"), ==, MONDAY_10AM + DAY);
+  g_assert_cmpint(schedule_get_last_success(s1, "c"), ==, MONDAY_10AM);
+  schedule_free(s1);
+
+  g_unlink(filename);
+  g_unlink(lock_filename);
+  g_rmdir(directory);
+
+  g_free(lock_filename);
+  g_free(filename);
+  g_free(directory);
+}
+
+static void test_schedule_counts()
+{
+  gchar *directory = g_dir_make_tmp("castget-XXXXXX", NULL);
+  gchar *filename = g_build_filename(directory, "schedule", NULL);
+  gchar *lock_filename = g_build_filename(directory, "schedule.lock", NULL);
+  gint64 one[] = { 1, 2, 3 }, two[] = { 10, 20 }, counts[3];
+  schedule *s1, *s2;
+
+  g_assert(directory);
+
+  s1 = schedule_load(filename);
+  s2 = schedule_load(filename);
+
+  schedule_get_counts(s1, "n", counts, 3);
+  g_assert_cmpint(counts[0], ==, 0);
+  g_assert_cmpint(counts[2], ==, 0);
+
+  schedule_add_counts(s1, "n", one, 3);
+  schedule_add_counts(s1, "n", one, 3);
+  schedule_get_counts(s1, "n", counts, 3);
+  g_assert_cmpint(counts[2], ==, 6);
+  g_assert_cmpint(schedule_save(s1), ==, 0);
+
+  /* Counts added by another process in the meantime are added to, not
+     replaced. */
+  schedule_add_counts(s2, "n", two, 2);
+  g_assert_cmpint(schedule_save(s2), ==, 0);
+  schedule_get_counts(s2, "n", counts, 3);
+  g_assert_cmpint(counts[0], ==, 12);
+  g_assert_cmpint(counts[1], ==, 24);
+  g_assert_cmpint(counts[2], ==, 6);
+
+  schedule_add_counts(s1, "n", one, 1);
+  g_assert_cmpint(schedule_save(s1), ==, 0);
+  schedule_free(s2);
+  schedule_free(s1);
+
+  s1 = schedule_load(filename);
+  schedule_get_counts(s1, "n", counts, 3);
+  g_assert_cmpint(counts[0], ==, 13);
+  g_assert_cmpint(counts[1], ==, 24);
+  g_assert_cmpint(counts[2], ==, 6);
+  schedule_free(s1);
+
+  g_unlink(filename);
+  g_unlink(lock_filename);
+  g_rmdir(directory);
+
+  g_free(lock_filename);
+  g_free(filename);
+  g_free(directory);
+}
+
+int main(int argc, char *argv[])
+{
+  g_test_init(&argc, &argv, NULL);
+
+  g_test_add_func("/schedule/next_update", test_schedule_next_update);
+  g_test_add_func("/schedule/file", test_schedule_file);
+  g_test_add_func("/schedule/merge", test_schedule_merge);
+  g_test_add_func("/schedule/counts", test_schedule_counts);
+
+  return g_test_run();
+}
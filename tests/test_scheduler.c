@@ -0,0 +1,73 @@
+#include "../src/scheduler.h"
+
+#include <glib.h>
+#include <stdlib.h>
+
+static void test_scheduler_order()
+{
+  scheduler *s = scheduler_new();
+  static const gint64 times[] = { 50, 10, 40, 10, 30, 20, 60, 0 };
+  gint64 due, previous = -1;
+  gpointer data;
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS(times); i++)
+    scheduler_add(s, times[i], GUINT_TO_POINTER(i + 1));
+
+  g_assert_cmpuint(scheduler_size(s), ==, G_N_ELEMENTS(times));
+
+  for (i = 0; i < G_N_ELEMENTS(times); i++) {
+    data = scheduler_pop(s, &due);
+
+    g_assert(data);
+    g_assert_cmpint(due, >=, previous);
+    g_assert_cmpint(due, ==, times[GPOINTER_TO_UINT(data) - 1]);
+
+    /* Tasks that are due at the same time come out in the order they were
+       added. */
+    if (due == 10)
+      g_assert_cmpuint(GPOINTER_TO_UINT(data), ==, previous == 10 ? 4 : 2);
+
+    previous = due;
+  }
+
+  g_assert(!scheduler_pop(s, &due));
+  g_assert_cmpuint(scheduler_size(s), ==, 0);
+
+  scheduler_free(s);
+}
+
+static void test_scheduler_reschedule()
+{
+  scheduler *s = scheduler_new();
+  gint64 due;
+
+  /* A task that is rescheduled after running comes after tasks that are
+     due earlier. */
+  scheduler_add(s, 0, "a");
+  scheduler_add(s, 0, "b");
+
+  g_assert_cmpstr(scheduler_pop(s, &due), ==, "a");
+  scheduler_add(s, due + 100, "a");
+  scheduler_add(s, due + 50, "c");
+
+  g_assert_cmpstr(scheduler_peek(s, &due), ==, "b");
+  g_assert_cmpstr(scheduler_pop(s, &due), ==, "b");
+  g_assert_cmpint(due, ==, 0);
+  g_assert_cmpstr(scheduler_pop(s, &due), ==, "c");
+  g_assert_cmpint(due, ==, 50);
+  g_assert_cmpstr(scheduler_pop(s, &due), ==, "a");
+  g_assert_cmpint(due, ==, 100);
+
+  scheduler_free(s);
+}
+
+int main(int argc, char *argv[])
+{
+  g_test_init(&argc, &argv, NULL);
+
+  g_test_add_func("/scheduler/order", test_scheduler_order);
+  g_test_add_func("/scheduler/reschedule", test_scheduler_reschedule);
+
+  return g_test_run();
+}
@@ -0,0 +1,162 @@
+#include "../src/spool.h"
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static void test_spool_index()
+{
+  gchar *directory = g_dir_make_tmp("castget-XXXXXX", NULL);
+  gchar *first = g_build_filename(directory, "a.mp3", NULL);
+  gchar *second = g_build_filename(directory, "a (2).mp3", NULL);
+  spool_index *s;
+  gchar *filename;
+
+  g_assert(directory);
+  g_assert(g_file_set_contents(first, "12345", 5, NULL));
+  g_assert(g_file_set_contents(second, "", 0, NULL));
+
+  s = spool_index_new(directory);
+  g_assert(s);
+
+  g_assert(spool_index_contains(s, "a.mp3"));
+  g_assert(spool_index_contains(s, "a (2).mp3"));
+  g_assert(!spool_index_contains(s, "b.mp3"));
+
+  g_assert_cmpint(spool_index_size(s, "a.mp3"), ==, 5);
+  g_assert_cmpint(spool_index_size(s, "b.mp3"), ==, -1);
+
+  /* The index is not refreshed from the file system... */
+  g_unlink(first);
+  g_assert(spool_index_contains(s, "a.mp3"));
+  g_assert_cmpint(spool_index_size(s, "a.mp3"), ==, 5);
+
+  /* ...but follows files that are added to it. */
+  filename = spool_index_free_filename(s, "a.mp3", FALSE);
+  g_assert_cmpstr(filename, ==, "a (3).mp3");
+  spool_index_add(s, filename, 42);
+  g_free(filename);
+
+  g_assert_cmpint(spool_index_size(s, "a (3).mp3"), ==, 42);
+
+  filename = spool_index_free_filename(s, "a.mp3", FALSE);
+  g_assert_cmpstr(filename, ==, "a (4).mp3");
+  g_free(filename);
+
+  filename = spool_index_free_filename(s, "b.mp3", FALSE);
+  g_assert_cmpstr(filename, ==, "b.mp3");
+  g_free(filename);
+
+  /* A filename can be required to have no partial file either. */
+  spool_index_add(s, "b.mp3.part", 10);
+  filename = spool_index_free_filename(s, "b.mp3", FALSE);
+  g_assert_cmpstr(filename, ==, "b.mp3");
+  g_free(filename);
+  filename = spool_index_free_filename(s, "b.mp3", TRUE);
+  g_assert_cmpstr(filename, ==, "b (2).mp3");
+  g_free(filename);
+  spool_index_remove(s, "b.mp3.part");
+
+  spool_index_remove(s, "a (3).mp3");
+  g_assert(!spool_index_contains(s, "a (3).mp3"));
+
+  spool_index_free(s);
+
+  g_unlink(second);
+  g_rmdir(directory);
+
+  g_assert(spool_index_new(directory) == NULL);
+
+  g_free(second);
+  g_free(first);
+  g_free(directory);
+}
+
+static void test_spool_index_total_size()
+{
+  gchar *directory = g_dir_make_tmp("castget-XXXXXX", NULL);
+  gchar *first = g_build_filename(directory, "a.mp3", NULL);
+  gchar *second = g_build_filename(directory, "b.mp3", NULL);
+  spool_index *s;
+
+  g_assert(directory);
+  g_assert(g_file_set_contents(first, "12345", 5, NULL));
+  g_assert(g_file_set_contents(second, "123", 3, NULL));
+
+  s = spool_index_new(directory);
+  g_assert(s);
+
+  g_assert_cmpint(spool_index_total_size(s), ==, 8);
+  g_assert_cmpint(spool_index_free_space(s), >=, 0);
+
+  /* The total follows files that are added, replaced and removed. */
+  spool_index_add(s, "c.mp3", 100);
+  g_assert_cmpint(spool_index_total_size(s), ==, 108);
+
+  spool_index_add(s, "c.mp3", 10);
+  g_assert_cmpint(spool_index_total_size(s), ==, 18);
+
+  spool_index_remove(s, "a.mp3");
+  g_assert_cmpint(spool_index_total_size(s), ==, 13);
+
+  spool_index_remove(s, "d.mp3");
+  g_assert_cmpint(spool_index_total_size(s), ==, 13);
+
+  spool_index_free(s);
+
+  g_unlink(first);
+  g_unlink(second);
+  g_rmdir(directory);
+
+  g_free(second);
+  g_free(first);
+  g_free(directory);
+}
+
+/* Channels that open the same directory, however it is named, share one
+   index until the last of them closes it. */
+static void test_spool_index_shared()
+{
+  gchar *directory = g_dir_make_tmp("castget-XXXXXX", NULL);
+  gchar *other_name = g_build_filename(directory, ".", NULL);
+  spool_index *s1, *s2, *s3;
+
+  g_assert(directory);
+
+  s1 = spool_index_open(directory);
+  s2 = spool_index_open(other_name);
+  g_assert(s1);
+  g_assert(s1 == s2);
+
+  spool_index_add(s1, "a.mp3", 5);
+  g_assert(spool_index_contains(s2, "a.mp3"));
+
+  spool_index_close(s1);
+  g_assert(spool_index_contains(s2, "a.mp3"));
+  spool_index_close(s2);
+
+  /* The directory is read again once the index has been closed. a.mp3
+     was only ever added to the index. */
+  s3 = spool_index_open(directory);
+  g_assert(!spool_index_contains(s3, "a.mp3"));
+  spool_index_close(s3);
+
+  g_rmdir(directory);
+
+  g_assert(spool_index_open(directory) == NULL);
+
+  g_free(other_name);
+  g_free(directory);
+}
+
+int main(int argc, char *argv[])
+{
+  g_test_init(&argc, &argv, NULL);
+
+  g_test_add_func("/spool/spool_index", test_spool_index);
+  g_test_add_func("/spool/spool_index_total_size", test_spool_index_total_size);
+  g_test_add_func("/spool/spool_index_shared", test_spool_index_shared);
+
+  return g_test_run();
+}
@@ -0,0 +1,144 @@
+#include "../src/trace.h"
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static gpointer _record_span(gpointer data)
+{
+  gint64 t = trace_begin();
+
+  g_assert_cmpint(t, >, 0);
+  trace_end(t, "test", "worker", NULL);
+
+  return NULL;
+}
+
+static void test_trace_disabled()
+{
+  /* Nothing is recorded before the trace is opened. */
+  g_assert_cmpint(trace_begin(), ==, 0);
+  trace_end(0, "test", "span", NULL);
+  trace_span(1, 1, "test", "span", NULL);
+  g_assert_cmpint(trace_close(), ==, 0);
+}
+
+static void test_trace_write()
+{
+  gchar *filename, *contents;
+  GThread *thread;
+  gint64 t;
+  int fd;
+
+  fd = g_file_open_tmp("castget-XXXXXX", &filename, NULL);
+  g_assert(fd >= 0);
+  close(fd);
+
+  g_assert_cmpint(trace_open(filename), ==, 0);
+
+  t = trace_begin();
+  g_assert_cmpint(t, >, 0);
+
+  thread = g_thread_new("worker", _record_span, NULL);
+  g_thread_join(thread);
+
+  trace_async_span(&t, t, 1500, "network", "dns", NULL);
+  trace_end(t, "test", "main \"span\"", "a\tb");
+
+  g_assert_cmpint(trace_close(), ==, 0);
+  g_assert_cmpint(trace_begin(), ==, 0);
+
+  g_assert(g_file_get_contents(filename, &contents, NULL, NULL));
+
+  g_assert(g_str_has_prefix(contents, "{\"displayTimeUnit\": \"ms\", "
+                                      "\"traceEvents\": [\n"));
+  g_assert(g_str_has_suffix(contents, "}\n]}\n"));
+
+  /* Each thread is named and gets its own track. */
+  g_assert(strstr(contents, "\"args\": {\"name\": \"main 1\"}}"));
+  g_assert(strstr(contents, "\"args\": {\"name\": \"thread 2\"}}"));
+  g_assert(strstr(contents, "{\"name\": \"worker\", \"cat\": \"test\", "
+                            "\"ph\": \"X\", \"ts\": "));
+
+  g_assert(strstr(contents, "{\"name\": \"main \\\"span\\\"\", "
+                            "\"cat\": \"test\", \"ph\": \"X\""));
+  g_assert(strstr(contents, "\"tid\": 1, \"args\": {\"detail\": "
+                            "\"a\\u0009b\"}, \"dur\": "));
+
+  g_assert(strstr(contents, "{\"name\": \"dns\", \"cat\": \"network\", "
+                            "\"ph\": \"b\""));
+  g_assert(strstr(contents, "{\"name\": \"dns\", \"cat\": \"network\", "
+                            "\"ph\": \"e\""));
+
+  g_free(contents);
+  g_unlink(filename);
+  g_free(filename);
+}
+
+/* Flushing writes the spans so far and starts over with the next ones. */
+static void test_trace_flush()
+{
+  gchar *filename, *contents;
+  GThread *thread;
+  int fd;
+
+  fd = g_file_open_tmp("castget-XXXXXX", &filename, NULL);
+  g_assert(fd >= 0);
+  close(fd);
+
+  g_assert_cmpint(trace_flush(), ==, 0);
+  g_assert_cmpint(trace_open(filename), ==, 0);
+
+  trace_end(trace_begin(), "test", "first", NULL);
+  g_assert_cmpint(trace_flush(), ==, 0);
+
+  g_assert(g_file_get_contents(filename, &contents, NULL, NULL));
+  g_assert(strstr(contents, "{\"name\": \"first\""));
+  g_assert(g_str_has_suffix(contents, "}\n]}\n"));
+  g_free(contents);
+
+  thread = g_thread_new("worker", _record_span, NULL);
+  g_thread_join(thread);
+  trace_end(trace_begin(), "test", "second", NULL);
+  g_assert_cmpint(trace_close(), ==, 0);
+
+  g_assert(g_file_get_contents(filename, &contents, NULL, NULL));
+  g_assert(!strstr(contents, "\"first\""));
+  g_assert(strstr(contents, "{\"name\": \"second\""));
+  g_assert(strstr(contents, "{\"name\": \"worker\""));
+
+  /* The new trace names its threads again, starting with the main
+     thread. */
+  g_assert(g_str_has_prefix(contents, "{\"displayTimeUnit\": \"ms\", "
+                                      "\"traceEvents\": [\n"
+                                      "{\"name\": \"thread_name\""));
+  g_assert(strstr(contents, "\"args\": {\"name\": \"main "));
+  g_assert(strstr(contents, "\"args\": {\"name\": \"thread "));
+  g_free(contents);
+
+  /* Closing right after a flush keeps the spans that were flushed. */
+  g_assert_cmpint(trace_open(filename), ==, 0);
+  trace_end(trace_begin(), "test", "third", NULL);
+  g_assert_cmpint(trace_flush(), ==, 0);
+  g_assert_cmpint(trace_close(), ==, 0);
+
+  g_assert(g_file_get_contents(filename, &contents, NULL, NULL));
+  g_assert(strstr(contents, "{\"name\": \"third\""));
+  g_free(contents);
+
+  g_unlink(filename);
+  g_free(filename);
+}
+
+int main(int argc, char *argv[])
+{
+  g_test_init(&argc, &argv, NULL);
+
+  g_test_add_func("/trace/disabled", test_trace_disabled);
+  g_test_add_func("/trace/write", test_trace_write);
+  g_test_add_func("/trace/flush", test_trace_flush);
+
+  return g_test_run();
+}
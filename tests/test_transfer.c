@@ -0,0 +1,308 @@
+#include "../src/transfer.h"
+#include "../src/urlget.h"
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define NUM_TRANSFERS 50
+
+struct _result {
+  GString *content;
+  int done;
+  int result;
+};
+
+static size_t write_cb(void *buffer, size_t size, size_t nmemb,
+                       void *user_data)
+{
+  struct _result *r = (struct _result *)user_data;
+
+  g_string_append_len(r->content, buffer, size * nmemb);
+
+  return size * nmemb;
+}
+
+static void done_cb(int result, void *user_data)
+{
+  struct _result *r = (struct _result *)user_data;
+
+  r->done++;
+  r->result = result;
+}
+
+/* Retrieves a number of local files at the same time. */
+static void test_transfer_concurrent()
+{
+  transfer_engine *e;
+  struct _result results[NUM_TRANSFERS];
+  gchar *directory, *filename, *url, *content;
+  int i;
+
+  directory = g_dir_make_tmp("castget-XXXXXX", NULL);
+  g_assert(directory);
+
+  e = transfer_engine_new();
+  g_assert(e);
+
+  for (i = 0; i < NUM_TRANSFERS; i++) {
+    filename = g_strdup_printf("%s/%d", directory, i);
+    content = g_strnfill(i * 1000, 'a' + i % 26);
+    g_assert(g_file_set_contents(filename, content, -1, NULL));
+
+    results[i].content = g_string_new(NULL);
+    results[i].done = 0;
+    results[i].result = -1;
+
+    url = g_strconcat("file://", filename, NULL);
+    g_assert_cmpint(urlget_buffer_async(e, url, &results[i], write_cb, NULL,
+                                        0, 0, 0, NULL, NULL, 0, NULL, done_cb),
+                    ==, 0);
+
+    g_free(url);
+    g_free(content);
+    g_free(filename);
+  }
+
+  g_assert_cmpuint(transfer_engine_active(e), ==, NUM_TRANSFERS);
+
+  transfer_engine_run(e);
+
+  g_assert_cmpuint(transfer_engine_active(e), ==, 0);
+
+  for (i = 0; i < NUM_TRANSFERS; i++) {
+    g_assert_cmpint(results[i].done, ==, 1);
+    g_assert_cmpint(results[i].result, ==, 0);
+    g_assert_cmpuint(results[i].content->len, ==, i * 1000);
+
+    if (i)
+      g_assert_cmpint(results[i].content->str[0], ==, 'a' + i % 26);
+
+    g_string_free(results[i].content, TRUE);
+
+    filename = g_strdup_printf("%s/%d", directory, i);
+    g_unlink(filename);
+    g_free(filename);
+  }
+
+  transfer_engine_free(e);
+
+  g_rmdir(directory);
+  g_free(directory);
+}
+
+/* Failed transfers are reported without affecting the others. */
+static void test_transfer_failure()
+{
+  transfer_engine *e;
+  struct _result missing, limited;
+  gchar *filename, *url;
+  int fd;
+
+  fd = g_file_open_tmp("castget-XXXXXX", &filename, NULL);
+  g_assert(fd >= 0);
+  close(fd);
+  g_assert(g_file_set_contents(filename, "0123456789", -1, NULL));
+
+  e = transfer_engine_new();
+  g_assert(e);
+
+  missing.content = g_string_new(NULL);
+  missing.done = 0;
+  g_assert_cmpint(urlget_buffer_async(e, "file:///nonexistent/castget",
+                                      &missing, write_cb, NULL, 0, 0, 0, NULL,
+                                      NULL, 0, NULL, done_cb),
+                  ==, 0);
+
+  limited.content = g_string_new(NULL);
+  limited.done = 0;
+  url = g_strconcat("file://", filename, NULL);
+  g_assert_cmpint(urlget_buffer_async(e, url, &limited, write_cb, NULL, 0, 5,
+                                      0, NULL, NULL, 0, NULL, done_cb),
+                  ==, 0);
+
+  transfer_engine_run(e);
+
+  g_assert_cmpint(missing.done, ==, 1);
+  g_assert_cmpint(missing.result, ==, 1);
+  g_assert_cmpint(limited.done, ==, 1);
+  g_assert_cmpint(limited.result, ==, 1);
+
+  g_string_free(missing.content, TRUE);
+  g_string_free(limited.content, TRUE);
+  transfer_engine_free(e);
+
+  g_unlink(filename);
+  g_free(filename);
+  g_free(url);
+}
+
+/* Returns a socket listening on a free local port, and sets 'url' to a URL
+   on it. */
+static int listen_helper(gchar **url)
+{
+  struct sockaddr_in address = { 0 };
+  socklen_t length = sizeof(address);
+  int fd;
+
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  fd = socket(AF_INET, SOCK_STREAM, 0);
+  g_assert(fd >= 0);
+  g_assert(bind(fd, (struct sockaddr *)&address, sizeof(address)) == 0);
+  g_assert(listen(fd, 4) == 0);
+  g_assert(getsockname(fd, (struct sockaddr *)&address, &length) == 0);
+
+  *url = g_strdup_printf("http://127.0.0.1:%d/feed.xml",
+                         ntohs(address.sin_port));
+
+  return fd;
+}
+
+/* Runs a transfer of 'url' with 'timeouts' and returns what it printed
+   on standard error. Sets 'elapsed' to the time it took in seconds. */
+static gchar *timeout_helper(const gchar *url,
+                             const urlget_timeouts *timeouts,
+                             urlget_stats *stats, double *elapsed)
+{
+  transfer_engine *e;
+  struct _result r;
+  gchar *filename, *errors;
+  gint64 started;
+  int fd, saved;
+
+  fd = g_file_open_tmp("castget-XXXXXX", &filename, NULL);
+  g_assert(fd >= 0);
+
+  fflush(stderr);
+  saved = dup(STDERR_FILENO);
+  g_assert(dup2(fd, STDERR_FILENO) >= 0);
+
+  e = transfer_engine_new();
+  g_assert(e);
+
+  r.content = g_string_new(NULL);
+  r.done = 0;
+  g_assert_cmpint(urlget_buffer_async(e, url, &r, write_cb, NULL, 0, 0, 0,
+                                      timeouts, stats, 0, NULL, done_cb),
+                  ==, 0);
+
+  started = g_get_monotonic_time();
+  transfer_engine_run(e);
+  *elapsed = (double)(g_get_monotonic_time() - started) / G_USEC_PER_SEC;
+
+  transfer_engine_free(e);
+
+  fflush(stderr);
+  dup2(saved, STDERR_FILENO);
+  close(saved);
+  close(fd);
+
+  g_assert_cmpint(r.done, ==, 1);
+  g_assert_cmpint(r.result, ==, 1);
+  g_string_free(r.content, TRUE);
+
+  g_assert(g_file_get_contents(filename, &errors, NULL, NULL));
+  g_unlink(filename);
+  g_free(filename);
+
+  return errors;
+}
+
+/* A server that accepts the connection but never answers is given up on
+   once the first byte timeout has passed. */
+static void test_transfer_first_byte_timeout()
+{
+  urlget_timeouts timeouts = { 0 };
+  urlget_stats stats = { 0 };
+  gchar *url, *errors;
+  double elapsed;
+  int fd;
+
+  /* The kernel completes the connection without it being accepted. */
+  fd = listen_helper(&url);
+
+  timeouts.first_byte = 1;
+  errors = timeout_helper(url, &timeouts, &stats, &elapsed);
+
+  g_assert(strstr(errors, "no data received within 1 seconds"));
+  g_assert_cmpint(stats.failures[URLGET_ERROR_TIMEOUT], ==, 1);
+  g_assert_cmpfloat(elapsed, >=, 1);
+  g_assert_cmpfloat(elapsed, <, 4);
+
+  close(fd);
+  g_free(errors);
+  g_free(url);
+}
+
+/* Sends the headers of a response and then its content a byte at a time,
+   five times a second, until the client goes away. */
+static gpointer trickle_server_run(gpointer data)
+{
+  static const char headers[] =
+      "HTTP/1.1 200 OK\r\nContent-Length: 1000\r\n\r\n";
+  int fd = GPOINTER_TO_INT(data), conn, i;
+  char request[4096];
+
+  conn = accept(fd, NULL, NULL);
+  g_assert(conn >= 0);
+  g_assert(read(conn, request, sizeof(request)) > 0);
+
+  if (send(conn, headers, strlen(headers), MSG_NOSIGNAL) > 0)
+    for (i = 0; i < 1000 && send(conn, "x", 1, MSG_NOSIGNAL) == 1; i++)
+      g_usleep(G_USEC_PER_SEC / 5);
+
+  close(conn);
+
+  return NULL;
+}
+
+/* A transfer that stays below the low speed limit for longer than the low
+   speed time is given up on. */
+static void test_transfer_low_speed_timeout()
+{
+  urlget_timeouts timeouts = { 0 };
+  urlget_stats stats = { 0 };
+  gchar *url, *errors;
+  GThread *server;
+  double elapsed;
+  int fd;
+
+  fd = listen_helper(&url);
+  server = g_thread_new("trickle", trickle_server_run, GINT_TO_POINTER(fd));
+
+  timeouts.low_speed_limit = 100;
+  timeouts.low_speed_time = 1;
+  errors = timeout_helper(url, &timeouts, &stats, &elapsed);
+
+  g_thread_join(server);
+
+  g_assert(strstr(errors, "Error retrieving"));
+  g_assert_cmpint(stats.failures[URLGET_ERROR_TIMEOUT], ==, 1);
+  g_assert_cmpfloat(elapsed, >=, 1);
+  g_assert_cmpfloat(elapsed, <, 4);
+
+  close(fd);
+  g_free(errors);
+  g_free(url);
+}
+
+int main(int argc, char *argv[])
+{
+  g_test_init(&argc, &argv, NULL);
+
+  g_test_add_func("/transfer/concurrent", test_transfer_concurrent);
+  g_test_add_func("/transfer/failure", test_transfer_failure);
+  g_test_add_func("/transfer/first_byte_timeout",
+                  test_transfer_first_byte_timeout);
+  g_test_add_func("/transfer/low_speed_timeout",
+                  test_transfer_low_speed_timeout);
+
+  return g_test_run();
+}
@@ -0,0 +1,173 @@
+#include "../src/writer.h"
+
+#include <fcntl.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Writes 'length' bytes of a known sequence in chunks of 'chunk_size' and
+   checks that the file ends up with exactly that content. */
+static void writer_helper(gsize length, gsize chunk_size, gint64 buffer_size,
+                          gint64 writeback_size)
+{
+  gchar *filename;
+  gchar *data;
+  gchar *contents;
+  gsize contents_length;
+  gsize i, n;
+  writer *w;
+  int fd;
+
+  fd = g_file_open_tmp("castget-XXXXXX", &filename, NULL);
+  g_assert(fd >= 0);
+
+  data = g_malloc(length);
+  for (i = 0; i < length; i++)
+    data[i] = (gchar)(i * 7 + i / 251);
+
+  w = writer_new(fd, 0, buffer_size, writeback_size);
+  g_assert(w);
+
+  for (i = 0; i < length; i += n) {
+    n = MIN(chunk_size, length - i);
+    g_assert(writer_write(w, data + i, n));
+    g_assert_cmpint(writer_offset(w), ==, i + n);
+  }
+
+  g_assert(writer_free(w));
+  close(fd);
+
+  g_assert(g_file_get_contents(filename, &contents, &contents_length, NULL));
+  g_assert_cmpuint(contents_length, ==, length);
+  g_assert(memcmp(contents, data, length) == 0);
+
+  g_free(contents);
+  g_free(data);
+  g_unlink(filename);
+  g_free(filename);
+}
+
+static void test_writer_small_chunks()
+{
+  writer_helper(100000, 1, 4096, 0);
+  writer_helper(100000, 1000, 4096, 0);
+  writer_helper(100000, 16384, 0, 0);
+}
+
+static void test_writer_large_chunks()
+{
+  writer_helper(100000, 4096, 4096, 0);
+  writer_helper(100000, 10000, 4096, 0);
+  writer_helper(100000, 100000, 4096, 0);
+  writer_helper(1000000, 102400, 0, 0);
+}
+
+/* Large chunks bypass the buffer, and have to land after the data that is
+   still buffered. */
+static void test_writer_mixed_chunks()
+{
+  static const gsize chunks[] = { 3, 70000, 1, 100000, 65536, 10 };
+  gchar *filename;
+  gchar *data;
+  gchar *contents;
+  gsize length = 0, contents_length;
+  gsize i, offset = 0;
+  writer *w;
+  int fd;
+
+  for (i = 0; i < G_N_ELEMENTS(chunks); i++)
+    length += chunks[i];
+
+  data = g_malloc(length);
+  for (i = 0; i < length; i++)
+    data[i] = (gchar)(i * 7 + i / 251);
+
+  fd = g_file_open_tmp("castget-XXXXXX", &filename, NULL);
+  g_assert(fd >= 0);
+
+  w = writer_new(fd, 0, 0, 0);
+  g_assert(w);
+
+  for (i = 0; i < G_N_ELEMENTS(chunks); i++) {
+    g_assert(writer_write(w, data + offset, chunks[i]));
+    offset += chunks[i];
+    g_assert_cmpint(writer_offset(w), ==, offset);
+  }
+
+  g_assert(writer_free(w));
+  close(fd);
+
+  g_assert(g_file_get_contents(filename, &contents, &contents_length, NULL));
+  g_assert_cmpuint(contents_length, ==, length);
+  g_assert(memcmp(contents, data, length) == 0);
+
+  g_free(contents);
+  g_free(data);
+  g_unlink(filename);
+  g_free(filename);
+}
+
+static void test_writer_writeback()
+{
+  writer_helper(1000000, 16384, 8192, 65536);
+}
+
+static void test_writer_append()
+{
+  gchar *filename;
+  gchar *contents;
+  gsize length;
+  writer *w;
+  int fd;
+
+  fd = g_file_open_tmp("castget-XXXXXX", &filename, NULL);
+  g_assert(fd >= 0);
+  g_assert(write(fd, "abc", 3) == 3);
+
+  w = writer_new(fd, 3, 0, 0);
+  g_assert(writer_write(w, "def", 3));
+  g_assert_cmpint(writer_offset(w), ==, 6);
+  g_assert(writer_free(w));
+  close(fd);
+
+  g_assert(g_file_get_contents(filename, &contents, &length, NULL));
+  g_assert_cmpstr(contents, ==, "abcdef");
+
+  g_free(contents);
+  g_unlink(filename);
+  g_free(filename);
+}
+
+static void test_writer_error()
+{
+  writer *w;
+  int fd;
+
+  fd = open("/dev/null", O_RDONLY);
+  g_assert(fd >= 0);
+
+  w = writer_new(fd, 0, 4096, 0);
+  g_assert(writer_write(w, "abc", 3));
+  g_assert(!writer_flush(w));
+  g_assert_cmpint(writer_error(w), !=, 0);
+  g_assert(!writer_write(w, "abc", 3));
+  g_assert(!writer_free(w));
+  close(fd);
+}
+
+int main(int argc, char *argv[])
+{
+  g_test_init(&argc, &argv, NULL);
+
+  g_test_add_func("/writer/small_chunks", test_writer_small_chunks);
+  g_test_add_func("/writer/large_chunks", test_writer_large_chunks);
+  g_test_add_func("/writer/mixed_chunks", test_writer_mixed_chunks);
+  g_test_add_func("/writer/writeback", test_writer_writeback);
+  g_test_add_func("/writer/append", test_writer_append);
+  g_test_add_func("/writer/error", test_writer_error);
+
+  return g_test_run();
+}